@@ -10,7 +10,7 @@ endif
 # PARTS
 # Sub-directories that contain code to 
 # be compiled.
-PARTS=fusg-common fusgd fusg fusg-test
+PARTS=fusg-common fusgd fusg fusg-test fusg-bench fusg-dbbench
 
 # BUILD_BASE
 # Directory where build will be performed.
@@ -49,6 +49,8 @@ define MAKE_PARTS =
 	$(MAKE) -j --jobserver-fds=3,4 -C fusgd $@
 	$(MAKE) -j --jobserver-fds=3,4 -C fusg $@
 	$(MAKE) -j --jobserver-fds=3,4 -C fusg-test $@
+	$(MAKE) -j --jobserver-fds=3,4 -C fusg-bench $@
+	$(MAKE) -j --jobserver-fds=3,4 -C fusg-dbbench $@
 endef	
 
 
@@ -0,0 +1,590 @@
+/*
+ * fusg-bench.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <libaudit.h>
+
+#include "fusg/conf.h"
+#include "fusg/db.h"
+#include "fusg/err.h"
+#include "fusg/logging.h"
+#include "fusg/version.h"
+
+#include "fusgd.h"
+#include "work.h"
+#include "fan.h"
+#include "flush.h"
+
+
+#define FUSG_BENCH_NAME "fusg-bench"
+#define FUSG_BENCH_DB_DEFAULT "/tmp/fusg-bench-db"
+#define FUSG_BENCH_DIR_DEFAULT "/tmp/fusg-bench-work"
+/** files the workload cycles through */
+#define WORKLOAD_FILES 256
+
+
+/*
+ * Replays an audit log through work() and store_event() of fusgd
+ * and reports throughput, latencies, db flush times and peak RSS
+ * as JSON.
+ *
+ * With --speed the log is fed through a pipe by a child process,
+ * which reproduces the original timing of the events (scaled by the
+ * given factor), and fusgd reads it like stdin, including the idle
+ * and flush paths. Otherwise fusgd reads the log at max speed.
+ *
+ * With --workload a child process runs file operations in a directory
+ * instead, and fusgd receives them from fanotify (--source fanotify)
+ * or not at all (--source none, e.g. to time the workload with audit
+ * rules in place). The log written by auditd for the same workload can
+ * be replayed afterwards to compare both sources side by side.
+ */
+
+
+fusgd_global_t global;
+
+
+typedef struct {
+	uint64_t* values;
+	size_t num;
+	size_t cap;
+} samples_t;
+
+
+static const char* log_path = NULL;
+static const char* out_path = NULL;
+static const char* db_path = FUSG_BENCH_DB_DEFAULT;
+/** replay speed factor (0: max speed) */
+static double speed = 0;
+/** operations of the workload (0: replay a log) */
+static uint64_t workload = 0;
+static const char* work_dir = FUSG_BENCH_DIR_DEFAULT;
+/** event source of the workload: "fanotify" or "none" */
+static const char* source = "fanotify";
+/** end of the workload [ns] */
+static volatile uint64_t workload_end_ns;
+
+static uint64_t start_ns;
+/** time stamp of the first event in the log [ms] */
+static uint64_t first_ms;
+
+static samples_t event_ns;
+static samples_t lag_ns;
+
+
+
+void reload_config(void)
+{
+	global.received_sighup = 0;
+}
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+static int samples_add(samples_t* s, uint64_t value)
+{
+	if (s->num == s->cap)
+	{
+		size_t cap = s->cap ? s->cap * 2 : 65536;
+		uint64_t* v = realloc(s->values, cap * sizeof(uint64_t));
+		if (!v) return -1;
+		s->values = v;
+		s->cap = cap;
+	}
+	s->values[s->num++] = value;
+	return 0;
+}
+
+static int samples_cmp(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * @param q quantile in [0,1]
+ * @return value at quantile q of sorted samples
+ */
+static uint64_t samples_quantile(const samples_t* s, double q)
+{
+	if (!s->num) return 0;
+	size_t i = (size_t)(q * (s->num - 1) + 0.5);
+	return s->values[i];
+}
+
+
+/**
+ * Parses the time stamp of an audit record (msg=audit(SEC.MILLI:SERIAL)).
+ * @return 0 on success -1 if line has no time stamp
+ */
+static int audit_timestamp_ms(const char* line, uint64_t* ms)
+{
+	const char* p = strstr(line, "audit(");
+	unsigned long sec, milli;
+	if (!p || 2 != sscanf(p, "audit(%lu.%lu:", &sec, &milli)) return -1;
+	*ms = (uint64_t)sec * 1000 + milli;
+	return 0;
+}
+
+static int first_timestamp(const char* path, uint64_t* ms)
+{
+	FILE* in = fopen(path, "r");
+	if (!in) return -1;
+	char line[MAX_AUDIT_MESSAGE_LENGTH + 1];
+	int rc = -1;
+	while (rc && fgets(line, sizeof(line), in))
+	{
+		rc = audit_timestamp_ms(line, ms);
+	}
+	fclose(in);
+	return rc;
+}
+
+
+static void bench_event_hook(const au_event_t* event, uint64_t duration_ns)
+{
+	samples_add(&event_ns, duration_ns);
+	if (speed > 0)
+	{
+		// lag: completion of the event relative to its replay time
+		uint64_t ms = (uint64_t)event->sec * 1000 + event->milli;
+		uint64_t offset = ms > first_ms ? ms - first_ms : 0;
+		uint64_t due = start_ns + (uint64_t)(offset * 1e6 / speed);
+		uint64_t now = now_ns();
+		samples_add(&lag_ns, now > due ? now - due : 0);
+	}
+}
+
+
+/**
+ * Writes the log to out, reproducing the original timing of events.
+ * Runs in a child process.
+ */
+static int feed(FILE* out)
+{
+	FILE* in = fopen(log_path, "r");
+	if (!in)
+	{
+		log_error("can't open '%s': %s", log_path, strerror(errno));
+		return ERR_USAGE;
+	}
+	char line[MAX_AUDIT_MESSAGE_LENGTH + 1];
+	while (fgets(line, sizeof(line), in))
+	{
+		uint64_t ms;
+		if (!audit_timestamp_ms(line, &ms) && ms > first_ms)
+		{
+			uint64_t due = start_ns + (uint64_t)((ms - first_ms) * 1e6 / speed);
+			uint64_t now = now_ns();
+			if (due > now)
+			{
+				// fusgd shall see all lines due so far, before we pause
+				fflush(out);
+				struct timespec ts = {
+					.tv_sec = (due - now) / 1000000000,
+					.tv_nsec = (due - now) % 1000000000,
+				};
+				nanosleep(&ts, NULL);
+			}
+		}
+		if (EOF == fputs(line, out)) break;
+	}
+	fclose(in);
+	fclose(out);
+	return ERR_NONE;
+}
+
+
+/**
+ * Runs the workload: each operation writes a file, reads it back,
+ * and every 4th operation deletes it. Runs in a child process.
+ */
+static int workload_run(void)
+{
+	char path[PATH_MAX + 16];
+	char data[4096];
+	memset(data, 'x', sizeof(data));
+	for (uint64_t i = 0; i < workload; i++)
+	{
+		snprintf(path, sizeof(path), "%s/w%lu", work_dir, i % WORKLOAD_FILES);
+		int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd == -1 || write(fd, data, sizeof(data)) != sizeof(data))
+		{
+			log_error("workload: '%s': %s", path, strerror(errno));
+			return ERR_UNKNOWN;
+		}
+		close(fd);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd == -1 || read(fd, data, sizeof(data)) != sizeof(data))
+		{
+			log_error("workload: '%s': %s", path, strerror(errno));
+			return ERR_UNKNOWN;
+		}
+		close(fd);
+		if (i % 4 == 3) unlink(path);
+	}
+	return ERR_NONE;
+}
+
+
+static void chld_handler(int sig)
+{
+	workload_end_ns = now_ns();
+	// work() reads what's left and returns
+	global.stop = 1;
+}
+
+
+/**
+ * Runs the workload in a child and processes its events until it exits.
+ */
+static int workload_bench(void)
+{
+	if (mkdir(work_dir, 0755) && errno != EEXIST)
+	{
+		log_error("can't create '%s': %s", work_dir, strerror(errno));
+		return ERR_USAGE;
+	}
+	if (!strcmp(source, "fanotify"))
+	{
+		global.mode = OP_FANOTIFY;
+		global.fd = -1;
+		if (fan_open(work_dir) == -1) return ERR_CONF;
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sa.sa_handler = chld_handler;
+	sigaction(SIGCHLD, &sa, NULL);
+
+	start_ns = now_ns();
+	pid_t child = fork();
+	if (child == 0) _exit(workload_run());
+	if (child == -1)
+	{
+		fan_close();
+		return ERR_UNKNOWN;
+	}
+
+	if (fan_enabled()) work();
+	int status = 0;
+	waitpid(child, &status, 0);
+	fan_close();
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+	{
+		log_error("workload failed");
+		return ERR_UNKNOWN;
+	}
+	return ERR_NONE;
+}
+
+
+/**
+ * Replays the log through work().
+ * @param feeder receives the pid of the feeding child, if any
+ */
+static int replay(pid_t* feeder)
+{
+	if (speed > 0)
+	{
+		int fds[2];
+		if (pipe(fds))
+		{
+			return ERR_UNKNOWN;
+		}
+		*feeder = fork();
+		if (*feeder == 0)
+		{
+			close(fds[0]);
+			FILE* out = fdopen(fds[1], "w");
+			_exit(out ? feed(out) : ERR_UNKNOWN);
+		}
+		close(fds[1]);
+		if (*feeder == -1)
+		{
+			close(fds[0]);
+			return ERR_UNKNOWN;
+		}
+		global.fin = fdopen(fds[0], "r");
+		// a pipe, like stdin: work() waits for input, completes
+		// events and commits batches when idle and flushes on time
+		global.mode = OP_PARSE_STDIN;
+	}
+	else
+	{
+		global.fin = fopen(log_path, "r");
+	}
+	if (!global.fin)
+	{
+		log_error("can't open '%s': %s", log_path, strerror(errno));
+		return ERR_USAGE;
+	}
+	global.fd = fileno(global.fin);
+
+	work();
+	return ERR_NONE;
+}
+
+
+static void report(FILE* out, double seconds)
+{
+	qsort(event_ns.values, event_ns.num, sizeof(uint64_t), samples_cmp);
+	qsort(lag_ns.values, lag_ns.num, sizeof(uint64_t), samples_cmp);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"version\": \"%s\",\n", FUSG_VER_STR);
+	if (workload)
+	{
+		double workload_seconds = (workload_end_ns - start_ns) / 1e9;
+		fprintf(out, "  \"source\": \"%s\",\n", source);
+		fprintf(out, "  \"workload_ops\": %lu,\n", workload);
+		fprintf(out, "  \"workload_seconds\": %.3f,\n", workload_seconds);
+		fprintf(out, "  \"workload_ops_per_s\": %.1f,\n", workload_seconds > 0 ? workload / workload_seconds : 0);
+	}
+	else
+	{
+		fprintf(out, "  \"log\": \"%s\",\n", log_path);
+		fprintf(out, "  \"speed\": %g,\n", speed);
+	}
+	fprintf(out, "  \"batch_events\": %d,\n", global.conf.db_batch_events);
+	fprintf(out, "  \"batch_time_ms\": %d,\n", global.conf.db_batch_time);
+	fprintf(out, "  \"events\": %lu,\n", global.events_processed);
+	fprintf(out, "  \"events_stored\": %lu,\n", global.events_stored);
+	fprintf(out, "  \"seconds\": %.3f,\n", seconds);
+	fprintf(out, "  \"events_per_s\": %.1f,\n", seconds > 0 ? global.events_processed / seconds : 0);
+	fprintf(out, "  \"event_us\": { \"p50\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f },\n",
+			samples_quantile(&event_ns, 0.5) / 1e3,
+			samples_quantile(&event_ns, 0.99) / 1e3,
+			samples_quantile(&event_ns, 0.999) / 1e3,
+			samples_quantile(&event_ns, 1.0) / 1e3);
+	fprintf(out, "  \"lag_ms\": { \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+			samples_quantile(&lag_ns, 0.5) / 1e6,
+			samples_quantile(&lag_ns, 0.99) / 1e6,
+			samples_quantile(&lag_ns, 1.0) / 1e6);
+	fprintf(out, "  \"db_flush\": { \"count\": %lu, \"total_ms\": %.3f, \"max_ms\": %.3f, \"reasons\": {",
+			global.db_flushes, global.db_flush_ns_total / 1e6, global.db_flush_ns_max / 1e6);
+	for (flush_reason_t r = 0; r < FLUSH_REASONS; r++)
+	{
+		fprintf(out, "%s \"%s\": %lu", r ? "," : "", flush_reason_name(r), flush_count(r));
+	}
+	fprintf(out, " } },\n");
+	fprintf(out, "  \"batches\": %lu,\n", global.batches_committed);
+	fprintf(out, "  \"peak_rss_kb\": %ld\n", usage.ru_maxrss);
+	fprintf(out, "}\n");
+}
+
+
+static void print_usage(void)
+{
+	printf("> %s <flags> <audit.log>\n", global.progname);
+	printf("> %s <flags> --workload <ops>\n", global.progname);
+	printf("-c | --conf <fusg.conf>\n"
+			"\tread config from given path <fusg.conf>.\n");
+	printf("-d | --db <dir>\n"
+			"\tdb to be created for the run (default: '%s').\n"
+			"\tAny existing db at <dir> will be deleted!\n", FUSG_BENCH_DB_DEFAULT);
+	printf("-s | --speed <factor>\n"
+			"\treplay with original timing scaled by <factor>\n"
+			"\t(2 = twice as fast). Default: max speed.\n");
+	printf("-o | --out <file>\n"
+			"\twrite JSON report to <file> instead of stdout.\n");
+	printf("-w | --workload <ops>\n"
+			"\trun <ops> file operations (write, read, every 4th delete)\n"
+			"\tinstead of replaying a log.\n");
+	printf("--dir <dir>\n"
+			"\tdirectory of the workload (default: '%s').\n", FUSG_BENCH_DIR_DEFAULT);
+	printf("--source fanotify|none\n"
+			"\tevent source of the workload (default: fanotify). With\n"
+			"\t'none' only the workload is timed, e.g. under audit rules.\n");
+}
+
+static int read_args(int argc, char** argv)
+{
+	global.progname = argv[0];
+	global.mode = OP_PARSE_FILE;
+	global.conf_file = FUSG_CONF_DEFAULT;
+
+	int i;
+	for (i = 1; i < argc; i++)
+	{
+		char* arg = argv[i];
+		if (!strcmp(arg, "-h") || !strcmp(arg, "--help"))
+		{
+			global.mode = OP_HELP;
+			return ERR_NONE;
+		}
+		else if (i + 1 >= argc)
+		{
+			break;
+		}
+		else if (!strcmp(arg, "-c") || !strcmp(arg, "--conf"))
+		{
+			global.conf_file = argv[++i];
+		}
+		else if (!strcmp(arg, "-d") || !strcmp(arg, "--db"))
+		{
+			db_path = argv[++i];
+		}
+		else if (!strcmp(arg, "-o") || !strcmp(arg, "--out"))
+		{
+			out_path = argv[++i];
+		}
+		else if (!strcmp(arg, "-s") || !strcmp(arg, "--speed"))
+		{
+			char* end;
+			speed = strtod(argv[++i], &end);
+			if (*end || speed < 0)
+			{
+				log_error("illegal speed: %s", argv[i]);
+				return ERR_USAGE;
+			}
+		}
+		else if (!strcmp(arg, "-w") || !strcmp(arg, "--workload"))
+		{
+			char* end;
+			workload = strtoull(argv[++i], &end, 10);
+			if (*end || !workload)
+			{
+				log_error("illegal workload: %s", argv[i]);
+				return ERR_USAGE;
+			}
+		}
+		else if (!strcmp(arg, "--dir"))
+		{
+			work_dir = argv[++i];
+		}
+		else if (!strcmp(arg, "--source"))
+		{
+			source = argv[++i];
+			if (strcmp(source, "fanotify") && strcmp(source, "none"))
+			{
+				log_error("illegal source: %s", source);
+				return ERR_USAGE;
+			}
+		}
+		else
+		{
+			log_error("illegal argument: %s", arg);
+			return ERR_USAGE;
+		}
+	}
+	if (workload && i == argc)
+	{
+		return ERR_NONE;
+	}
+	if (i != argc - 1)
+	{
+		log_error("missing log file to replay");
+		return ERR_USAGE;
+	}
+	log_path = argv[i];
+	return ERR_NONE;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int rc = 0;
+	pid_t feeder = -1;
+
+	memset(&global, 0, sizeof(global));
+	time(&global.last_stats_report);
+
+	// keep stdout clean for the report
+	logging_set_log_levels(LL_WARN, LL_IGNORE, LL_WARN);
+	logging_init(FUSG_BENCH_NAME);
+	logging_setup_console(0);
+
+	rc = read_args(argc, argv);
+	if (rc || global.mode == OP_HELP)
+	{
+		print_usage();
+		return rc;
+	}
+
+	if (fusg_conf_read(&global.conf, global.conf_file))
+	{
+		log_warn("can't read config at '%s', using defaults", global.conf_file);
+	}
+	// don't interfere with a running fusgd
+	snprintf(global.conf.db_path, PATH_MAX, "%s", db_path);
+	global.conf.fusgd_socket[0] = '\0';
+	global.conf.fusgd_live[0] = '\0';
+
+	if (speed > 0 && first_timestamp(log_path, &first_ms))
+	{
+		log_error("no audit records in '%s'", log_path);
+		return ERR_USAGE;
+	}
+
+	db_delete(db_path);
+	db_flags_t db_flags = DB_WRITE;
+	if (global.conf.db_snapshot_period) db_flags |= DB_SNAPSHOT;
+	if (global.conf.db_inodes) db_flags |= DB_INODES;
+	global.db = db_open(db_path, db_flags);
+	if (!global.db)
+	{
+		log_error("can't open db at '%s': %s", db_path, strerror(errno));
+		return ERR_DB;
+	}
+
+	work_event_hook = bench_event_hook;
+	start_ns = now_ns();
+
+	rc = workload ? workload_bench() : replay(&feeder);
+	if (rc) goto bail;
+
+	double seconds = (now_ns() - start_ns) / 1e9;
+
+	FILE* out = out_path ? fopen(out_path, "w") : stdout;
+	if (out)
+	{
+		report(out, seconds);
+		if (out != stdout) fclose(out);
+	}
+	else
+	{
+		log_error("can't open '%s': %s", out_path, strerror(errno));
+		rc = ERR_USAGE;
+	}
+
+bail:
+	if (feeder > 0)
+	{
+		kill(feeder, SIGTERM);
+		waitpid(feeder, NULL, 0);
+	}
+	if (global.fin) fclose(global.fin);
+	db_close(global.db);
+	free(event_ns.values);
+	free(lag_ns.values);
+	return rc;
+}
@@ -17,11 +17,110 @@
 #define FUSG_LOGPATH_DEFAULT "/var/log/fusg/fusgd.log"
 #define FUSG_TRACEPATH_DEFAULT ""
 #define FUSG_DBPATH_DEFAULT "/var/fusg/db"
+#define FUSG_SOCKET_DEFAULT ""
+#define FUSG_LIVE_DEFAULT ""
+#define FUSG_LIVE_ENTRIES_DEFAULT 65536
+#define FUSG_METRICS_DEFAULT ""
+#define FUSG_METRICS_PERIOD_DEFAULT 10
+#define FUSG_LAG_WARN_DEFAULT 60
+#define FUSG_DEGRADE_MAX_DEFAULT 0
+#define FUSG_DEGRADE_LAG_DEFAULT 5
+#define FUSG_DEGRADE_BACKLOG_DEFAULT 75
+#define FUSG_DEGRADE_WINDOWS_DEFAULT ""
+#define FUSG_SPOOL_DEFAULT ""
+#define FUSG_SPOOL_MAX_DEFAULT 1024
+#define FUSG_SPOOL_WATERMARK_DEFAULT 50
+#define FUSG_TAIL_DEFAULT ""
+#define FUSG_TAIL_STATE_DEFAULT "/var/fusg/fusgd.tail"
+#define FUSG_FANOTIFY_DEFAULT ""
+#define FUSG_INFLIGHT_MAX_DEFAULT 1024
+#define FUSG_INFLIGHT_TIMEOUT_DEFAULT 2000
+#define FUSG_DB_SNAPSHOT_PERIOD_DEFAULT 10
+#define FUSG_DB_BATCH_EVENTS_DEFAULT 256
+#define FUSG_DB_BATCH_TIME_DEFAULT 100
+#define FUSG_DB_INODES_DEFAULT 0
+#define FUSG_DB_RETENTION_DAYS_DEFAULT 0
+#define FUSG_DB_RETENTION_DELETED_DAYS_DEFAULT 0
+#define FUSG_DB_PRUNE_PERIOD_DEFAULT 3600
+#define FUSG_DB_PRUNE_WORK_DEFAULT 1000
+#define FUSG_DB_REORGANISE_PAUSE_DEFAULT 500
+#define FUSG_DB_DIR_DEPTH_DEFAULT 4
+#define FUSG_DB_DIR_PENDING_DEFAULT 4096
+#define FUSG_DB_FLUSH_UPDATES_DEFAULT 10000
+#define FUSG_DB_FLUSH_KIB_DEFAULT 4096
+#define FUSG_DB_FLUSH_AGE_DEFAULT 5000
+#define FUSG_DB_FLUSH_IDLE_DEFAULT 1000
 
 typedef struct {
 	char fusgd_log[PATH_MAX];
 	char fusgd_trace[PATH_MAX];
 	char db_path[PATH_MAX];
+	/** unix socket of the fusgd query service (empty: disabled) */
+	char fusgd_socket[PATH_MAX];
+	/** name of the shared memory live table (empty: disabled) */
+	char fusgd_live[NAME_MAX];
+	/** max number of entries in the live table */
+	int fusgd_live_entries;
+	/** file receiving metrics in Prometheus text format (empty: disabled) */
+	char fusgd_metrics[PATH_MAX];
+	/** seconds between updates of the metrics file */
+	int fusgd_metrics_period;
+	/** warn if the ingestion lag exceeds this many seconds (0: never) */
+	int fusgd_lag_warn;
+	/** highest degradation level under overload (0: no overload protection) */
+	int fusgd_degrade_max;
+	/** overload if events are processed this many seconds late */
+	int fusgd_degrade_lag;
+	/** overload if the input pipe is filled by this many percent */
+	int fusgd_degrade_backlog;
+	/** file receiving the degraded time windows (empty: log only) */
+	char fusgd_degrade_windows[PATH_MAX];
+	/** spool file for input backing up (empty: disabled) */
+	char fusgd_spool[PATH_MAX];
+	/** size cap of the spool file in MiB */
+	int fusgd_spool_max;
+	/** start spooling if the input pipe is filled by this many percent */
+	int fusgd_spool_watermark;
+	/** audit log to follow instead of reading stdin (empty: stdin) */
+	char fusgd_tail[PATH_MAX];
+	/** resume state of fusgd_tail */
+	char fusgd_tail_state[PATH_MAX];
+	/** directories to watch with fanotify instead of reading audit events (empty: disabled) */
+	char fusgd_fanotify[PATH_MAX];
+	/** max number of events in flight, i.e. not yet complete */
+	int fusgd_inflight_max;
+	/** complete events after this many milliseconds without EOE */
+	int fusgd_inflight_timeout;
+	/** seconds between published read snapshots (0: disabled) */
+	int db_snapshot_period;
+	/** max number of events per db batch (0: no batching) */
+	int db_batch_events;
+	/** max time in milliseconds a db batch stays open */
+	int db_batch_time;
+	/** 1: identify files by inode, further paths are aliases */
+	int db_inodes;
+	/** drop entries not updated for this many days (0: keep) */
+	int db_retention_days;
+	/** drop entries of files deleted this many days ago (0: keep) */
+	int db_retention_deleted_days;
+	/** seconds between the starts of pruning runs */
+	int db_prune_period;
+	/** max number of entries or records per pruning step */
+	int db_prune_work;
+	/** max milliseconds to reorganise a db file (0: never) */
+	int db_reorganise_pause;
+	/** levels of directories to keep rollups of (0: none) */
+	int db_dir_depth;
+	/** max number of directories with deltas not yet written */
+	int db_dir_pending;
+	/** flush after this many updates (0: no limit) */
+	int db_flush_updates;
+	/** flush after this many KiB of updated records (0: no limit) */
+	int db_flush_kib;
+	/** flush when the oldest update is this many milliseconds old */
+	int db_flush_age;
+	/** flush when input is idle for this many milliseconds */
+	int db_flush_idle;
 } fusg_conf_t;
 
 int fusg_conf_read(fusg_conf_t* conf, const char* path);
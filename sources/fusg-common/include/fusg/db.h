@@ -24,6 +24,10 @@ typedef enum
 	DB_READ  = 1<<0,
 	DB_WRITE = 1<<1,
 	DB_SYNC  = 1<<2,
+	/** writer publishes read snapshots (see db_snapshot()) */
+	DB_SNAPSHOT = 1<<3,
+	/** writer identifies files by inode, paths become aliases (see db_update_r()) */
+	DB_INODES = 1<<4,
 }
 db_flags_t;
 
@@ -39,6 +43,14 @@ typedef struct
 } fusg_stats_key_t;
 #pragma pack()
 
+#pragma pack(8)
+typedef struct
+{
+	uint64_t dev;
+	uint64_t ino;
+} fusg_inode_t;
+#pragma pack()
+
 #pragma pack(8)
 typedef struct
 {
@@ -47,12 +59,13 @@ typedef struct
 	uint64_t create;
 	uint64_t exec;
 	uint64_t time;
-	uint64_t _reserved;
+	/** time stamp of the latest deletion of the file (FUSG_DELET) or 0 */
+	uint64_t deleted;
 } fusg_stats_t;
 #pragma pack()
 
 static inline
-void fugs_stats_add(fusg_stats_t* stats_total,fusg_stats_t* stats)
+void fugs_stats_add(fusg_stats_t* stats_total, const fusg_stats_t* stats)
 {
 	stats_total->create += stats->create;
 	stats_total->exec += stats->exec;
@@ -62,8 +75,33 @@ void fugs_stats_add(fusg_stats_t* stats_total,fusg_stats_t* stats)
 }
 
 
+/**
+ * Running totals of all entries of an executable or a file.
+ */
+typedef struct {
+	/** number of entries, i.e. files of the executable or executables of the file */
+	uint64_t entries;
+	/** summed counters, latest time stamps */
+	fusg_stats_t stats;
+} fusg_rollup_t;
+
+
 typedef struct __db_t* dbref_t;
 
+/**
+ * Updates not yet flushed to disk (see db_dirty()).
+ */
+typedef struct {
+	/** number of updated entries and records */
+	uint64_t updates;
+	/** approximate size of the updated records [bytes] */
+	uint64_t bytes;
+	/** time of the first update not flushed (CLOCK_MONOTONIC) [ns], 0 if none */
+	uint64_t first_ns;
+	/** time of the latest update (CLOCK_MONOTONIC) [ns], 0 if none */
+	uint64_t last_ns;
+} db_dirty_t;
+
 typedef struct __fusg_stats_iterator_t {
 	dbref_t dbc;
 	int have_lock;
@@ -73,8 +111,17 @@ typedef struct __fusg_stats_iterator_t {
 
 /**
  * Opens a data base.
+ *
+ * Readers (DB_READ) open the latest snapshot published by the
+ * writer, if there is one, and fall back to the live db otherwise.
+ * A reader on a snapshot never takes the db lock and therefore
+ * never blocks the writer.
+ *
+ * A writer opened without DB_SNAPSHOT withdraws any previously
+ * published snapshot, so readers won't see stale data.
+ *
  * @param dbpath path to the db (folder on file system)
- * @param flags FUSG_READ (readonly) | FUSG_WRITE (R/W) | DB_SYNC
+ * @param flags FUSG_READ (readonly) | FUSG_WRITE (R/W) | DB_SYNC | DB_SNAPSHOT
  * @return db-reference or NULL on error.
  */
 dbref_t db_open(const char* dbpath, db_flags_t flags);
@@ -86,6 +133,34 @@ void db_close(dbref_t db);
 
 int db_flush(dbref_t db);
 
+/**
+ * Get what db_flush() would write to disk, e.g. to decide when to flush.
+ */
+void db_dirty(dbref_t db, db_dirty_t* dirty);
+
+/**
+ * Publishes an immutable point-in-time copy of the db for readers.
+ *
+ * Requires a db opened with DB_WRITE | DB_SNAPSHOT. The copy is
+ * placed into a new generation directory next to the live files
+ * and then atomically activated. Files get cloned (copy-on-write)
+ * where the file system supports it and copied otherwise. Unless
+ * called with the lock held, copying happens without the lock and
+ * the generation is dropped if the db changed meanwhile.
+ *
+ * Without reflinks, snapshots of large dbs are spaced out, so that
+ * copying takes at most a tenth of the time; calls in between do
+ * nothing.
+ *
+ * Readers keep working on the generation they opened, even when
+ * a newer one gets published meanwhile. Superseded generations
+ * are removed after a grace period. Nothing happens, if there
+ * were no updates since the last snapshot.
+ *
+ * @return 0 on success -1 otherwise
+ */
+int db_snapshot(dbref_t db);
+
 /**
  * Deletes the entire database from file system.
  */
@@ -122,9 +197,39 @@ int db_delete(const char* dbpath);
  * The lock is released, when the db_iterator_release()
  * function was called.
  *
+ * Locking is a no-op for readers on a snapshot.
+ *
  */
 int db_lock(dbref_t db);
 int db_unlock(dbref_t db);
+
+/**
+ * Starts a batch of updates.
+ *
+ * All db accesses until db_commit_batch() run under a single
+ * db lock, and with DB_SYNC, the db gets synced only once on
+ * commit. While a batch is open, readers on the live db (i.e.
+ * without a snapshot) have to wait. Thus, batches should be
+ * kept short.
+ *
+ * Batches cannot be nested.
+ *
+ * @return 0 on success -1 otherwise
+ */
+int db_begin_batch(dbref_t db);
+
+/**
+ * Ends the batch started by db_begin_batch(), syncs in
+ * case of DB_SYNC and releases the db lock.
+ *
+ * @return 0 on success -1 otherwise
+ */
+int db_commit_batch(dbref_t db);
+
+/**
+ * @return number of updates in the currently open batch or -1 if there is none.
+ */
+int db_batch_size(dbref_t db);
 /**
  * Type of file usage.
  */
@@ -149,11 +254,106 @@ typedef enum {
  */
 int db_update(dbref_t dbc, const char* executable, const char* filepath, file_usage_t flags, uint64_t timestamp);
 
+/**
+ * Same as db_update() but optionally provides the key and
+ * the resulting state of the updated entry.
+ *
+ * With DB_INODES and a known inode, a file is one object with all
+ * its paths (hard links, rename targets) sharing one file id. The
+ * first path seen is its name, further paths are its aliases. A
+ * path keeps its id, even if it refers to a new inode later on
+ * (e.g. editors replacing a file on save). FUSG_DELET releases the
+ * inode at the end of the event (see db_end_event()), so it can be
+ * reused by another file.
+ *
+ * @param inode identity of the file or NULL if unknown
+ * @param key receives the key of the updated entry, if not NULL
+ * @param stats receives the stats after the update, if not NULL
+ * @return 0 on success -1 otherwise
+ */
+int db_update_r(dbref_t dbc, const char* executable, const char* filepath, const fusg_inode_t* inode,
+		file_usage_t flags, uint64_t timestamp, fusg_stats_key_t* key, fusg_stats_t* stats);
+
+/**
+ * Ends the updates of one event: inodes deleted by it are released,
+ * unless a later update of the event referred to them again. A rename
+ * logs the old name as deleted before the new one as created, both
+ * with the same inode: the file keeps its id.
+ * @return 0 on success -1 otherwise
+ */
+int db_end_event(dbref_t dbc);
+
+/**
+ * Bulk load: gets the id of an executable and creates it, if missing.
+ * Ids are created in call order, like db_update() does.
+ * @return 0 on success -1 otherwise
+ */
+int db_exec_create_id(dbref_t dbc, const char* executable, uint64_t* id);
+
+/**
+ * Bulk load: gets the id of a filepath and creates it, if missing.
+ * @return 0 on success -1 otherwise
+ */
+int db_file_create_id(dbref_t dbc, const char* filepath, uint64_t* id);
+
+/**
+ * Bulk load: adds aggregated updates to an entry. Counters are added,
+ * the time stamp is replaced, as if the updates were applied one by one.
+ * @param key ids from db_exec_create_id() and db_file_create_id()
+ * @return 0 on success -1 otherwise
+ */
+int db_update_stats(dbref_t dbc, const fusg_stats_key_t* key, const fusg_stats_t* stats);
+
 /**
  * get usage stats of a given executable + filepath combination.
+ * @return 0 on success, 1 if there is no such entry and -1 on error
  */
 int db_fetch(dbref_t dbc, const char* executable, const char* filepath, fusg_stats_t* fusg_stats);
 
+/**
+ * Get the rollup of all entries of an executable. Rollups are kept
+ * up to date by every update and prune, so this is a single lookup.
+ * @return 0 on success, 1 if there is no such executable and -1 on
+ *         error (errno ENOTSUP: db has no rollups)
+ */
+int db_exec_rollup(dbref_t dbc, const char* executable, fusg_rollup_t* rollup);
+
+/**
+ * Get the rollup of all entries of a file.
+ * @see db_exec_rollup()
+ */
+int db_file_rollup(dbref_t dbc, const char* filepath, fusg_rollup_t* rollup);
+
+/**
+ * Sets the number of directory levels to keep rollups of
+ * (see db_dir_rollup()). Changing it rebuilds them from all entries.
+ * The depth is stored in the db: other writers keep them up to date
+ * without calling this.
+ *
+ * Updates collect their deltas per directory in memory, which get
+ * written on db_flush(), snapshot, lookup, db_close() or when there
+ * are more than max_pending directories. Until the next db_flush(),
+ * the db is marked as having rollups behind its entries: a writer
+ * opening a db with the mark set (i.e. after a crash) rebuilds them.
+ *
+ * Requires a db opened with DB_WRITE.
+ * @param depth levels of directories below root (0: none)
+ * @param max_pending max number of directories with pending deltas
+ *        (<= 0: default)
+ * @return 0 on success -1 otherwise
+ */
+int db_dirs(dbref_t dbc, int depth, int max_pending);
+
+/**
+ * Get the rollup of all entries of files in the given directory
+ * and below, such as the latest access time of the subtree.
+ * @param dir canonical path of a directory
+ * @return 0 on success, 1 if there is no entry below dir and -1 on
+ *         error (errno ENOTSUP: no directory rollups, ERANGE: dir
+ *         is deeper than their depth or root)
+ */
+int db_dir_rollup(dbref_t dbc, const char* dir, fusg_rollup_t* rollup);
+
 /**
  * Get unique id of executable.
  * @return ((uint64_t)-1) if not found
@@ -179,6 +379,15 @@ uint64_t db_file_get_id(dbref_t dbc, const char* filepath);
  */
 int db_file_get_file(dbref_t dbc, uint64_t key_long, char* buffer, size_t size);
 
+/**
+ * Get the aliases of a file, i.e. its paths other than its name
+ * (see DB_INODES).
+ * @param buffer receives the aliases, each terminated by '\0',
+ *        followed by an empty string
+ * @return number of aliases or -1 on error (e.g. buffer too small)
+ */
+int db_file_get_aliases(dbref_t dbc, uint64_t key_long, char* buffer, size_t size);
+
 /**
  * Initialises an iterator to walk through fusg_stats entries.
  * Iteration runs in a db transaction until
@@ -205,4 +414,90 @@ fusg_stats_key_t db_iterator_get_fugs_stats_key(fusg_stats_iterator_t* iterator)
 }
 
 
+/**
+ * Retention policy (see db_prune_begin()).
+ */
+typedef struct
+{
+	/** drop entries not updated since this time stamp (0: keep) */
+	uint64_t expire_before;
+	/**
+	 * drop entries of files deleted before this time stamp
+	 * and not used since (0: keep)
+	 */
+	uint64_t deleted_before;
+} db_retention_t;
+
+typedef struct
+{
+	uint64_t entries;
+	uint64_t files;
+	uint64_t execs;
+	/** db files reorganised */
+	uint64_t reorganised;
+	/** bytes released by reorganising */
+	int64_t reclaimed;
+} db_prune_stats_t;
+
+/**
+ * Receives the key of each entry dropped by db_prune_step().
+ */
+typedef void (*db_prune_visitor_t)(void* ctx, const fusg_stats_key_t* key);
+
+/**
+ * Starts pruning the db according to the given retention policy.
+ *
+ * Pruning is done in small steps (see db_prune_step()) in between
+ * regular updates:
+ *
+ *   1. drop expired entries and entries of unknown ids,
+ *   2. drop entries of deleted files,
+ *   3. remove executables and files (with their aliases) without
+ *      entries left,
+ *   4. reorganise the db files, which had records removed.
+ *
+ * A file is deleted, if the latest update of all its entries was
+ * a FUSG_DELET. Files and executables updated while pruning is in
+ * progress are kept.
+ *
+ * Entries added or removed while a pass over the db is in
+ * progress may cause gdbm to skip others. Skipped entries are
+ * left to the next run, their files and executables are kept:
+ * those get removed only if their rollups show no entries left.
+ *
+ * Requires a db opened with DB_WRITE.
+ *
+ * @return 0 on success -1 otherwise (e.g. pruning in progress)
+ */
+int db_prune_begin(dbref_t dbc, const db_retention_t* retention);
+
+/**
+ * Does the next step of pruning, under a single db lock.
+ *
+ * Free space in gdbm files is reused by later updates, but only
+ * reorganising shrinks them. That rewrites a file entirely, thus
+ * takes time in proportion to its size. Files expected to take
+ * longer than max_pause_ms are left as they are.
+ *
+ * @param max_work max number of entries visited or records removed
+ * @param max_pause_ms max time to reorganise a db file (0: never)
+ * @param dropped receives the dropped entries, if not NULL
+ * @param stats accumulates the results, if not NULL
+ * @return 1 if there is more to do, 0 if pruning is done
+ *         and -1 on error (pruning was aborted)
+ */
+int db_prune_step(dbref_t dbc, int max_work, int max_pause_ms,
+		db_prune_visitor_t dropped, void* ctx, db_prune_stats_t* stats);
+
+/**
+ * @return 1 if pruning is in progress, 0 otherwise
+ */
+int db_prune_active(dbref_t dbc);
+
+/**
+ * Aborts pruning in progress.
+ */
+void db_prune_abort(dbref_t dbc);
+
+
 #endif /* FUSG_DB_H_ */
@@ -0,0 +1,90 @@
+/*
+ * live.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef FUSG_LIVE_H_
+#define FUSG_LIVE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fusg/db.h"
+
+
+/*
+ * Live statistics table in shared memory.
+ *
+ * fusgd publishes the most recently updated fusg_stats entries
+ * together with their executable and file paths in a named
+ * shared memory segment (see shm_overview(7)). fusg maps it
+ * read-only and looks up entries without any system call.
+ *
+ * There is a single writer. Readers synchronise through a
+ * sequence lock: the writer increments a sequence counter before
+ * and after each modification, and readers retry if the counter
+ * was odd or has changed while they were reading.
+ *
+ * Entries are placed by the hash of their file path, so all
+ * entries of a file are found in a single probe sequence. When
+ * the table or its string arena fills up, the writer starts
+ * over with an empty table. Thus the table holds the entries
+ * updated most recently, not all entries of the db.
+ */
+
+
+typedef struct __live_t* liveref_t;
+
+
+/**
+ * Receives the entries found by a lookup.
+ * @return 0 to continue, anything else stops the lookup
+ */
+typedef int (*live_visitor_t)(void* ctx, const char* exec, const char* file, const fusg_stats_t* stats);
+
+
+/**
+ * Creates the shared memory segment. Writer only. A segment of a
+ * previous run is taken over empty, if it has the same capacity,
+ * and replaced otherwise. Readers, which still map it, never fault.
+ * @param name name of the segment, e.g. "/fusgd.live"
+ * @param capacity max number of entries
+ * @return reference or NULL on error
+ */
+liveref_t live_create(const char* name, size_t capacity);
+
+/**
+ * Removes the shared memory segment. Writer only.
+ */
+void live_destroy(liveref_t live);
+
+/**
+ * Publishes the new state of an entry. Writer only.
+ * @return 0 on success -1 otherwise
+ */
+int live_update(liveref_t live, const fusg_stats_key_t* key, const char* exec, const char* file, const fusg_stats_t* stats);
+
+/**
+ * Maps an existing shared memory segment read-only.
+ * @return reference or NULL if there is none
+ */
+liveref_t live_open(const char* name);
+
+void live_close(liveref_t live);
+
+/**
+ * Visits all entries of the given file.
+ * @return number of entries visited or -1 on error
+ */
+long live_lookup_file(liveref_t live, const char* file, live_visitor_t visit, void* ctx);
+
+/**
+ * Visits all entries of the given executable.
+ * @return number of entries visited or -1 on error
+ */
+long live_lookup_exec(liveref_t live, const char* exec, live_visitor_t visit, void* ctx);
+
+
+#endif /* FUSG_LIVE_H_ */
@@ -9,6 +9,7 @@
 #define FUSG_LOGGING_H_
 
 #include <stdio.h>
+#include <stdint.h>
 
 typedef enum
 {
@@ -52,6 +53,13 @@ void logging_set_log_levels(loglevel_t console_max_level, loglevel_t file_max_le
  */
 int logging_setup_file(FILE* log_file, int chain);
 
+/**
+ * replaces the file of the file logger, e.g. to reopen a rotated
+ * log file. NULL mutes the file logger.
+ * @return previous log file
+ */
+FILE* logging_set_file(FILE* log_file);
+
 /**
  * setup logging to log to console only, using stdout and stderr respectively.
  *
@@ -87,6 +95,86 @@ int logging_setup_syslog(const char* ident, int chain);
  */
 void logging_finalize(void);
 
+/**
+ * Moves writing log messages into a background thread: log_xxx()
+ * just formats the message into a lock-free ring of messages
+ * (LOG_RING_SLOTS). If the ring is full, messages are dropped and counted.
+ * log_fatal() waits until the ring is written and writes directly.
+ *
+ * Loggers can still be set up and replaced while the thread runs.
+ *
+ * @return 0 on success, -1 otherwise (logging stays synchronous)
+ */
+int logging_start_async(void);
+
+/**
+ * Writes the pending messages and stops the background thread.
+ */
+void logging_stop_async(void);
+
+/**
+ * Waits until the pending messages are written and logs the
+ * messages suppressed by rate limits so far.
+ */
+void logging_flush(void);
+
+/**
+ * @return 1 if any logger would write a message of this level
+ */
+int log_enabled(loglevel_t level);
+
+
+/** messages logged at once by a call site of log_limited() */
+#define LOG_LIMIT_BURST 10
+/** messages per second of a call site of log_limited(), after a burst */
+#define LOG_LIMIT_RATE 1
+
+/**
+ * Rate limit of a call site, see log_limited().
+ */
+typedef struct log_limit_t
+{
+	/** earliest time of the next message, minus the burst [ns] */
+	uint64_t tat;
+	uint64_t suppressed;
+	loglevel_t level;
+	const char* fmt;
+	/** known to logging_flush(), once a message was suppressed */
+	int listed;
+	struct log_limit_t* next;
+} log_limit_t;
+
+/**
+ * Logs a message like log_xxx(), but rate limited per call site
+ * (token bucket of LOG_LIMIT_BURST messages, LOG_LIMIT_RATE per second).
+ * The next message logged notes how many were suppressed, or
+ * logging_flush() does, if there is none. Meant for messages, which
+ * may be repeated for each event.
+ */
+#define log_limited(level, ...) \
+	do { \
+		static log_limit_t __log_limit; \
+		log_limited_at(&__log_limit, level, __VA_ARGS__); \
+	} while (0)
+
+void log_limited_at(log_limit_t* limit, loglevel_t level, const char* fmt, ...)
+		__attribute__((format(printf, 3, 4)));
+
+/**
+ * Takes a token of limit for a message, for callers doing expensive
+ * work to build it: they skip it, if the message is suppressed.
+ * @return 1 if the message is to be logged with log_limit_log(),
+ *         0 if suppressed (counted) or level is disabled
+ */
+int log_limit_take(log_limit_t* limit, loglevel_t level, const char* fmt);
+
+/**
+ * Logs a message, which got a token of log_limit_take().
+ */
+void log_limit_log(log_limit_t* limit, loglevel_t level, const char* fmt, ...)
+		__attribute__((format(printf, 3, 4)));
+
+
 /** Log a debug message. */
 void log_debug(const char *fmt, ...);
 /** Log a info message. */
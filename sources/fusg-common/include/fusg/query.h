@@ -0,0 +1,149 @@
+/*
+ * query.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef FUSG_QUERY_H_
+#define FUSG_QUERY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fusg/db.h"
+
+
+/*
+ * Binary protocol of the fusgd query service.
+ *
+ * The client connects to the unix domain socket of fusgd
+ * (see fusgd_socket in fusg.conf) and sends a single request:
+ *
+ *   query_request_t + arg_len bytes argument (a path, '\0' terminated)
+ *
+ * fusgd answers with a sequence of replies, one per matching
+ * fusg_stats entry, followed by a final reply carrying the
+ * status QUERY_END, QUERY_NOTFOUND or QUERY_FAILED:
+ *
+ *   query_reply_t + exec_len bytes executable + file_len bytes file
+ *
+ * Summary queries answer with a single record carrying the
+ * rollup of the given file, executable or directory (see
+ * db_file_rollup() and db_dir_rollup()),
+ * before the final reply.
+ *
+ * Strings in replies are not terminated. Afterwards, fusgd
+ * closes the connection. All values are in host byte order,
+ * because client and server always run on the same host.
+ */
+
+#define QUERY_MAGIC   0x46555351 /* "FUSQ" */
+#define QUERY_VERSION 2
+
+
+typedef enum {
+	/** all executables, which used the given file */
+	QUERY_FILE = 1,
+	/** all files used by the given executable */
+	QUERY_EXEC,
+	/** all entries of files in the given directory and below */
+	QUERY_SUBTREE,
+	/** all entries */
+	QUERY_DUMP,
+	/**
+	 * name and aliases of the given file (see DB_INODES):
+	 * one record per path, name first, without executable and stats
+	 */
+	QUERY_ALIASES,
+	/** rollup of all entries of the given file */
+	QUERY_SUMMARY_FILE,
+	/** rollup of all entries of the given executable */
+	QUERY_SUMMARY_EXEC,
+	/** rollup of all entries of files in the given directory and below */
+	QUERY_SUMMARY_DIR,
+} query_type_t;
+
+
+typedef enum {
+	QUERY_RECORD = 0,
+	QUERY_END,
+	QUERY_NOTFOUND,
+	QUERY_FAILED,
+} query_status_t;
+
+
+#pragma pack(8)
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t type;
+	uint32_t arg_len;
+	uint32_t _reserved;
+} query_request_t;
+#pragma pack()
+
+#pragma pack(8)
+typedef struct
+{
+	uint32_t status;
+	uint16_t exec_len;
+	uint16_t file_len;
+	fusg_stats_t stats;
+	/** number of entries summed up in stats: 1, or more in summaries */
+	uint64_t entries;
+} query_reply_t;
+#pragma pack()
+
+
+/**
+ * Connects to the query service of fusgd.
+ * @return socket or -1 if the service is not available.
+ */
+int query_connect(const char* socket_path);
+
+/**
+ * Sends a request.
+ * @param arg path argument or NULL (QUERY_DUMP)
+ * @return 0 on success -1 otherwise
+ */
+int query_send_request(int sock, query_type_t type, const char* arg);
+
+/**
+ * Receives a request.
+ * @param arg buffer of given size receiving the '\0' terminated argument.
+ * @return 0 on success -1 otherwise (errno is set)
+ */
+int query_recv_request(int sock, query_request_t* request, char* arg, size_t size);
+
+/**
+ * Packs a reply into buf, the way query_send_reply() sends it.
+ * @param entries see query_reply_t
+ * @return size of the reply, which was packed only if it fits into size
+ */
+size_t query_pack_reply(void* buf, size_t size, query_status_t status,
+		const char* exec, const char* file, const fusg_stats_t* stats, uint64_t entries);
+
+/**
+ * Sends a reply. exec and file may be NULL for replies other than QUERY_RECORD.
+ * @return 0 on success -1 otherwise
+ */
+int query_send_reply(int sock, query_status_t status, const char* exec, const char* file, const fusg_stats_t* stats);
+
+/**
+ * Sends the reply of a summary query (QUERY_RECORD).
+ * @return 0 on success -1 otherwise
+ */
+int query_send_rollup(int sock, const char* exec, const char* file, const fusg_rollup_t* rollup);
+
+/**
+ * Receives a reply.
+ * @param exec, file buffers of at least PATH_MAX+1 bytes receiving
+ *        '\0' terminated strings.
+ * @return status of the reply or -1 on error.
+ */
+int query_recv_reply(int sock, query_reply_t* reply, char* exec, char* file);
+
+
+#endif /* FUSG_QUERY_H_ */
@@ -11,6 +11,8 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <errno.h>
 
 #include "fusg/conf.h"
 #include "fusg/err.h"
@@ -32,6 +34,39 @@ void fusg_config_init(fusg_conf_t* conf)
 	strcpy(conf->fusgd_log, FUSG_LOGPATH_DEFAULT);
 	strcpy(conf->fusgd_trace, FUSG_TRACEPATH_DEFAULT);
 	strcpy(conf->db_path, FUSG_DBPATH_DEFAULT);
+	strcpy(conf->fusgd_socket, FUSG_SOCKET_DEFAULT);
+	strcpy(conf->fusgd_live, FUSG_LIVE_DEFAULT);
+	conf->fusgd_live_entries = FUSG_LIVE_ENTRIES_DEFAULT;
+	strcpy(conf->fusgd_metrics, FUSG_METRICS_DEFAULT);
+	conf->fusgd_metrics_period = FUSG_METRICS_PERIOD_DEFAULT;
+	conf->fusgd_lag_warn = FUSG_LAG_WARN_DEFAULT;
+	conf->fusgd_degrade_max = FUSG_DEGRADE_MAX_DEFAULT;
+	conf->fusgd_degrade_lag = FUSG_DEGRADE_LAG_DEFAULT;
+	conf->fusgd_degrade_backlog = FUSG_DEGRADE_BACKLOG_DEFAULT;
+	strcpy(conf->fusgd_degrade_windows, FUSG_DEGRADE_WINDOWS_DEFAULT);
+	strcpy(conf->fusgd_spool, FUSG_SPOOL_DEFAULT);
+	conf->fusgd_spool_max = FUSG_SPOOL_MAX_DEFAULT;
+	conf->fusgd_spool_watermark = FUSG_SPOOL_WATERMARK_DEFAULT;
+	strcpy(conf->fusgd_tail, FUSG_TAIL_DEFAULT);
+	strcpy(conf->fusgd_tail_state, FUSG_TAIL_STATE_DEFAULT);
+	strcpy(conf->fusgd_fanotify, FUSG_FANOTIFY_DEFAULT);
+	conf->fusgd_inflight_max = FUSG_INFLIGHT_MAX_DEFAULT;
+	conf->fusgd_inflight_timeout = FUSG_INFLIGHT_TIMEOUT_DEFAULT;
+	conf->db_snapshot_period = FUSG_DB_SNAPSHOT_PERIOD_DEFAULT;
+	conf->db_batch_events = FUSG_DB_BATCH_EVENTS_DEFAULT;
+	conf->db_batch_time = FUSG_DB_BATCH_TIME_DEFAULT;
+	conf->db_inodes = FUSG_DB_INODES_DEFAULT;
+	conf->db_retention_days = FUSG_DB_RETENTION_DAYS_DEFAULT;
+	conf->db_retention_deleted_days = FUSG_DB_RETENTION_DELETED_DAYS_DEFAULT;
+	conf->db_prune_period = FUSG_DB_PRUNE_PERIOD_DEFAULT;
+	conf->db_prune_work = FUSG_DB_PRUNE_WORK_DEFAULT;
+	conf->db_reorganise_pause = FUSG_DB_REORGANISE_PAUSE_DEFAULT;
+	conf->db_dir_depth = FUSG_DB_DIR_DEPTH_DEFAULT;
+	conf->db_dir_pending = FUSG_DB_DIR_PENDING_DEFAULT;
+	conf->db_flush_updates = FUSG_DB_FLUSH_UPDATES_DEFAULT;
+	conf->db_flush_kib = FUSG_DB_FLUSH_KIB_DEFAULT;
+	conf->db_flush_age = FUSG_DB_FLUSH_AGE_DEFAULT;
+	conf->db_flush_idle = FUSG_DB_FLUSH_IDLE_DEFAULT;
 }
 
 
@@ -145,6 +180,21 @@ int consume(char c, char** line)
 }
 
 
+int property_int(const char* name, const char* value, int* result)
+{
+	char* end;
+	errno = 0;
+	long l = strtol(value, &end, 0);
+	if (errno || end == value || *end || l < 0 || l > INT_MAX)
+	{
+		conf_error("property '%s' requires a non-negative integer but got '%s'", name, value);
+		return -1;
+	}
+	*result = (int)l;
+	return 0;
+}
+
+
 int property(fusg_conf_t* conf, const char* name, const char* value)
 {
 	int rc = 0;
@@ -160,6 +210,158 @@ int property(fusg_conf_t* conf, const char* name, const char* value)
 	{
 		snprintf(conf->fusgd_trace, PATH_MAX, "%s", value);
 	}
+	else if (!strcmp(name, "fusgd_socket"))
+	{
+		snprintf(conf->fusgd_socket, PATH_MAX, "%s", value);
+	}
+	else if (!strcmp(name, "fusgd_live"))
+	{
+		if (value[0] && (value[0] != '/' || strchr(value + 1, '/')))
+		{
+			conf_error("fusgd_live requires a name of the form '/name' but got '%s'", value);
+			rc = -1;
+		}
+		else snprintf(conf->fusgd_live, NAME_MAX, "%s", value);
+	}
+	else if (!strcmp(name, "fusgd_live_entries"))
+	{
+		rc = property_int(name, value, &conf->fusgd_live_entries);
+	}
+	else if (!strcmp(name, "fusgd_metrics"))
+	{
+		snprintf(conf->fusgd_metrics, PATH_MAX, "%s", value);
+	}
+	else if (!strcmp(name, "fusgd_metrics_period"))
+	{
+		rc = property_int(name, value, &conf->fusgd_metrics_period);
+	}
+	else if (!strcmp(name, "fusgd_lag_warn"))
+	{
+		rc = property_int(name, value, &conf->fusgd_lag_warn);
+	}
+	else if (!strcmp(name, "fusgd_degrade_max"))
+	{
+		rc = property_int(name, value, &conf->fusgd_degrade_max);
+		if (!rc && (conf->fusgd_degrade_max < 0 || conf->fusgd_degrade_max > 3))
+		{
+			conf_error("fusgd_degrade_max requires a level in 0..3 but got '%s'", value);
+			rc = -1;
+		}
+	}
+	else if (!strcmp(name, "fusgd_degrade_lag"))
+	{
+		rc = property_int(name, value, &conf->fusgd_degrade_lag);
+	}
+	else if (!strcmp(name, "fusgd_degrade_backlog"))
+	{
+		rc = property_int(name, value, &conf->fusgd_degrade_backlog);
+	}
+	else if (!strcmp(name, "fusgd_degrade_windows"))
+	{
+		snprintf(conf->fusgd_degrade_windows, PATH_MAX, "%s", value);
+	}
+	else if (!strcmp(name, "fusgd_spool"))
+	{
+		snprintf(conf->fusgd_spool, PATH_MAX, "%s", value);
+	}
+	else if (!strcmp(name, "fusgd_spool_max"))
+	{
+		rc = property_int(name, value, &conf->fusgd_spool_max);
+	}
+	else if (!strcmp(name, "fusgd_spool_watermark"))
+	{
+		rc = property_int(name, value, &conf->fusgd_spool_watermark);
+		if (!rc && (conf->fusgd_spool_watermark < 1 || conf->fusgd_spool_watermark > 100))
+		{
+			conf_error("fusgd_spool_watermark requires a percentage in 1..100 but got '%s'", value);
+			rc = -1;
+		}
+	}
+	else if (!strcmp(name, "fusgd_tail"))
+	{
+		snprintf(conf->fusgd_tail, PATH_MAX, "%s", value);
+	}
+	else if (!strcmp(name, "fusgd_tail_state"))
+	{
+		snprintf(conf->fusgd_tail_state, PATH_MAX, "%s", value);
+	}
+	else if (!strcmp(name, "fusgd_fanotify"))
+	{
+		snprintf(conf->fusgd_fanotify, PATH_MAX, "%s", value);
+	}
+	else if (!strcmp(name, "fusgd_inflight_max"))
+	{
+		rc = property_int(name, value, &conf->fusgd_inflight_max);
+		if (!rc && !conf->fusgd_inflight_max)
+		{
+			conf_error("fusgd_inflight_max requires at least 1");
+			rc = -1;
+		}
+	}
+	else if (!strcmp(name, "fusgd_inflight_timeout"))
+	{
+		rc = property_int(name, value, &conf->fusgd_inflight_timeout);
+	}
+	else if (!strcmp(name, "db_snapshot_period"))
+	{
+		rc = property_int(name, value, &conf->db_snapshot_period);
+	}
+	else if (!strcmp(name, "db_batch_events"))
+	{
+		rc = property_int(name, value, &conf->db_batch_events);
+	}
+	else if (!strcmp(name, "db_batch_time"))
+	{
+		rc = property_int(name, value, &conf->db_batch_time);
+	}
+	else if (!strcmp(name, "db_inodes"))
+	{
+		rc = property_int(name, value, &conf->db_inodes);
+	}
+	else if (!strcmp(name, "db_retention_days"))
+	{
+		rc = property_int(name, value, &conf->db_retention_days);
+	}
+	else if (!strcmp(name, "db_retention_deleted_days"))
+	{
+		rc = property_int(name, value, &conf->db_retention_deleted_days);
+	}
+	else if (!strcmp(name, "db_prune_period"))
+	{
+		rc = property_int(name, value, &conf->db_prune_period);
+	}
+	else if (!strcmp(name, "db_prune_work"))
+	{
+		rc = property_int(name, value, &conf->db_prune_work);
+	}
+	else if (!strcmp(name, "db_reorganise_pause"))
+	{
+		rc = property_int(name, value, &conf->db_reorganise_pause);
+	}
+	else if (!strcmp(name, "db_dir_depth"))
+	{
+		rc = property_int(name, value, &conf->db_dir_depth);
+	}
+	else if (!strcmp(name, "db_dir_pending"))
+	{
+		rc = property_int(name, value, &conf->db_dir_pending);
+	}
+	else if (!strcmp(name, "db_flush_updates"))
+	{
+		rc = property_int(name, value, &conf->db_flush_updates);
+	}
+	else if (!strcmp(name, "db_flush_kib"))
+	{
+		rc = property_int(name, value, &conf->db_flush_kib);
+	}
+	else if (!strcmp(name, "db_flush_age"))
+	{
+		rc = property_int(name, value, &conf->db_flush_age);
+	}
+	else if (!strcmp(name, "db_flush_idle"))
+	{
+		rc = property_int(name, value, &conf->db_flush_idle);
+	}
 	else
 	{
 		conf_error("unknown config property '%s'", name);
@@ -211,6 +413,8 @@ int fusg_conf_read(fusg_conf_t* conf, const char* path)
 	fusg_config_init(conf);
 
 	file = path;
+	// read again on reload
+	linenum = 0;
 	FILE* stream = fopen(path, "r");
 	if (!stream) return ERR_CONF;
 
@@ -6,23 +6,34 @@
  */
 
 
-
+#define _GNU_SOURCE
 #include <gdbm.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #include <unistd.h>
+#include <dirent.h>
 #include <errno.h>
 #include <assert.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "fusg/db.h"
 #include "fusg/logging.h"
 #include "fusg/utils.h"
 
 #define DB_ID_ENTRY "id"
+#define DB_ROLLUP_ENTRY "rollups"
+#define DB_DIRS_ENTRY "dirs"
+#define DB_DIRS_PENDING_ENTRY "dirs-pending"
+/** directory deltas kept in memory at most, by default */
+#define DB_DIRS_PENDING_DEFAULT 4096
+/** inodes an event may delete before they are released early */
+#define DB_RELEASE_MAX 16
 
 #define DB_FILE_EXEC "exec.db"
 #define DB_FILE_EXER "execr.db"
@@ -30,7 +41,38 @@
 #define DB_FILE_FILR "filer.db"
 #define DB_FILE_EVNT "evnt.db"
 #define DB_FILE_IDTB "idtb.db"
-
+#define DB_FILE_INOD "inod.db"
+#define DB_FILE_ALIS "alis.db"
+#define DB_FILE_XSUM "xsum.db"
+#define DB_FILE_FSUM "fsum.db"
+#define DB_FILE_DSUM "dsum.db"
+
+#define DB_SNAP_LINK   "snapshot"
+#define DB_SNAP_PREFIX "snap."
+
+/** superseded generations stay this long for readers still opening them [s] */
+#define DB_SNAP_GRACE 30
+/** attempts of a reader to open a snapshot, before it takes the live db */
+#define DB_SNAP_RETRIES 3
+/** full copies of at least this size are subject to DB_SNAP_COPY_SHARE [bytes] */
+#define DB_SNAP_COPY_MIN_SIZE (16 * 1024 * 1024)
+/** full copies take at most 1/DB_SNAP_COPY_SHARE of the time */
+#define DB_SNAP_COPY_SHARE 10
+
+static const char* const __db_files[] = {
+	DB_FILE_EXEC,
+	DB_FILE_EXER,
+	DB_FILE_FILE,
+	DB_FILE_FILR,
+	DB_FILE_EVNT,
+	DB_FILE_IDTB,
+	DB_FILE_INOD,
+	DB_FILE_ALIS,
+	DB_FILE_XSUM,
+	DB_FILE_FSUM,
+	DB_FILE_DSUM,
+	NULL
+};
 
 typedef struct __db_t {
 	/** used to indicate that we already tried to close it */
@@ -39,6 +81,8 @@ typedef struct __db_t {
 	int lockfd;
 	/** dirty == 1 -> has pending data to be flushed to disk */
 	int dirty;
+	/** what is pending (see db_dirty()) */
+	db_dirty_t dirty_stats;
 
 	/** executables */
 	GDBM_FILE exec_db;
@@ -52,9 +96,51 @@ typedef struct __db_t {
 	GDBM_FILE evnt_db;
 	/** id table: used to generate dunique ids */
 	GDBM_FILE idtb_db;
+	/** inodes: file id of (dev, ino), NULL in dbs predating it */
+	GDBM_FILE inod_db;
+	/** aliases: further paths of a file id, NULL in dbs predating it */
+	GDBM_FILE alis_db;
+	/** rollups of executables, NULL in dbs predating it */
+	GDBM_FILE xsum_db;
+	/** rollups of files, NULL in dbs predating it */
+	GDBM_FILE fsum_db;
+	/** rollups of directories, NULL in dbs predating it */
+	GDBM_FILE dsum_db;
+	/** levels of directories aggregated in dsum_db (0: none) */
+	int dir_depth;
+	/** directory deltas not yet written (see db_dirs()) */
+	struct __db_dirs_t* dirs;
+	/** dirs_marked == 1 -> dsum_db is marked behind evnt_db until the next sync */
+	int dirs_marked;
+
+	/** inodes deleted by the current event (see db_end_event()) */
+	fusg_inode_t released[DB_RELEASE_MAX];
+	uint64_t released_ids[DB_RELEASE_MAX];
+	int num_released;
 
 	int lock_depth;
 
+	/** in_batch == 1 -> db_begin_batch() holds a lock */
+	int in_batch;
+	/** number of updates in the current batch */
+	int batch_updates;
+
+	/** reader working on a published snapshot (no locking required) */
+	int snapshot;
+	/** generation of the last published snapshot */
+	uint64_t snap_gen;
+	/** snap_dirty == 1 -> has updates not yet published in a snapshot */
+	int snap_dirty;
+	/** no snapshot before this time (CLOCK_MONOTONIC) [ns] */
+	uint64_t snap_next_ns;
+	/** snap_copied == 1 -> files had to be copied, logged once */
+	int snap_copied;
+
+	/** pruning in progress or NULL (see db_prune_begin()) */
+	struct __db_prune_t* prune;
+	/** measured throughput of gdbm_reorganize() [bytes/s] */
+	double reorg_rate;
+
 	char path[0];
 } db_t;
 
@@ -79,18 +165,63 @@ static inline uint64_t* __db_fetch_str_long(GDBM_FILE db, const char* key_str, u
 static inline int __db_store_long_str(GDBM_FILE db, uint64_t key_long, const char* value_str);
 static inline int __db_fetch_long_str(GDBM_FILE db, uint64_t key_long, char* value, size_t size);
 
+static inline datum db_datum_str(const char* value);
+static inline datum db_datum_long(uint64_t* value);
 static inline datum __db_datum_evnt_key(fusg_stats_key_t* value);
 static inline datum __db_datum_evnt_content(fusg_stats_t* value);
 static inline int __db_get_or_create_unique_id(dbref_t dbc, GDBM_FILE str_id_db, const char* key, uint64_t* id);
 static inline fusg_stats_t* __db_evnt_fetch(dbref_t dbc, fusg_stats_key_t* evnt_key, fusg_stats_t* evnt_val);
 static inline int __db_evnt_store(dbref_t dbc, fusg_stats_key_t* evnt_key, fusg_stats_t* evnt_val);
 static inline int __db_check_expected_notfound(void);
-static inline int __db_get_fusg_key(dbref_t dbc, const char* executable, const char* filepath, fusg_stats_key_t* evnt_key);
+static inline void __db_touch(dbref_t dbc, uint64_t updates, uint64_t bytes);
+static inline uint64_t __db_update_size(dbref_t dbc);
+static inline int __db_get_fusg_key(dbref_t dbc, const char* executable, const char* filepath,
+		const fusg_inode_t* inode, fusg_stats_key_t* evnt_key);
+static inline int __db_get_file_id(dbref_t dbc, const char* filepath, const fusg_inode_t* inode, uint64_t* id);
+static inline int __db_inode_release(dbref_t dbc, const fusg_inode_t* inode, uint64_t id);
+static inline int __db_find_fusg_key(dbref_t dbc, const char* executable, const char* filepath, fusg_stats_key_t* evnt_key);
+static inline int __db_file_exists(dbref_t dbc, uint64_t id);
+static void __db_prune_touch(dbref_t dbc, const fusg_stats_key_t* key);
+static inline int __db_rollup_update(dbref_t dbc, const fusg_stats_key_t* key,
+		const fusg_stats_t* delta, int entries);
+static int __db_rollup_build(dbref_t dbc);
+static int __db_dirs_update(dbref_t dbc, const char* filepath, uint64_t file_id,
+		const fusg_stats_t* delta, int entries, int sign);
+static int __db_dirs_write(dbref_t dbc);
+static int __db_dirs_mark(dbref_t dbc);
+static void __db_dirs_free(dbref_t dbc);
+static int __db_dirs_build(dbref_t dbc);
 
 void __db_sync(dbref_t dbc);
 
+static int __db_snapshot_resolve(const char* dbpath, char* snappath);
+static uint64_t __db_snapshot_generation(const char* dbpath);
+static int __db_snapshot_withdraw(const char* dbpath);
+static int __db_snapshot_cleanup(const char* dbpath, uint64_t keep_gen);
+static int __db_copy_file(const char* src, const char* dst, int* cloned);
+static dbref_t __db_open(const char* dbpath, db_flags_t flags, int use_snapshot, int* retry);
+
 
 dbref_t db_open(const char* dbpath, db_flags_t flags)
+{
+	// the writer removes superseded generations after a grace period,
+	// a reader resolving one just before gets the next generation.
+	int retry = 1;
+	dbref_t dbc = NULL;
+	for (int attempt = 1; !dbc && retry; attempt++)
+	{
+		retry = 0;
+		dbc = __db_open(dbpath, flags, attempt < DB_SNAP_RETRIES, &retry);
+	}
+	return dbc;
+}
+
+/**
+ * @param use_snapshot readers may open the published snapshot
+ * @param retry set to 1 if opening the snapshot failed
+ */
+static
+dbref_t __db_open(const char* dbpath, db_flags_t flags, int use_snapshot, int* retry)
 {
 	int dbinit = 0; // whether we have to initialise the database
 
@@ -100,7 +231,7 @@ dbref_t db_open(const char* dbpath, db_flags_t flags)
 	assert(fiscanonical(dbpath));
 
 	// check if flags make sense
-	assert(0 == (flags & ~(DB_SYNC | DB_READ | DB_WRITE)));
+	assert(0 == (flags & ~(DB_SYNC | DB_READ | DB_WRITE | DB_SNAPSHOT | DB_INODES)));
 
 	size_t pathlen = strlen(dbpath) + 1;
 
@@ -143,16 +274,44 @@ dbref_t db_open(const char* dbpath, db_flags_t flags)
 	db_t* dbc = (db_t*)calloc(1, sizeof(db_t) + pathlen);
 	strcpy(dbc->path, dbpath);
 
+	// directory containing the files to be opened
+	const char* filesdir = dbpath;
+	char snappath[PATH_MAX];
+
 	dbc->open_flags = flags;
-	dbc->lockfd = open(dbpath, O_RDONLY);
-	if (!dbc->lockfd)
+	if (!(flags & DB_WRITE) && use_snapshot && 0 == __db_snapshot_resolve(dbpath, snappath))
 	{
-		log_error("db_open: can't lock db: %s", strerror(errno));
-		rc = -1;
-		goto error;
+		// readers prefer the snapshot and don't need the lock
+		dbc->snapshot = 1;
+		filesdir = snappath;
+	}
+	else
+	{
+		dbc->lockfd = open(dbpath, O_RDONLY);
+		if (dbc->lockfd == -1)
+		{
+			log_error("db_open: can't lock db: %s", strerror(errno));
+			dbc->lockfd = 0;
+			rc = -1;
+			goto error;
+		}
 	}
 	db_lock(dbc);
 
+	if (flags & DB_WRITE)
+	{
+		if (flags & DB_SNAPSHOT)
+		{
+			dbc->snap_gen = __db_snapshot_generation(dbpath);
+			// publish initial state on first snapshot
+			dbc->snap_dirty = 1;
+		}
+		else if (__db_snapshot_withdraw(dbpath))
+		{
+			goto error;
+		}
+	}
+
 	// defines the size of chunks to be transfered to db.
 	// If less than file system block size, its set to
 	// file system block size.
@@ -172,50 +331,132 @@ dbref_t db_open(const char* dbpath, db_flags_t flags)
 	void (* fatal_func)(const char *);
 	fatal_func = __db_perror; // FIXME: think about db-error handling
 
-	char pathbuf[PATH_MAX];
+	char pathbuf[PATH_MAX + NAME_MAX + 2];
 
-	sprintf(pathbuf, "%s/%s", dbpath, DB_FILE_EXEC);
+	sprintf(pathbuf, "%s/%s", filesdir, DB_FILE_EXEC);
 	dbc->exec_db = gdbm_open(pathbuf, block_size, gdbm_mode, mode, fatal_func);
 	if (!dbc->exec_db) {
 		__db_perror("gdbm_open(exec.db)");
 		goto error;
 	}
 
-	sprintf(pathbuf, "%s/%s", dbpath, DB_FILE_EXER);
+	sprintf(pathbuf, "%s/%s", filesdir, DB_FILE_EXER);
 	dbc->execr_db = gdbm_open(pathbuf, block_size, gdbm_mode, mode, fatal_func);
 	if (!dbc->execr_db) {
 		__db_perror("gdbm_open(execr.db)");
 		goto error;
 	}
 
-	sprintf(pathbuf, "%s/%s", dbpath, DB_FILE_FILE);
+	sprintf(pathbuf, "%s/%s", filesdir, DB_FILE_FILE);
 	dbc->file_db = gdbm_open(pathbuf, block_size, gdbm_mode, mode, fatal_func);
 	if (!dbc->file_db) {
 		__db_perror("gdbm_open(file.db)");
 		goto error;
 	}
 
-	sprintf(pathbuf, "%s/%s", dbpath, DB_FILE_FILR);
+	sprintf(pathbuf, "%s/%s", filesdir, DB_FILE_FILR);
 	dbc->filer_db = gdbm_open(pathbuf, block_size, gdbm_mode, mode, fatal_func);
 	if (!dbc->filer_db) {
 		__db_perror("gdbm_open(filer.db)");
 		goto error;
 	}
 
-	sprintf(pathbuf, "%s/%s", dbpath, DB_FILE_EVNT);
+	sprintf(pathbuf, "%s/%s", filesdir, DB_FILE_EVNT);
 	dbc->evnt_db = gdbm_open(pathbuf, block_size, gdbm_mode, mode, fatal_func);
 	if (!dbc->evnt_db) {
 		__db_perror("gdbm_open(evnt.db)");
 		goto error;
 	}
 
-	sprintf(pathbuf, "%s/%s", dbpath, DB_FILE_IDTB);
+	sprintf(pathbuf, "%s/%s", filesdir, DB_FILE_IDTB);
 	dbc->idtb_db = gdbm_open(pathbuf, block_size, gdbm_mode, mode, fatal_func);
 	if (!dbc->idtb_db) {
 		__db_perror("gdbm_open(idtb.db)");
 		goto error;
 	}
 
+	// added later: readers of older dbs go without
+	sprintf(pathbuf, "%s/%s", filesdir, DB_FILE_INOD);
+	if ((flags & DB_WRITE) || fexists(pathbuf))
+	{
+		dbc->inod_db = gdbm_open(pathbuf, block_size, gdbm_mode, mode, fatal_func);
+		if (!dbc->inod_db) {
+			__db_perror("gdbm_open(inod.db)");
+			goto error;
+		}
+	}
+
+	sprintf(pathbuf, "%s/%s", filesdir, DB_FILE_ALIS);
+	if ((flags & DB_WRITE) || fexists(pathbuf))
+	{
+		dbc->alis_db = gdbm_open(pathbuf, block_size, gdbm_mode, mode, fatal_func);
+		if (!dbc->alis_db) {
+			__db_perror("gdbm_open(alis.db)");
+			goto error;
+		}
+	}
+
+	// added later as well: rollups are valid, once they have been built
+	uint64_t built = dbinit;
+	if (!dbinit && !__db_fetch_str_long(dbc->idtb_db, DB_ROLLUP_ENTRY, &built)
+			&& __db_check_expected_notfound())
+	{
+		goto error;
+	}
+	sprintf(pathbuf, "%s/%s", filesdir, DB_FILE_XSUM);
+	built = built && fexists(pathbuf);
+	sprintf(pathbuf, "%s/%s", filesdir, DB_FILE_FSUM);
+	built = built && fexists(pathbuf);
+	// partial rollups of an interrupted build get truncated
+	int rollup_build = !dbinit && !built && (flags & DB_WRITE);
+	int rollup_mode = rollup_build ? (GDBM_NOLOCK | GDBM_NEWDB) : gdbm_mode;
+
+	if ((flags & DB_WRITE) || built)
+	{
+		sprintf(pathbuf, "%s/%s", filesdir, DB_FILE_XSUM);
+		dbc->xsum_db = gdbm_open(pathbuf, block_size, rollup_mode, mode, fatal_func);
+		if (!dbc->xsum_db) {
+			__db_perror("gdbm_open(xsum.db)");
+			goto error;
+		}
+		sprintf(pathbuf, "%s/%s", filesdir, DB_FILE_FSUM);
+		dbc->fsum_db = gdbm_open(pathbuf, block_size, rollup_mode, mode, fatal_func);
+		if (!dbc->fsum_db) {
+			__db_perror("gdbm_open(fsum.db)");
+			goto error;
+		}
+	}
+	if (dbinit && __db_store_str_long(dbc->idtb_db, DB_ROLLUP_ENTRY, 1)) goto error;
+	if (rollup_build && __db_rollup_build(dbc)) goto error;
+
+	// directory aggregates of the depth stored by db_dirs()
+	uint64_t dir_depth = 0;
+	if (!dbinit && !__db_fetch_str_long(dbc->idtb_db, DB_DIRS_ENTRY, &dir_depth)
+			&& __db_check_expected_notfound())
+	{
+		goto error;
+	}
+	// deltas lost by a crash: rollups behind the entries
+	uint64_t dirs_pending = 0;
+	if (!dbinit && !__db_fetch_str_long(dbc->idtb_db, DB_DIRS_PENDING_ENTRY, &dirs_pending)
+			&& __db_check_expected_notfound())
+	{
+		goto error;
+	}
+	dbc->dirs_marked = (dirs_pending != 0);
+	sprintf(pathbuf, "%s/%s", filesdir, DB_FILE_DSUM);
+	int dirs_build = (!fexists(pathbuf) || dirs_pending) && dir_depth && (flags & DB_WRITE);
+	int dirs_mode = dirs_build ? (GDBM_NOLOCK | GDBM_NEWDB) : gdbm_mode;
+	if ((flags & DB_WRITE) || fexists(pathbuf))
+	{
+		dbc->dsum_db = gdbm_open(pathbuf, block_size, dirs_mode, mode, fatal_func);
+		if (!dbc->dsum_db) {
+			__db_perror("gdbm_open(dsum.db)");
+			goto error;
+		}
+		dbc->dir_depth = dir_depth;
+	}
+	if (dirs_build && __db_dirs_build(dbc)) goto error;
 
 	if (dbinit)
 	{
@@ -231,6 +472,7 @@ dbref_t db_open(const char* dbpath, db_flags_t flags)
 
 
 error:
+	*retry = dbc->snapshot;
 	db_unlock(dbc);
 	db_close(dbc);
 	return NULL;
@@ -241,6 +483,20 @@ void db_close(dbref_t dbc)
 {
 	if (dbc && dbc->open_flags)
 	{
+		if (dbc->num_released) db_end_event(dbc);
+		if (dbc->in_batch)
+		{
+			log_warn("database batch was not committed. Committing now.");
+			db_commit_batch(dbc);
+		}
+		if (dbc->snap_dirty && !dbc->lock_depth && (dbc->open_flags & DB_SNAPSHOT))
+		{
+			// leave the final state to the readers
+			db_snapshot(dbc);
+		}
+		// pending directory deltas
+		if (!dbc->lock_depth) db_flush(dbc);
+		db_prune_abort(dbc);
 		dbc->open_flags = 0;
 		if (dbc->lock_depth)
 		{
@@ -259,6 +515,12 @@ void db_close(dbref_t dbc)
 		if (dbc->filer_db) gdbm_close(dbc->filer_db);
 		if (dbc->evnt_db)  gdbm_close(dbc->evnt_db);
 		if (dbc->idtb_db)  gdbm_close(dbc->idtb_db);
+		if (dbc->inod_db)  gdbm_close(dbc->inod_db);
+		if (dbc->alis_db)  gdbm_close(dbc->alis_db);
+		if (dbc->xsum_db)  gdbm_close(dbc->xsum_db);
+		if (dbc->fsum_db)  gdbm_close(dbc->fsum_db);
+		if (dbc->dsum_db)  gdbm_close(dbc->dsum_db);
+		__db_dirs_free(dbc);
 
 		if (dbc->lockfd)   close(dbc->lockfd);
 		free(dbc);
@@ -281,14 +543,29 @@ void __db_sync(dbref_t dbc)
 {
 	if (dbc->open_flags & DB_WRITE)
 	{
+		int dirs_rc = __db_dirs_write(dbc);
+		if (dirs_rc) __db_perror("writing directory rollups");
 		if (dbc->exec_db)  gdbm_sync(dbc->exec_db);
 		if (dbc->execr_db) gdbm_sync(dbc->execr_db);
 		if (dbc->file_db)  gdbm_sync(dbc->file_db);
 		if (dbc->filer_db) gdbm_sync(dbc->filer_db);
 		if (dbc->evnt_db)  gdbm_sync(dbc->evnt_db);
 		if (dbc->idtb_db)  gdbm_sync(dbc->idtb_db);
+		if (dbc->inod_db)  gdbm_sync(dbc->inod_db);
+		if (dbc->alis_db)  gdbm_sync(dbc->alis_db);
+		if (dbc->xsum_db)  gdbm_sync(dbc->xsum_db);
+		if (dbc->fsum_db)  gdbm_sync(dbc->fsum_db);
+		if (dbc->dsum_db)  gdbm_sync(dbc->dsum_db);
+		// rollups caught up, once the entries are on disk
+		if (dbc->dirs_marked && !dirs_rc
+				&& !__db_store_str_long(dbc->idtb_db, DB_DIRS_PENDING_ENTRY, 0))
+		{
+			gdbm_sync(dbc->idtb_db);
+			dbc->dirs_marked = 0;
+		}
 		log_debug("db synced to disk");
 		dbc->dirty = 0;
+		memset(&dbc->dirty_stats, 0, sizeof(db_dirty_t));
 	}
 }
 
@@ -305,10 +582,16 @@ int db_flush(dbref_t dbc)
 }
 
 
+void db_dirty(dbref_t dbc, db_dirty_t* dirty)
+{
+	*dirty = dbc->dirty_stats;
+}
+
+
 int db_lock(dbref_t dbc)
 {
 	int rc = 0;
-	if (!dbc->lock_depth)
+	if (!dbc->lock_depth && !dbc->snapshot)
 	{
 		// blocks until lock is free
 		int lockop = dbc->open_flags & DB_WRITE ? LOCK_EX : LOCK_SH;
@@ -340,14 +623,220 @@ int db_unlock(dbref_t dbc)
 			__db_sync(dbc);
 		}
 
-		rc = flock(dbc->lockfd, LOCK_UN);
-		if (rc) log_error("db_unlock(): %s", strerror(errno));
+		if (!dbc->snapshot)
+		{
+			rc = flock(dbc->lockfd, LOCK_UN);
+			if (rc) log_error("db_unlock(): %s", strerror(errno));
+		}
+	}
+	return rc;
+}
+
+
+int db_begin_batch(dbref_t dbc)
+{
+	if (dbc->in_batch)
+	{
+		log_error("db_begin_batch(): batch already open");
+		return -1;
+	}
+	int rc = db_lock(dbc);
+	if (rc) return rc;
+	dbc->in_batch = 1;
+	dbc->batch_updates = 0;
+	return 0;
+}
+
+int db_commit_batch(dbref_t dbc)
+{
+	if (!dbc->in_batch)
+	{
+		log_error("db_commit_batch(): no batch open");
+		return -1;
+	}
+	dbc->in_batch = 0;
+	// syncs in case of DB_SYNC
+	return db_unlock(dbc);
+}
+
+int db_batch_size(dbref_t dbc)
+{
+	return dbc->in_batch ? dbc->batch_updates : -1;
+}
+
+
+/**
+ * Identifies the state of a db file, which changes with every write.
+ */
+typedef struct {
+	off_t size;
+	struct timespec mtime;
+} db_stamp_t;
+
+static
+int __db_stamp(const char* path, db_stamp_t* stamp)
+{
+	struct stat st;
+	if (stat(path, &st))
+	{
+		// missing optional files
+		memset(stamp, 0, sizeof(db_stamp_t));
+		return errno == ENOENT ? 0 : -1;
+	}
+	stamp->size = st.st_size;
+	stamp->mtime = st.st_mtim;
+	return 0;
+}
+
+int db_snapshot(dbref_t dbc)
+{
+	if ((dbc->open_flags & (DB_WRITE|DB_SNAPSHOT)) != (DB_WRITE|DB_SNAPSHOT))
+	{
+		log_error("db_snapshot(): db not opened for publishing snapshots");
+		return -1;
+	}
+	if (!dbc->snap_dirty) return 0;
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uint64_t start_ns = (uint64_t)start.tv_sec * 1000000000 + start.tv_nsec;
+	// still paying off the last full copy
+	if (start_ns < dbc->snap_next_ns) return 0;
+
+	int rc;
+	if ((rc = db_lock(dbc))) return rc;
+
+	// snapshot has to contain everything written so far
+	__db_sync(dbc);
+
+	uint64_t gen = dbc->snap_gen + 1;
+	char snapdir[PATH_MAX];
+	char srcbuf[PATH_MAX + NAME_MAX + 2];
+	char dstbuf[PATH_MAX + NAME_MAX + 2];
+	char linkbuf[PATH_MAX];
+	char target[32];
+	size_t num_files = sizeof(__db_files) / sizeof(__db_files[0]) - 1;
+	db_stamp_t stamps[num_files];
+	db_stamp_t stamp;
+
+	for (size_t i = 0; i < num_files && !rc; i++)
+	{
+		snprintf(srcbuf, sizeof(srcbuf), "%s/%s", dbc->path, __db_files[i]);
+		rc = __db_stamp(srcbuf, &stamps[i]);
+	}
+	if (rc)
+	{
+		log_error("db_snapshot: stat(%s): %s", srcbuf, strerror(errno));
+		goto bail;
+	}
+
+	// Copying doesn't need the lock, if this is the outermost: we are
+	// not writing meanwhile and readers of the live db may continue.
+	// Another writer could, which the stamps reveal afterwards.
+	int unlocked = dbc->lock_depth == 1;
+	if (unlocked) db_unlock(dbc);
+
+	snprintf(target, sizeof(target), "%s%lu", DB_SNAP_PREFIX, gen);
+	snprintf(snapdir, PATH_MAX, "%s/%s", dbc->path, target);
+
+	// leftovers of an interrupted attempt
+	fremove_r(snapdir);
+	rc = mkdir(snapdir, 0700);
+	if (rc == -1)
+	{
+		log_error("db_snapshot: mkdir(%s): %s", snapdir, strerror(errno));
+		if (unlocked) return rc;
+		goto bail;
+	}
+
+	int cloned = 1;
+	off_t copied = 0;
+	for (size_t i = 0; i < num_files && !rc; i++)
+	{
+		snprintf(srcbuf, sizeof(srcbuf), "%s/%s", dbc->path, __db_files[i]);
+		snprintf(dstbuf, sizeof(dstbuf), "%s/%s", snapdir, __db_files[i]);
+		int file_cloned = 1;
+		rc = __db_copy_file(srcbuf, dstbuf, &file_cloned);
+		if (!file_cloned) copied += stamps[i].size;
+		cloned = cloned && file_cloned;
+	}
+
+	if (unlocked && (db_lock(dbc) | rc))
+	{
+		db_unlock(dbc);
+		fremove_r(snapdir);
+		return -1;
+	}
+	if (rc)
+	{
+		fremove_r(snapdir);
+		goto bail;
+	}
+	for (size_t i = 0; i < num_files && !rc; i++)
+	{
+		snprintf(srcbuf, sizeof(srcbuf), "%s/%s", dbc->path, __db_files[i]);
+		rc = __db_stamp(srcbuf, &stamp) || memcmp(&stamp, &stamps[i], sizeof(stamp));
+	}
+	if (rc)
+	{
+		log_warn("db_snapshot: db changed while copying, dropped generation %lu", gen);
+		fremove_r(snapdir);
+		rc = -1;
+		goto bail;
+	}
+
+	// activate new generation by atomically replacing the link
+	snprintf(linkbuf, PATH_MAX, "%s/%s.tmp", dbc->path, DB_SNAP_LINK);
+	snprintf(dstbuf, sizeof(dstbuf), "%s/%s", dbc->path, DB_SNAP_LINK);
+	unlink(linkbuf);
+	rc = symlink(target, linkbuf);
+	if (!rc) rc = rename(linkbuf, dstbuf);
+	if (rc)
+	{
+		log_error("db_snapshot: activating '%s': %s", snapdir, strerror(errno));
+		unlink(linkbuf);
+		fremove_r(snapdir);
+		goto bail;
+	}
+
+	dbc->snap_gen = gen;
+	dbc->snap_dirty = 0;
+	log_debug("db snapshot %lu published", gen);
+
+	if (!cloned && copied >= DB_SNAP_COPY_MIN_SIZE)
+	{
+		// Without reflinks every snapshot copies the whole db, which
+		// holds up ingestion. Space them out, so that copying takes
+		// a bounded share of the time.
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		uint64_t elapsed_ns = (uint64_t)end.tv_sec * 1000000000 + end.tv_nsec - start_ns;
+		dbc->snap_next_ns = start_ns + elapsed_ns * DB_SNAP_COPY_SHARE;
+		if (!dbc->snap_copied)
+		{
+			log_warn("db_snapshot: no reflinks on '%s', copying %lu MiB took %.1f s,"
+					" snapshots at most every %.1f s",
+					dbc->path, (unsigned long)(copied >> 20), elapsed_ns / 1e9,
+					elapsed_ns * DB_SNAP_COPY_SHARE / 1e9);
+			dbc->snap_copied = 1;
+		}
 	}
+
+	// readers might still be opening previous generations
+	__db_snapshot_cleanup(dbc->path, gen);
+bail:
+	db_unlock(dbc);
 	return rc;
 }
 
 
 int db_update(dbref_t dbc, const char* executable, const char* filepath, file_usage_t flags, uint64_t timestamp)
+{
+	return db_update_r(dbc, executable, filepath, NULL, flags, timestamp, NULL, NULL);
+}
+
+int db_update_r(dbref_t dbc, const char* executable, const char* filepath, const fusg_inode_t* inode,
+		file_usage_t flags, uint64_t timestamp, fusg_stats_key_t* key, fusg_stats_t* stats)
 {
 	db_lock(dbc);
 	//
@@ -357,9 +846,30 @@ int db_update(dbref_t dbc, const char* executable, const char* filepath, file_us
 	int rc = 0;
 	fusg_stats_key_t evnt_key;
 
-	rc = __db_get_fusg_key(dbc, executable, filepath, &evnt_key);
+	if (!(dbc->open_flags & DB_INODES) || !inode || !inode->ino)
+	{
+		inode = NULL;
+	}
+	rc = __db_get_fusg_key(dbc, executable, filepath, inode, &evnt_key);
 	if (rc == -1) goto bail;
 
+	if (inode)
+	{
+		// referred to again, e.g. rename's new name after the old one
+		for (int i = dbc->num_released - 1; i >= 0; i--)
+		{
+			if (!memcmp(&dbc->released[i], inode, sizeof(fusg_inode_t)))
+				dbc->released[i] = dbc->released[--dbc->num_released];
+		}
+	}
+	if (inode && (flags & FUSG_DELET))
+	{
+		// the inode may be reused by another file, after this event
+		if (dbc->num_released == DB_RELEASE_MAX && db_end_event(dbc)) goto bail;
+		dbc->released[dbc->num_released] = *inode;
+		dbc->released_ids[dbc->num_released++] = evnt_key.file_id;
+	}
+
 
 
 	//
@@ -369,27 +879,115 @@ int db_update(dbref_t dbc, const char* executable, const char* filepath, file_us
 	fusg_stats_t evnt_val;
 
 	// fetch current state
+	int created = 0;
 	if (!__db_evnt_fetch(dbc, &evnt_key, &evnt_val)) {
 		// does not exist
 		memset(&evnt_val, 0, sizeof(fusg_stats_t));
+		created = 1;
 	}
 
 	// increment counters
-	evnt_val.read   += ((flags & FUSG_READ)  > 0);
-	evnt_val.write  += ((flags & FUSG_WRITE) > 0);
-	evnt_val.create += ((flags & FUSG_CREAT) > 0);
-	evnt_val.exec   += ((flags & FUSG_EXEC)  > 0);
+	fusg_stats_t delta = {
+		.read   = ((flags & FUSG_READ)  > 0),
+		.write  = ((flags & FUSG_WRITE) > 0),
+		.create = ((flags & FUSG_CREAT) > 0),
+		.exec   = ((flags & FUSG_EXEC)  > 0),
+		.time   = timestamp,
+		.deleted = (flags & FUSG_DELET) ? timestamp : 0,
+	};
+	evnt_val.read   += delta.read;
+	evnt_val.write  += delta.write;
+	evnt_val.create += delta.create;
+	evnt_val.exec   += delta.exec;
 	evnt_val.time    = timestamp;
+	if (delta.deleted) evnt_val.deleted = delta.deleted;
 
 	// update content in db
-	rc = __db_evnt_store(dbc, &evnt_key, &evnt_val);
-	dbc->dirty = 1;
+	rc = __db_dirs_mark(dbc);
+	if (!rc) rc = __db_evnt_store(dbc, &evnt_key, &evnt_val);
+	if (!rc) rc = __db_rollup_update(dbc, &evnt_key, &delta, created);
+	// aliases count for the directory of the file's name
+	if (!rc) rc = __db_dirs_update(dbc, inode ? NULL : filepath, evnt_key.file_id, &delta, created, 1);
+	if (dbc->prune) __db_prune_touch(dbc, &evnt_key);
+	__db_touch(dbc, 1, __db_update_size(dbc));
+	dbc->batch_updates++;
+	if (key) *key = evnt_key;
+	if (stats) *stats = evnt_val;
 bail:
 	if (rc != 0) __db_perror("db_update");
 	db_unlock(dbc);
 	return rc;
 }
 
+int db_end_event(dbref_t dbc)
+{
+	if (!dbc->num_released) return 0;
+	db_lock(dbc);
+	int rc = 0;
+	for (int i = 0; i < dbc->num_released && !rc; i++)
+	{
+		rc = __db_inode_release(dbc, &dbc->released[i], dbc->released_ids[i]);
+	}
+	dbc->num_released = 0;
+	__db_touch(dbc, 0, 0);
+	if (rc != 0) __db_perror("db_end_event");
+	db_unlock(dbc);
+	return rc;
+}
+
+int db_exec_create_id(dbref_t dbc, const char* executable, uint64_t* id)
+{
+	db_lock(dbc);
+	int rc = __db_get_or_create_unique_id(dbc, dbc->exec_db, executable, id);
+	if (!rc) rc = __db_store_long_str(dbc->execr_db, *id, executable);
+	if (rc != 0) __db_perror("db_exec_create_id");
+	db_unlock(dbc);
+	return rc;
+}
+
+int db_file_create_id(dbref_t dbc, const char* filepath, uint64_t* id)
+{
+	db_lock(dbc);
+	int rc = __db_get_or_create_unique_id(dbc, dbc->file_db, filepath, id);
+	if (!rc) rc = __db_store_long_str(dbc->filer_db, *id, filepath);
+	if (rc != 0) __db_perror("db_file_create_id");
+	db_unlock(dbc);
+	return rc;
+}
+
+int db_update_stats(dbref_t dbc, const fusg_stats_key_t* key, const fusg_stats_t* stats)
+{
+	db_lock(dbc);
+	fusg_stats_key_t evnt_key = *key;
+	fusg_stats_t evnt_val;
+	int created = 0;
+	if (!__db_evnt_fetch(dbc, &evnt_key, &evnt_val)) {
+		// does not exist
+		memset(&evnt_val, 0, sizeof(fusg_stats_t));
+		created = 1;
+	}
+
+	evnt_val.read   += stats->read;
+	evnt_val.write  += stats->write;
+	evnt_val.create += stats->create;
+	evnt_val.exec   += stats->exec;
+	// like the latest of the aggregated updates
+	evnt_val.time    = stats->time;
+	if (stats->deleted) evnt_val.deleted = stats->deleted;
+
+	int rc = __db_dirs_mark(dbc);
+	if (!rc) rc = __db_evnt_store(dbc, &evnt_key, &evnt_val);
+	if (!rc) rc = __db_rollup_update(dbc, &evnt_key, stats, created);
+	if (!rc) rc = __db_dirs_update(dbc, NULL, evnt_key.file_id, stats, created, 1);
+	if (dbc->prune) __db_prune_touch(dbc, &evnt_key);
+	__db_touch(dbc, 1, __db_update_size(dbc));
+	dbc->batch_updates++;
+	if (rc != 0) __db_perror("db_update_stats");
+	db_unlock(dbc);
+	return rc;
+}
+
+
 int db_fetch(dbref_t dbc, const char* executable, const char* filepath, fusg_stats_t* fusg_stats)
 {
 	int rc = 0;
@@ -400,24 +998,66 @@ int db_fetch(dbref_t dbc, const char* executable, const char* filepath, fusg_sta
 
 	fusg_stats_key_t evnt_key;
 
-	rc = __db_get_fusg_key(dbc, executable, filepath, &evnt_key);
-	if (rc == -1) goto bail;
-
-
-	//
-	// update entry in event db
-	//
+	// readers must not create ids
+	rc = __db_find_fusg_key(dbc, executable, filepath, &evnt_key);
+	if (rc) goto bail;
 
 
 	// fetch current state
 	if (!__db_evnt_fetch(dbc, &evnt_key, fusg_stats)) {
-		rc = __db_check_expected_notfound();
+		rc = (gdbm_errno == GDBM_ITEM_NOT_FOUND) ? 1 : -1;
+	}
+bail:
+	db_unlock(dbc);
+	return rc;
+}
+
+
+/**
+ * @return 0 on success, 1 if not found and -1 on error
+ */
+static int __db_rollup_fetch(dbref_t dbc, GDBM_FILE path_db, GDBM_FILE sum_db,
+		const char* path, fusg_rollup_t* rollup)
+{
+	if (!sum_db)
+	{
+		errno = ENOTSUP;
+		return -1;
+	}
+	int rc = 0;
+	db_lock(dbc);
+	uint64_t id;
+	if (!__db_fetch_str_long(path_db, path, &id))
+	{
+		rc = __db_check_expected_notfound() ? -1 : 1;
+		goto bail;
+	}
+	datum result = gdbm_fetch(sum_db, db_datum_long(&id));
+	if (result.dptr)
+	{
+		assert(result.dsize == sizeof(fusg_rollup_t));
+		memcpy(rollup, result.dptr, sizeof(fusg_rollup_t));
+		free(result.dptr);
+	}
+	else
+	{
+		rc = __db_check_expected_notfound() ? -1 : 1;
 	}
 bail:
 	db_unlock(dbc);
 	return rc;
 }
 
+int db_exec_rollup(dbref_t dbc, const char* executable, fusg_rollup_t* rollup)
+{
+	return __db_rollup_fetch(dbc, dbc->exec_db, dbc->xsum_db, executable, rollup);
+}
+
+int db_file_rollup(dbref_t dbc, const char* filepath, fusg_rollup_t* rollup)
+{
+	return __db_rollup_fetch(dbc, dbc->file_db, dbc->fsum_db, filepath, rollup);
+}
+
 
 int db_fusg_stats_first(dbref_t dbc, fusg_stats_iterator_t* iterator)
 {
@@ -503,6 +1143,38 @@ int db_file_get_file(dbref_t dbc, uint64_t key_long, char* buffer, size_t size)
 
 
 
+int db_file_get_aliases(dbref_t dbc, uint64_t key_long, char* buffer, size_t size)
+{
+	int rc = 0;
+	if (size < 1) return -1;
+	buffer[0] = '\0';
+	if (!dbc->alis_db) return 0;
+
+	db_lock(dbc);
+	datum result = gdbm_fetch(dbc->alis_db, db_datum_long(&key_long));
+	if (result.dptr)
+	{
+		if ((size_t)result.dsize + 1 > size)
+		{
+			rc = -1;
+		}
+		else
+		{
+			memcpy(buffer, result.dptr, result.dsize);
+			buffer[result.dsize] = '\0';
+			for (int i = 0; i < result.dsize; i++) rc += (result.dptr[i] == '\0');
+		}
+		free(result.dptr);
+	}
+	else if (__db_check_expected_notfound())
+	{
+		rc = -1;
+	}
+	db_unlock(dbc);
+	return rc;
+}
+
+
 uint64_t db_file_get_id(dbref_t dbc, const char* filepath)
 {
 	uint64_t id;
@@ -617,13 +1289,19 @@ int __db_check_expected_notfound(void)
 }
 
 static inline
-int __db_get_fusg_key(dbref_t dbc, const char* executable, const char* filepath, fusg_stats_key_t* evnt_key)
+int __db_get_fusg_key(dbref_t dbc, const char* executable, const char* filepath,
+		const fusg_inode_t* inode, fusg_stats_key_t* evnt_key)
 {
 	int rc = 0;
 	rc = __db_get_or_create_unique_id(dbc, dbc->exec_db, executable, &evnt_key->exec_id);
 	if (rc != 0) goto bail;
 	rc = __db_store_long_str(dbc->execr_db, evnt_key->exec_id, executable);
 	if (rc != 0) goto bail;
+	if (inode)
+	{
+		rc = __db_get_file_id(dbc, filepath, inode, &evnt_key->file_id);
+		goto bail;
+	}
 	rc = __db_get_or_create_unique_id(dbc, dbc->file_db, filepath, &evnt_key->file_id);
 	if (rc != 0) goto bail;
 	rc = __db_store_long_str(dbc->filer_db, evnt_key->file_id, filepath);
@@ -631,13 +1309,159 @@ bail:
 	return rc;
 }
 
+
 static inline
-fusg_stats_t* __db_evnt_fetch(dbref_t dbc, fusg_stats_key_t* evnt_key, fusg_stats_t* evnt_val)
+datum __db_datum_inode(const fusg_inode_t* value)
 {
-	datum key = __db_datum_evnt_key(evnt_key);
-	datum result = gdbm_fetch(dbc->evnt_db, key);
-	if (result.dptr)
-	{
+	datum d;
+	d.dptr = (char*)value;
+	d.dsize = sizeof(fusg_inode_t);
+	return d;
+}
+
+/**
+ * @return id of the file with the given inode or NULL if there is none
+ */
+static inline
+uint64_t* __db_inode_fetch(dbref_t dbc, const fusg_inode_t* inode, uint64_t* id)
+{
+	datum result = gdbm_fetch(dbc->inod_db, __db_datum_inode(inode));
+	if (result.dptr)
+	{
+		assert(result.dsize == sizeof(uint64_t));
+		*id = *((uint64_t*)result.dptr);
+		free(result.dptr);
+		return id;
+	}
+	else
+	{
+		__db_check_expected_notfound();
+		return NULL;
+	}
+}
+
+static inline
+int __db_inode_store(dbref_t dbc, const fusg_inode_t* inode, uint64_t id)
+{
+	return __db_store(dbc->inod_db, __db_datum_inode(inode), db_datum_long(&id));
+}
+
+static inline
+int __db_inode_release(dbref_t dbc, const fusg_inode_t* inode, uint64_t id)
+{
+	uint64_t owner;
+	if (!__db_inode_fetch(dbc, inode, &owner))
+	{
+		return __db_check_expected_notfound();
+	}
+	if (owner != id) return 0;
+	if (gdbm_delete(dbc->inod_db, __db_datum_inode(inode)))
+	{
+		return __db_check_expected_notfound();
+	}
+	return 0;
+}
+
+/**
+ * Appends a path to the aliases of a file.
+ */
+static inline
+int __db_alias_add(dbref_t dbc, uint64_t id, const char* filepath)
+{
+	datum key = db_datum_long(&id);
+	datum list = gdbm_fetch(dbc->alis_db, key);
+	if (!list.dptr && __db_check_expected_notfound()) return -1;
+
+	size_t len = strlen(filepath) + 1;
+	datum content;
+	content.dsize = list.dsize + len;
+	content.dptr = malloc(content.dsize);
+	if (!content.dptr)
+	{
+		free(list.dptr);
+		log_error("db: out of memory");
+		return -1;
+	}
+	if (list.dptr) memcpy(content.dptr, list.dptr, list.dsize);
+	memcpy(content.dptr + list.dsize, filepath, len);
+	int rc = __db_store(dbc->alis_db, key, content);
+	free(list.dptr);
+	free(content.dptr);
+	return rc;
+}
+
+/**
+ * @return 1 if the file id was not pruned, 0 otherwise
+ */
+static inline
+int __db_file_exists(dbref_t dbc, uint64_t id)
+{
+	return gdbm_exists(dbc->filer_db, db_datum_long(&id));
+}
+
+/**
+ * Like __db_get_or_create_unique_id() for file_db, but by path
+ * or by inode: a path keeps its id, an unknown path of a known
+ * inode becomes an alias of its file.
+ */
+static inline
+int __db_get_file_id(dbref_t dbc, const char* filepath, const fusg_inode_t* inode, uint64_t* id)
+{
+	uint64_t owner;
+	if (__db_fetch_str_long(dbc->file_db, filepath, id))
+	{
+		// known path: a new inode (e.g. replaced on save) is still the same file
+		if (__db_inode_fetch(dbc, inode, &owner))
+		{
+			// unless the inode belongs to a pruned file
+			if (__db_file_exists(dbc, owner)) return 0;
+		}
+		else if (__db_check_expected_notfound()) return -1;
+		return __db_inode_store(dbc, inode, *id);
+	}
+	if (__db_check_expected_notfound()) return -1;
+
+	if (__db_inode_fetch(dbc, inode, id))
+	{
+		// another path of a known file: hard link, rename target, ...
+		if (__db_file_exists(dbc, *id))
+		{
+			if (__db_store_str_long(dbc->file_db, filepath, *id)) return -1;
+			return __db_alias_add(dbc, *id, filepath);
+		}
+		// ... or the inode of a pruned file
+	}
+	else if (__db_check_expected_notfound()) return -1;
+
+	// new file
+	if (__db_id_next(dbc, id)) return -1;
+	if (__db_store_str_long(dbc->file_db, filepath, *id)) return -1;
+	if (__db_store_long_str(dbc->filer_db, *id, filepath)) return -1;
+	return __db_inode_store(dbc, inode, *id);
+}
+
+/**
+ * Like __db_get_fusg_key() but without creating missing ids.
+ * @return 0 if found, 1 if not found and -1 on error
+ */
+static inline
+int __db_find_fusg_key(dbref_t dbc, const char* executable, const char* filepath, fusg_stats_key_t* evnt_key)
+{
+	if (!__db_fetch_str_long(dbc->exec_db, executable, &evnt_key->exec_id)
+			|| !__db_fetch_str_long(dbc->file_db, filepath, &evnt_key->file_id))
+	{
+		return (gdbm_errno == GDBM_ITEM_NOT_FOUND) ? 1 : -1;
+	}
+	return 0;
+}
+
+static inline
+fusg_stats_t* __db_evnt_fetch(dbref_t dbc, fusg_stats_key_t* evnt_key, fusg_stats_t* evnt_val)
+{
+	datum key = __db_datum_evnt_key(evnt_key);
+	datum result = gdbm_fetch(dbc->evnt_db, key);
+	if (result.dptr)
+	{
 		assert(result.dsize == sizeof(fusg_stats_t));
 		*evnt_val = *((fusg_stats_t*)result.dptr);
 		free(result.dptr);
@@ -664,6 +1488,147 @@ int __db_evnt_store(dbref_t dbc, fusg_stats_key_t* evnt_key, fusg_stats_t* evnt_
 
 
 
+/**
+ * Applies delta to the rollup of key: counters get summed up, time
+ * stamps keep their maximum. entries is the change of the number of
+ * entries, records reaching 0 get removed.
+ * @param sign 1 to add, -1 to subtract delta
+ * @return 0 on success, 1 if the record was removed and -1 on error
+ */
+static inline
+int __db_rollup_apply(GDBM_FILE sum_db, datum key, const fusg_stats_t* delta, int entries, int sign)
+{
+	fusg_rollup_t rollup;
+	datum result = gdbm_fetch(sum_db, key);
+	if (result.dptr)
+	{
+		assert(result.dsize == sizeof(fusg_rollup_t));
+		memcpy(&rollup, result.dptr, sizeof(fusg_rollup_t));
+		free(result.dptr);
+	}
+	else if (__db_check_expected_notfound())
+	{
+		return -1;
+	}
+	else
+	{
+		memset(&rollup, 0, sizeof(fusg_rollup_t));
+	}
+
+	if (sign < 0)
+	{
+		// removing more than there is means the rollup was off already
+		if (rollup.entries <= (uint64_t)entries)
+		{
+			if (gdbm_delete(sum_db, key)) return __db_check_expected_notfound();
+			return 1;
+		}
+		rollup.entries -= entries;
+		rollup.stats.read   -= (rollup.stats.read   < delta->read)   ? rollup.stats.read   : delta->read;
+		rollup.stats.write  -= (rollup.stats.write  < delta->write)  ? rollup.stats.write  : delta->write;
+		rollup.stats.create -= (rollup.stats.create < delta->create) ? rollup.stats.create : delta->create;
+		rollup.stats.exec   -= (rollup.stats.exec   < delta->exec)   ? rollup.stats.exec   : delta->exec;
+	}
+	else
+	{
+		rollup.entries += entries;
+		fugs_stats_add(&rollup.stats, delta);
+		if (delta->deleted > rollup.stats.deleted) rollup.stats.deleted = delta->deleted;
+	}
+	datum content = { (char*)&rollup, sizeof(fusg_rollup_t) };
+	return gdbm_store(sum_db, key, content, GDBM_REPLACE);
+}
+
+/**
+ * Adds delta to the rollups of executable and file of key.
+ * @param entries 1 if the entry was created, 0 otherwise
+ */
+static inline
+int __db_rollup_update(dbref_t dbc, const fusg_stats_key_t* key,
+		const fusg_stats_t* delta, int entries)
+{
+	if (!dbc->xsum_db || !dbc->fsum_db) return 0;
+	uint64_t exec_id = key->exec_id;
+	uint64_t file_id = key->file_id;
+	if (__db_rollup_apply(dbc->xsum_db, db_datum_long(&exec_id), delta, entries, 1)) return -1;
+	return __db_rollup_apply(dbc->fsum_db, db_datum_long(&file_id), delta, entries, 1);
+}
+
+/**
+ * Builds the rollups of a db, which had none so far.
+ * @return 0 on success -1 otherwise
+ */
+static int __db_rollup_build(dbref_t dbc)
+{
+	log_info("db: building rollups of executables and files");
+	int rc = 0;
+	uint64_t entries = 0;
+	datum key = gdbm_firstkey(dbc->evnt_db);
+	if (!key.dptr && __db_check_expected_notfound()) rc = -1;
+	while (key.dptr && !rc)
+	{
+		fusg_stats_key_t evnt_key;
+		fusg_stats_t evnt_val;
+		if (key.dsize == sizeof(fusg_stats_key_t))
+		{
+			memcpy(&evnt_key, key.dptr, sizeof(evnt_key));
+			if (__db_evnt_fetch(dbc, &evnt_key, &evnt_val))
+			{
+				rc = __db_rollup_update(dbc, &evnt_key, &evnt_val, 1);
+				entries++;
+			}
+		}
+		datum next = gdbm_nextkey(dbc->evnt_db, key);
+		if (!next.dptr && __db_check_expected_notfound()) rc = -1;
+		free(key.dptr);
+		key = next;
+	}
+	free(key.dptr);
+	if (!rc) rc = __db_store_str_long(dbc->idtb_db, DB_ROLLUP_ENTRY, 1);
+	if (rc)
+	{
+		__db_perror("building rollups");
+		return -1;
+	}
+	log_info("db: rollups built from %lu entries", entries);
+	__db_sync(dbc);
+	return 0;
+}
+
+
+
+/**
+ * Marks the db dirty after updates of about the given size.
+ */
+static inline
+void __db_touch(dbref_t dbc, uint64_t updates, uint64_t bytes)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	if (!dbc->dirty_stats.first_ns) dbc->dirty_stats.first_ns = now_ns;
+	dbc->dirty_stats.last_ns = now_ns;
+	dbc->dirty_stats.updates += updates;
+	dbc->dirty_stats.bytes += bytes;
+	dbc->dirty = 1;
+	dbc->snap_dirty = 1;
+}
+
+/**
+ * @return size of the records written by an update of an entry,
+ *         not counting new ids and directory rollups
+ */
+static inline
+uint64_t __db_update_size(dbref_t dbc)
+{
+	uint64_t size = sizeof(fusg_stats_key_t) + sizeof(fusg_stats_t);
+	if (dbc->xsum_db) size += sizeof(uint64_t) + sizeof(fusg_rollup_t);
+	if (dbc->fsum_db) size += sizeof(uint64_t) + sizeof(fusg_rollup_t);
+	return size;
+}
+
+
+
 void __db_perror(const char* context) {
 	log_error("db-error: %s (errno: %s)", context, gdbm_strerror(gdbm_errno));
 }
@@ -800,3 +1765,995 @@ int __db_id_next(dbref_t dbc, uint64_t* next)
 	}
 }
 
+
+
+/**
+ * Determines the directory of the currently published snapshot.
+ * @return 0 if there is one and -1 otherwise
+ */
+static
+int __db_snapshot_resolve(const char* dbpath, char* snappath)
+{
+	char linkpath[PATH_MAX];
+	snprintf(linkpath, PATH_MAX, "%s/%s", dbpath, DB_SNAP_LINK);
+
+	// pins the generation: the link may be replaced
+	// while we are opening its files.
+	if (!realpath(linkpath, snappath)) return -1;
+
+	char pathbuf[PATH_MAX + NAME_MAX + 2];
+	for (const char* const* f = __db_files; *f; f++)
+	{
+		sprintf(pathbuf, "%s/%s", snappath, *f);
+		if (!fexists(pathbuf)) return -1;
+	}
+	return 0;
+}
+
+/**
+ * @return generation of the currently published snapshot or 0
+ */
+static
+uint64_t __db_snapshot_generation(const char* dbpath)
+{
+	char linkpath[PATH_MAX];
+	char target[NAME_MAX+1];
+	unsigned long gen = 0;
+
+	snprintf(linkpath, PATH_MAX, "%s/%s", dbpath, DB_SNAP_LINK);
+	ssize_t len = readlink(linkpath, target, NAME_MAX);
+	if (len > 0)
+	{
+		target[len] = '\0';
+		if (1 != sscanf(target, DB_SNAP_PREFIX "%lu", &gen)) gen = 0;
+	}
+	return gen;
+}
+
+/**
+ * Removes the published snapshot, so readers go back to the live db.
+ */
+static
+int __db_snapshot_withdraw(const char* dbpath)
+{
+	char linkpath[PATH_MAX];
+	snprintf(linkpath, PATH_MAX, "%s/%s", dbpath, DB_SNAP_LINK);
+	if (unlink(linkpath) && errno != ENOENT)
+	{
+		log_error("db_open: can't withdraw snapshot '%s': %s", linkpath, strerror(errno));
+		return -1;
+	}
+	return __db_snapshot_cleanup(dbpath, 0);
+}
+
+/**
+ * Removes all snapshot generations except for keep_gen, its predecessor
+ * and those superseded less than DB_SNAP_GRACE seconds ago. A reader may
+ * have resolved one of them, but not yet opened its files.
+ */
+static
+int __db_snapshot_cleanup(const char* dbpath, uint64_t keep_gen)
+{
+	DIR* dir = opendir(dbpath);
+	if (!dir) return -1;
+
+	char pathbuf[PATH_MAX];
+	unsigned long gen;
+	time_t now = time(NULL);
+	struct stat st;
+	for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir))
+	{
+		if (1 != sscanf(entry->d_name, DB_SNAP_PREFIX "%lu", &gen)) continue;
+		if (keep_gen && (gen == keep_gen || gen + 1 == keep_gen)) continue;
+		if (keep_gen && gen < keep_gen)
+		{
+			// superseded when its successor got written
+			snprintf(pathbuf, PATH_MAX, "%s/%s%lu", dbpath, DB_SNAP_PREFIX, gen + 1);
+			if (!stat(pathbuf, &st) && now - st.st_mtime < DB_SNAP_GRACE) continue;
+		}
+
+		snprintf(pathbuf, PATH_MAX, "%s/%s", dbpath, entry->d_name);
+		if (fremove_r(pathbuf)) log_warn("removing '%s': %s", pathbuf, strerror(errno));
+	}
+	closedir(dir);
+	return 0;
+}
+
+/**
+ * Copies src to dst, using a copy-on-write clone where possible.
+ * @param cloned set to 0 if the data had to be copied
+ */
+static
+int __db_copy_file(const char* src, const char* dst, int* cloned)
+{
+	int rc = -1;
+	int dfd = -1;
+	int sfd = open(src, O_RDONLY);
+	if (sfd == -1) goto bail;
+	dfd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (dfd == -1) goto bail;
+
+	if (0 == ioctl(dfd, FICLONE, sfd))
+	{
+		rc = 0;
+		goto bail;
+	}
+
+	// no reflinks: copy in kernel, if possible
+	*cloned = 0;
+	ssize_t n;
+	do n = copy_file_range(sfd, NULL, dfd, NULL, 1<<30, 0);
+	while (n > 0);
+
+	if (n == -1 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL))
+	{
+		char buf[1<<16];
+		if (lseek(sfd, 0, SEEK_SET) || ftruncate(dfd, 0) || lseek(dfd, 0, SEEK_SET)) goto bail;
+		while ((n = read(sfd, buf, sizeof(buf))) > 0)
+		{
+			if (write(dfd, buf, n) != n)
+			{
+				n = -1;
+				break;
+			}
+		}
+	}
+	rc = (n == 0) ? 0 : -1;
+bail:
+	if (rc) log_error("db_snapshot: copy '%s' -> '%s': %s", src, dst, strerror(errno));
+	if (sfd != -1) close(sfd);
+	if (dfd != -1) close(dfd);
+	return rc;
+}
+
+
+
+/*
+ * Pruning (see db_prune_begin())
+ */
+
+/** initial guess of the throughput of gdbm_reorganize() [bytes/s] */
+#define DB_REORG_RATE_DEFAULT (64.0 * 1024 * 1024)
+/** files smaller than this are too small to measure the throughput */
+#define DB_REORG_RATE_MIN_SIZE (1024 * 1024)
+
+typedef enum {
+	PRUNE_EXPIRED,
+	PRUNE_DELETED,
+	PRUNE_IDS,
+	PRUNE_REORGANISE,
+	PRUNE_DONE,
+} __db_prune_phase_t;
+
+/** what pruning knows about a file or an executable */
+typedef struct {
+	/** id + 1, 0: free slot */
+	uint64_t slot_id;
+	/** latest update of its entries */
+	uint64_t time;
+	/** latest deletion of the file */
+	uint64_t deleted;
+	/** has entries left or was updated while pruning */
+	int keep;
+	/** its path is missing */
+	int unknown;
+} __db_prune_node_t;
+
+/** open addressing hash table of nodes by id */
+typedef struct {
+	size_t mask;
+	size_t used;
+	__db_prune_node_t* nodes;
+} __db_prune_nodes_t;
+
+/** the db files, in the order they get reorganised (smallest first, usually) */
+typedef enum {
+	PRUNE_ALIS, PRUNE_INOD, PRUNE_XSUM, PRUNE_EXER, PRUNE_EXEC,
+	PRUNE_FSUM, PRUNE_FILR, PRUNE_FILE, PRUNE_DSUM, PRUNE_EVNT,
+	PRUNE_DB_FILES
+} __db_prune_file_t;
+
+typedef struct __db_prune_t {
+	db_retention_t retention;
+	__db_prune_phase_t phase;
+	/** next key to visit in evnt_db, dptr NULL: pass done */
+	datum cursor;
+	__db_prune_nodes_t files;
+	__db_prune_nodes_t execs;
+	/** next slot to check in phase PRUNE_IDS, files first */
+	size_t slot;
+	/** next db file to reorganise */
+	int reorg;
+	/** records removed per db file */
+	uint64_t removed[PRUNE_DB_FILES];
+	/** entries to drop in the current step */
+	fusg_stats_key_t* drops;
+	int num_drops;
+	int cap_drops;
+} __db_prune_t;
+
+
+static inline
+uint64_t __db_prune_hash(uint64_t x)
+{
+	// splitmix64 finaliser
+	x ^= x >> 30; x *= 0xbf58476d1ce4e5b9UL;
+	x ^= x >> 27; x *= 0x94d049bb133111ebUL;
+	x ^= x >> 31;
+	return x;
+}
+
+static int __db_prune_nodes_init(__db_prune_nodes_t* t, size_t cap)
+{
+	t->mask = cap - 1;
+	t->used = 0;
+	t->nodes = calloc(cap, sizeof(__db_prune_node_t));
+	return t->nodes ? 0 : -1;
+}
+
+/**
+ * @return node of the id or NULL if there is none
+ */
+static __db_prune_node_t* __db_prune_nodes_find(__db_prune_nodes_t* t, uint64_t id)
+{
+	for (size_t i = __db_prune_hash(id) & t->mask; t->nodes[i].slot_id; i = (i + 1) & t->mask)
+	{
+		if (t->nodes[i].slot_id == id + 1) return &t->nodes[i];
+	}
+	return NULL;
+}
+
+/**
+ * @param created set to 1 if the node is new
+ * @return node of the id, NULL if out of memory
+ */
+static __db_prune_node_t* __db_prune_nodes_get(__db_prune_nodes_t* t, uint64_t id, int* created)
+{
+	*created = 0;
+	__db_prune_node_t* node = __db_prune_nodes_find(t, id);
+	if (node) return node;
+
+	if ((t->used + 1) * 2 > t->mask + 1)
+	{
+		// grow at 50% load
+		__db_prune_nodes_t n;
+		if (__db_prune_nodes_init(&n, (t->mask + 1) * 2)) return NULL;
+		for (size_t i = 0; i <= t->mask; i++)
+		{
+			if (!t->nodes[i].slot_id) continue;
+			size_t k;
+			for (k = __db_prune_hash(t->nodes[i].slot_id - 1) & n.mask; n.nodes[k].slot_id; k = (k + 1) & n.mask);
+			n.nodes[k] = t->nodes[i];
+		}
+		n.used = t->used;
+		free(t->nodes);
+		*t = n;
+	}
+	size_t i;
+	for (i = __db_prune_hash(id) & t->mask; t->nodes[i].slot_id; i = (i + 1) & t->mask);
+	t->nodes[i].slot_id = id + 1;
+	t->used++;
+	*created = 1;
+	return &t->nodes[i];
+}
+
+
+/**
+ * Files and executables updated while pruning are kept.
+ */
+static void __db_prune_touch(dbref_t dbc, const fusg_stats_key_t* key)
+{
+	__db_prune_node_t* node = __db_prune_nodes_find(&dbc->prune->files, key->file_id);
+	if (node) node->keep = 1;
+	node = __db_prune_nodes_find(&dbc->prune->execs, key->exec_id);
+	if (node) node->keep = 1;
+}
+
+
+int db_prune_begin(dbref_t dbc, const db_retention_t* retention)
+{
+	if (!(dbc->open_flags & DB_WRITE) || dbc->prune)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	__db_prune_t* p = calloc(1, sizeof(__db_prune_t));
+	if (!p || __db_prune_nodes_init(&p->files, 1<<12) || __db_prune_nodes_init(&p->execs, 1<<8))
+	{
+		log_error("db_prune_begin: out of memory");
+		if (p)
+		{
+			free(p->files.nodes);
+			free(p);
+		}
+		return -1;
+	}
+	p->retention = *retention;
+	p->phase = PRUNE_EXPIRED;
+
+	db_lock(dbc);
+	p->cursor = gdbm_firstkey(dbc->evnt_db);
+	db_unlock(dbc);
+	dbc->prune = p;
+	return 0;
+}
+
+int db_prune_active(dbref_t dbc)
+{
+	return dbc->prune != NULL;
+}
+
+void db_prune_abort(dbref_t dbc)
+{
+	__db_prune_t* p = dbc->prune;
+	if (!p) return;
+	free(p->cursor.dptr);
+	free(p->files.nodes);
+	free(p->execs.nodes);
+	free(p->drops);
+	free(p);
+	dbc->prune = NULL;
+}
+
+
+static int __db_prune_drop(__db_prune_t* p, const fusg_stats_key_t* key)
+{
+	if (p->num_drops == p->cap_drops)
+	{
+		int cap = p->cap_drops ? p->cap_drops * 2 : 256;
+		fusg_stats_key_t* d = realloc(p->drops, cap * sizeof(fusg_stats_key_t));
+		if (!d) return -1;
+		p->drops = d;
+		p->cap_drops = cap;
+	}
+	p->drops[p->num_drops++] = *key;
+	return 0;
+}
+
+/**
+ * Looks up the node of an id and checks on first sight, whether the
+ * id is known (reverse_db).
+ */
+static __db_prune_node_t* __db_prune_node(__db_prune_nodes_t* t, GDBM_FILE reverse_db, uint64_t id)
+{
+	int created;
+	__db_prune_node_t* node = __db_prune_nodes_get(t, id, &created);
+	if (node && created) node->unknown = !gdbm_exists(reverse_db, db_datum_long(&id));
+	return node;
+}
+
+/**
+ * Visits the entry of key in phase PRUNE_EXPIRED or PRUNE_DELETED.
+ * @return 0 on success -1 otherwise
+ */
+static int __db_prune_visit(dbref_t dbc, __db_prune_t* p, datum key)
+{
+	if (key.dsize != sizeof(fusg_stats_key_t)) return 0;
+	fusg_stats_key_t evnt_key;
+	fusg_stats_t evnt_val;
+	memcpy(&evnt_key, key.dptr, sizeof(evnt_key));
+	if (!__db_evnt_fetch(dbc, &evnt_key, &evnt_val)) return 0;
+
+	if (p->phase == PRUNE_EXPIRED)
+	{
+		__db_prune_node_t* file = __db_prune_node(&p->files, dbc->filer_db, evnt_key.file_id);
+		__db_prune_node_t* exec = __db_prune_node(&p->execs, dbc->execr_db, evnt_key.exec_id);
+		if (!file || !exec) return -1;
+
+		if (file->unknown || exec->unknown
+				|| evnt_val.time < p->retention.expire_before)
+		{
+			return __db_prune_drop(p, &evnt_key);
+		}
+		if (evnt_val.time > file->time) file->time = evnt_val.time;
+		if (evnt_val.deleted > file->deleted) file->deleted = evnt_val.deleted;
+		return 0;
+	}
+
+	// PRUNE_DELETED: entries added meanwhile have no nodes
+	__db_prune_node_t* file = __db_prune_nodes_find(&p->files, evnt_key.file_id);
+	__db_prune_node_t* exec = __db_prune_nodes_find(&p->execs, evnt_key.exec_id);
+	if (evnt_val.time < p->retention.expire_before)
+	{
+		// skipped by the first pass
+		if (!__db_prune_node(&p->files, dbc->filer_db, evnt_key.file_id)
+				|| !__db_prune_node(&p->execs, dbc->execr_db, evnt_key.exec_id))
+		{
+			return -1;
+		}
+		return __db_prune_drop(p, &evnt_key);
+	}
+	if (file && file->deleted
+			&& file->deleted >= file->time
+			&& file->deleted < p->retention.deleted_before
+			&& evnt_val.time <= file->deleted)
+	{
+		return __db_prune_drop(p, &evnt_key);
+	}
+	if (file) file->keep = 1;
+	if (exec) exec->keep = 1;
+	return 0;
+}
+
+/**
+ * Walks through the next max_work entries.
+ * @return 1 if there are more, 0 at the end and -1 on error
+ */
+static int __db_prune_pass(dbref_t dbc, __db_prune_t* p, int max_work,
+		db_prune_visitor_t dropped, void* ctx, db_prune_stats_t* stats)
+{
+	int rc = 0;
+	p->num_drops = 0;
+	for (int work = 0; p->cursor.dptr && work < max_work && !rc; work++)
+	{
+		datum key = p->cursor;
+		// advance first: dropped keys must not be the cursor
+		p->cursor = gdbm_nextkey(dbc->evnt_db, key);
+		if (!p->cursor.dptr && __db_check_expected_notfound()) rc = -1;
+		if (!rc) rc = __db_prune_visit(dbc, p, key);
+		free(key.dptr);
+	}
+
+	if (p->num_drops) rc = __db_dirs_mark(dbc);
+	for (int i = 0; i < p->num_drops && !rc; i++)
+	{
+		fusg_stats_t evnt_val;
+		if (!__db_evnt_fetch(dbc, &p->drops[i], &evnt_val)
+				|| gdbm_delete(dbc->evnt_db, __db_datum_evnt_key(&p->drops[i])))
+		{
+			if (__db_check_expected_notfound()) rc = -1;
+			continue;
+		}
+		p->removed[PRUNE_EVNT]++;
+		int removed;
+		if (dbc->xsum_db && dbc->fsum_db)
+		{
+			removed = __db_rollup_apply(dbc->xsum_db, db_datum_long(&p->drops[i].exec_id), &evnt_val, 1, -1);
+			if (removed >= 0) p->removed[PRUNE_XSUM] += removed;
+			else rc = -1;
+			removed = rc ? -1 : __db_rollup_apply(dbc->fsum_db, db_datum_long(&p->drops[i].file_id), &evnt_val, 1, -1);
+			if (removed >= 0) p->removed[PRUNE_FSUM] += removed;
+			else rc = -1;
+		}
+		removed = rc ? -1 : __db_dirs_update(dbc, NULL, p->drops[i].file_id, &evnt_val, 1, -1);
+		if (removed >= 0) p->removed[PRUNE_DSUM] += removed;
+		else rc = -1;
+		if (stats) stats->entries++;
+		if (dropped) dropped(ctx, &p->drops[i]);
+	}
+	if (p->num_drops) __db_touch(dbc, p->num_drops, p->num_drops * __db_update_size(dbc));
+	if (rc) return -1;
+	return p->cursor.dptr ? 1 : 0;
+}
+
+/**
+ * Deletes key from path_db, if it still refers to id.
+ */
+static int __db_prune_path(GDBM_FILE path_db, datum key, uint64_t id)
+{
+	datum result = gdbm_fetch(path_db, key);
+	if (!result.dptr) return __db_check_expected_notfound();
+	int owned = (result.dsize == sizeof(uint64_t) && !memcmp(result.dptr, &id, sizeof(id)));
+	free(result.dptr);
+	if (owned && gdbm_delete(path_db, key)) return __db_check_expected_notfound();
+	return owned;
+}
+
+/**
+ * Removes the path, the aliases and the id of a file or executable.
+ * @return number of records removed or -1 on error
+ */
+static int __db_prune_id(dbref_t dbc, __db_prune_t* p, GDBM_FILE path_db, GDBM_FILE reverse_db,
+		GDBM_FILE alias_db, __db_prune_file_t path_file, __db_prune_file_t reverse_file, uint64_t id)
+{
+	int rc;
+	int removed = 0;
+	datum key = db_datum_long(&id);
+
+	datum path = gdbm_fetch(reverse_db, key);
+	if (!path.dptr) return __db_check_expected_notfound();
+	rc = __db_prune_path(path_db, path, id);
+	free(path.dptr);
+	if (rc < 0) return -1;
+	p->removed[path_file] += rc;
+	removed += rc;
+
+	datum aliases = alias_db ? gdbm_fetch(alias_db, key) : (datum){ NULL, 0 };
+	if (aliases.dptr)
+	{
+		for (int i = 0; i < aliases.dsize && rc >= 0; )
+		{
+			datum alias = db_datum_str(aliases.dptr + i);
+			rc = __db_prune_path(path_db, alias, id);
+			p->removed[path_file] += (rc > 0);
+			removed += (rc > 0);
+			i += alias.dsize;
+		}
+		free(aliases.dptr);
+		if (rc < 0) return -1;
+		if (gdbm_delete(alias_db, key)) return __db_check_expected_notfound();
+		p->removed[PRUNE_ALIS]++;
+		removed++;
+	}
+	else if (alias_db && __db_check_expected_notfound()) return -1;
+
+	if (gdbm_delete(reverse_db, key)) return __db_check_expected_notfound();
+	p->removed[reverse_file]++;
+	return removed + 1;
+}
+
+/**
+ * Checks the rollup of id for entries left. The passes may have missed
+ * some: gdbm skips keys, while others get added or removed. Without
+ * rollups (never with DB_WRITE) the id counts as used.
+ * @return 1 if id has entries, 0 if not and -1 on error
+ */
+static int __db_prune_used(GDBM_FILE sum_db, uint64_t id)
+{
+	if (!sum_db) return 1;
+	datum result = gdbm_fetch(sum_db, db_datum_long(&id));
+	if (!result.dptr) return __db_check_expected_notfound();
+	free(result.dptr);
+	return 1;
+}
+
+/**
+ * Removes files and executables without entries, max_work records at most.
+ * @return 1 if there are more, 0 at the end and -1 on error
+ */
+static int __db_prune_ids(dbref_t dbc, __db_prune_t* p, int max_work, db_prune_stats_t* stats)
+{
+	int work = 0;
+	size_t num_files = p->files.mask + 1;
+	size_t num_slots = num_files + p->execs.mask + 1;
+	for (; p->slot < num_slots && work < max_work; p->slot++)
+	{
+		int is_file = p->slot < num_files;
+		__db_prune_node_t* node = is_file
+				? &p->files.nodes[p->slot]
+				: &p->execs.nodes[p->slot - num_files];
+		if (!node->slot_id || node->keep || node->unknown) continue;
+
+		uint64_t id = node->slot_id - 1;
+		int used = __db_prune_used(is_file ? dbc->fsum_db : dbc->xsum_db, id);
+		if (used < 0) return -1;
+		if (used) continue;
+		int removed = is_file
+				? __db_prune_id(dbc, p, dbc->file_db, dbc->filer_db, dbc->alis_db, PRUNE_FILE, PRUNE_FILR, id)
+				: __db_prune_id(dbc, p, dbc->exec_db, dbc->execr_db, NULL, PRUNE_EXEC, PRUNE_EXER, id);
+		if (removed < 0) return -1;
+		work += removed;
+		if (removed && stats)
+		{
+			if (is_file) stats->files++;
+			else stats->execs++;
+		}
+		__db_touch(dbc, removed, 0);
+	}
+	return p->slot < num_slots ? 1 : 0;
+}
+
+/**
+ * Reorganises the next db file, which had records removed and
+ * is expected to be done within max_pause_ms.
+ * @return 1 if there are more, 0 at the end and -1 on error
+ */
+static int __db_prune_reorganise(dbref_t dbc, __db_prune_t* p, int max_pause_ms, db_prune_stats_t* stats)
+{
+	const struct {
+		const char* name;
+		GDBM_FILE dbf;
+	} files[PRUNE_DB_FILES] = {
+		[PRUNE_ALIS] = { DB_FILE_ALIS, dbc->alis_db },
+		[PRUNE_INOD] = { DB_FILE_INOD, dbc->inod_db },
+		[PRUNE_XSUM] = { DB_FILE_XSUM, dbc->xsum_db },
+		[PRUNE_EXER] = { DB_FILE_EXER, dbc->execr_db },
+		[PRUNE_EXEC] = { DB_FILE_EXEC, dbc->exec_db },
+		[PRUNE_FSUM] = { DB_FILE_FSUM, dbc->fsum_db },
+		[PRUNE_FILR] = { DB_FILE_FILR, dbc->filer_db },
+		[PRUNE_FILE] = { DB_FILE_FILE, dbc->file_db },
+		[PRUNE_DSUM] = { DB_FILE_DSUM, dbc->dsum_db },
+		[PRUNE_EVNT] = { DB_FILE_EVNT, dbc->evnt_db },
+	};
+
+	for (; p->reorg < PRUNE_DB_FILES; p->reorg++)
+	{
+		GDBM_FILE dbf = files[p->reorg].dbf;
+		if (!dbf || !p->removed[p->reorg] || max_pause_ms <= 0) continue;
+
+		struct stat st;
+		if (fstat(gdbm_fdesc(dbf), &st)) continue;
+		double estimate = st.st_size / dbc->reorg_rate;
+		if (estimate * 1000 > max_pause_ms)
+		{
+			log_info("db: %s not reorganised (%ld bytes, about %.0f ms), its free space gets reused",
+					files[p->reorg].name, st.st_size, estimate * 1000);
+			continue;
+		}
+
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (gdbm_reorganize(dbf))
+		{
+			__db_perror("gdbm_reorganize");
+			return -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		if (st.st_size >= DB_REORG_RATE_MIN_SIZE && seconds > 0) dbc->reorg_rate = st.st_size / seconds;
+
+		off_t size = st.st_size;
+		if (fstat(gdbm_fdesc(dbf), &st)) st.st_size = size;
+		log_info("db: %s reorganised in %.0f ms, %ld -> %ld bytes",
+				files[p->reorg].name, seconds * 1000, size, st.st_size);
+		if (stats)
+		{
+			stats->reorganised++;
+			stats->reclaimed += size - st.st_size;
+		}
+		__db_touch(dbc, 1, st.st_size);
+		// one file per step
+		p->reorg++;
+		break;
+	}
+	return p->reorg < PRUNE_DB_FILES ? 1 : 0;
+}
+
+
+int db_prune_step(dbref_t dbc, int max_work, int max_pause_ms,
+		db_prune_visitor_t dropped, void* ctx, db_prune_stats_t* stats)
+{
+	__db_prune_t* p = dbc->prune;
+	if (!p) return 0;
+	if (!dbc->reorg_rate) dbc->reorg_rate = DB_REORG_RATE_DEFAULT;
+
+	db_lock(dbc);
+	// pending deltas may belong to entries about to be dropped
+	int rc = __db_dirs_write(dbc);
+	if (rc) p->phase = PRUNE_DONE;
+	switch (p->phase)
+	{
+	case PRUNE_EXPIRED:
+	case PRUNE_DELETED:
+		rc = __db_prune_pass(dbc, p, max_work, dropped, ctx, stats);
+		if (rc == 0 && p->phase == PRUNE_EXPIRED)
+		{
+			// second pass: entries of deleted files and what is left
+			p->phase = PRUNE_DELETED;
+			p->cursor = gdbm_firstkey(dbc->evnt_db);
+			if (!p->cursor.dptr && __db_check_expected_notfound()) rc = -1;
+			else rc = 1;
+		}
+		else if (rc == 0)
+		{
+			p->phase = PRUNE_IDS;
+			rc = 1;
+		}
+		break;
+	case PRUNE_IDS:
+		rc = __db_prune_ids(dbc, p, max_work, stats);
+		if (rc == 0)
+		{
+			p->phase = PRUNE_REORGANISE;
+			rc = 1;
+		}
+		break;
+	case PRUNE_REORGANISE:
+		rc = __db_prune_reorganise(dbc, p, max_pause_ms, stats);
+		if (rc == 0) p->phase = PRUNE_DONE;
+		break;
+	case PRUNE_DONE:
+		break;
+	}
+	db_unlock(dbc);
+
+	if (rc <= 0) db_prune_abort(dbc);
+	return rc;
+}
+
+
+
+/*
+ * Directory aggregates
+ *
+ * Rollups of the entries of all files below a directory, for the
+ * top dir_depth levels. Updates collect their deltas per directory
+ * in memory, which get written on sync, when there are too many or
+ * before a lookup. So a hot file costs one write per directory and
+ * sync instead of one per update. Pruning subtracts directly.
+ */
+
+/** delta of a directory not yet written */
+typedef struct {
+	char* dir;
+	fusg_rollup_t delta;
+} __db_dirs_slot_t;
+
+/** open addressing hash table of deltas by directory */
+typedef struct __db_dirs_t {
+	size_t mask;
+	size_t used;
+	size_t max_pending;
+	__db_dirs_slot_t* slots;
+} __db_dirs_t;
+
+
+static inline
+uint64_t __db_dirs_hash(const char* dir, size_t len)
+{
+	// FNV-1a
+	uint64_t h = 0xcbf29ce484222325UL;
+	for (size_t i = 0; i < len; i++)
+	{
+		h ^= (unsigned char)dir[i];
+		h *= 0x100000001b3UL;
+	}
+	return h;
+}
+
+static int __db_dirs_init(dbref_t dbc, size_t max_pending)
+{
+	__db_dirs_t* d = calloc(1, sizeof(__db_dirs_t));
+	if (!d) return -1;
+	size_t cap = 16;
+	while (cap < 2 * max_pending) cap <<= 1;
+	d->slots = calloc(cap, sizeof(__db_dirs_slot_t));
+	if (!d->slots)
+	{
+		free(d);
+		return -1;
+	}
+	d->mask = cap - 1;
+	d->max_pending = max_pending;
+	dbc->dirs = d;
+	return 0;
+}
+
+static void __db_dirs_free(dbref_t dbc)
+{
+	__db_dirs_t* d = dbc->dirs;
+	if (!d) return;
+	for (size_t i = 0; i <= d->mask; i++) free(d->slots[i].dir);
+	free(d->slots);
+	free(d);
+	dbc->dirs = NULL;
+}
+
+/**
+ * Writes all pending deltas to dsum_db. Deltas not written stay
+ * pending, for the next write. A directory may get a second slot
+ * then, which adds up just the same.
+ * @return 0 on success -1 otherwise
+ */
+static int __db_dirs_write(dbref_t dbc)
+{
+	__db_dirs_t* d = dbc->dirs;
+	if (!d || !d->used) return 0;
+	for (size_t i = 0; i <= d->mask; i++)
+	{
+		__db_dirs_slot_t* slot = &d->slots[i];
+		if (!slot->dir) continue;
+		if (__db_rollup_apply(dbc->dsum_db, db_datum_str(slot->dir),
+				&slot->delta.stats, slot->delta.entries, 1))
+		{
+			return -1;
+		}
+		free(slot->dir);
+		slot->dir = NULL;
+		d->used--;
+	}
+	return 0;
+}
+
+/**
+ * Marks dsum_db behind evnt_db before the first change of entries
+ * after a sync, durably: the deltas are in memory until the next one.
+ * A writer opening a db with the mark set rebuilds the rollups.
+ * @return 0 on success -1 otherwise
+ */
+static int __db_dirs_mark(dbref_t dbc)
+{
+	if (dbc->dirs_marked || !dbc->dsum_db || !dbc->dir_depth) return 0;
+	if (__db_store_str_long(dbc->idtb_db, DB_DIRS_PENDING_ENTRY, 1)) return -1;
+	gdbm_sync(dbc->idtb_db);
+	dbc->dirs_marked = 1;
+	return 0;
+}
+
+/**
+ * Adds a delta to the pending one of dir.
+ */
+static int __db_dirs_add(dbref_t dbc, const char* dir, size_t len, const fusg_stats_t* delta, int entries)
+{
+	if (!dbc->dirs && __db_dirs_init(dbc, DB_DIRS_PENDING_DEFAULT)) return -1;
+	__db_dirs_t* d = dbc->dirs;
+
+	size_t i = __db_dirs_hash(dir, len) & d->mask;
+	for (; d->slots[i].dir; i = (i + 1) & d->mask)
+	{
+		if (!strcmp(d->slots[i].dir, dir)) break;
+	}
+	__db_dirs_slot_t* slot = &d->slots[i];
+	if (!slot->dir)
+	{
+		if (d->used >= d->max_pending)
+		{
+			if (__db_dirs_write(dbc)) return -1;
+			return __db_dirs_add(dbc, dir, len, delta, entries);
+		}
+		slot->dir = strdup(dir);
+		if (!slot->dir) return -1;
+		memset(&slot->delta, 0, sizeof(fusg_rollup_t));
+		d->used++;
+	}
+	slot->delta.entries += entries;
+	fugs_stats_add(&slot->delta.stats, delta);
+	if (delta->deleted > slot->delta.stats.deleted) slot->delta.stats.deleted = delta->deleted;
+	return 0;
+}
+
+/**
+ * Applies delta to the directories above a file.
+ * @param filepath name of the file or NULL to look it up by file_id
+ * @param sign 1 to add (pending), -1 to subtract (immediately)
+ * @return number of records removed (sign -1) or 0 on success, -1 on error
+ */
+static int __db_dirs_update(dbref_t dbc, const char* filepath, uint64_t file_id,
+		const fusg_stats_t* delta, int entries, int sign)
+{
+	if (!dbc->dsum_db || !dbc->dir_depth) return 0;
+
+	char dir[PATH_MAX + 1];
+	if (!filepath)
+	{
+		// pruned meanwhile: nothing to account for
+		if (__db_fetch_long_str(dbc->filer_db, file_id, dir, sizeof(dir))) return 0;
+		filepath = dir;
+	}
+	else if (strlen(filepath) > PATH_MAX)
+	{
+		return 0;
+	}
+	if (filepath != dir) strcpy(dir, filepath);
+
+	int removed = 0;
+	int depth = 0;
+	for (size_t i = 1; dir[i] && depth < dbc->dir_depth; i++)
+	{
+		if (dir[i] != '/') continue;
+		depth++;
+		dir[i] = '\0';
+		int rc = (sign > 0)
+				? __db_dirs_add(dbc, dir, i, delta, entries)
+				: __db_rollup_apply(dbc->dsum_db, db_datum_str(dir), delta, entries, -1);
+		dir[i] = '/';
+		if (rc < 0) return -1;
+		removed += rc;
+	}
+	return removed;
+}
+
+/**
+ * (Re)builds the directory aggregates from evnt.db.
+ * Until it is done, the db has none.
+ * @return 0 on success -1 otherwise
+ */
+static int __db_dirs_build(dbref_t dbc)
+{
+	log_info("db: building directory rollups, %d levels", dbc->dir_depth);
+	if (__db_store_str_long(dbc->idtb_db, DB_DIRS_ENTRY, 0)) return -1;
+
+	int rc = 0;
+	uint64_t entries = 0;
+	datum key = gdbm_firstkey(dbc->evnt_db);
+	if (!key.dptr && __db_check_expected_notfound()) rc = -1;
+	while (key.dptr && !rc)
+	{
+		fusg_stats_key_t evnt_key;
+		fusg_stats_t evnt_val;
+		if (key.dsize == sizeof(fusg_stats_key_t))
+		{
+			memcpy(&evnt_key, key.dptr, sizeof(evnt_key));
+			if (__db_evnt_fetch(dbc, &evnt_key, &evnt_val))
+			{
+				rc = __db_dirs_update(dbc, NULL, evnt_key.file_id, &evnt_val, 1, 1);
+				entries++;
+			}
+		}
+		datum next = gdbm_nextkey(dbc->evnt_db, key);
+		if (!next.dptr && __db_check_expected_notfound()) rc = -1;
+		free(key.dptr);
+		key = next;
+	}
+	free(key.dptr);
+	if (!rc) rc = __db_dirs_write(dbc);
+	if (!rc) rc = __db_store_str_long(dbc->idtb_db, DB_DIRS_ENTRY, dbc->dir_depth);
+	if (rc)
+	{
+		__db_perror("building directory rollups");
+		return -1;
+	}
+	log_info("db: directory rollups built from %lu entries", entries);
+	__db_sync(dbc);
+	return 0;
+}
+
+
+int db_dirs(dbref_t dbc, int depth, int max_pending)
+{
+	if (!(dbc->open_flags & DB_WRITE) || !dbc->dsum_db || depth < 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	int rc = db_lock(dbc);
+	if (rc) return rc;
+
+	if (max_pending <= 0) max_pending = DB_DIRS_PENDING_DEFAULT;
+	if (!dbc->dirs || dbc->dirs->max_pending != (size_t)max_pending)
+	{
+		rc = __db_dirs_write(dbc);
+		__db_dirs_free(dbc);
+		if (!rc) rc = __db_dirs_init(dbc, max_pending);
+	}
+
+	if (!rc && depth != dbc->dir_depth)
+	{
+		// start over
+		char pathbuf[PATH_MAX + NAME_MAX + 2];
+		sprintf(pathbuf, "%s/%s", dbc->path, DB_FILE_DSUM);
+		gdbm_close(dbc->dsum_db);
+		dbc->dsum_db = gdbm_open(pathbuf, 0, GDBM_NOLOCK | GDBM_NEWDB, 0600, __db_perror);
+		if (!dbc->dsum_db)
+		{
+			__db_perror("gdbm_open(dsum.db)");
+			rc = -1;
+		}
+		// without: discard the pending deltas of the previous depth
+		__db_dirs_free(dbc);
+		if (!rc) rc = __db_dirs_init(dbc, max_pending);
+		dbc->dir_depth = depth;
+		if (!rc && depth) rc = __db_dirs_build(dbc);
+		else if (!rc) rc = __db_store_str_long(dbc->idtb_db, DB_DIRS_ENTRY, 0);
+		__db_touch(dbc, 1, 0);
+	}
+	db_unlock(dbc);
+	return rc;
+}
+
+
+int db_dir_rollup(dbref_t dbc, const char* dir, fusg_rollup_t* rollup)
+{
+	if (!dbc->dsum_db || !dbc->dir_depth)
+	{
+		errno = ENOTSUP;
+		return -1;
+	}
+	int depth = 0;
+	for (const char* c = dir + 1; *c; c++) depth += (*c == '/');
+	if (dir[0] != '/' || !dir[1] || depth >= dbc->dir_depth)
+	{
+		// root and levels below are not aggregated
+		errno = ERANGE;
+		return -1;
+	}
+
+	db_lock(dbc);
+	int rc = __db_dirs_write(dbc);
+	if (rc) goto bail;
+	datum result = gdbm_fetch(dbc->dsum_db, db_datum_str(dir));
+	if (result.dptr)
+	{
+		assert(result.dsize == sizeof(fusg_rollup_t));
+		memcpy(rollup, result.dptr, sizeof(fusg_rollup_t));
+		free(result.dptr);
+	}
+	else
+	{
+		rc = __db_check_expected_notfound() ? -1 : 1;
+	}
+bail:
+	db_unlock(dbc);
+	return rc;
+}
@@ -0,0 +1,481 @@
+/*
+ * live.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fusg/live.h"
+#include "fusg/logging.h"
+
+
+#define LIVE_MAGIC   0x4655534c /* "FUSL" */
+#define LIVE_VERSION 1
+
+/** average space in the string arena per entry */
+#define LIVE_ARENA_PER_ENTRY 128
+
+/** max attempts of a reader to get a consistent view */
+#define LIVE_READ_RETRIES 10000
+
+/** offsets below are never used for strings (0 marks empty slots) */
+#define LIVE_ARENA_START 8
+
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity;
+	uint64_t arena_size;
+	/** sequence lock: odd while the writer modifies the table */
+	uint64_t seq;
+	/** incremented whenever the writer starts over */
+	uint64_t generation;
+	uint64_t used;
+	uint64_t arena_used;
+} live_header_t;
+
+typedef struct
+{
+	fusg_stats_key_t key;
+	fusg_stats_t stats;
+	uint64_t file_hash;
+	uint32_t exec_off;
+	/** 0 -> slot is empty */
+	uint32_t file_off;
+} live_entry_t;
+
+
+typedef struct __live_t {
+	int writer;
+	size_t map_size;
+	live_header_t* header;
+	live_entry_t* entries;
+	char* arena;
+
+	/** writer only: arena offsets of interned strings by hash */
+	uint64_t intern_mask;
+	uint32_t* intern;
+
+	char name[NAME_MAX + 1];
+} live_t;
+
+
+/** a matching entry copied by a reader */
+typedef struct {
+	fusg_stats_t stats;
+	size_t exec;
+	size_t file;
+} live_match_t;
+
+typedef struct {
+	live_match_t* matches;
+	size_t num;
+	size_t cap;
+	char* strings;
+	size_t strings_used;
+	size_t strings_cap;
+} live_result_t;
+
+
+
+static inline uint64_t live_hash(const char* s)
+{
+	// FNV-1a
+	uint64_t h = 14695981039346656037UL;
+	for (; *s; s++)
+	{
+		h ^= (unsigned char)*s;
+		h *= 1099511628211UL;
+	}
+	return h;
+}
+
+static inline size_t live_size(uint64_t capacity, uint64_t arena_size)
+{
+	return sizeof(live_header_t) + capacity * sizeof(live_entry_t) + arena_size;
+}
+
+static void live_map(live_t* live, void* addr)
+{
+	live->header  = addr;
+	live->entries = (live_entry_t*)(live->header + 1);
+	live->arena   = (char*)(live->entries + live->header->capacity);
+}
+
+
+static void live_reset(live_t* live);
+
+
+static inline void live_write_begin(live_header_t* h)
+{
+	__atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void live_write_end(live_header_t* h)
+{
+	__atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline int live_read_begin(live_header_t* h, uint64_t* seq)
+{
+	for (int i = 0; i < LIVE_READ_RETRIES; i++)
+	{
+		*seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+		if (!(*seq & 1)) return 0;
+	}
+	// writer died while writing?
+	errno = EAGAIN;
+	return -1;
+}
+
+static inline int live_read_retry(live_header_t* h, uint64_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&h->seq, __ATOMIC_RELAXED) != seq;
+}
+
+
+/**
+ * @return string at offset in arena or NULL, if the offset is
+ *         invalid, which readers may see during modifications.
+ */
+static inline const char* live_string(live_t* live, uint32_t off, size_t* len)
+{
+	uint64_t size = live->header->arena_size;
+	*len = 0;
+	if (off < LIVE_ARENA_START || off >= size) return NULL;
+	*len = strnlen(live->arena + off, size - off);
+	return (off + *len < size) ? live->arena + off : NULL;
+}
+
+
+
+liveref_t live_create(const char* name, size_t capacity)
+{
+	// power of two, so we can mask hashes
+	uint64_t cap = 64;
+	while (cap < capacity) cap <<= 1;
+	uint64_t arena_size = cap * LIVE_ARENA_PER_ENTRY;
+	if (arena_size > UINT32_MAX) arena_size = UINT32_MAX;
+	size_t size = live_size(cap, arena_size);
+	int created = 0;
+
+	live_t* live = calloc(1, sizeof(live_t));
+	if (!live) return NULL;
+	snprintf(live->name, sizeof(live->name), "%s", name);
+	live->writer = 1;
+
+	live->intern_mask = cap * 4 - 1;
+	live->intern = calloc(cap * 4, sizeof(uint32_t));
+	if (!live->intern) goto error;
+
+	// Readers may still have the table of a previous run mapped:
+	// truncating it would crash them with SIGBUS. Reuse it, if it
+	// has the same geometry, and replace it by a new one otherwise.
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd != -1)
+	{
+		struct stat st;
+		void* addr = MAP_FAILED;
+		if (!fstat(fd, &st) && st.st_size == (off_t)size)
+		{
+			addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+		live_header_t* h = addr;
+		if (addr != MAP_FAILED && h->magic == LIVE_MAGIC && h->version == LIVE_VERSION
+				&& h->capacity == cap && h->arena_size == arena_size)
+		{
+			live->map_size = size;
+			live_map(live, addr);
+			// readers see a new generation
+			live_reset(live);
+			return live;
+		}
+		if (addr != MAP_FAILED) munmap(addr, size);
+		shm_unlink(name);
+	}
+
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd == -1) goto error;
+	created = 1;
+	if (ftruncate(fd, size))
+	{
+		close(fd);
+		goto error;
+	}
+	void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) goto error;
+	live->map_size = size;
+
+	live_header_t* h = addr;
+	h->version = LIVE_VERSION;
+	h->capacity = cap;
+	h->arena_size = arena_size;
+	h->arena_used = LIVE_ARENA_START;
+	live_map(live, addr);
+	// readers check magic last
+	__atomic_store_n(&h->magic, LIVE_MAGIC, __ATOMIC_RELEASE);
+	return live;
+
+error:
+	log_error("live: can't create '%s': %s", name, strerror(errno));
+	if (created) shm_unlink(name);
+	free(live->intern);
+	free(live);
+	return NULL;
+}
+
+void live_destroy(liveref_t live)
+{
+	if (!live) return;
+	shm_unlink(live->name);
+	live_close(live);
+}
+
+liveref_t live_open(const char* name)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) return NULL;
+
+	live_t* live = NULL;
+	struct stat st;
+	void* addr = MAP_FAILED;
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(live_header_t)) goto error;
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) goto error;
+
+	live_header_t* h = addr;
+	if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != LIVE_MAGIC
+			|| h->version != LIVE_VERSION
+			|| live_size(h->capacity, h->arena_size) != st.st_size)
+	{
+		log_error("live: '%s' has unexpected format", name);
+		goto error;
+	}
+
+	live = calloc(1, sizeof(live_t));
+	if (!live) goto error;
+	snprintf(live->name, sizeof(live->name), "%s", name);
+	live->map_size = st.st_size;
+	live_map(live, addr);
+	close(fd);
+	return live;
+
+error:
+	if (addr != MAP_FAILED) munmap(addr, st.st_size);
+	close(fd);
+	return NULL;
+}
+
+void live_close(liveref_t live)
+{
+	if (!live) return;
+	if (live->header) munmap(live->header, live->map_size);
+	free(live->intern);
+	free(live);
+}
+
+
+
+/**
+ * Starts over with an empty table. Writer only.
+ */
+static void live_reset(live_t* live)
+{
+	live_header_t* h = live->header;
+	// unless a writer died while writing
+	if (!(h->seq & 1)) live_write_begin(h);
+	memset(live->entries, 0, h->capacity * sizeof(live_entry_t));
+	h->used = 0;
+	h->arena_used = LIVE_ARENA_START;
+	h->generation++;
+	live_write_end(h);
+	memset(live->intern, 0, (live->intern_mask + 1) * sizeof(uint32_t));
+}
+
+/**
+ * Finds or adds a string in the arena. Writer only, inside of a write section.
+ * @return offset of the string
+ */
+static uint32_t live_intern(live_t* live, const char* s, uint64_t hash)
+{
+	size_t i;
+	for (i = hash & live->intern_mask; live->intern[i]; i = (i + 1) & live->intern_mask)
+	{
+		if (!strcmp(live->arena + live->intern[i], s)) return live->intern[i];
+	}
+	live_header_t* h = live->header;
+	uint32_t off = h->arena_used;
+	size_t len = strlen(s) + 1;
+	memcpy(live->arena + off, s, len);
+	h->arena_used += len;
+	live->intern[i] = off;
+	return off;
+}
+
+
+int live_update(liveref_t live, const fusg_stats_key_t* key, const char* exec, const char* file, const fusg_stats_t* stats)
+{
+	live_header_t* h = live->header;
+	uint64_t file_hash = live_hash(file);
+	uint64_t mask = h->capacity - 1;
+
+	size_t i;
+	for (i = file_hash & mask; live->entries[i].file_off; i = (i + 1) & mask)
+	{
+		live_entry_t* e = &live->entries[i];
+		if (e->key.exec_id == key->exec_id && e->key.file_id == key->file_id)
+		{
+			live_write_begin(h);
+			e->stats = *stats;
+			live_write_end(h);
+			return 0;
+		}
+	}
+
+	// new entry
+	size_t space = strlen(exec) + strlen(file) + 2;
+	if (space > h->arena_size / 2) return -1;
+	if ((h->used + 1) * 4 > h->capacity * 3 || h->arena_used + space > h->arena_size)
+	{
+		live_reset(live);
+		for (i = file_hash & mask; live->entries[i].file_off; i = (i + 1) & mask);
+	}
+
+	live_write_begin(h);
+	live_entry_t* e = &live->entries[i];
+	e->key = *key;
+	e->stats = *stats;
+	e->file_hash = file_hash;
+	e->exec_off = live_intern(live, exec, live_hash(exec));
+	e->file_off = live_intern(live, file, file_hash);
+	h->used++;
+	live_write_end(h);
+	return 0;
+}
+
+
+
+static int live_result_add(live_result_t* r, const fusg_stats_t* stats,
+		const char* exec, size_t exec_len, const char* file, size_t file_len)
+{
+	if (r->num == r->cap)
+	{
+		size_t cap = r->cap ? r->cap * 2 : 16;
+		live_match_t* m = realloc(r->matches, cap * sizeof(live_match_t));
+		if (!m) return -1;
+		r->matches = m;
+		r->cap = cap;
+	}
+	size_t need = r->strings_used + exec_len + file_len + 2;
+	if (need > r->strings_cap)
+	{
+		size_t cap = r->strings_cap ? r->strings_cap : 4096;
+		while (cap < need) cap *= 2;
+		char* s = realloc(r->strings, cap);
+		if (!s) return -1;
+		r->strings = s;
+		r->strings_cap = cap;
+	}
+	live_match_t* m = &r->matches[r->num++];
+	m->stats = *stats;
+	m->exec = r->strings_used;
+	memcpy(r->strings + r->strings_used, exec, exec_len);
+	r->strings[r->strings_used + exec_len] = '\0';
+	r->strings_used += exec_len + 1;
+	m->file = r->strings_used;
+	memcpy(r->strings + r->strings_used, file, file_len);
+	r->strings[r->strings_used + file_len] = '\0';
+	r->strings_used += file_len + 1;
+	return 0;
+}
+
+static long live_result_visit(live_result_t* r, live_visitor_t visit, void* ctx)
+{
+	long count = 0;
+	for (size_t i = 0; i < r->num; i++, count++)
+	{
+		live_match_t* m = &r->matches[i];
+		if (visit(ctx, r->strings + m->exec, r->strings + m->file, &m->stats)) break;
+	}
+	free(r->matches);
+	free(r->strings);
+	return count;
+}
+
+/**
+ * Copies matching entries under the sequence lock.
+ *
+ * @param file if not NULL, probe entries of this file only
+ * @param exec if not NULL, scan all entries of this executable
+ */
+static long live_lookup(live_t* live, const char* file, const char* exec, live_visitor_t visit, void* ctx)
+{
+	live_header_t* h = live->header;
+	live_result_t r;
+	memset(&r, 0, sizeof(r));
+
+	uint64_t seq;
+	uint64_t file_hash = file ? live_hash(file) : 0;
+	uint64_t mask = h->capacity - 1;
+	int retries = 0;
+	do {
+		r.num = 0;
+		r.strings_used = 0;
+		if (live_read_begin(h, &seq) || retries++ > LIVE_READ_RETRIES) goto error;
+
+		size_t i = file ? (file_hash & mask) : 0;
+		for (uint64_t n = 0; n < h->capacity; n++, i = (i + 1) & mask)
+		{
+			live_entry_t e = live->entries[i];
+			if (!e.file_off)
+			{
+				// end of probe sequence
+				if (file) break;
+				else continue;
+			}
+			if (file && e.file_hash != file_hash) continue;
+
+			size_t exec_len, file_len;
+			const char* es = live_string(live, e.exec_off, &exec_len);
+			const char* fs = live_string(live, e.file_off, &file_len);
+			if (!es || !fs) break; // inconsistent -> retry
+
+			if ((file && strcmp(fs, file)) || (exec && strcmp(es, exec))) continue;
+			if (live_result_add(&r, &e.stats, es, exec_len, fs, file_len)) goto error;
+		}
+	} while (live_read_retry(h, seq));
+
+	return live_result_visit(&r, visit, ctx);
+error:
+	free(r.matches);
+	free(r.strings);
+	return -1;
+}
+
+
+long live_lookup_file(liveref_t live, const char* file, live_visitor_t visit, void* ctx)
+{
+	return live_lookup(live, file, NULL, visit, ctx);
+}
+
+long live_lookup_exec(liveref_t live, const char* exec, live_visitor_t visit, void* ctx)
+{
+	return live_lookup(live, NULL, exec, visit, ctx);
+}
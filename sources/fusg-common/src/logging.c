@@ -5,7 +5,7 @@
  *      Author: homac
  */
 
-
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,6 +13,11 @@
 #include <limits.h>
 #include <stdarg.h>
 #include <syslog.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include <assert.h>
 
@@ -36,7 +41,7 @@ static loglevel_t console_loglevel = LL_DEBUG;
 static loglevel_t file_loglevel    = LL_DEBUG;
 
 
-static const int LOG_MAX_MSG_LEN = PATH_MAX * 2 + NAME_MAX;
+#define LOG_MAX_MSG_LEN (PATH_MAX * 2 + NAME_MAX)
 
 
 typedef void (*logging_function_v)(loglevel_t level, const char* fmt, va_list ap);
@@ -64,6 +69,42 @@ void logging_chain_init(void);
 void logging_chain_append(logging_function logger);
 void logging_chain_clear(void);
 
+static void logging_finalize_loggers(void);
+static void log_v(loglevel_t level, const char* fmt, va_list ap);
+
+
+/** messages pending for the background writer */
+#define LOG_RING_SLOTS 128
+
+typedef struct
+{
+	/** position it is free for (pos) or written at (pos + 1) */
+	uint64_t seq;
+	loglevel_t level;
+	char message[LOG_MAX_MSG_LEN];
+} log_slot_t;
+
+static log_slot_t* ring = NULL;
+/** next position to write (producers) */
+static uint64_t ring_head = 0;
+/** next position to read (writer thread) */
+static uint64_t ring_tail = 0;
+static uint64_t ring_dropped = 0;
+
+static pthread_t writer;
+static int writer_running = 0;
+static volatile int writer_stop = 0;
+/** writer waits for messages */
+static int writer_idle = 0;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wake = PTHREAD_COND_INITIALIZER;
+
+/** held while writing, so loggers can be replaced meanwhile */
+static pthread_mutex_t loggers_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/** call sites of log_limited() with suppressed messages */
+static log_limit_t* limits = NULL;
+
 
 // TODO: missing need time stamps in output (console/file)
 
@@ -94,35 +135,51 @@ int logging_init(const char* progname)
 
 int logging_setup_file(FILE* log_file, int chain)
 {
+	pthread_mutex_lock(&loggers_mutex);
 	if (chain) logging_chain_init();
-	else logging_finalize();
+	else logging_finalize_loggers();
 
 	logging_file = log_file;
 
 	if (chain) logging_chain_append(log_to_file);
 	else logging = log_to_file_v;
+	pthread_mutex_unlock(&loggers_mutex);
 	return 0;
 }
 
+FILE* logging_set_file(FILE* log_file)
+{
+	pthread_mutex_lock(&loggers_mutex);
+	FILE* previous = logging_file;
+	if (previous) fflush(previous);
+	logging_file = log_file;
+	pthread_mutex_unlock(&loggers_mutex);
+	return previous;
+}
+
 int logging_setup_console(int chain)
 {
+	pthread_mutex_lock(&loggers_mutex);
 	if (chain) logging_chain_init();
-	else logging_finalize();
+	else logging_finalize_loggers();
 
 	if (chain) logging_chain_append(log_to_console);
 	else logging = log_to_console_v;
+	pthread_mutex_unlock(&loggers_mutex);
 	return 0;
 }
 
 int logging_setup_syslog(const char* ident, int chain)
 {
+	pthread_mutex_lock(&loggers_mutex);
 	if (chain) logging_chain_init();
-	else logging_finalize();
+	else logging_finalize_loggers();
 
 	openlog(ident, LOG_PERROR | LOG_PID, LOG_DAEMON);
 
 	if (chain) logging_chain_append(log_to_syslog);
 	else logging = log_to_syslog_v;
+	pthread_mutex_unlock(&loggers_mutex);
 	return 0;
 }
 
@@ -152,6 +209,15 @@ void logging_finalize_that_v(logging_function_v f)
 
 
 void logging_finalize(void)
+{
+	logging_stop_async();
+	logging_flush();
+	pthread_mutex_lock(&loggers_mutex);
+	logging_finalize_loggers();
+	pthread_mutex_unlock(&loggers_mutex);
+}
+
+static void logging_finalize_loggers(void)
 {
 	if (logging == log_to_chain_v)
 	{
@@ -191,7 +257,7 @@ void log_debug(const char *fmt, ...)
 {
 	va_list ap;
     va_start(ap, fmt);
-	logging(LL_DEBUG, fmt, ap);
+	log_v(LL_DEBUG, fmt, ap);
     va_end(ap);
 }
 
@@ -199,7 +265,7 @@ void log_info(const char *fmt, ...)
 {
 	va_list ap;
     va_start(ap, fmt);
-	logging(LL_INFO, fmt, ap);
+	log_v(LL_INFO, fmt, ap);
     va_end(ap);
 }
 
@@ -207,7 +273,7 @@ void log_warn(const char *fmt, ...)
 {
 	va_list ap;
     va_start(ap, fmt);
-	logging(LL_WARN, fmt, ap);
+	log_v(LL_WARN, fmt, ap);
     va_end(ap);
 }
 
@@ -215,7 +281,7 @@ void log_error(const char *fmt, ...)
 {
 	va_list ap;
     va_start(ap, fmt);
-	logging(LL_ERROR, fmt, ap);
+	log_v(LL_ERROR, fmt, ap);
     va_end(ap);
 }
 
@@ -223,7 +289,7 @@ void log_fatal(const char *fmt, ...)
 {
 	va_list ap;
     va_start(ap, fmt);
-	logging(LL_FATAL, fmt, ap);
+	log_v(LL_FATAL, fmt, ap);
     va_end(ap);
 }
 
@@ -265,7 +331,7 @@ void log_to_syslog_v(loglevel_t level, const char* fmt, va_list ap)
 
 void log_to_file(loglevel_t level, const char* message)
 {
-    if (level < file_loglevel) return;
+    if (level < file_loglevel || !logging_file) return;
     fprintf(logging_file, "%s: %s\n", _S(level), message);
     fflush(logging_file);
 }
@@ -364,3 +430,366 @@ void logging_chain_clear(void)
 	logging_chain[0] = 0;
 }
 
+
+
+
+/*
+ * Level checks, before any formatting
+ */
+
+static int logger_enabled(logging_function logger, loglevel_t level)
+{
+	if (logger == log_to_console) return level >= console_loglevel;
+	else if (logger == log_to_file) return level >= file_loglevel && logging_file;
+	else if (logger == log_to_syslog) return level >= syslog_loglevel;
+	else return 0;
+}
+
+int log_enabled(loglevel_t level)
+{
+	if (logging != log_to_chain_v) return logger_enabled(logging_get_function(logging), level);
+	for (int i = 0; i < logging_chain_size; i++)
+	{
+		if (logging_chain[i] && logger_enabled(logging_chain[i], level)) return 1;
+	}
+	return 0;
+}
+
+/**
+ * Writes a formatted message to the loggers.
+ */
+static void log_write(loglevel_t level, const char* message)
+{
+	if (logging != log_to_chain_v)
+	{
+		logging_get_function(logging)(level, message);
+		return;
+	}
+	for (int i = 0; i < logging_chain_size; i++)
+	{
+		logging_chain[i](level, message);
+	}
+}
+
+static void log_level(loglevel_t level, const char* fmt, ...)
+{
+	va_list ap;
+    va_start(ap, fmt);
+	log_v(level, fmt, ap);
+    va_end(ap);
+}
+
+
+/*
+ * Background writer
+ */
+
+/**
+ * Queues a message, never blocks (bounded MPMC queue after D. Vyukov).
+ */
+static void ring_put(loglevel_t level, const char* fmt, va_list ap)
+{
+	uint64_t pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+	log_slot_t* slot;
+	for (;;)
+	{
+		slot = &ring[pos % LOG_RING_SLOTS];
+		int64_t diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&ring_head, &pos, pos + 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		}
+		else if (diff < 0)
+		{
+			// full
+			__atomic_add_fetch(&ring_dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		else pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+	}
+
+	slot->level = level;
+	slot->message[0] = 0;
+	log_format_message(slot->message, LOG_MAX_MSG_LEN, fmt, ap);
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	// pairs with the fence of the writer going idle
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&writer_idle, __ATOMIC_RELAXED))
+	{
+		pthread_mutex_lock(&writer_mutex);
+		pthread_cond_signal(&writer_wake);
+		pthread_mutex_unlock(&writer_mutex);
+	}
+}
+
+/**
+ * @return 1 if the next message is queued completely
+ */
+static int ring_pending(void)
+{
+	uint64_t pos = __atomic_load_n(&ring_tail, __ATOMIC_RELAXED);
+	return __atomic_load_n(&ring[pos % LOG_RING_SLOTS].seq, __ATOMIC_ACQUIRE) == pos + 1;
+}
+
+/**
+ * Writes the queued messages (one consumer at a time).
+ */
+static void ring_write(void)
+{
+	pthread_mutex_lock(&loggers_mutex);
+	while (ring_pending())
+	{
+		uint64_t pos = ring_tail;
+		log_slot_t* slot = &ring[pos % LOG_RING_SLOTS];
+		log_write(slot->level, slot->message);
+		__atomic_store_n(&slot->seq, pos + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+		__atomic_store_n(&ring_tail, pos + 1, __ATOMIC_RELEASE);
+	}
+
+	uint64_t dropped = __atomic_exchange_n(&ring_dropped, 0, __ATOMIC_RELAXED);
+	if (dropped)
+	{
+		char message[64];
+		snprintf(message, sizeof(message), "logging: %lu messages dropped", dropped);
+		log_write(LL_WARN, message);
+	}
+	pthread_mutex_unlock(&loggers_mutex);
+}
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Logs the messages suppressed by call sites, which went quiet.
+ * @param all regardless of the call site being quiet
+ */
+static void limits_report(int all)
+{
+	uint64_t now = now_ns();
+	for (log_limit_t* l = __atomic_load_n(&limits, __ATOMIC_ACQUIRE); l; l = l->next)
+	{
+		if (!__atomic_load_n(&l->suppressed, __ATOMIC_RELAXED)) continue;
+		// still busy: its next message will tell
+		if (!all && __atomic_load_n(&l->tat, __ATOMIC_RELAXED) > now) continue;
+		uint64_t suppressed = __atomic_exchange_n(&l->suppressed, 0, __ATOMIC_RELAXED);
+		if (suppressed)
+		{
+			log_level(l->level, "%lu similar messages suppressed: '%s'", suppressed,
+					__atomic_load_n(&l->fmt, __ATOMIC_RELAXED));
+		}
+	}
+}
+
+
+static void* writer_main(void* arg)
+{
+	// signals are for the main thread
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+	uint64_t last_report = now_ns();
+	while (!writer_stop)
+	{
+		ring_write();
+		if (now_ns() - last_report >= 1000000000UL)
+		{
+			limits_report(0);
+			last_report = now_ns();
+		}
+
+		pthread_mutex_lock(&writer_mutex);
+		__atomic_store_n(&writer_idle, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (!writer_stop && !ring_pending())
+		{
+			// timeout: reporting suppressed messages
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_sec++;
+			pthread_cond_timedwait(&writer_wake, &writer_mutex, &until);
+		}
+		__atomic_store_n(&writer_idle, 0, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&writer_mutex);
+	}
+	ring_write();
+	return NULL;
+}
+
+
+int logging_start_async(void)
+{
+	if (writer_running) return 0;
+	if (!ring)
+	{
+		ring = calloc(LOG_RING_SLOTS, sizeof(log_slot_t));
+		if (!ring) return -1;
+		for (uint64_t i = 0; i < LOG_RING_SLOTS; i++) ring[i].seq = i;
+		ring_head = ring_tail = 0;
+	}
+	writer_stop = 0;
+	int rc = pthread_create(&writer, NULL, writer_main, NULL);
+	if (rc)
+	{
+		errno = rc;
+		return -1;
+	}
+	__atomic_store_n(&writer_running, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void logging_stop_async(void)
+{
+	if (!writer_running) return;
+	// from now on, log_xxx() writes directly
+	__atomic_store_n(&writer_running, 0, __ATOMIC_RELEASE);
+
+	pthread_mutex_lock(&writer_mutex);
+	writer_stop = 1;
+	pthread_cond_signal(&writer_wake);
+	pthread_mutex_unlock(&writer_mutex);
+	pthread_join(writer, NULL);
+	// messages of callers, which raced with the stop
+	ring_write();
+}
+
+/**
+ * Waits until the writer has written what was queued so far.
+ */
+static void logging_flush_ring(void)
+{
+	uint64_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+	while (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)
+			&& __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) < head)
+	{
+		pthread_mutex_lock(&writer_mutex);
+		pthread_cond_signal(&writer_wake);
+		pthread_mutex_unlock(&writer_mutex);
+		struct timespec pause = { 0, 1000000 };
+		nanosleep(&pause, NULL);
+	}
+}
+
+void logging_flush(void)
+{
+	limits_report(1);
+	logging_flush_ring();
+}
+
+
+static void log_v(loglevel_t level, const char* fmt, va_list ap)
+{
+	if (!log_enabled(level)) return;
+	if (!__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE))
+	{
+		logging(level, fmt, ap);
+	}
+	else if (level < LL_FATAL)
+	{
+		ring_put(level, fmt, ap);
+	}
+	else
+	{
+		// last words: in order and for sure
+		logging_flush_ring();
+		pthread_mutex_lock(&loggers_mutex);
+		logging(level, fmt, ap);
+		pthread_mutex_unlock(&loggers_mutex);
+	}
+}
+
+
+/*
+ * Rate limits
+ */
+
+/**
+ * Takes a token (GCRA: tat advances by one interval per message
+ * and may run ahead of now by the burst).
+ * @return 1 if the message may be logged
+ */
+static int limit_take(log_limit_t* limit, uint64_t now)
+{
+	const uint64_t interval = 1000000000UL / LOG_LIMIT_RATE;
+	const uint64_t burst = interval * (LOG_LIMIT_BURST - 1);
+	uint64_t tat = __atomic_load_n(&limit->tat, __ATOMIC_RELAXED);
+	for (;;)
+	{
+		uint64_t next = tat > now ? tat : now;
+		if (next - now > burst) return 0;
+		if (__atomic_compare_exchange_n(&limit->tat, &tat, next + interval, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED)) return 1;
+	}
+}
+
+/**
+ * Makes a call site known to limits_report().
+ */
+static void limit_list(log_limit_t* limit)
+{
+	int listed = 0;
+	if (!__atomic_compare_exchange_n(&limit->listed, &listed, 1, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) return;
+	log_limit_t* head = __atomic_load_n(&limits, __ATOMIC_RELAXED);
+	do limit->next = head;
+	while (!__atomic_compare_exchange_n(&limits, &head, limit, 1,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+int log_limit_take(log_limit_t* limit, loglevel_t level, const char* fmt)
+{
+	if (!log_enabled(level)) return 0;
+	if (!limit_take(limit, now_ns()))
+	{
+		limit->level = level;
+		__atomic_store_n(&limit->fmt, fmt, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&limit->suppressed, 1, __ATOMIC_RELAXED);
+		limit_list(limit);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Logs a message, which took a token of limit, noting the suppressed ones.
+ */
+static void limit_log_v(log_limit_t* limit, loglevel_t level, const char* fmt, va_list ap)
+{
+	uint64_t suppressed = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+	if (!suppressed)
+	{
+		log_v(level, fmt, ap);
+	}
+	else
+	{
+		char message[LOG_MAX_MSG_LEN];
+		message[0] = 0;
+		log_format_message(message, LOG_MAX_MSG_LEN, fmt, ap);
+		log_level(level, "%s (%lu similar messages suppressed)", message, suppressed);
+	}
+}
+
+void log_limit_log(log_limit_t* limit, loglevel_t level, const char* fmt, ...)
+{
+	va_list ap;
+    va_start(ap, fmt);
+	limit_log_v(limit, level, fmt, ap);
+    va_end(ap);
+}
+
+void log_limited_at(log_limit_t* limit, loglevel_t level, const char* fmt, ...)
+{
+	if (!log_limit_take(limit, level, fmt)) return;
+
+	va_list ap;
+    va_start(ap, fmt);
+	limit_log_v(limit, level, fmt, ap);
+    va_end(ap);
+}
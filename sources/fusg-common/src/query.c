@@ -0,0 +1,178 @@
+/*
+ * query.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "fusg/query.h"
+#include "fusg/logging.h"
+
+
+static int query_read(int sock, void* buf, size_t len)
+{
+	char* p = buf;
+	while (len)
+	{
+		ssize_t n = read(sock, p, len);
+		if (n == 0)
+		{
+			errno = ECONNRESET;
+			return -1;
+		}
+		else if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int query_write(int sock, const void* buf, size_t len)
+{
+	const char* p = buf;
+	while (len)
+	{
+		// don't die on SIGPIPE, if the peer went away
+		ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+
+int query_connect(const char* socket_path)
+{
+	struct sockaddr_un addr;
+	if (!socket_path || !socket_path[0]
+			|| strlen(socket_path) >= sizeof(addr.sun_path))
+	{
+		return -1;
+	}
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1) return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+	if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)))
+	{
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+
+int query_send_request(int sock, query_type_t type, const char* arg)
+{
+	query_request_t request;
+	memset(&request, 0, sizeof(request));
+	request.magic = QUERY_MAGIC;
+	request.version = QUERY_VERSION;
+	request.type = type;
+	request.arg_len = arg ? strlen(arg) + 1 : 0;
+
+	if (query_write(sock, &request, sizeof(request))) return -1;
+	if (arg && query_write(sock, arg, request.arg_len)) return -1;
+	return 0;
+}
+
+
+int query_recv_request(int sock, query_request_t* request, char* arg, size_t size)
+{
+	if (query_read(sock, request, sizeof(query_request_t))) return -1;
+	if (request->magic != QUERY_MAGIC || request->version != QUERY_VERSION
+			|| request->arg_len >= size)
+	{
+		errno = EPROTO;
+		return -1;
+	}
+	if (query_read(sock, arg, request->arg_len)) return -1;
+	arg[request->arg_len] = '\0';
+	return 0;
+}
+
+
+size_t query_pack_reply(void* buf, size_t size, query_status_t status,
+		const char* exec, const char* file, const fusg_stats_t* stats, uint64_t entries)
+{
+	query_reply_t reply;
+	memset(&reply, 0, sizeof(reply));
+	reply.status = status;
+	reply.exec_len = exec ? strlen(exec) : 0;
+	reply.file_len = file ? strlen(file) : 0;
+	if (stats) reply.stats = *stats;
+	reply.entries = entries;
+
+	size_t len = sizeof(reply) + reply.exec_len + reply.file_len;
+	if (len > size) return len;
+	char* p = buf;
+	memcpy(p, &reply, sizeof(reply));
+	p += sizeof(reply);
+	if (reply.exec_len) memcpy(p, exec, reply.exec_len);
+	p += reply.exec_len;
+	if (reply.file_len) memcpy(p, file, reply.file_len);
+	return len;
+}
+
+
+int query_send_reply(int sock, query_status_t status, const char* exec, const char* file, const fusg_stats_t* stats)
+{
+	char buf[sizeof(query_reply_t) + 2 * PATH_MAX];
+	size_t len = query_pack_reply(buf, sizeof(buf), status, exec, file, stats, stats != NULL);
+	if (len > sizeof(buf))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return query_write(sock, buf, len);
+}
+
+
+int query_send_rollup(int sock, const char* exec, const char* file, const fusg_rollup_t* rollup)
+{
+	char buf[sizeof(query_reply_t) + 2 * PATH_MAX];
+	size_t len = query_pack_reply(buf, sizeof(buf), QUERY_RECORD, exec, file, &rollup->stats, rollup->entries);
+	if (len > sizeof(buf))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return query_write(sock, buf, len);
+}
+
+
+int query_recv_reply(int sock, query_reply_t* reply, char* exec, char* file)
+{
+	if (query_read(sock, reply, sizeof(query_reply_t))) return -1;
+	if (reply->exec_len > PATH_MAX || reply->file_len > PATH_MAX)
+	{
+		errno = EPROTO;
+		return -1;
+	}
+	if (query_read(sock, exec, reply->exec_len)) return -1;
+	exec[reply->exec_len] = '\0';
+	if (query_read(sock, file, reply->file_len)) return -1;
+	file[reply->file_len] = '\0';
+	return reply->status;
+}
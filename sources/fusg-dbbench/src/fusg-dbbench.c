@@ -0,0 +1,343 @@
+/*
+ * fusg-dbbench.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+
+/*
+ * Microbenchmarks of the db primitives.
+ *
+ * The db implementation is compiled into this translation unit, to
+ * time its internal (static) primitives separately:
+ *
+ *   flock            db_lock() + db_unlock() on the lock file
+ *   get_id           __db_get_or_create_unique_id() of existing file
+ *   create_id        __db_get_or_create_unique_id() of new file
+ *   store_long_str   __db_store_long_str() (reverse lookup)
+ *   evnt_fetch       __db_evnt_fetch()
+ *   evnt_store       __db_evnt_store()
+ *   update_locked    db_update() while holding the lock (batched)
+ *   update           db_update() with its own lock
+ *   fetch            db_fetch()
+ *   iterate          db_fusg_stats_first/next + db_iterator_fetch per entry
+ *   sync             sync of all db files after 'ops' updates
+ *
+ * for db sizes from 10^3 up to --max entries, with hot (1% of the
+ * entries) and cold (uniform) key distributions. Output is CSV.
+ */
+
+#include "../../fusg-common/src/db.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "fusg/err.h"
+
+
+#define DBBENCH_DB_DEFAULT "/tmp/fusg-dbbench-db"
+#define DBBENCH_EXECS 100
+
+
+typedef enum {
+	DIST_HOT,
+	DIST_COLD,
+} dist_t;
+
+static const char* dist_names[] = { "hot", "cold" };
+
+
+static const char* db_path = DBBENCH_DB_DEFAULT;
+static uint64_t max_size = 1000000;
+static uint64_t ops = 10000;
+static uint64_t rnd = 0x9e3779b97f4a7c15UL;
+
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint64_t random_next(void)
+{
+	// xorshift64*
+	rnd ^= rnd >> 12;
+	rnd ^= rnd << 25;
+	rnd ^= rnd >> 27;
+	return rnd * 2685821657736338717UL;
+}
+
+/**
+ * @return index of an existing entry of a db with size entries.
+ */
+static uint64_t random_entry(dist_t dist, uint64_t size)
+{
+	uint64_t range = size;
+	if (dist == DIST_HOT)
+	{
+		range = size / 100;
+		if (!range) range = 1;
+	}
+	return random_next() % range;
+}
+
+static const char* entry_file(uint64_t i, char* buf)
+{
+	sprintf(buf, "/bench/dir%03lu/file%lu", i % 1000, i);
+	return buf;
+}
+
+static const char* entry_exec(uint64_t i, char* buf)
+{
+	sprintf(buf, "/usr/bin/exec%lu", i % DBBENCH_EXECS);
+	return buf;
+}
+
+
+static void report(uint64_t size, dist_t dist, const char* op, uint64_t count, uint64_t total_ns)
+{
+	printf("%lu,%s,%s,%lu,%lu,%.1f\n", size, dist_names[dist], op, count, total_ns,
+			count ? (double)total_ns / count : 0.0);
+	fflush(stdout);
+}
+
+
+/**
+ * Fills the db with entries [from, to).
+ */
+static int populate(dbref_t db, uint64_t from, uint64_t to)
+{
+	char exebuf[64], filebuf[64];
+	int rc = db_begin_batch(db);
+	for (uint64_t i = from; !rc && i < to; i++)
+	{
+		rc = db_update(db, entry_exec(i, exebuf), entry_file(i, filebuf), FUSG_READ, i);
+	}
+	if (!rc) rc = db_commit_batch(db);
+	if (!rc) rc = db_flush(db);
+	return rc;
+}
+
+
+static void bench_flock(dbref_t db, uint64_t size, dist_t dist)
+{
+	uint64_t start = now_ns();
+	for (uint64_t n = 0; n < ops; n++)
+	{
+		db_lock(db);
+		db_unlock(db);
+	}
+	report(size, dist, "flock", ops, now_ns() - start);
+}
+
+static void bench_ids(dbref_t db, uint64_t size, dist_t dist)
+{
+	char filebuf[64];
+	uint64_t id = 0;
+
+	db_lock(db);
+	uint64_t total = 0;
+	for (uint64_t n = 0; n < ops; n++)
+	{
+		entry_file(random_entry(dist, size), filebuf);
+		uint64_t start = now_ns();
+		__db_get_or_create_unique_id(db, db->file_db, filebuf, &id);
+		total += now_ns() - start;
+	}
+	report(size, dist, "get_id", ops, total);
+
+	// new entries, removed again below to keep the size
+	total = 0;
+	for (uint64_t n = 0; n < ops; n++)
+	{
+		entry_file(size + n, filebuf);
+		uint64_t start = now_ns();
+		__db_get_or_create_unique_id(db, db->file_db, filebuf, &id);
+		total += now_ns() - start;
+	}
+	report(size, dist, "create_id", ops, total);
+	for (uint64_t n = 0; n < ops; n++)
+	{
+		gdbm_delete(db->file_db, db_datum_str(entry_file(size + n, filebuf)));
+	}
+
+	total = 0;
+	for (uint64_t n = 0; n < ops; n++)
+	{
+		uint64_t i = random_entry(dist, size);
+		entry_file(i, filebuf);
+		__db_fetch_str_long(db->file_db, filebuf, &id);
+		uint64_t start = now_ns();
+		__db_store_long_str(db->filer_db, id, filebuf);
+		total += now_ns() - start;
+	}
+	report(size, dist, "store_long_str", ops, total);
+	db_unlock(db);
+}
+
+static void bench_evnt(dbref_t db, uint64_t size, dist_t dist)
+{
+	char exebuf[64], filebuf[64];
+	fusg_stats_key_t key;
+	fusg_stats_t stats;
+	uint64_t fetch_total = 0;
+	uint64_t store_total = 0;
+
+	db_lock(db);
+	for (uint64_t n = 0; n < ops; n++)
+	{
+		uint64_t i = random_entry(dist, size);
+		__db_find_fusg_key(db, entry_exec(i, exebuf), entry_file(i, filebuf), &key);
+
+		uint64_t start = now_ns();
+		__db_evnt_fetch(db, &key, &stats);
+		uint64_t mid = now_ns();
+		__db_evnt_store(db, &key, &stats);
+		uint64_t end = now_ns();
+
+		fetch_total += mid - start;
+		store_total += end - mid;
+	}
+	db_unlock(db);
+	report(size, dist, "evnt_fetch", ops, fetch_total);
+	report(size, dist, "evnt_store", ops, store_total);
+}
+
+static void bench_update(dbref_t db, uint64_t size, dist_t dist)
+{
+	char exebuf[64], filebuf[64];
+	fusg_stats_t stats;
+
+	db_lock(db);
+	uint64_t start = now_ns();
+	for (uint64_t n = 0; n < ops; n++)
+	{
+		uint64_t i = random_entry(dist, size);
+		db_update(db, entry_exec(i, exebuf), entry_file(i, filebuf), FUSG_READ, n);
+	}
+	report(size, dist, "update_locked", ops, now_ns() - start);
+	db_unlock(db);
+
+	start = now_ns();
+	for (uint64_t n = 0; n < ops; n++)
+	{
+		uint64_t i = random_entry(dist, size);
+		db_update(db, entry_exec(i, exebuf), entry_file(i, filebuf), FUSG_READ, n);
+	}
+	report(size, dist, "update", ops, now_ns() - start);
+
+	start = now_ns();
+	for (uint64_t n = 0; n < ops; n++)
+	{
+		uint64_t i = random_entry(dist, size);
+		db_fetch(db, entry_exec(i, exebuf), entry_file(i, filebuf), &stats);
+	}
+	report(size, dist, "fetch", ops, now_ns() - start);
+
+	start = now_ns();
+	db_lock(db);
+	__db_sync(db);
+	db_unlock(db);
+	report(size, dist, "sync", 1, now_ns() - start);
+}
+
+static void bench_iterate(dbref_t db, uint64_t size, dist_t dist)
+{
+	fusg_stats_iterator_t it;
+	fusg_stats_t stats;
+	uint64_t count = 0;
+
+	uint64_t start = now_ns();
+	for (int rc = db_fusg_stats_first(db, &it); rc == 0; rc = db_iterator_next(&it))
+	{
+		db_iterator_fetch(&it, &stats);
+		count++;
+	}
+	db_iterator_release(it);
+	report(size, dist, "iterate", count, now_ns() - start);
+}
+
+
+static void print_usage(const char* progname)
+{
+	printf("> %s <flags>\n", progname);
+	printf("-d | --db <dir>\n"
+			"\tdb to be created (default: '%s').\n"
+			"\tAny existing db at <dir> will be deleted!\n", DBBENCH_DB_DEFAULT);
+	printf("-m | --max <n>\n"
+			"\tlargest db size in entries (default: %lu, up to 10^7).\n", max_size);
+	printf("-n | --ops <n>\n"
+			"\toperations per measurement (default: %lu).\n", ops);
+}
+
+int main(int argc, char** argv)
+{
+	logging_set_log_levels(LL_WARN, LL_IGNORE, LL_WARN);
+	logging_init("fusg-dbbench");
+	logging_setup_console(0);
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (i + 1 < argc && (!strcmp(arg, "-d") || !strcmp(arg, "--db")))
+		{
+			db_path = argv[++i];
+		}
+		else if (i + 1 < argc && (!strcmp(arg, "-m") || !strcmp(arg, "--max")))
+		{
+			max_size = strtoull(argv[++i], NULL, 10);
+		}
+		else if (i + 1 < argc && (!strcmp(arg, "-n") || !strcmp(arg, "--ops")))
+		{
+			ops = strtoull(argv[++i], NULL, 10);
+		}
+		else
+		{
+			print_usage(argv[0]);
+			return strcmp(arg, "-h") && strcmp(arg, "--help") ? ERR_USAGE : ERR_NONE;
+		}
+	}
+	if (!fiscanonical(db_path))
+	{
+		log_error("db path must be absolute and canonical: '%s'", db_path);
+		return ERR_USAGE;
+	}
+
+	db_delete(db_path);
+	dbref_t db = db_open(db_path, DB_WRITE);
+	if (!db)
+	{
+		log_error("can't open db at '%s': %s", db_path, strerror(errno));
+		return ERR_DB;
+	}
+
+	printf("size,distribution,op,count,total_ns,ns_per_op\n");
+	uint64_t size = 0;
+	for (uint64_t target = 1000; target <= max_size; target *= 10)
+	{
+		// grow the db incrementally
+		if (populate(db, size, target))
+		{
+			log_error("failed to populate db with %lu entries", target);
+			db_close(db);
+			return ERR_DB;
+		}
+		size = target;
+
+		for (dist_t dist = DIST_HOT; dist <= DIST_COLD; dist++)
+		{
+			bench_flock(db, size, dist);
+			bench_ids(db, size, dist);
+			bench_evnt(db, size, dist);
+			bench_update(db, size, dist);
+		}
+		bench_iterate(db, size, DIST_COLD);
+	}
+
+	db_close(db);
+	return ERR_NONE;
+}
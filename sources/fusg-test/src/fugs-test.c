@@ -4,16 +4,48 @@
 #include "fusg/logging.h"
 #include "fusg/utils.h"
 #include "fusg/system.h"
+#include "fusg/query.h"
+#include "fusg/live.h"
+
+#include "generate.h"
+
+#include "fusgd.h"
+#include "degrade.h"
+#include "assemble.h"
+#include "spool.h"
+#include "tail.h"
+#include "input.h"
+#include "metrics.h"
+#include "procs.h"
+#include "serial.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 
 #include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <zlib.h>
+#include <zstd.h>
 
 #define DB_BASE_PATH "/tmp/fugsdb-test"
 
 
+/* modules of fusgd get linked for testing */
+fusgd_global_t global;
+
+void reload_config(void)
+{
+	global.received_sighup = 0;
+}
+
+
 void test_coredump_size(void)
 {
 	rlim_t coresize = system_coredump_size();
@@ -317,7 +349,1363 @@ void test_db_search(void)
 }
 
 
-int main(void) {
+void test_db_snapshot(void)
+{
+	const char* exe = "/usr/bin/firefox";
+	const char* file = "/home/homac/.mozilla/snapshot";
+	fusg_stats_t stats;
+
+	int rc = db_delete(DB_BASE_PATH);
+	assert(rc == 0);
+	dbref_t db = db_open(DB_BASE_PATH, DB_WRITE | DB_SNAPSHOT);
+	assert(db != NULL);
+
+	rc = db_update(db, exe, file, FUSG_READ, 1);
+	assert(rc == 0);
+	rc = db_snapshot(db);
+	assert(rc == 0);
+
+	// reader works on published snapshot
+	dbref_t reader = db_open(DB_BASE_PATH, DB_READ);
+	assert(reader != NULL);
+
+	// writer is not blocked by a reader holding an iterator
+	fusg_stats_iterator_t it;
+	rc = db_fusg_stats_first(reader, &it);
+	assert(rc == 0);
+	rc = db_update(db, exe, file, FUSG_READ, 2);
+	assert(rc == 0);
+	rc = db_snapshot(db);
+	assert(rc == 0);
+	db_iterator_release(it);
+
+	// reader still sees its point in time
+	rc = db_fetch(reader, exe, file, &stats);
+	assert(rc == 0);
+	assert(stats.read == 1);
+	assert(stats.time == 1);
+	db_close(reader);
+
+	// a new reader sees the new snapshot
+	reader = db_open(DB_BASE_PATH, DB_READ);
+	assert(reader != NULL);
+	rc = db_fetch(reader, exe, file, &stats);
+	assert(rc == 0);
+	assert(stats.read == 2);
+	assert(stats.time == 2);
+	db_close(reader);
+
+	// superseded generations stay for readers, which resolved them
+	rc = db_update(db, exe, file, FUSG_READ, 3);
+	assert(rc == 0);
+	rc = db_snapshot(db);
+	assert(rc == 0);
+	assert(fexists(DB_BASE_PATH "/snap.1"));
+
+	db_close(db);
+
+	// a writer without snapshots withdraws them
+	db = db_open(DB_BASE_PATH, DB_WRITE);
+	assert(db != NULL);
+	rc = db_update(db, exe, file, FUSG_READ, 4);
+	assert(rc == 0);
+	db_close(db);
+
+	reader = db_open(DB_BASE_PATH, DB_READ);
+	assert(reader != NULL);
+	rc = db_fetch(reader, exe, file, &stats);
+	assert(rc == 0);
+	assert(stats.read == 4);
+	db_close(reader);
+}
+
+
+void test_db_batch(void)
+{
+	const char* exe = "/usr/bin/firefox";
+	const char* file = "/home/homac/.mozilla/batch";
+	fusg_stats_t stats;
+
+	int rc = db_delete(DB_BASE_PATH);
+	assert(rc == 0);
+	dbref_t db = db_open(DB_BASE_PATH, DB_WRITE | DB_SYNC);
+	assert(db != NULL);
+
+	assert(db_batch_size(db) == -1);
+	rc = db_commit_batch(db);
+	assert(rc == -1);
+
+	rc = db_begin_batch(db);
+	assert(rc == 0);
+	rc = db_begin_batch(db);
+	assert(rc == -1);
+	for (int i = 0; i < 10; i++)
+	{
+		rc = db_update(db, exe, file, FUSG_WRITE, i);
+		assert(rc == 0);
+	}
+	assert(db_batch_size(db) == 10);
+
+	// visible inside of the batch
+	rc = db_fetch(db, exe, file, &stats);
+	assert(rc == 0);
+	assert(stats.write == 10);
+
+	rc = db_commit_batch(db);
+	assert(rc == 0);
+	assert(db_batch_size(db) == -1);
+	db_close(db);
+
+	db = db_open(DB_BASE_PATH, DB_READ);
+	assert(db != NULL);
+	rc = db_fetch(db, exe, file, &stats);
+	assert(rc == 0);
+	assert(stats.write == 10);
+	assert(stats.time == 9);
+	db_close(db);
+}
+
+
+void test_db_update_stats(void)
+{
+	const char* exe = "/usr/bin/firefox";
+	const char* file = "/home/homac/.mozilla/bulk";
+	fusg_stats_key_t key;
+	fusg_stats_t stats;
+
+	int rc = db_delete(DB_BASE_PATH);
+	assert(rc == 0);
+	dbref_t db = db_open(DB_BASE_PATH, DB_WRITE);
+	assert(db != NULL);
+
+	rc = db_exec_create_id(db, exe, &key.exec_id);
+	assert(rc == 0);
+	rc = db_file_create_id(db, file, &key.file_id);
+	assert(rc == 0);
+	// same ids as db_update would use
+	assert(db_exec_get_id(db, exe) == key.exec_id);
+	assert(db_file_get_id(db, file) == key.file_id);
+	uint64_t id;
+	rc = db_exec_create_id(db, exe, &id);
+	assert(rc == 0 && id == key.exec_id);
+
+	fusg_stats_t add = { .read = 2, .write = 1, .create = 0, .exec = 3, .time = 7 };
+	rc = db_update_stats(db, &key, &add);
+	assert(rc == 0);
+	rc = db_update(db, exe, file, FUSG_READ, 8);
+	assert(rc == 0);
+	add.time = 9;
+	rc = db_update_stats(db, &key, &add);
+	assert(rc == 0);
+
+	rc = db_fetch(db, exe, file, &stats);
+	assert(rc == 0);
+	assert(stats.read == 5);
+	assert(stats.write == 2);
+	assert(stats.exec == 6);
+	assert(stats.time == 9);
+
+	char buffer[PATH_MAX];
+	rc = db_exec_get_executable(db, key.exec_id, buffer, sizeof(buffer));
+	assert(rc == 0 && !strcmp(buffer, exe));
+	rc = db_file_get_file(db, key.file_id, buffer, sizeof(buffer));
+	assert(rc == 0 && !strcmp(buffer, file));
+	db_close(db);
+}
+
+
+void test_db_inodes(void)
+{
+	const char* exe = "/usr/bin/vim";
+	const char* file = "/home/homac/notes";
+	const char* link = "/home/homac/notes.link";
+	const char* other = "/home/homac/other";
+	fusg_inode_t inode = { .dev = 0x801, .ino = 4711 };
+	fusg_stats_key_t key, key_link;
+	fusg_stats_t stats;
+	char buffer[PATH_MAX];
+
+	int rc = db_delete(DB_BASE_PATH);
+	assert(rc == 0);
+	dbref_t db = db_open(DB_BASE_PATH, DB_WRITE | DB_INODES);
+	assert(db != NULL);
+
+	// hard link: one file, the second path is an alias
+	rc = db_update_r(db, exe, file, &inode, FUSG_READ, 1, &key, NULL);
+	assert(rc == 0);
+	rc = db_update_r(db, exe, link, &inode, FUSG_WRITE, 2, &key_link, &stats);
+	assert(rc == 0);
+	assert(key_link.file_id == key.file_id);
+	assert(stats.read == 1 && stats.write == 1 && stats.time == 2);
+	assert(db_file_get_id(db, link) == key.file_id);
+
+	rc = db_fetch(db, exe, link, &stats);
+	assert(rc == 0 && stats.read == 1 && stats.write == 1);
+	rc = db_file_get_file(db, key.file_id, buffer, sizeof(buffer));
+	assert(rc == 0 && !strcmp(buffer, file));
+	rc = db_file_get_aliases(db, key.file_id, buffer, sizeof(buffer));
+	assert(rc == 1 && !strcmp(buffer, link) && buffer[strlen(link) + 1] == '\0');
+	rc = db_file_get_aliases(db, key.file_id, buffer, 4);
+	assert(rc == -1);
+
+	// path without inode stays a file of its own
+	rc = db_update_r(db, exe, other, NULL, FUSG_READ, 3, &key_link, NULL);
+	assert(rc == 0 && key_link.file_id != key.file_id);
+	rc = db_file_get_aliases(db, key_link.file_id, buffer, sizeof(buffer));
+	assert(rc == 0 && buffer[0] == '\0');
+
+	// deleted: inode may be reused by another file
+	rc = db_update_r(db, exe, link, &inode, FUSG_DELET, 4, NULL, NULL);
+	assert(rc == 0);
+	rc = db_update_r(db, exe, file, &inode, FUSG_DELET, 5, NULL, NULL);
+	assert(rc == 0);
+	rc = db_end_event(db);
+	assert(rc == 0);
+	rc = db_update_r(db, exe, "/home/homac/new", &inode, FUSG_CREAT, 6, &key_link, NULL);
+	assert(rc == 0 && key_link.file_id != key.file_id);
+	rc = db_end_event(db);
+	assert(rc == 0);
+
+	// rename: one event deletes the old name, then creates the new one
+	fusg_inode_t moved = { .dev = 0x801, .ino = 4712 };
+	rc = db_update_r(db, exe, "/home/homac/draft", &moved, FUSG_CREAT, 7, &key, NULL);
+	assert(rc == 0);
+	rc = db_end_event(db);
+	assert(rc == 0);
+	rc = db_update_r(db, "/usr/bin/mv", "/home/homac/draft", &moved, FUSG_DELET, 8, NULL, NULL);
+	assert(rc == 0);
+	rc = db_update_r(db, "/usr/bin/mv", "/home/homac/final", &moved, FUSG_CREAT, 8, &key_link, NULL);
+	assert(rc == 0 && key_link.file_id == key.file_id);
+	rc = db_end_event(db);
+	assert(rc == 0);
+	// the file keeps its inode
+	rc = db_update_r(db, exe, "/home/homac/final.link", &moved, FUSG_READ, 9, &key_link, NULL);
+	assert(rc == 0 && key_link.file_id == key.file_id);
+	db_close(db);
+
+	// without DB_INODES, paths are files
+	rc = db_delete(DB_BASE_PATH);
+	assert(rc == 0);
+	db = db_open(DB_BASE_PATH, DB_WRITE);
+	assert(db != NULL);
+	rc = db_update_r(db, exe, file, &inode, FUSG_READ, 1, &key, NULL);
+	assert(rc == 0);
+	rc = db_update_r(db, exe, link, &inode, FUSG_READ, 2, &key_link, NULL);
+	assert(rc == 0 && key_link.file_id != key.file_id);
+	db_close(db);
+}
+
+
+static void test_db_prune_dropped(void* ctx, const fusg_stats_key_t* key)
+{
+	(*(int*)ctx)++;
+}
+
+void test_db_prune(void)
+{
+	const char* exe1 = "/usr/bin/make";
+	const char* exe2 = "/usr/bin/rm";
+	const char* exe3 = "/usr/bin/gone";
+	fusg_inode_t inode = { .dev = 0x801, .ino = 815 };
+	fusg_stats_key_t key;
+	fusg_stats_t stats;
+
+	int rc = db_delete(DB_BASE_PATH);
+	assert(rc == 0);
+	dbref_t db = db_open(DB_BASE_PATH, DB_WRITE | DB_INODES);
+	assert(db != NULL);
+
+	// expired
+	rc = db_update(db, exe1, "/tmp/a", FUSG_READ, 100);
+	assert(rc == 0);
+	rc = db_update(db, exe2, "/tmp/a", FUSG_READ, 200);
+	assert(rc == 0);
+	rc = db_update_r(db, exe3, "/tmp/old", &inode, FUSG_READ, 50, &key, NULL);
+	assert(rc == 0);
+	uint64_t old_id = key.file_id;
+	// kept
+	rc = db_update(db, exe1, "/tmp/b", FUSG_READ, 1000);
+	assert(rc == 0);
+	// deleted
+	rc = db_update(db, exe1, "/tmp/c", FUSG_CREAT, 900);
+	assert(rc == 0);
+	rc = db_update(db, exe1, "/tmp/c", FUSG_DELET, 950);
+	assert(rc == 0);
+	rc = db_fetch(db, exe1, "/tmp/c", &stats);
+	assert(rc == 0 && stats.deleted == 950);
+	// deleted and created again
+	rc = db_update(db, exe2, "/tmp/d", FUSG_DELET, 960);
+	assert(rc == 0);
+	rc = db_update(db, exe1, "/tmp/d", FUSG_CREAT, 970);
+	assert(rc == 0);
+
+	db_retention_t retention = { .expire_before = 300, .deleted_before = 2000 };
+	rc = db_prune_begin(db, &retention);
+	assert(rc == 0 && db_prune_active(db));
+	rc = db_prune_begin(db, &retention);
+	assert(rc == -1);
+
+	int dropped = 0;
+	db_prune_stats_t prune_stats;
+	memset(&prune_stats, 0, sizeof(prune_stats));
+	int steps = 0;
+	while ((rc = db_prune_step(db, 2, 1000, test_db_prune_dropped, &dropped, &prune_stats)) == 1) steps++;
+	assert(rc == 0 && !db_prune_active(db));
+	assert(steps > 3);
+	assert(dropped == 4 && prune_stats.entries == 4);
+	assert(prune_stats.files == 3);
+	assert(prune_stats.execs == 1);
+	assert(prune_stats.reorganised > 0);
+
+	assert(db_file_get_id(db, "/tmp/a") == (uint64_t)-1);
+	assert(db_file_get_id(db, "/tmp/c") == (uint64_t)-1);
+	assert(db_file_get_id(db, "/tmp/old") == (uint64_t)-1);
+	assert(db_exec_get_id(db, exe3) == (uint64_t)-1);
+	assert(db_exec_get_id(db, exe2) != (uint64_t)-1);
+	rc = db_fetch(db, exe1, "/tmp/b", &stats);
+	assert(rc == 0 && stats.read == 1);
+	rc = db_fetch(db, exe1, "/tmp/d", &stats);
+	assert(rc == 0 && stats.create == 1);
+	rc = db_fetch(db, exe2, "/tmp/d", &stats);
+	assert(rc == 0 && stats.deleted == 960);
+
+	// the inode of a pruned file belongs to a new file
+	rc = db_update_r(db, exe1, "/tmp/new", &inode, FUSG_READ, 1100, &key, NULL);
+	assert(rc == 0 && key.file_id != old_id);
+	char buffer[PATH_MAX];
+	rc = db_file_get_aliases(db, key.file_id, buffer, sizeof(buffer));
+	assert(rc == 0);
+	rc = db_update(db, exe1, "/tmp/a", FUSG_READ, 1200);
+	assert(rc == 0);
+	rc = db_fetch(db, exe1, "/tmp/a", &stats);
+	assert(rc == 0 && stats.read == 1);
+
+	// nothing left to do
+	rc = db_prune_begin(db, &retention);
+	assert(rc == 0);
+	memset(&prune_stats, 0, sizeof(prune_stats));
+	while ((rc = db_prune_step(db, 100, 1000, NULL, NULL, &prune_stats)) == 1);
+	assert(rc == 0 && prune_stats.entries == 0 && prune_stats.reorganised == 0);
+
+	// entries added between steps, gdbm skips some of the others
+	char exe[64];
+	char path[64];
+	for (int i = 0; i < 256; i++)
+	{
+		sprintf(path, "/tmp/e%d", i);
+		rc = db_update(db, exe3, path, FUSG_READ, 50);
+		assert(rc == 0);
+	}
+	rc = db_prune_begin(db, &retention);
+	assert(rc == 0);
+	int added = 0;
+	while ((rc = db_prune_step(db, 1, 0, NULL, NULL, NULL)) == 1)
+	{
+		for (int i = 0; i < 8 && added < 2048; i++, added++)
+		{
+			sprintf(exe, "/usr/bin/x%d", added);
+			sprintf(path, "/tmp/e%d", added % 256);
+			rc = db_update(db, exe, path, FUSG_WRITE, 1300);
+			assert(rc == 0);
+		}
+	}
+	assert(rc == 0);
+	for (int i = 0; i < added; i++)
+	{
+		sprintf(exe, "/usr/bin/x%d", i);
+		sprintf(path, "/tmp/e%d", i % 256);
+		rc = db_fetch(db, exe, path, &stats);
+		assert(rc == 0 && stats.write == 1);
+	}
+	db_close(db);
+}
+
+
+void test_db_rollup(void)
+{
+	const char* exe1 = "/usr/bin/make";
+	const char* exe2 = "/usr/bin/rm";
+	fusg_rollup_t rollup;
+
+	int rc = db_delete(DB_BASE_PATH);
+	assert(rc == 0);
+	dbref_t db = db_open(DB_BASE_PATH, DB_WRITE);
+	assert(db != NULL);
+
+	rc = db_update(db, exe1, "/tmp/a", FUSG_READ, 100);
+	assert(rc == 0);
+	rc = db_update(db, exe1, "/tmp/a", FUSG_WRITE, 150);
+	assert(rc == 0);
+	rc = db_update(db, exe1, "/tmp/b", FUSG_CREAT, 1000);
+	assert(rc == 0);
+	rc = db_update(db, exe2, "/tmp/a", FUSG_DELET, 200);
+	assert(rc == 0);
+
+	rc = db_exec_rollup(db, exe1, &rollup);
+	assert(rc == 0 && rollup.entries == 2);
+	assert(rollup.stats.read == 1 && rollup.stats.write == 1 && rollup.stats.create == 1);
+	assert(rollup.stats.time == 1000);
+	rc = db_file_rollup(db, "/tmp/a", &rollup);
+	assert(rc == 0 && rollup.entries == 2);
+	assert(rollup.stats.read == 1 && rollup.stats.write == 1);
+	assert(rollup.stats.time == 200 && rollup.stats.deleted == 200);
+	rc = db_file_rollup(db, "/tmp/none", &rollup);
+	assert(rc == 1);
+
+	// bulk updates
+	fusg_stats_key_t key;
+	rc = db_exec_create_id(db, exe2, &key.exec_id);
+	assert(rc == 0);
+	rc = db_file_create_id(db, "/tmp/b", &key.file_id);
+	assert(rc == 0);
+	fusg_stats_t stats = { .read = 5, .time = 1100 };
+	rc = db_update_stats(db, &key, &stats);
+	assert(rc == 0);
+	rc = db_update_stats(db, &key, &stats);
+	assert(rc == 0);
+	rc = db_file_rollup(db, "/tmp/b", &rollup);
+	assert(rc == 0 && rollup.entries == 2 && rollup.stats.read == 10);
+
+	// pruned entries get subtracted
+	db_retention_t retention = { .expire_before = 300 };
+	rc = db_prune_begin(db, &retention);
+	assert(rc == 0);
+	while ((rc = db_prune_step(db, 100, 1000, NULL, NULL, NULL)) == 1);
+	assert(rc == 0);
+	rc = db_exec_rollup(db, exe1, &rollup);
+	assert(rc == 0 && rollup.entries == 1);
+	assert(rollup.stats.read == 0 && rollup.stats.create == 1);
+	rc = db_file_rollup(db, "/tmp/a", &rollup);
+	assert(rc == 1);
+	db_close(db);
+
+	// rollups of dbs, which had none, get built on open
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/xsum.db", DB_BASE_PATH);
+	rc = unlink(path);
+	assert(rc == 0);
+	snprintf(path, sizeof(path), "%s/fsum.db", DB_BASE_PATH);
+	rc = unlink(path);
+	assert(rc == 0);
+	db = db_open(DB_BASE_PATH, DB_READ);
+	assert(db != NULL);
+	rc = db_exec_rollup(db, exe1, &rollup);
+	assert(rc == -1 && errno == ENOTSUP);
+	db_close(db);
+	db = db_open(DB_BASE_PATH, DB_WRITE);
+	assert(db != NULL);
+	db_close(db);
+	db = db_open(DB_BASE_PATH, DB_READ);
+	assert(db != NULL);
+	rc = db_file_rollup(db, "/tmp/b", &rollup);
+	assert(rc == 0 && rollup.entries == 2 && rollup.stats.read == 10 && rollup.stats.create == 1);
+	db_close(db);
+}
+
+
+void test_db_dirs(void)
+{
+	const char* exe1 = "/usr/bin/make";
+	const char* exe2 = "/usr/bin/rm";
+	fusg_rollup_t rollup;
+
+	int rc = db_delete(DB_BASE_PATH);
+	assert(rc == 0);
+	dbref_t db = db_open(DB_BASE_PATH, DB_WRITE);
+	assert(db != NULL);
+
+	rc = db_update(db, exe1, "/opt/vendor/lib/a.so", FUSG_READ, 100);
+	assert(rc == 0);
+	rc = db_dir_rollup(db, "/opt", &rollup);
+	assert(rc == -1 && errno == ENOTSUP);
+
+	// existing entries get aggregated
+	rc = db_dirs(db, 2, 2);
+	assert(rc == 0);
+	rc = db_dir_rollup(db, "/opt/vendor", &rollup);
+	assert(rc == 0 && rollup.entries == 1 && rollup.stats.time == 100);
+
+	// more directories than pending deltas
+	rc = db_update(db, exe1, "/opt/vendor/lib/a.so", FUSG_READ, 200);
+	assert(rc == 0);
+	rc = db_update(db, exe2, "/opt/vendor/bin/tool", FUSG_EXEC, 300);
+	assert(rc == 0);
+	rc = db_update(db, exe1, "/var/log/x", FUSG_WRITE, 400);
+	assert(rc == 0);
+	rc = db_update(db, exe1, "/opt/other/y", FUSG_CREAT, 500);
+	assert(rc == 0);
+
+	rc = db_dir_rollup(db, "/opt/vendor", &rollup);
+	assert(rc == 0 && rollup.entries == 2);
+	assert(rollup.stats.read == 2 && rollup.stats.exec == 1 && rollup.stats.time == 300);
+	rc = db_dir_rollup(db, "/opt", &rollup);
+	assert(rc == 0 && rollup.entries == 3 && rollup.stats.time == 500);
+	rc = db_dir_rollup(db, "/var/log", &rollup);
+	assert(rc == 0 && rollup.stats.write == 1);
+	rc = db_dir_rollup(db, "/opt/vendor/lib", &rollup);
+	assert(rc == -1 && errno == ERANGE);
+	rc = db_dir_rollup(db, "/", &rollup);
+	assert(rc == -1 && errno == ERANGE);
+	rc = db_dir_rollup(db, "/usr", &rollup);
+	assert(rc == 1);
+
+	// pruned entries get subtracted
+	db_retention_t retention = { .expire_before = 250 };
+	rc = db_prune_begin(db, &retention);
+	assert(rc == 0);
+	while ((rc = db_prune_step(db, 100, 1000, NULL, NULL, NULL)) == 1);
+	assert(rc == 0);
+	rc = db_dir_rollup(db, "/opt/vendor", &rollup);
+	assert(rc == 0 && rollup.entries == 1 && rollup.stats.exec == 1 && rollup.stats.read == 0);
+	db_close(db);
+
+	// readers see what was written and the depth
+	db = db_open(DB_BASE_PATH, DB_READ);
+	assert(db != NULL);
+	rc = db_dir_rollup(db, "/opt", &rollup);
+	assert(rc == 0 && rollup.entries == 2);
+	rc = db_dir_rollup(db, "/opt/vendor/bin", &rollup);
+	assert(rc == -1 && errno == ERANGE);
+	db_close(db);
+
+	// other depth: rebuilt
+	db = db_open(DB_BASE_PATH, DB_WRITE);
+	assert(db != NULL);
+	rc = db_dirs(db, 3, 0);
+	assert(rc == 0);
+	rc = db_dir_rollup(db, "/opt/vendor/bin", &rollup);
+	assert(rc == 0 && rollup.entries == 1 && rollup.stats.time == 300);
+	rc = db_dir_rollup(db, "/opt", &rollup);
+	assert(rc == 0 && rollup.entries == 2);
+	db_close(db);
+
+	// crashed with deltas pending: rebuilt from the entries on disk
+	pid_t pid = fork();
+	assert(pid >= 0);
+	if (!pid)
+	{
+		db = db_open(DB_BASE_PATH, DB_WRITE);
+		if (!db) _exit(1);
+		rc = db_update(db, exe1, "/opt/vendor/lib/b.so", FUSG_READ, 600);
+		rc |= db_update(db, exe2, "/opt/other/z", FUSG_WRITE, 700);
+		_exit(rc ? 1 : 0);
+	}
+	int status;
+	assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	db = db_open(DB_BASE_PATH, DB_WRITE);
+	assert(db != NULL);
+	fusg_stats_t stats;
+	uint64_t entries = 2;
+	entries += !db_fetch(db, exe1, "/opt/vendor/lib/b.so", &stats);
+	entries += !db_fetch(db, exe2, "/opt/other/z", &stats);
+	rc = db_dir_rollup(db, "/opt", &rollup);
+	assert(rc == 0 && rollup.entries == entries);
+	db_close(db);
+}
+
+
+void test_db_dirty(void)
+{
+	db_dirty_t dirty;
+	int rc = db_delete(DB_BASE_PATH);
+	assert(rc == 0);
+	dbref_t db = db_open(DB_BASE_PATH, DB_WRITE);
+	assert(db != NULL);
+	db_dirty(db, &dirty);
+	assert(dirty.updates == 0 && dirty.first_ns == 0);
+
+	rc = db_update(db, "/usr/bin/make", "/tmp/a", FUSG_READ, 100);
+	assert(rc == 0);
+	rc = db_update(db, "/usr/bin/make", "/tmp/b", FUSG_READ, 200);
+	assert(rc == 0);
+	db_dirty(db, &dirty);
+	assert(dirty.updates == 2 && dirty.bytes > 2 * sizeof(fusg_stats_t));
+	assert(dirty.first_ns && dirty.last_ns >= dirty.first_ns);
+
+	rc = db_flush(db);
+	assert(rc == 0);
+	db_dirty(db, &dirty);
+	assert(dirty.updates == 0 && dirty.bytes == 0 && dirty.first_ns == 0);
+	db_close(db);
+}
+
+
+/**
+ * @return number of lines in the log, last line in last
+ */
+static int testsub_log_lines(const char* path, char* last, size_t size)
+{
+	FILE* f = fopen(path, "r");
+	assert(f != NULL);
+	int lines = 0;
+	while (fgets(last, size, f)) lines++;
+	fclose(f);
+	return lines;
+}
+
+void test_logging(void)
+{
+	const char* path = "/tmp/fusg-test.log";
+	char last[256];
+	FILE* f = fopen(path, "w");
+	assert(f != NULL);
+	logging_setup_file(f, 0);
+	logging_set_log_levels(LL_DEBUG, LL_INFO, LL_DEBUG);
+	assert(!log_enabled(LL_DEBUG));
+	assert(log_enabled(LL_INFO));
+
+	// burst, then suppressed
+	for (int i = 0; i < 100; i++) log_limited(LL_WARN, "burst %d", i);
+	assert(testsub_log_lines(path, last, sizeof(last)) == LOG_LIMIT_BURST);
+	logging_flush();
+	assert(testsub_log_lines(path, last, sizeof(last)) == LOG_LIMIT_BURST + 1);
+	assert(strstr(last, "90 similar messages suppressed"));
+
+	// callers building messages themselves skip suppressed ones
+	static log_limit_t limit;
+	int taken = 0;
+	for (int i = 0; i < 100; i++)
+	{
+		if (!log_limit_take(&limit, LL_WARN, "built %d")) continue;
+		log_limit_log(&limit, LL_WARN, "built %d", i);
+		taken++;
+	}
+	assert(taken == LOG_LIMIT_BURST);
+	assert(!log_limit_take(&limit, LL_DEBUG, "built %d"));
+	logging_flush();
+	assert(testsub_log_lines(path, last, sizeof(last)) == 2 * LOG_LIMIT_BURST + 2);
+	assert(strstr(last, "90 similar messages suppressed"));
+
+	// background writer keeps the order
+	int rc = logging_start_async();
+	assert(rc == 0);
+	for (int i = 0; i < 50; i++) log_info("async %d", i);
+	log_debug("not written");
+	logging_flush();
+	assert(testsub_log_lines(path, last, sizeof(last)) == 2 * LOG_LIMIT_BURST + 52);
+	assert(!strcmp(last, "info: async 49\n"));
+	logging_stop_async();
+
+	logging_setup_console(0);
+	logging_set_log_levels(LL_DEBUG, LL_DEBUG, LL_DEBUG);
+	fclose(f);
+	unlink(path);
+}
+
+
+void test_query_protocol(void)
+{
+	int sv[2];
+	int rc = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	assert(rc == 0);
+
+	rc = query_send_request(sv[0], QUERY_FILE, "/home/homac/.mozilla");
+	assert(rc == 0);
+
+	query_request_t request;
+	char arg[PATH_MAX + 1];
+	rc = query_recv_request(sv[1], &request, arg, sizeof(arg));
+	assert(rc == 0);
+	assert(request.type == QUERY_FILE);
+	assert(!strcmp(arg, "/home/homac/.mozilla"));
+
+	fusg_stats_t stats;
+	memset(&stats, 0, sizeof(stats));
+	stats.read = 3;
+	stats.time = 42;
+	rc = query_send_reply(sv[1], QUERY_RECORD, "/usr/bin/firefox", "/home/homac/.mozilla", &stats);
+	assert(rc == 0);
+	rc = query_send_reply(sv[1], QUERY_END, NULL, NULL, NULL);
+	assert(rc == 0);
+
+	query_reply_t reply;
+	char exebuf[PATH_MAX + 1];
+	char filebuf[PATH_MAX + 1];
+	rc = query_recv_reply(sv[0], &reply, exebuf, filebuf);
+	assert(rc == QUERY_RECORD);
+	assert(!strcmp(exebuf, "/usr/bin/firefox"));
+	assert(!strcmp(filebuf, "/home/homac/.mozilla"));
+	assert(reply.stats.read == 3);
+	assert(reply.stats.time == 42);
+	assert(reply.entries == 1);
+	rc = query_recv_reply(sv[0], &reply, exebuf, filebuf);
+	assert(rc == QUERY_END);
+
+	fusg_rollup_t rollup = { .entries = 7, .stats = stats };
+	rc = query_send_rollup(sv[1], NULL, "/home/homac/.mozilla", &rollup);
+	assert(rc == 0);
+	rc = query_recv_reply(sv[0], &reply, exebuf, filebuf);
+	assert(rc == QUERY_RECORD);
+	assert(!exebuf[0] && !strcmp(filebuf, "/home/homac/.mozilla"));
+	assert(reply.entries == 7 && reply.stats.read == 3);
+
+	// argument exceeding the buffer is a protocol error
+	rc = query_send_request(sv[0], QUERY_EXEC, "/usr/bin/thunderbird");
+	assert(rc == 0);
+	rc = query_recv_request(sv[1], &request, arg, 8);
+	assert(rc == -1);
+
+	close(sv[0]);
+	close(sv[1]);
+}
+
+
+static int testsub_live_count(void* ctx, const char* exec, const char* file, const fusg_stats_t* stats)
+{
+	fusg_stats_t* total = ctx;
+	fugs_stats_add(total, stats);
+	return 0;
+}
+
+void test_live_table(void)
+{
+	const char* name = "/fusg-test.live";
+	liveref_t writer = live_create(name, 64);
+	assert(writer != NULL);
+	liveref_t reader = live_open(name);
+	assert(reader != NULL);
+
+	fusg_stats_key_t key = { .exec_id = 1, .file_id = 1 };
+	fusg_stats_t stats = { .read = 1, .time = 1 };
+	int rc = live_update(writer, &key, "/usr/bin/firefox", "/home/homac/.mozilla", &stats);
+	assert(rc == 0);
+	key.exec_id = 2;
+	rc = live_update(writer, &key, "/usr/bin/thunderbird", "/home/homac/.mozilla", &stats);
+	assert(rc == 0);
+	// update of existing entry
+	stats.read = 2;
+	rc = live_update(writer, &key, "/usr/bin/thunderbird", "/home/homac/.mozilla", &stats);
+	assert(rc == 0);
+
+	fusg_stats_t total;
+	memset(&total, 0, sizeof(total));
+	long count = live_lookup_file(reader, "/home/homac/.mozilla", testsub_live_count, &total);
+	assert(count == 2);
+	assert(total.read == 3);
+
+	memset(&total, 0, sizeof(total));
+	count = live_lookup_exec(reader, "/usr/bin/thunderbird", testsub_live_count, &total);
+	assert(count == 1);
+	assert(total.read == 2);
+
+	count = live_lookup_file(reader, "/home/homac/.thunderbird", testsub_live_count, &total);
+	assert(count == 0);
+
+	// writer starts over, when the table fills up
+	char filebuf[64];
+	for (uint64_t i = 0; i < 100; i++)
+	{
+		key.file_id = 100 + i;
+		snprintf(filebuf, sizeof(filebuf), "/tmp/file.%lu", i);
+		rc = live_update(writer, &key, "/usr/bin/thunderbird", filebuf, &stats);
+		assert(rc == 0);
+	}
+	memset(&total, 0, sizeof(total));
+	count = live_lookup_file(reader, "/tmp/file.99", testsub_live_count, &total);
+	assert(count == 1);
+
+	// next run of the writer takes the table over, empty
+	live_close(writer);
+	writer = live_create(name, 64);
+	assert(writer != NULL);
+	count = live_lookup_file(reader, "/tmp/file.99", testsub_live_count, &total);
+	assert(count == 0);
+	rc = live_update(writer, &key, "/usr/bin/thunderbird", "/tmp/file.99", &stats);
+	assert(rc == 0);
+	count = live_lookup_file(reader, "/tmp/file.99", testsub_live_count, &total);
+	assert(count == 1);
+
+	// or replaces it, while the reader keeps its mapping
+	live_close(writer);
+	writer = live_create(name, 1024);
+	assert(writer != NULL);
+	count = live_lookup_file(reader, "/tmp/file.99", testsub_live_count, &total);
+	assert(count == 1);
+	live_close(reader);
+	reader = live_open(name);
+	assert(reader != NULL);
+	count = live_lookup_file(reader, "/tmp/file.99", testsub_live_count, &total);
+	assert(count == 0);
+
+	live_close(reader);
+	live_destroy(writer);
+	assert(live_open(name) == NULL);
+}
+
+
+void test_generate(void)
+{
+	const char* presets[] = { "find", "ide", "build", "idle" };
+	for (int i = 0; i < 4; i++)
+	{
+		generate_params_t params = *generate_preset(presets[i]);
+		params.events = 100;
+
+		char* buf = NULL;
+		size_t size = 0;
+		FILE* out = open_memstream(&buf, &size);
+		assert(out != NULL);
+		int rc = generate(out, &params);
+		assert(rc == 0);
+		fclose(out);
+
+		// one SYSCALL, CWD, PATH and EOE record per event
+		int records = 0;
+		for (char* p = buf; (p = strchr(p, '\n')); p++) records++;
+		assert(records == 4 * 100);
+		assert(strstr(buf, "msg=audit(1600000000.000:1): ") != NULL);
+
+		// a path keeps its inode
+		char names[100][256];
+		unsigned long inodes[100];
+		int paths = 0;
+		for (char* p = buf; (p = strstr(p, "type=PATH ")); p++)
+		{
+			char name[256];
+			unsigned long inode;
+			rc = sscanf(strstr(p, " name="), " name=\"%255[^\"]\" inode=%lu", name, &inode);
+			assert(rc == 2);
+			for (int k = 0; k < paths; k++)
+			{
+				assert(strcmp(names[k], name) || inodes[k] == inode);
+			}
+			strcpy(names[paths], name);
+			inodes[paths++] = inode;
+		}
+		assert(paths == 100);
+		free(buf);
+	}
+	assert(generate_preset("none") == NULL);
+}
+
+
+void test_degrade_load(void)
+{
+	global.conf.fusgd_degrade_lag = 4;
+	global.conf.fusgd_degrade_backlog = 50;
+	assert(degrade_load(5, 0) == 1);
+	assert(degrade_load(0, 60) == 1);
+	assert(degrade_load(3, 10) == 0);
+	assert(degrade_load(1, 30) == 0);
+	assert(degrade_load(2, 25) == -1);
+
+	// a disabled limit doesn't keep fusgd degraded
+	global.conf.fusgd_degrade_backlog = 0;
+	assert(degrade_load(5, 100) == 1);
+	assert(degrade_load(1, 100) == -1);
+	global.conf.fusgd_degrade_lag = 0;
+	global.conf.fusgd_degrade_backlog = 50;
+	assert(degrade_load(100, 60) == 1);
+	assert(degrade_load(100, 20) == -1);
+
+	memset(&global.conf, 0, sizeof(global.conf));
+}
+
+
+static struct {
+	unsigned long serial;
+	int records;
+	size_t len;
+} test_assembled[16];
+static size_t test_assembled_num = 0;
+
+static void test_assemble_emit(const char* records, size_t len)
+{
+	assert(test_assembled_num < 16);
+	char first[128];
+	snprintf(first, sizeof(first), "%.*s", (int)(len < 127 ? len : 127), records);
+	const char* stamp = strstr(first, "audit(");
+	assert(stamp && 1 == sscanf(stamp, "audit(%*u.%*u:%lu)", &test_assembled[test_assembled_num].serial));
+	int n = 0;
+	for (size_t i = 0; i < len; i++) n += (records[i] == '\n');
+	test_assembled[test_assembled_num].records = n;
+	test_assembled[test_assembled_num++].len = len;
+}
+
+static void test_assemble_add(const char* type, unsigned long time_ms, unsigned long serial)
+{
+	char line[128];
+	int len = snprintf(line, sizeof(line), "type=%s msg=audit(%lu.%03lu:%lu): x\n",
+			type, time_ms / 1000, time_ms % 1000, serial);
+	assemble_record(line, len);
+}
+
+void test_assemble(void)
+{
+	int rc = assemble_init(4, 1000, test_assemble_emit);
+	assert(rc == 0);
+
+	// EOE completes, an EOE after completion is dropped
+	test_assemble_add("SYSCALL", 1000000, 1);
+	test_assemble_add("PATH", 1000000, 1);
+	assert(test_assembled_num == 0 && assemble_inflight() == 1);
+	test_assemble_add("EOE", 1000000, 1);
+	assert(test_assembled_num == 1 && test_assembled[0].serial == 1 && test_assembled[0].records == 3);
+	test_assemble_add("EOE", 1000000, 1);
+	assert(test_assembled_num == 1 && assemble_inflight() == 0);
+	assert(assemble_offset() == assemble_bytes());
+
+	// single record events complete right away
+	test_assemble_add("LOGIN", 1000000, 3);
+	assert(test_assembled_num == 2 && test_assembled[1].serial == 3 && assemble_inflight() == 0);
+
+	// slot collision: the older event is completed early
+	uint64_t evicted = metrics.counters[METRIC_EVENTS_EVICTED];
+	test_assemble_add("SYSCALL", 1000000, 2);
+	uint64_t offset = assemble_offset();
+	test_assemble_add("SYSCALL", 1000000, 6);
+	assert(test_assembled_num == 3 && test_assembled[2].serial == 2 && test_assembled[2].records == 1);
+	assert(metrics.counters[METRIC_EVENTS_EVICTED] == evicted + 1);
+	assert(assemble_offset() > offset);
+
+	// timeout by event time, oldest first
+	uint64_t timed_out = metrics.counters[METRIC_EVENTS_TIMED_OUT];
+	test_assemble_add("SYSCALL", 1000500, 7);
+	test_assemble_add("SYSCALL", 1001000, 9);
+	assert(test_assembled_num == 3);
+	test_assemble_add("PATH", 1001600, 9);
+	assert(test_assembled_num == 5 && test_assembled[3].serial == 6 && test_assembled[4].serial == 7);
+	assert(metrics.counters[METRIC_EVENTS_TIMED_OUT] == timed_out + 2);
+	assemble_flush();
+	assert(test_assembled_num == 6 && test_assembled[5].serial == 9 && test_assembled[5].records == 2);
+	test_assembled_num = 0;
+
+	// record and byte limits
+	uint64_t limited = metrics.counters[METRIC_EVENTS_LIMITED];
+	for (int i = 0; i < 256; i++) test_assemble_add("PATH", 1002000, 12);
+	assert(test_assembled_num == 1 && test_assembled[0].records == 256);
+	size_t big_len = 100 * 1024;
+	char* big = malloc(big_len);
+	assert(big != NULL);
+	memset(big, 'x', big_len);
+	int header = sprintf(big, "type=PATH msg=audit(1002.000:13): ");
+	big[header] = 'x';
+	big[big_len - 1] = '\n';
+	assemble_record(big, big_len);
+	assemble_record(big, big_len);
+	assert(test_assembled_num == 1);
+	assemble_record(big, big_len);
+	assert(test_assembled_num == 2 && test_assembled[1].serial == 13 && test_assembled[1].len == 3 * big_len);
+	assert(metrics.counters[METRIC_EVENTS_LIMITED] == limited + 2);
+	free(big);
+	test_assembled_num = 0;
+
+	// resizing keeps the arrival order, collisions complete the older
+	test_assemble_add("SYSCALL", 1002000, 22);
+	test_assemble_add("SYSCALL", 1002000, 20);
+	test_assemble_add("SYSCALL", 1002000, 21);
+	rc = assemble_resize(8, 1000);
+	assert(rc == 0);
+	uint64_t serials[4];
+	assert(assemble_serials(serials, 4) == 3);
+	assert(serials[0] == 22 && serials[1] == 20 && serials[2] == 21);
+	assert(test_assembled_num == 0);
+	rc = assemble_resize(1, 1000);
+	assert(rc == 0);
+	assert(test_assembled_num == 2 && test_assembled[0].serial == 22 && test_assembled[1].serial == 20);
+	assert(assemble_serials(serials, 4) == 1 && serials[0] == 21);
+	test_assemble_add("EOE", 1002000, 21);
+	assert(test_assembled_num == 3 && test_assembled[2].serial == 21 && test_assembled[2].records == 2);
+	assert(assemble_inflight() == 0);
+
+	assemble_destroy();
+	test_assembled_num = 0;
+}
+
+
+static size_t test_spool_emitted = 0;
+
+static void test_spool_emit(const char* records, size_t len)
+{
+	(void)records;
+	test_spool_emitted++;
+}
+
+
+/**
+ * @return read offset in the spool's header
+ */
+static unsigned long test_spool_header(const char* path)
+{
+	char header[64] = "";
+	unsigned long offset = 0;
+	FILE* in = fopen(path, "r");
+	assert(in != NULL);
+	assert(fgets(header, sizeof(header), in) != NULL);
+	fclose(in);
+	assert(1 == sscanf(header, "fusgd-spool %lu", &offset));
+	return offset;
+}
+
+
+void test_spool(void)
+{
+	const char* path = DB_BASE_PATH "-spool";
+	const char* event = "type=SYSCALL msg=audit(1600000000.000:1): a\n"
+			"type=PATH msg=audit(1600000000.000:1): b\n";
+	unlink(path);
+	int rc = assemble_init(16, 0, test_spool_emit);
+	assert(rc == 0);
+	rc = spool_open(path, 1 << 20);
+	assert(rc == 0);
+	unsigned long start = test_spool_header(path);
+
+	// lines in flight aren't processed yet
+	rc = spool_write(event, strlen(event));
+	assert(rc == 0);
+	assert(spool_active());
+	size_t len;
+	const char* line;
+	while ((line = spool_line(&len))) assemble_record(line, len);
+	assert(!spool_active());
+	spool_checkpoint();
+	assert(test_spool_header(path) == start);
+
+	assemble_flush();
+	assert(test_spool_emitted == 1);
+	spool_checkpoint();
+	struct stat st;
+	rc = stat(path, &st);
+	assert(rc == 0 && (unsigned long)st.st_size == start);
+
+	// the intake passes input on in order
+	int fds[2];
+	rc = pipe(fds);
+	assert(rc == 0);
+	int fd = spool_intake_start(fds[0], 50);
+	assert(fd != -1);
+	assert(write(fds[1], event, strlen(event)) == (ssize_t)strlen(event));
+	close(fds[1]);
+	reader_t input;
+	rc = reader_init(&input, fd, 4096);
+	assert(rc == 0);
+	char got[256] = "";
+	while (reader_fill(&input) > 0 || !input.eof);
+	memcpy(got, input.buf, reader_pending(&input));
+	assert(!strcmp(got, event));
+	reader_consume(&input, reader_pending(&input));
+	rc = spool_intake_stop(&input);
+	assert(rc == fds[0]);
+	assert(!spool_active());
+	close(fds[0]);
+	reader_destroy(&input);
+
+	// the intake's input is kept on close
+	rc = pipe(fds);
+	assert(rc == 0);
+	fd = spool_intake_start(fds[0], 50);
+	assert(fd != -1);
+	assert(write(fds[1], event, strlen(event)) == (ssize_t)strlen(event));
+	close(fds[1]);
+	struct pollfd passed = { .fd = fd, .events = POLLIN };
+	rc = poll(&passed, 1, 5000);
+	assert(rc == 1);
+	spool_close();
+	close(fd);
+	close(fds[0]);
+	rc = stat(path, &st);
+	assert(rc == 0 && (unsigned long)st.st_size == start + strlen(event));
+	assert(test_spool_header(path) == start);
+
+	unlink(path);
+	assemble_destroy();
+}
+
+
+static uint64_t test_tail_emitted[16];
+static size_t test_tail_num = 0;
+
+static void test_tail_emit(const char* records, size_t len)
+{
+	if (tail_skip(records, len)) return;
+	unsigned long serial = 0;
+	const char* stamp = strstr(records, "audit(");
+	assert(stamp && 1 == sscanf(stamp, "audit(%*u.%*u:%lu)", &serial));
+	assert(test_tail_num < 16);
+	test_tail_emitted[test_tail_num++] = serial;
+}
+
+static void test_tail_append(const char* path, const char* data)
+{
+	FILE* out = fopen(path, "a");
+	assert(out != NULL);
+	fputs(data, out);
+	fclose(out);
+}
+
+/**
+ * Reads until tail_follow() finds nothing more.
+ */
+static void test_tail_read(reader_t* input)
+{
+	for (;;)
+	{
+		size_t len;
+		const char* line = reader_line(input, &len);
+		if (line) assemble_record(line, len);
+		else if (!input->eof) reader_fill(input);
+		else if (!tail_follow(input)) break;
+	}
+}
+
+
+void test_tail(void)
+{
+	const char* path = DB_BASE_PATH "-audit.log";
+	const char* state = DB_BASE_PATH "-audit.state";
+	char rotated[2][PATH_MAX];
+	snprintf(rotated[0], PATH_MAX, "%s.1", path);
+	snprintf(rotated[1], PATH_MAX, "%s.2", path);
+	unlink(path);
+	unlink(rotated[0]);
+	unlink(rotated[1]);
+	unlink(state);
+	global.conf.fusgd_inflight_max = 16;
+
+	// 2 is in flight, 4 is stored at the checkpoint
+	test_tail_append(path,
+			"type=SYSCALL msg=audit(1000.000:1): a\n"
+			"type=EOE msg=audit(1000.000:1): \n"
+			"type=SYSCALL msg=audit(1000.002:2): b\n"
+			"type=SYSCALL msg=audit(1000.004:4): d\n"
+			"type=EOE msg=audit(1000.004:4): \n");
+	int rc = assemble_init(16, 60000, test_tail_emit);
+	assert(rc == 0);
+	int fd = tail_open(path, state);
+	assert(fd != -1);
+	reader_t input;
+	rc = reader_init(&input, fd, 4096);
+	assert(rc == 0);
+	input.follow = 1;
+	test_tail_read(&input);
+	assert(test_tail_num == 2 && test_tail_emitted[0] == 1 && test_tail_emitted[1] == 4);
+	tail_checkpoint();
+	tail_close();
+	reader_destroy(&input);
+	assemble_destroy();
+
+	// 3 started before 4, but its syscall took longer
+	test_tail_append(path,
+			"type=EOE msg=audit(1000.002:2): \n"
+			"type=SYSCALL msg=audit(1000.003:3): c\n"
+			"type=EOE msg=audit(1000.003:3): \n");
+	test_tail_num = 0;
+	rc = assemble_init(16, 60000, test_tail_emit);
+	assert(rc == 0);
+	fd = tail_open(path, state);
+	assert(fd != -1);
+	rc = reader_init(&input, fd, 4096);
+	assert(rc == 0);
+	input.follow = 1;
+	test_tail_read(&input);
+	assert(test_tail_num == 2 && test_tail_emitted[0] == 2 && test_tail_emitted[1] == 3);
+
+	// rotated twice before the end of the file was noticed
+	rc = rename(path, rotated[0]);
+	assert(rc == 0);
+	test_tail_append(path, "type=SYSCALL msg=audit(1001.000:5): e\ntype=EOE msg=audit(1001.000:5): \n");
+	rc = rename(rotated[0], rotated[1]) || rename(path, rotated[0]);
+	assert(rc == 0);
+	test_tail_append(path, "type=SYSCALL msg=audit(1002.000:6): f\ntype=EOE msg=audit(1002.000:6): \n");
+	test_tail_read(&input);
+	assert(test_tail_num == 4 && test_tail_emitted[2] == 5 && test_tail_emitted[3] == 6);
+
+	tail_close();
+	reader_destroy(&input);
+	assemble_destroy();
+	unlink(path);
+	unlink(rotated[0]);
+	unlink(rotated[1]);
+	unlink(state);
+	memset(&global.conf, 0, sizeof(global.conf));
+}
+
+
+static void* test_metrics_thread(void* arg)
+{
+	metrics_thread(arg);
+	for (int i = 0; i < 1000; i++) metrics_inc(METRIC_QUERIES);
+	metrics_add(METRIC_SPOOLED_BYTES, 4096);
+	return NULL;
+}
+
+void test_metrics(void)
+{
+	static metrics_block_t block;
+	uint64_t queries = metrics_total(METRIC_QUERIES);
+	uint64_t spooled = metrics_total(METRIC_SPOOLED_BYTES);
+
+	// counted by the thread and the main thread, summed up
+	pthread_t thread;
+	int rc = pthread_create(&thread, NULL, test_metrics_thread, &block);
+	assert(rc == 0);
+	for (int i = 0; i < 1000; i++) metrics_inc(METRIC_QUERIES);
+	pthread_join(thread, NULL);
+	assert(metrics_total(METRIC_QUERIES) == queries + 2000);
+	assert(block.counters[METRIC_QUERIES] == 1000);
+
+	// the block keeps its counts for a thread started again
+	rc = pthread_create(&thread, NULL, test_metrics_thread, &block);
+	assert(rc == 0);
+	pthread_join(thread, NULL);
+	assert(metrics_total(METRIC_QUERIES) == queries + 3000);
+	assert(metrics_total(METRIC_SPOOLED_BYTES) == spooled + 8192);
+}
+
+
+void test_procs(void)
+{
+	procsref_t procs = procs_create(4);
+	assert(procs != NULL);
+	assert(!procs_exe(procs, 100, "\"/usr/bin/make\""));
+
+	const char* exe = procs_set_exe(procs, 100, "\"/usr/bin/make\"", "/usr/bin/make");
+	assert(exe && !strcmp(exe, "/usr/bin/make"));
+	assert(procs_exe(procs, 100, "\"/usr/bin/make\"") == exe);
+	assert(!procs_exe(procs, 100, "\"/usr/bin/cc\""));
+	assert(!procs_set_exe(procs, 0, "\"/usr/bin/make\"", "/usr/bin/make"));
+
+	// cwd needs the executable
+	assert(!procs_set_cwd(procs, 101, "\"/tmp\"", "/tmp"));
+	const char* cwd = procs_set_cwd(procs, 100, "\"/tmp\"", "/tmp");
+	assert(cwd && !strcmp(cwd, "/tmp"));
+	assert(procs_cwd(procs, 100, "\"/tmp\"") == cwd);
+	assert(!procs_cwd(procs, 100, "\"/home\""));
+	cwd = procs_set_cwd(procs, 100, "2F686F6D65", "/home");
+	assert(procs_cwd(procs, 100, "2F686F6D65") == cwd && !procs_cwd(procs, 100, "\"/tmp\""));
+
+	// exec of the same file keeps the entry
+	assert(procs_set_exe(procs, 100, "\"/usr/bin/make\"", "/usr/bin/make") == exe);
+	assert(procs_cwd(procs, 100, "2F686F6D65") == cwd);
+
+	// exec of another file or pid reused: new entry without cwd
+	exe = procs_set_exe(procs, 100, "\"/usr/bin/cc\"", "/usr/bin/cc");
+	assert(exe && procs_exe(procs, 100, "\"/usr/bin/cc\"") == exe);
+	assert(!procs_exe(procs, 100, "\"/usr/bin/make\""));
+	assert(!procs_cwd(procs, 100, "2F686F6D65"));
+
+	// slot collision: the newer pid takes it
+	assert(procs_set_exe(procs, 104, "\"/usr/bin/rm\"", "/usr/bin/rm"));
+	assert(!procs_exe(procs, 100, "\"/usr/bin/cc\""));
+	assert(procs_exe(procs, 104, "\"/usr/bin/rm\""));
+	assert(procs_set_exe(procs, 101, "\"/usr/bin/ls\"", "/usr/bin/ls"));
+	assert(procs_exe(procs, 104, "\"/usr/bin/rm\""));
+
+	// exit drops the entry, others stay
+	procs_exit(procs, 104);
+	procs_exit(procs, 100);
+	assert(!procs_exe(procs, 104, "\"/usr/bin/rm\""));
+	assert(procs_exe(procs, 101, "\"/usr/bin/ls\""));
+	procs_destroy(procs);
+}
+
+
+static void test_serial_track(unsigned long serial)
+{
+	au_event_t event = { .sec = 0, .milli = 0, .serial = serial, .host = "test-serial" };
+	serial_track(&event);
+}
+
+void test_serial(void)
+{
+	// other tests may have tracked events already
+	serial_stats_t before, after;
+	serial_totals(&before);
+
+	// gap, late arrival, duplicate, restart of auditd
+	unsigned long serials[] = { 1, 2, 5, 3, 3, 1000000, 7 };
+	for (int i = 0; i < sizeof(serials) / sizeof(serials[0]); i++) test_serial_track(serials[i]);
+	serial_totals(&after);
+	assert(after.events - before.events == 7);
+	assert(after.missing - before.missing == 2 - 1 + 999994);
+	assert(after.duplicates - before.duplicates == 1);
+	assert(after.reordered - before.reordered == 1);
+	assert(after.stale - before.stale == 0);
+	assert(after.resets - before.resets == 1);
+
+	// restarted at 7: no duplicate, the window was cleared
+	test_serial_track(5);
+	test_serial_track(8);
+	serial_totals(&after);
+	assert(after.duplicates - before.duplicates == 1);
+	assert(after.reordered - before.reordered == 2);
+	assert(after.missing - before.missing == 999994);
+
+	// behind the window: stale
+	test_serial_track(5008);
+	test_serial_track(8);
+	serial_totals(&after);
+	assert(after.missing - before.missing == 999994 + 4999);
+	assert(after.stale - before.stale == 1);
+
+	// 4104 reuses the bit of 8 which was cleared when moving the window
+	test_serial_track(4104);
+	test_serial_track(4104);
+	serial_totals(&after);
+	assert(after.reordered - before.reordered == 3);
+	assert(after.duplicates - before.duplicates == 2);
+	assert(after.missing - before.missing == 999994 + 4998);
+	assert(after.events - before.events == 13);
+	assert(after.resets - before.resets == 1);
+}
+
+
+void test_input_order(void)
+{
+	// rotated logs, newest first by name
+	const char* names[] = { "", ".1", ".2", ".10" };
+	char path[PATH_MAX];
+	char data[128];
+	for (int i = 0; i < 4; i++)
+	{
+		snprintf(path, PATH_MAX, "%s-input.log%s", DB_BASE_PATH, names[i]);
+		snprintf(data, sizeof(data), "type=SYSCALL msg=audit(%d.250:%d): x\n", 4000 - i * 1000, 40 - i);
+		unlink(path);
+		// compressed ones by their first record as well
+		if (i == 3)
+		{
+			gzFile gz = gzopen(path, "wb");
+			assert(gz != NULL);
+			gzputs(gz, data);
+			gzclose(gz);
+		}
+		else if (i == 2)
+		{
+			char packed[256];
+			size_t len = ZSTD_compress(packed, sizeof(packed), data, strlen(data), 1);
+			assert(!ZSTD_isError(len));
+			FILE* out = fopen(path, "w");
+			assert(out != NULL && fwrite(packed, 1, len, out) == len);
+			fclose(out);
+		}
+		else test_tail_append(path, data);
+	}
+
+	int rc = input_add(DB_BASE_PATH "-input.log*");
+	assert(rc == 4 && input_files() == 4);
+	for (int i = 0; i < 4; i++)
+	{
+		snprintf(path, PATH_MAX, "%s-input.log%s", DB_BASE_PATH, names[3 - i]);
+		assert(!strcmp(input_file(i), path));
+	}
+	rc = input_add(DB_BASE_PATH "-input.none*");
+	assert(rc == -1 && input_files() == 4);
+
+	input_clear();
+	for (int i = 0; i < 4; i++)
+	{
+		snprintf(path, PATH_MAX, "%s-input.log%s", DB_BASE_PATH, names[i]);
+		unlink(path);
+	}
+}
+
+
+int main(int argc, char** argv) {
+	if (argc > 1 && !strcmp(argv[1], "--generate"))
+	{
+		return generate_main(argc - 1, argv + 1);
+	}
+
 	test_coredump_pattern();
 	test_coredump_size();
 	test_fabsolute();
@@ -330,5 +1718,27 @@ int main(void) {
 
 	test_db_search();
 
+	test_db_snapshot();
+	test_db_batch();
+	test_db_update_stats();
+	test_db_inodes();
+	test_db_prune();
+	test_db_rollup();
+	test_db_dirs();
+	test_db_dirty();
+
+	test_logging();
+	test_query_protocol();
+	test_live_table();
+	test_generate();
+	test_degrade_load();
+	test_assemble();
+	test_spool();
+	test_tail();
+	test_input_order();
+	test_procs();
+	test_serial();
+	test_metrics();
+
 	return EXIT_SUCCESS;
 }
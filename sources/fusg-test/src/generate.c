@@ -0,0 +1,282 @@
+/*
+ * generate.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#include "generate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fusg/logging.h"
+
+
+/** number of recently used paths considered for repetitions */
+#define GENERATE_RECENT 64
+#define GENERATE_PATH_MAX 512
+#define GENERATE_DEPTH_MAX 32
+
+/** time stamp of the first event (reproducible output) */
+#define GENERATE_EPOCH 1600000000UL
+
+#define SYSCALL_OPEN   2
+#define SYSCALL_OPENAT 257
+
+
+static const generate_params_t presets[] = {
+	{
+		// single process walking a huge tree: paths drawn at random from
+		// fanout^depth, so they hardly repeat (unlike the real find, which
+		// visits each path exactly once)
+		.name = "find", .exe = "find", .root = "/",
+		.events = 100000, .execs = 1, .depth = 8, .fanout = 12,
+		.relative = 0.9, .locality = 0.02, .failures = 0.01, .creates = 0,
+		.burst = 100000, .burst_gap_ms = 0, .event_gap_us = 20,
+	},
+	{
+		// few processes, many class path lookups, lots of them failing
+		.name = "ide", .exe = "java", .root = "/home/user/workspace",
+		.events = 100000, .execs = 8, .depth = 6, .fanout = 20,
+		.relative = 0.2, .locality = 0.5, .failures = 0.3, .creates = 0.02,
+		.burst = 5000, .burst_gap_ms = 200, .event_gap_us = 50,
+	},
+	{
+		// many short lived processes reading the same headers
+		.name = "build", .exe = "cc1", .root = "/home/user/project",
+		.events = 100000, .execs = 40, .depth = 5, .fanout = 15,
+		.relative = 0.7, .locality = 0.7, .failures = 0.2, .creates = 0.05,
+		.burst = 200, .burst_gap_ms = 50, .event_gap_us = 100,
+	},
+	{
+		// desktop applications touching the same few files now and then
+		.name = "idle", .exe = "app", .root = "/home/user",
+		.events = 10000, .execs = 30, .depth = 4, .fanout = 8,
+		.relative = 0.1, .locality = 0.9, .failures = 0.05, .creates = 0.01,
+		.burst = 5, .burst_gap_ms = 2000, .event_gap_us = 1000,
+	},
+};
+
+
+typedef struct {
+	const generate_params_t* p;
+	uint64_t rnd;
+	char recent[GENERATE_RECENT][GENERATE_PATH_MAX];
+	unsigned num_recent;
+	unsigned next_recent;
+} generator_t;
+
+
+
+static uint64_t gen_random(generator_t* g)
+{
+	// xorshift64*: same output on all platforms
+	g->rnd ^= g->rnd >> 12;
+	g->rnd ^= g->rnd << 25;
+	g->rnd ^= g->rnd >> 27;
+	return g->rnd * 2685821657736338717UL;
+}
+
+static double gen_uniform(generator_t* g)
+{
+	return (gen_random(g) >> 11) * (1.0 / (1UL << 53));
+}
+
+static unsigned gen_below(generator_t* g, unsigned n)
+{
+	return n ? gen_random(g) % n : 0;
+}
+
+
+/**
+ * Generates a path relative to the root of the tree.
+ */
+static void gen_path(generator_t* g, char* path)
+{
+	const generate_params_t* p = g->p;
+	if (g->num_recent && gen_uniform(g) < p->locality)
+	{
+		strcpy(path, g->recent[gen_below(g, g->num_recent)]);
+		return;
+	}
+
+	unsigned depth = 1 + gen_below(g, p->depth);
+	size_t len = 0;
+	for (unsigned i = 1; i < depth; i++)
+	{
+		len += sprintf(path + len, "dir%u/", gen_below(g, p->fanout));
+	}
+	sprintf(path + len, "file%u", gen_below(g, p->fanout));
+
+	strcpy(g->recent[g->next_recent], path);
+	g->next_recent = (g->next_recent + 1) % GENERATE_RECENT;
+	if (g->num_recent < GENERATE_RECENT) g->num_recent++;
+}
+
+
+/**
+ * @return inode of a path relative to the root of the tree, the same
+ *         for each occurrence of the path, as for a real file
+ */
+static unsigned long gen_inode(const char* relpath)
+{
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	for (; *relpath; relpath++)
+	{
+		h ^= (unsigned char)*relpath;
+		h *= 16777619u;
+	}
+	// clear of the low, reserved inode numbers
+	return 1000 + (h & 0x7fffffff);
+}
+
+
+static int gen_event(generator_t* g, FILE* out, uint64_t t_us, unsigned long serial, unsigned exe)
+{
+	const generate_params_t* p = g->p;
+	char ts[64];
+	snprintf(ts, sizeof(ts), "audit(%lu.%03lu:%lu)",
+			GENERATE_EPOCH + t_us / 1000000, (t_us / 1000) % 1000, serial);
+
+	char exepath[GENERATE_PATH_MAX];
+	if (p->execs > 1) snprintf(exepath, sizeof(exepath), "/usr/bin/%s-%u", p->exe, exe);
+	else snprintf(exepath, sizeof(exepath), "/usr/bin/%s", p->exe);
+
+	char relpath[GENERATE_PATH_MAX];
+	gen_path(g, relpath);
+	int relative = gen_uniform(g) < p->relative;
+	int failed = gen_uniform(g) < p->failures;
+	int create = !failed && gen_uniform(g) < p->creates;
+	const char* sep = (p->root[strlen(p->root) - 1] == '/') ? "" : "/";
+
+	fprintf(out, "type=SYSCALL msg=%s: arch=c000003e syscall=%d success=%s exit=%d"
+			" a0=ffffff9c a1=7ffc5e1f3000 a2=%x a3=0 items=1 ppid=1 pid=%u"
+			" auid=1000 uid=1000 gid=1000 euid=1000 suid=1000 fsuid=1000"
+			" egid=1000 sgid=1000 fsgid=1000 tty=pts0 ses=1 comm=\"%s\" exe=\"%s\" key=(null)\n",
+			ts, relative ? SYSCALL_OPENAT : SYSCALL_OPEN,
+			failed ? "no" : "yes", failed ? -2 : 3,
+			create ? 0x241 : 0, 1000 + exe, p->exe, exepath);
+	fprintf(out, "type=CWD msg=%s: cwd=\"%s\"\n", ts, p->root);
+	fprintf(out, "type=PATH msg=%s: item=0 name=\"%s%s%s\" inode=%lu dev=08:01"
+			" mode=0100644 ouid=1000 ogid=1000 rdev=00:00 nametype=%s"
+			" cap_fp=0 cap_fi=0 cap_fe=0 cap_fver=0\n",
+			ts, relative ? "" : p->root, relative ? "" : sep, relpath,
+			gen_inode(relpath), failed ? "UNKNOWN" : (create ? "CREATE" : "NORMAL"));
+	return (fprintf(out, "type=EOE msg=%s:\n", ts) < 0) ? -1 : 0;
+}
+
+
+const generate_params_t* generate_preset(const char* name)
+{
+	for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); i++)
+	{
+		if (!strcmp(presets[i].name, name)) return &presets[i];
+	}
+	return NULL;
+}
+
+
+int generate(FILE* out, const generate_params_t* params)
+{
+	generator_t* g = calloc(1, sizeof(generator_t));
+	if (!g) return -1;
+	g->p = params;
+	g->rnd = params->seed ? params->seed : 0x9e3779b97f4a7c15UL;
+
+	int rc = 0;
+	uint64_t t_us = 0;
+	unsigned exe = 0;
+	for (unsigned long serial = 1; !rc && serial <= params->events; serial++)
+	{
+		if (params->burst && (serial - 1) % params->burst == 0)
+		{
+			// new burst, most probably of another process
+			if (serial > 1) t_us += params->burst_gap_ms * 1000UL;
+			exe = gen_below(g, params->execs);
+		}
+		else
+		{
+			t_us += params->event_gap_us;
+			if (gen_uniform(g) < 0.1) exe = gen_below(g, params->execs);
+		}
+		rc = gen_event(g, out, t_us, serial, exe);
+	}
+	free(g);
+	return rc;
+}
+
+
+
+static void generate_usage(void)
+{
+	printf("> fusg-test --generate <preset> [options] > audit.log\n");
+	printf("presets: find, ide, build, idle\n");
+	printf("options (override the preset):\n");
+	printf("  --events N      number of events\n");
+	printf("  --execs N       number of executables\n");
+	printf("  --depth N       depth of the path tree (max %d)\n", GENERATE_DEPTH_MAX);
+	printf("  --fanout N      entries per directory\n");
+	printf("  --relative R    ratio of relative paths [0..1]\n");
+	printf("  --locality R    probability to repeat a recent path [0..1]\n");
+	printf("  --failures R    ratio of failed syscalls [0..1]\n");
+	printf("  --creates R     ratio of created files [0..1]\n");
+	printf("  --burst N       events per burst\n");
+	printf("  --gap MS        pause between bursts\n");
+	printf("  --interval US   time between events within a burst\n");
+	printf("  --seed N        seed of the random generator\n");
+}
+
+int generate_main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		generate_usage();
+		return EXIT_FAILURE;
+	}
+	const generate_params_t* preset = generate_preset(argv[1]);
+	if (!preset)
+	{
+		log_error("unknown preset: '%s'", argv[1]);
+		generate_usage();
+		return EXIT_FAILURE;
+	}
+	generate_params_t params = *preset;
+
+	for (int i = 2; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			log_error("missing value: %s", arg);
+			return EXIT_FAILURE;
+		}
+		const char* value = argv[++i];
+		if (!strcmp(arg, "--events")) params.events = strtoul(value, NULL, 10);
+		else if (!strcmp(arg, "--execs")) params.execs = strtoul(value, NULL, 10);
+		else if (!strcmp(arg, "--depth")) params.depth = strtoul(value, NULL, 10);
+		else if (!strcmp(arg, "--fanout")) params.fanout = strtoul(value, NULL, 10);
+		else if (!strcmp(arg, "--relative")) params.relative = strtod(value, NULL);
+		else if (!strcmp(arg, "--locality")) params.locality = strtod(value, NULL);
+		else if (!strcmp(arg, "--failures")) params.failures = strtod(value, NULL);
+		else if (!strcmp(arg, "--creates")) params.creates = strtod(value, NULL);
+		else if (!strcmp(arg, "--burst")) params.burst = strtoul(value, NULL, 10);
+		else if (!strcmp(arg, "--gap")) params.burst_gap_ms = strtoul(value, NULL, 10);
+		else if (!strcmp(arg, "--interval")) params.event_gap_us = strtoul(value, NULL, 10);
+		else if (!strcmp(arg, "--seed")) params.seed = strtoull(value, NULL, 10);
+		else
+		{
+			log_error("illegal argument: %s", arg);
+			generate_usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (params.depth < 1 || params.depth > GENERATE_DEPTH_MAX || params.execs < 1 || params.fanout < 1)
+	{
+		log_error("depth, execs and fanout must be in 1..%d", GENERATE_DEPTH_MAX);
+		return EXIT_FAILURE;
+	}
+
+	return generate(stdout, &params) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+/*
+ * generate.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef GENERATE_H_
+#define GENERATE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+/*
+ * Generator of synthetic raw audit logs (SYSCALL, CWD, PATH and EOE
+ * records) as read by fusgd, to measure performance against
+ * reproducible workloads.
+ */
+
+
+typedef struct {
+	const char* name;
+	/** basename of the executables */
+	const char* exe;
+	/** working directory and root of the generated path tree */
+	const char* root;
+	/** number of events */
+	unsigned long events;
+	/** number of distinct executables */
+	unsigned execs;
+	/** max depth of the path tree below root */
+	unsigned depth;
+	/** sub-directories and files per directory */
+	unsigned fanout;
+	/** ratio of paths relative to cwd */
+	double relative;
+	/** probability to repeat one of the recently used paths */
+	double locality;
+	/** ratio of failed syscalls */
+	double failures;
+	/** ratio of created files */
+	double creates;
+	/** events per burst */
+	unsigned burst;
+	/** pause between bursts [ms] */
+	unsigned burst_gap_ms;
+	/** time between events within a burst [us] */
+	unsigned event_gap_us;
+	uint64_t seed;
+} generate_params_t;
+
+
+/**
+ * @return parameters of the preset with given name or NULL.
+ *         Presets: find, ide, build, idle
+ */
+const generate_params_t* generate_preset(const char* name);
+
+/**
+ * Writes params->events events to out.
+ * @return 0 on success -1 on write errors
+ */
+int generate(FILE* out, const generate_params_t* params);
+
+/**
+ * Command line interface: --generate PRESET [OPTIONS]
+ * @return exit code
+ */
+int generate_main(int argc, char** argv);
+
+
+#endif /* GENERATE_H_ */
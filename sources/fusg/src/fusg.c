@@ -24,6 +24,7 @@ typedef enum {
 	CMD_VERS,
 	CMD_SEARCH_FILES,
 	CMD_SEARCH_EXECS,
+	CMD_SEARCH_SUBTREE,
 	CMD_DUMP,
 } fusg_cmd_t;
 
@@ -62,6 +63,16 @@ int read_args(int argc, char** argv)
 			}
 			rc = 0;
 		}
+		else if (!strcmp(arg, "-l") || !strcmp(arg, "--live"))
+		{
+			search_set_live(1);
+			rc = 0;
+		}
+		else if (!strcmp(arg, "-s") || !strcmp(arg, "--summary"))
+		{
+			search_set_summary(1);
+			rc = 0;
+		}
 		else if (!strcmp(arg, "-f") || !strcmp(arg, "--file"))
 		{
 			command = CMD_SEARCH_EXECS;
@@ -92,6 +103,21 @@ int read_args(int argc, char** argv)
 			}
 			break;
 		}
+		else if (!strcmp(arg, "-d") || !strcmp(arg, "--dir"))
+		{
+			command = CMD_SEARCH_SUBTREE;
+			if (argc < 3)
+			{
+				log_error("missing directories");
+				command = CMD_HELP;
+			}
+			else
+			{
+				i++;
+				rc = 0;
+			}
+			break;
+		}
 		else if (!strcmp(arg, "-a") || !strcmp(arg, "--all"))
 		{
 			command = CMD_DUMP;
@@ -126,6 +152,9 @@ int print_help()
 	printf("  -e|--exec EXE [EXE]...\n"
 		   "    For each EXEcutable list all files, which have been\n"
 		   "    used by it.\n");
+	printf("  -d|--dir DIR [DIR]...\n"
+		   "    For each DIRectory list all executables and the files\n"
+		   "    in it or below, which have been used by them.\n");
 	printf("  -a|--all\n"
 		   "    Dump all file usage statistics found in the database.\n");
 	printf("  -v|--vers:\n"
@@ -135,11 +164,25 @@ int print_help()
 	printf("\nFLAGS:\n");
 	printf("  -c|--conf:\n"
 		   "    Provide a different config file than '/etc/fusg/fusg.conf'.\n");
+	printf("  -l|--live:\n"
+		   "    Look up files and executables in the live table of fusgd\n"
+		   "    (see 'fusgd_live'). It holds recently updated entries only.\n");
+	printf("  -s|--summary:\n"
+		   "    Print the summary line only. With -f, -e and -d it is looked\n"
+		   "    up in the rollups of the file, executable or directory\n"
+		   "    (see 'db_dir_depth'), which is a lot faster than summing up\n"
+		   "    all entries.\n");
 	printf("\nEXAMPLES:\n");
 	printf("  List executables, which used given <file>\n");
 	printf("    > %s <flags> (-f|--file) <file>\n\n", progname);
 	printf("  List files, which where used by given <executable>\n");
 	printf("    > %s <flags> (-e|--exec) <executable>\n\n", progname);
+	printf("  Summary of the usage of given <file>\n");
+	printf("    > %s <flags> (-s|--summary) (-f|--file) <file>\n\n", progname);
+	printf("  Latest usage of any file in <directory> and below\n");
+	printf("    > %s <flags> (-s|--summary) (-d|--dir) <directory>\n\n", progname);
+	printf("  List usage of files in <directory> and below\n");
+	printf("    > %s <flags> (-d|--dir) <directory>\n\n", progname);
 	printf("  List the whole data base content\n");
 	printf("    > %s <flags> (-a|--all)\n\n", progname);
 	return 0;
@@ -169,6 +212,8 @@ int do_command(void)
 		return search_files(conf_file, num_entries, entries);
 	case CMD_SEARCH_EXECS:
 		return search_execs(conf_file, num_entries, entries);
+	case CMD_SEARCH_SUBTREE:
+		return search_subtree(conf_file, num_entries, entries);
 	case CMD_DUMP:
 		return search_dump_all(conf_file);
 	default:
@@ -15,9 +15,35 @@
 #include "../../fusg-common/include/fusg/err.h"
 #include "../../fusg-common/include/fusg/logging.h"
 #include "../../fusg-common/include/fusg/utils.h"
+#include "../../fusg-common/include/fusg/query.h"
+#include "../../fusg-common/include/fusg/live.h"
+
+#include <unistd.h>
 
 static fusg_conf_t conf;
 dbref_t db = NULL;
+static int use_live = 0;
+static int summary_only = 0;
+
+
+/** which of the two paths of an entry to print */
+typedef enum {
+	SHOW_EXEC = 1<<0,
+	SHOW_FILE = 1<<1,
+} search_show_t;
+
+
+void search_set_live(int enabled)
+{
+	use_live = enabled;
+}
+
+
+void search_set_summary(int enabled)
+{
+	summary_only = enabled;
+}
+
 
 int search_init(const char* conf_file)
 {
@@ -27,22 +53,216 @@ int search_init(const char* conf_file)
 		log_error("can't read config at '%s': %s", conf_file, strerror(errno));
 		return ERR_CONF;
 	}
+	return rc;
+}
 
+/**
+ * Opens the db on first use, i.e. if the query service of fusgd
+ * is not available.
+ */
+int search_db(void)
+{
+	if (db) return 0;
 	db = db_open(conf.db_path, FUSG_READ);
 	if (!db)
 	{
 		log_error("can't open db at '%s': %s", conf.db_path, strerror(errno));
 		return ERR_DB;
 	}
-	return rc;
+	return 0;
 }
 
 int search_done(void)
 {
 	if (db) db_close(db);
+	db = NULL;
+	return 0;
+}
+
+
+void search_print_entry(search_show_t show, const fusg_stats_t* stats, const char* exe, const char* file)
+{
+	if (summary_only) return;
+	char tmbuf[256];
+	printf("\t%3lu %3lu %3lu %3lu %s '%s'\n",
+			stats->create, stats->read, stats->write, stats->exec, ptime(stats->time, tmbuf),
+			(show & SHOW_EXEC) ? exe : file);
+	if (show == (SHOW_EXEC | SHOW_FILE))
+	{
+		printf("\t\t'%s'\n", file);
+	}
+}
+
+void search_print_summary(const fusg_stats_t* stats_total, int count)
+{
+	char tmbuf[256];
+	printf("summary %3lu %3lu %3lu %3lu %s %5d\n",
+			stats_total->create, stats_total->read, stats_total->write, stats_total->exec, ptime(stats_total->time, tmbuf), count);
+}
+
+
+/**
+ * Runs a query through the query service of fusgd.
+ *
+ * @param header printed before the first entry, if not NULL
+ * @return 0 on success, 1 if nothing was found
+ *         and -1 if the service is not available.
+ */
+int search_service(query_type_t type, const char* arg, search_show_t show, const char* header, fusg_stats_t* stats_total, int* count)
+{
+	int sock = query_connect(conf.fusgd_socket);
+	if (sock == -1) return -1;
+
+	int rc = query_send_request(sock, type, arg);
+	if (rc)
+	{
+		close(sock);
+		return -1;
+	}
+
+	char exebuf[PATH_MAX + 1];
+	char filebuf[PATH_MAX + 1];
+	query_reply_t reply;
+	int status;
+	for (status = query_recv_reply(sock, &reply, exebuf, filebuf);
+			status == QUERY_RECORD;
+			status = query_recv_reply(sock, &reply, exebuf, filebuf))
+	{
+		if (header)
+		{
+			printf("%s", header);
+			header = NULL;
+		}
+		search_print_entry(show, &reply.stats, exebuf, filebuf);
+		fugs_stats_add(stats_total, &reply.stats);
+		(*count)++;
+	}
+	close(sock);
+
+	switch (status)
+	{
+	case QUERY_END:
+		if (header) printf("%s", header);
+		return 0;
+	case QUERY_NOTFOUND:
+		return 1;
+	default:
+		if (*count)
+		{
+			// can't start over: output was already written
+			log_error("query service failed");
+			return 0;
+		}
+		log_warn("query service failed, using db");
+		return -1;
+	}
+}
+
+
+
+/**
+ * Looks up the rollup of a file or an executable through the
+ * query service of fusgd or in the db.
+ *
+ * @param type QUERY_SUMMARY_FILE, QUERY_SUMMARY_EXEC or QUERY_SUMMARY_DIR
+ * @return 0 on success, 1 if nothing was found
+ *         and -1 if there are no rollups.
+ */
+int search_rollup(query_type_t type, const char* arg, fusg_stats_t* stats_total, int* count)
+{
+	int sock = query_connect(conf.fusgd_socket);
+	if (sock != -1)
+	{
+		char exebuf[PATH_MAX + 1];
+		char filebuf[PATH_MAX + 1];
+		query_reply_t reply;
+		int status = -1;
+		if (!query_send_request(sock, type, arg))
+		{
+			status = query_recv_reply(sock, &reply, exebuf, filebuf);
+		}
+		if (status == QUERY_RECORD)
+		{
+			*stats_total = reply.stats;
+			*count = reply.entries;
+		}
+		close(sock);
+		if (status == QUERY_RECORD) return 0;
+		if (status == QUERY_NOTFOUND) return 1;
+	}
+
+	if (search_db()) return -1;
+	fusg_rollup_t rollup;
+	int rc = (type == QUERY_SUMMARY_FILE) ? db_file_rollup(db, arg, &rollup)
+			: (type == QUERY_SUMMARY_EXEC) ? db_exec_rollup(db, arg, &rollup)
+			: db_dir_rollup(db, arg, &rollup);
+	if (rc == 0)
+	{
+		*stats_total = rollup.stats;
+		*count = rollup.entries;
+	}
+	return rc;
+}
+
+
+typedef struct {
+	search_show_t show;
+	fusg_stats_t* stats_total;
+	int* count;
+} search_live_ctx_t;
+
+static int search_live_print(void* ctx, const char* exec, const char* file, const fusg_stats_t* stats)
+{
+	search_live_ctx_t* c = ctx;
+	search_print_entry(c->show, stats, exec, file);
+	fugs_stats_add(c->stats_total, stats);
+	(*c->count)++;
 	return 0;
 }
 
+/**
+ * Looks up entries in the live table of fusgd.
+ *
+ * The live table holds the most recently updated entries only.
+ * Entries not found there are reported as not existing.
+ *
+ * @param header printed before the entries
+ * @return 0 on success and -1 if the live table is not available.
+ */
+int search_live(query_type_t type, const char* arg, search_show_t show, const char* header, fusg_stats_t* stats_total, int* count)
+{
+	if (!conf.fusgd_live[0]) return -1;
+	liveref_t live = live_open(conf.fusgd_live);
+	if (!live)
+	{
+		log_warn("live table '%s' not available: %s", conf.fusgd_live, strerror(errno));
+		return -1;
+	}
+
+	printf("%s", header);
+	search_live_ctx_t ctx = { show, stats_total, count };
+	long rc = (type == QUERY_FILE)
+			? live_lookup_file(live, arg, search_live_print, &ctx)
+			: live_lookup_exec(live, arg, search_live_print, &ctx);
+	live_close(live);
+	if (rc < 0) log_error("live table lookup failed: %s", strerror(errno));
+	return 0;
+}
+
+/**
+ * Runs a query through the live table, if requested,
+ * or the query service otherwise.
+ * @return see search_service()
+ */
+int search_query(query_type_t type, const char* arg, search_show_t show, const char* header, fusg_stats_t* stats_total, int* count)
+{
+	if (use_live && (type == QUERY_FILE || type == QUERY_EXEC))
+	{
+		if (!search_live(type, arg, show, header, stats_total, count)) return 0;
+		log_warn("using query service or db instead");
+	}
+	return search_service(type, arg, show, header, stats_total, count);
+}
 
 
 int search_files_single(const char* exe)
@@ -52,7 +272,7 @@ int search_files_single(const char* exe)
 	size_t maxpath = PATH_MAX + 1;
 	char filebuf[maxpath];
 	char exebuf[maxpath];
-	char tmbuf[256];
+	char header[maxpath + 64];
 	fusg_stats_t stats;
 	fusg_stats_t stats_total;
 
@@ -71,40 +291,70 @@ int search_files_single(const char* exe)
 		file_exists = 1;
 	}
 
-	uint64_t exec_id = db_exec_get_id(db, exe);
-	int entry_exists = (exec_id != (uint64_t)-1);
-	if (!file_exists && !entry_exists)
+	int count = 0;
+	snprintf(header, sizeof(header), "files used by executable '%s'\n", exe);
+
+	if (summary_only && !use_live)
+	{
+		rc = search_rollup(QUERY_SUMMARY_EXEC, exe, &stats_total, &count);
+		if (rc == 0 || (rc == 1 && file_exists))
+		{
+			printf("%s", header);
+			search_print_summary(&stats_total, count);
+			return 0;
+		}
+		if (rc == 1)
+		{
+			log_error("no fs and no db entry: '%s'", exe);
+			return ERR_USAGE;
+		}
+	}
+
+	rc = search_query(QUERY_EXEC, exe, SHOW_FILE, header, &stats_total, &count);
+	if (rc == 1 && file_exists)
+	{
+		printf("%s", header);
+	}
+	else if (rc == 1)
 	{
 		log_error("no fs and no db entry: '%s'", exe);
 		return ERR_USAGE;
 	}
-
-	int count = 0;
-	printf("files used by executable '%s'\n", exe);
-	if (entry_exists)
+	else if (rc == -1)
 	{
-		for (rc = db_fusg_stats_first(db, &it); rc == 0; rc = db_iterator_next(&it))
+		if ((rc = search_db())) return rc;
+
+		uint64_t exec_id = db_exec_get_id(db, exe);
+		int entry_exists = (exec_id != (uint64_t)-1);
+		if (!file_exists && !entry_exists)
 		{
-			rc = db_iterator_fetch(&it, &stats);
-			assert(rc == 0);
-			fusg_stats_key_t key = db_iterator_get_fugs_stats_key(&it);
-			if (key.exec_id != exec_id)
+			log_error("no fs and no db entry: '%s'", exe);
+			return ERR_USAGE;
+		}
+
+		printf("%s", header);
+		if (entry_exists)
+		{
+			for (rc = db_fusg_stats_first(db, &it); rc == 0; rc = db_iterator_next(&it))
 			{
-				continue;
+				rc = db_iterator_fetch(&it, &stats);
+				assert(rc == 0);
+				fusg_stats_key_t key = db_iterator_get_fugs_stats_key(&it);
+				if (key.exec_id != exec_id)
+				{
+					continue;
+				}
+				// ids without path are left for the next pruning run
+				if (db_file_get_file(db, key.file_id, filebuf, maxpath)) continue;
+
+				search_print_entry(SHOW_FILE, &stats, exe, filebuf);
+				fugs_stats_add(&stats_total, &stats);
+				count++;
 			}
-			rc = db_file_get_file(db, key.file_id, filebuf, maxpath);
-			assert(rc == 0);
-
-			printf("\t%3lu %3lu %3lu %3lu %s '%s'\n",
-					stats.create, stats.read, stats.write, stats.exec, ptime(stats.time, tmbuf),
-					filebuf);
-			fugs_stats_add(&stats_total, &stats);
-			count++;
+			db_iterator_release(it);
 		}
-		db_iterator_release(it);
 	}
-	printf("summary %3lu %3lu %3lu %3lu %s %5d\n",
-			stats_total.create, stats_total.read, stats_total.write, stats_total.exec, ptime(stats_total.time, tmbuf), count);
+	search_print_summary(&stats_total, count);
 
 	return rc;
 }
@@ -122,6 +372,101 @@ int search_files(const char* conf_file, int num_execs, char** execs)
 	return search_done();
 }
 
+/** max size of the aliases of a file */
+#define SEARCH_ALIASES_MAX (PATH_MAX * 16)
+
+/**
+ * Looks up the name and the aliases of a file (see DB_INODES)
+ * through the query service of fusgd.
+ *
+ * @param name buffer of PATH_MAX+1 bytes receiving the name of the file
+ * @param aliases receives the aliases, each terminated by '\0',
+ *        followed by an empty string
+ * @return number of aliases, 0 if the file is unknown,
+ *         and -1 if the service is not available.
+ */
+int search_service_aliases(const char* file, char* name, char* aliases, size_t size)
+{
+	int sock = query_connect(conf.fusgd_socket);
+	if (sock == -1) return -1;
+
+	if (query_send_request(sock, QUERY_ALIASES, file))
+	{
+		close(sock);
+		return -1;
+	}
+
+	char exebuf[PATH_MAX + 1];
+	char filebuf[PATH_MAX + 1];
+	query_reply_t reply;
+	int status;
+	int num = -1;
+	size_t len = 0;
+	aliases[0] = '\0';
+	for (status = query_recv_reply(sock, &reply, exebuf, filebuf);
+			status == QUERY_RECORD;
+			status = query_recv_reply(sock, &reply, exebuf, filebuf))
+	{
+		if (num++ < 0)
+		{
+			strcpy(name, filebuf);
+			continue;
+		}
+		size_t n = strlen(filebuf) + 1;
+		if (len + n + 1 > size) continue;
+		memcpy(aliases + len, filebuf, n);
+		len += n;
+		aliases[len] = '\0';
+	}
+	close(sock);
+
+	switch (status)
+	{
+	case QUERY_END:
+		return num < 0 ? 0 : num;
+	case QUERY_NOTFOUND:
+		return 0;
+	default:
+		// e.g. fusgd not supporting aliases
+		return -1;
+	}
+}
+
+/**
+ * Looks up the name and the aliases of a file in the db.
+ * @see search_service_aliases()
+ */
+int search_db_aliases(const char* file, char* name, char* aliases, size_t size)
+{
+	aliases[0] = '\0';
+	uint64_t file_id = db_file_get_id(db, file);
+	if (file_id == (uint64_t)-1
+			|| db_file_get_file(db, file_id, name, PATH_MAX + 1))
+	{
+		return 0;
+	}
+	int num = db_file_get_aliases(db, file_id, aliases, size);
+	if (num < 0)
+	{
+		log_warn("can't get aliases of '%s'", name);
+		return 0;
+	}
+	return num;
+}
+
+/**
+ * Appends the aliases of a file to a header.
+ */
+void search_header_aliases(char* header, size_t size, const char* aliases)
+{
+	for (; *aliases; aliases += strlen(aliases) + 1)
+	{
+		size_t len = strlen(header);
+		snprintf(header + len, size - len, "\talias '%s'\n", aliases);
+	}
+}
+
+
 int search_execs_single(char* file)
 {
 	int rc = 0;
@@ -130,7 +475,6 @@ int search_execs_single(char* file)
 	size_t maxpath = PATH_MAX + 1;
 	char exebuf[maxpath];
 	char filebuf[maxpath];
-	char tmbuf[256];
 	fusg_stats_t stats;
 	fusg_stats_t stats_total;
 
@@ -148,54 +492,189 @@ int search_execs_single(char* file)
 		file_exists = 1;
 	}
 
-	uint64_t file_id = db_file_get_id(db, file);
-	int entry_exists = (file_id != (uint64_t)-1);
+	// query by name, if the file is an alias
+	char name[maxpath];
+	char aliases[SEARCH_ALIASES_MAX];
+	int num_aliases = search_service_aliases(file, name, aliases, sizeof(aliases));
+	if (num_aliases > 0) file = name;
+
+	int count = 0;
+	char header[maxpath + 64 + sizeof(aliases) + 64];
+	snprintf(header, sizeof(header), "executables using file '%s'\n", file);
+	if (num_aliases > 0) search_header_aliases(header, sizeof(header), aliases);
 
-	if (!file_exists && !entry_exists)
+	if (summary_only && !use_live)
+	{
+		rc = search_rollup(QUERY_SUMMARY_FILE, file, &stats_total, &count);
+		if (rc == 0 || (rc == 1 && file_exists))
+		{
+			printf("%s", header);
+			search_print_summary(&stats_total, count);
+			return 0;
+		}
+		if (rc == 1)
+		{
+			log_error("no fs and no db entry: '%s'", file);
+			return ERR_USAGE;
+		}
+	}
+
+	rc = search_query(QUERY_FILE, file, SHOW_EXEC, header, &stats_total, &count);
+	if (rc == 1 && file_exists)
+	{
+		printf("%s", header);
+	}
+	else if (rc == 1)
 	{
 		log_error("no fs and no db entry: '%s'", file);
 		return ERR_USAGE;
 	}
+	else if (rc == -1)
+	{
+		if ((rc = search_db())) return rc;
+
+		if (num_aliases < 0 && search_db_aliases(file, name, aliases, sizeof(aliases)) > 0)
+		{
+			file = name;
+			snprintf(header, sizeof(header), "executables using file '%s'\n", file);
+			search_header_aliases(header, sizeof(header), aliases);
+		}
+
+		uint64_t file_id = db_file_get_id(db, file);
+		int entry_exists = (file_id != (uint64_t)-1);
+
+		if (!file_exists && !entry_exists)
+		{
+			log_error("no fs and no db entry: '%s'", file);
+			return ERR_USAGE;
+		}
+
+		printf("%s", header);
+		if (entry_exists) {
+			for (rc = db_fusg_stats_first(db, &it); rc == 0; rc = db_iterator_next(&it))
+			{
+				rc = db_iterator_fetch(&it, &stats);
+				assert(rc == 0);
+				fusg_stats_key_t key = db_iterator_get_fugs_stats_key(&it);
+				if (key.file_id != file_id)
+				{
+					continue;
+				}
+				// ids without path are left for the next pruning run
+				if (db_exec_get_executable(db, key.exec_id, exebuf, maxpath)) continue;
+
+				search_print_entry(SHOW_EXEC, &stats, exebuf, file);
+				fugs_stats_add(&stats_total, &stats);
+				count++;
+			}
+			db_iterator_release(it);
+		}
+	}
+	search_print_summary(&stats_total, count);
+
+	return rc;
+}
+
+int search_execs(const char* conf_file, int num_files, char** files)
+{
+	int rc = search_init(conf_file);
+	if (rc) return rc;
+
+	for (int i = 0; i < num_files; i++)
+	{
+		search_execs_single(files[i]);
+	}
+
+	return search_done();
+}
 
 
+int search_subtree_single(const char* dir)
+{
+	int rc = 0;
+
+	fusg_stats_iterator_t it;
+	size_t maxpath = PATH_MAX + 1;
+	char exebuf[maxpath];
+	char filebuf[maxpath];
+	char dirbuf[maxpath];
+	char header[maxpath + 64];
+	fusg_stats_t stats;
+	fusg_stats_t stats_total;
+
+	memset(&stats_total, 0, sizeof(fusg_stats_t));
+
+	char cwd[maxpath];
+	if (realpath(dir, dirbuf))
+	{
+		dir = dirbuf;
+	}
+	else if (getcwd(cwd, maxpath) && fabsolute(cwd, dir, dirbuf))
+	{
+		// does not exist anymore, but might be in the db
+		dir = dirbuf;
+	}
+	else
+	{
+		log_error("%s: '%s'", strerror(errno), dir);
+		return ERR_USAGE;
+	}
+
 	int count = 0;
-	printf("executables using file '%s'\n", file);
-	if (entry_exists) {
+	snprintf(header, sizeof(header), "usage of files in directory '%s'\n", dir);
+
+	if (summary_only)
+	{
+		// directories too deep have no rollups
+		rc = search_rollup(QUERY_SUMMARY_DIR, dir, &stats_total, &count);
+		if (rc >= 0)
+		{
+			printf("%s", header);
+			search_print_summary(&stats_total, count);
+			return 0;
+		}
+	}
+
+	rc = search_service(QUERY_SUBTREE, dir, SHOW_EXEC | SHOW_FILE, header, &stats_total, &count);
+	if (rc == -1)
+	{
+		if ((rc = search_db())) return rc;
+
+		printf("%s", header);
+		size_t len = strlen(dir);
+		if (len == 1) len = 0; // root directory
 		for (rc = db_fusg_stats_first(db, &it); rc == 0; rc = db_iterator_next(&it))
 		{
-			rc = db_iterator_fetch(&it, &stats);
-			assert(rc == 0);
 			fusg_stats_key_t key = db_iterator_get_fugs_stats_key(&it);
-			if (key.file_id != file_id)
+			// ids without path are left for the next pruning run
+			if (db_file_get_file(db, key.file_id, filebuf, maxpath)) continue;
+			if (strncmp(filebuf, dir, len) || (filebuf[len] != '/' && filebuf[len] != '\0'))
 			{
 				continue;
 			}
-			rc = db_exec_get_executable(db, key.exec_id, exebuf, maxpath);
+			rc = db_iterator_fetch(&it, &stats);
 			assert(rc == 0);
+			if (db_exec_get_executable(db, key.exec_id, exebuf, maxpath)) continue;
 
-			printf("\t%3lu %3lu %3lu %3lu %s '%s'\n",
-					stats.create, stats.read, stats.write, stats.exec, ptime(stats.time, tmbuf),
-					exebuf);
-
+			search_print_entry(SHOW_EXEC | SHOW_FILE, &stats, exebuf, filebuf);
 			fugs_stats_add(&stats_total, &stats);
 			count++;
 		}
 		db_iterator_release(it);
 	}
-	printf("summary %3lu %3lu %3lu %3lu %s %5d\n",
-			stats_total.create, stats_total.read, stats_total.write, stats_total.exec, ptime(stats_total.time, tmbuf), count);
+	search_print_summary(&stats_total, count);
 
 	return rc;
 }
 
-int search_execs(const char* conf_file, int num_files, char** files)
+int search_subtree(const char* conf_file, int num_dirs, char** dirs)
 {
 	int rc = search_init(conf_file);
 	if (rc) return rc;
 
-	for (int i = 0; i < num_files; i++)
+	for (int i = 0; i < num_dirs; i++)
 	{
-		search_execs_single(files[i]);
+		search_subtree_single(dirs[i]);
 	}
 
 	return search_done();
@@ -212,7 +691,6 @@ int search_dump_all(const char* conf_file)
 	size_t maxpath = PATH_MAX + 1;
 	char exebuf[maxpath];
 	char filebuf[maxpath];
-	char tmbuf[256];
 	fusg_stats_t stats;
 	fusg_stats_t stats_total;
 
@@ -221,28 +699,32 @@ int search_dump_all(const char* conf_file)
 
 
 	int count = 0;
-	for (rc = db_fusg_stats_first(db, &it); rc == 0; rc = db_iterator_next(&it))
+	rc = search_service(QUERY_DUMP, NULL, SHOW_EXEC | SHOW_FILE, NULL, &stats_total, &count);
+	if (rc == -1)
 	{
-		rc = db_iterator_fetch(&it, &stats);
-		assert(rc == 0);
-		fusg_stats_key_t key = db_iterator_get_fugs_stats_key(&it);
-		rc = db_exec_get_executable(db, key.exec_id, exebuf, maxpath);
-		assert(rc == 0);
+		if ((rc = search_db())) return rc;
 
-		rc = db_file_get_file(db, key.file_id, filebuf, maxpath);
-		assert(rc == 0);
+		for (rc = db_fusg_stats_first(db, &it); rc == 0; rc = db_iterator_next(&it))
+		{
+			rc = db_iterator_fetch(&it, &stats);
+			assert(rc == 0);
+			fusg_stats_key_t key = db_iterator_get_fugs_stats_key(&it);
+			// ids without path are left for the next pruning run
+			if (db_exec_get_executable(db, key.exec_id, exebuf, maxpath)
+					|| db_file_get_file(db, key.file_id, filebuf, maxpath))
+			{
+				continue;
+			}
 
-		printf("\t%3lu %3lu %3lu %3lu %s '%s'\n\t\t'%s'\n",
-				stats.create, stats.read, stats.write, stats.exec, ptime(stats.time, tmbuf),
-				exebuf, filebuf);
+			search_print_entry(SHOW_EXEC | SHOW_FILE, &stats, exebuf, filebuf);
 
-		fugs_stats_add(&stats_total, &stats);
-		count++;
+			fugs_stats_add(&stats_total, &stats);
+			count++;
+		}
+		db_iterator_release(it);
 	}
-	db_iterator_release(it);
 
 
 
 	return search_done();
 }
-
@@ -8,8 +8,22 @@
 
 
 
+/**
+ * Look up files and executables in the live table of fusgd
+ * instead of the query service or the db.
+ */
+void search_set_live(int enabled);
+
+/**
+ * Print the summary line only, without the entries. Files and
+ * executables get looked up in their rollups then.
+ */
+void search_set_summary(int enabled);
+
 int search_files(const char* conf_file, int num_execs, char** execs);
 
 int search_execs(const char* conf_file, int num_files, char** files);
 
+int search_subtree(const char* conf_file, int num_dirs, char** dirs);
+
 int search_dump_all(const char* conf_file);
@@ -0,0 +1,8 @@
+PART := fusgd
+
+
+# Objects of fusgd without its main(), to
+# run the daemon's code paths in tools.
+FUSGD_OBJS := $(patsubst $(SOURCES_DIR)/$(PART)/%.c, $(OBJECTS_DIR)/$(PART)/%.o, \
+                 $(filter-out %/fusgd.c, $(shell find $(SOURCES_DIR)/$(PART)/src -name "*.c")))
+FUSGD_INCL := -I "$(SOURCES_DIR)/$(PART)/src"
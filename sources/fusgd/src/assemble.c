@@ -0,0 +1,373 @@
+/*
+ * assemble.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#define _GNU_SOURCE
+#include "assemble.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libaudit.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+
+#include "metrics.h"
+
+
+/** max records of an event */
+#define ASSEMBLE_RECORDS_MAX 256
+/** max size of an event */
+#define ASSEMBLE_BYTES_MAX (256 * 1024)
+/** larger buffers are freed after their event completed */
+#define ASSEMBLE_KEEP_BYTES (64 * 1024)
+/** max length of a record type name */
+#define ASSEMBLE_TYPE_MAX 64
+
+
+typedef struct {
+	int used;
+	uint64_t serial;
+	/** hash of the node (host) or 0 */
+	uint64_t node;
+	/** event time of the first record */
+	uint64_t time_ms;
+	int records;
+	/** input bytes before its first record */
+	uint64_t offset;
+	char* buf;
+	size_t len;
+	size_t cap;
+	/** arrival order: neighbour slots or -1 */
+	int older;
+	int newer;
+} slot_t;
+
+typedef struct {
+	uint64_t node;
+	int type;
+	uint64_t time_ms;
+	uint64_t serial;
+} header_t;
+
+
+static slot_t* slots = NULL;
+static int num_slots = 0;
+static int timeout_ms = 0;
+static assemble_emit_t emit = NULL;
+
+static int oldest = -1;
+static int newest = -1;
+static size_t inflight = 0;
+/** input bytes so far */
+static uint64_t total_bytes = 0;
+/** input bytes before the event being emitted */
+static uint64_t emit_offset = 0;
+/** event time of the latest record */
+static uint64_t latest_ms = 0;
+
+
+
+int assemble_init(int max_slots, int timeout, assemble_emit_t emit_event)
+{
+	if (max_slots < 1) max_slots = 1;
+	slots = calloc(max_slots, sizeof(slot_t));
+	if (!slots)
+	{
+		log_error("assemble: out of memory");
+		return -1;
+	}
+	num_slots = max_slots;
+	timeout_ms = timeout;
+	emit = emit_event;
+	oldest = newest = -1;
+	inflight = 0;
+	total_bytes = 0;
+	emit_offset = 0;
+	latest_ms = 0;
+	return 0;
+}
+
+
+void assemble_destroy(void)
+{
+	for (int i = 0; i < num_slots; i++) free(slots[i].buf);
+	free(slots);
+	slots = NULL;
+	num_slots = 0;
+}
+
+
+static int parse_number(const char** p, const char* end, uint64_t* value)
+{
+	const char* start = *p;
+	*value = 0;
+	while (*p < end && **p >= '0' && **p <= '9')
+	{
+		*value = *value * 10 + (**p - '0');
+		(*p)++;
+	}
+	return *p == start ? -1 : 0;
+}
+
+/**
+ * Parses "[node=<node> ]type=<type> msg=audit(<sec>.<milli>:<serial>):"
+ * @return 0 on success, -1 otherwise
+ */
+static int parse_header(const char* line, size_t len, header_t* h)
+{
+	const char* p = line;
+	const char* end = line + len;
+
+	h->node = 0;
+	if (len > 5 && !memcmp(p, "node=", 5))
+	{
+		// FNV-1a, never 0
+		h->node = 0xcbf29ce484222325UL;
+		for (p += 5; p < end && *p != ' '; p++)
+			h->node = (h->node ^ (unsigned char)*p) * 0x100000001b3UL;
+		if (p < end) p++;
+	}
+
+	if (end - p < 5 || memcmp(p, "type=", 5)) return -1;
+	p += 5;
+	char type[ASSEMBLE_TYPE_MAX];
+	size_t n = 0;
+	while (p < end && *p != ' ' && n < ASSEMBLE_TYPE_MAX - 1) type[n++] = *p++;
+	type[n] = 0;
+	h->type = (n == 3 && !memcmp(type, "EOE", 3)) ? AUDIT_EOE : audit_name_to_msg_type(type);
+
+	const char* audit = memmem(p, end - p, "audit(", 6);
+	if (!audit) return -1;
+	p = audit + 6;
+	uint64_t sec, milli;
+	if (parse_number(&p, end, &sec) || p == end || *p++ != '.'
+			|| parse_number(&p, end, &milli) || p == end || *p++ != ':'
+			|| parse_number(&p, end, &h->serial))
+	{
+		return -1;
+	}
+	h->time_ms = sec * 1000 + milli;
+	return 0;
+}
+
+
+/**
+ * @return 1 if events of this record type consist of this record only
+ */
+static int single_record(int type)
+{
+	// user space and daemon messages, see linux/audit.h
+	return (type > 0 && type < AUDIT_SYSCALL)
+			|| (type >= AUDIT_FIRST_USER_MSG2 && type <= AUDIT_LAST_USER_MSG2);
+}
+
+
+static void unlink_slot(int i)
+{
+	slot_t* s = &slots[i];
+	if (s->older != -1) slots[s->older].newer = s->newer;
+	else oldest = s->newer;
+	if (s->newer != -1) slots[s->newer].older = s->older;
+	else newest = s->older;
+}
+
+static void complete(int i)
+{
+	slot_t* s = &slots[i];
+	unlink_slot(i);
+	s->used = 0;
+	inflight--;
+
+	emit_offset = s->offset;
+	emit(s->buf, s->len);
+
+	s->len = 0;
+	if (s->cap > ASSEMBLE_KEEP_BYTES)
+	{
+		free(s->buf);
+		s->buf = NULL;
+		s->cap = 0;
+	}
+}
+
+static void open_slot(int i, const header_t* h, uint64_t offset)
+{
+	slot_t* s = &slots[i];
+	s->used = 1;
+	s->serial = h->serial;
+	s->node = h->node;
+	s->time_ms = h->time_ms;
+	s->records = 0;
+	s->offset = offset;
+	s->len = 0;
+	s->older = newest;
+	s->newer = -1;
+	if (newest != -1) slots[newest].newer = i;
+	else oldest = i;
+	newest = i;
+	inflight++;
+}
+
+static int append(slot_t* s, const char* line, size_t len)
+{
+	if (s->len + len > s->cap)
+	{
+		size_t cap = s->cap ? s->cap * 2 : 4096;
+		while (cap < s->len + len) cap *= 2;
+		char* buf = realloc(s->buf, cap);
+		if (!buf) return -1;
+		s->buf = buf;
+		s->cap = cap;
+	}
+	memcpy(s->buf + s->len, line, len);
+	s->len += len;
+	s->records++;
+	return 0;
+}
+
+
+int assemble_resize(int max_slots, int timeout)
+{
+	if (max_slots < 1) max_slots = 1;
+	timeout_ms = timeout;
+	if (max_slots == num_slots) return 0;
+
+	slot_t* moved = calloc(max_slots, sizeof(slot_t));
+	if (!moved)
+	{
+		log_error("assemble: out of memory");
+		return -1;
+	}
+
+	slot_t* old = slots;
+	int old_slots = num_slots;
+	int i = oldest;
+	slots = moved;
+	num_slots = max_slots;
+	oldest = newest = -1;
+	inflight = 0;
+
+	// re-insert in arrival order, hence the arrival list stays intact
+	while (i != -1)
+	{
+		slot_t* s = &old[i];
+		int next = s->newer;
+		int j = (int)((s->serial ^ s->node) % num_slots);
+		if (slots[j].used)
+		{
+			metrics_inc(METRIC_EVENTS_EVICTED);
+			complete(j);
+		}
+		char* buf = slots[j].buf;
+		slots[j] = *s;
+		s->buf = NULL;
+		free(buf);
+		slots[j].older = newest;
+		slots[j].newer = -1;
+		if (newest != -1) slots[newest].newer = j;
+		else oldest = j;
+		newest = j;
+		inflight++;
+		i = next;
+	}
+
+	for (i = 0; i < old_slots; i++) free(old[i].buf);
+	free(old);
+	return 0;
+}
+
+
+void assemble_record(const char* line, size_t len)
+{
+	header_t h;
+	uint64_t offset = total_bytes;
+	total_bytes += len;
+	if (parse_header(line, len, &h))
+	{
+		// no record: let auparse judge it
+		emit_offset = offset;
+		emit(line, len);
+		return;
+	}
+	if (h.time_ms > latest_ms) latest_ms = h.time_ms;
+
+	int i = (int)((h.serial ^ h.node) % num_slots);
+	slot_t* s = &slots[i];
+	if (s->used && (s->serial != h.serial || s->node != h.node))
+	{
+		// newer event needs the slot
+		metrics_inc(METRIC_EVENTS_EVICTED);
+		complete(i);
+	}
+
+	if (!s->used)
+	{
+		// EOE of an event completed already
+		if (h.type == AUDIT_EOE) return;
+		open_slot(i, &h, offset);
+	}
+
+	if (append(s, line, len))
+	{
+		log_warn("assemble: out of memory, dropping record of event %lu", h.serial);
+		complete(i);
+	}
+	else if (h.type == AUDIT_EOE || (s->records == 1 && single_record(h.type)))
+	{
+		complete(i);
+	}
+	else if (s->records >= ASSEMBLE_RECORDS_MAX || s->len >= ASSEMBLE_BYTES_MAX)
+	{
+		metrics_inc(METRIC_EVENTS_LIMITED);
+		complete(i);
+	}
+
+	// events which didn't see their EOE in time
+	while (oldest != -1 && slots[oldest].time_ms + timeout_ms < latest_ms)
+	{
+		metrics_inc(METRIC_EVENTS_TIMED_OUT);
+		complete(oldest);
+	}
+}
+
+
+void assemble_flush(void)
+{
+	while (oldest != -1) complete(oldest);
+}
+
+
+size_t assemble_inflight(void)
+{
+	return inflight;
+}
+
+
+uint64_t assemble_offset(void)
+{
+	return oldest != -1 ? slots[oldest].offset : total_bytes;
+}
+
+
+uint64_t assemble_bytes(void)
+{
+	return total_bytes;
+}
+
+
+uint64_t assemble_emitting(void)
+{
+	return emit_offset;
+}
+
+
+size_t assemble_serials(uint64_t* serials, size_t max)
+{
+	size_t n = 0;
+	for (int i = oldest; i != -1 && n < max; i = slots[i].newer) serials[n++] = slots[i].serial;
+	return n;
+}
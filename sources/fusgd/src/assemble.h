@@ -0,0 +1,96 @@
+/*
+ * assemble.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef ASSEMBLE_H_
+#define ASSEMBLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * Event assembler.
+ *
+ * Groups records into events by their serial, before they go to
+ * auparse. auparse completes events on EOE, but events without EOE
+ * stay in its queue until the input is idle, which never happens
+ * under load. Instead, the assembler completes an event
+ *   - on its EOE record or if it's a single record event,
+ *   - if it exceeds ASSEMBLE_RECORDS_MAX records or ASSEMBLE_BYTES_MAX bytes,
+ *   - if it's older than fusgd_inflight_timeout ms (by event time)
+ *     compared to the latest record, or
+ *   - if a newer event needs its slot.
+ *
+ * There are fusgd_inflight_max slots, indexed by serial, hence
+ * finding the event of a record is O(1) and memory stays flat.
+ */
+
+
+/**
+ * Receives a complete event, i.e. its records.
+ */
+typedef void (*assemble_emit_t)(const char* records, size_t len);
+
+/**
+ * @param slots max number of events in flight
+ * @param timeout_ms max time between first and latest record of an event
+ * @return 0 on success, -1 otherwise
+ */
+int assemble_init(int slots, int timeout_ms, assemble_emit_t emit);
+
+void assemble_destroy(void);
+
+/**
+ * Changes the number of slots and the timeout (on config reload).
+ * Events in flight move to the new slots in their arrival order; if two
+ * of them share a slot, the older one is completed early, as on eviction.
+ * No event is dropped.
+ * @return 0 on success, -1 if out of memory (nothing changed)
+ */
+int assemble_resize(int slots, int timeout_ms);
+
+/**
+ * Adds a record (a line of input).
+ */
+void assemble_record(const char* line, size_t len);
+
+/**
+ * Completes all events in flight, e.g. when the input is idle.
+ */
+void assemble_flush(void);
+
+/**
+ * @return number of events in flight
+ */
+size_t assemble_inflight(void);
+
+/**
+ * @return input bytes (passed to assemble_record()) before the
+ *         first record of the oldest event in flight, i.e. input
+ *         up to there is processed completely
+ */
+uint64_t assemble_offset(void);
+
+/**
+ * @return input bytes passed to assemble_record() so far
+ */
+uint64_t assemble_bytes(void);
+
+/**
+ * For the emit callback.
+ * @return input bytes before the first record of the event being emitted
+ */
+uint64_t assemble_emitting(void);
+
+/**
+ * @param serials receives the serials of the events in flight, oldest first
+ * @return number of serials
+ */
+size_t assemble_serials(uint64_t* serials, size_t max);
+
+
+#endif /* ASSEMBLE_H_ */
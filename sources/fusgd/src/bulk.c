@@ -0,0 +1,619 @@
+/*
+ * bulk.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#define _GNU_SOURCE
+#include "bulk.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <auparse.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+#include "../../fusg-common/include/fusg/err.h"
+#include "../../fusg-common/include/fusg/db.h"
+
+#include "fusgd.h"
+#include "store.h"
+#include "work.h"
+
+
+/** chunks are fed to auparse in pieces of this size */
+#define BULK_FEED_SIZE (64 * 1024)
+/** marks file names in the sequence of new names */
+#define BULK_SEQ_FILE (1U << 31)
+
+
+/** interned strings */
+typedef struct {
+	char** strs;
+	uint32_t num;
+	uint32_t cap;
+	/** open addressing: index + 1, 0 is empty */
+	uint32_t* slots;
+	uint32_t num_slots;
+} strtab_t;
+
+typedef struct {
+	uint32_t exec;
+	uint32_t file;
+	fusg_stats_t stats;
+} bulk_pair_t;
+
+typedef struct {
+	bulk_pair_t* pairs;
+	uint32_t num;
+	uint32_t cap;
+	/** open addressing: index + 1, 0 is empty */
+	uint32_t* slots;
+	uint32_t num_slots;
+} pairtab_t;
+
+typedef struct {
+	int index;
+	const char* data;
+	size_t len;
+
+	strtab_t execs;
+	strtab_t files;
+	pairtab_t pairs;
+	/** names in order of their first occurrence, i.e. id creation */
+	uint32_t* seq;
+	size_t num_seq;
+	size_t cap_seq;
+
+	uint64_t events;
+	uint64_t usages;
+	int rc;
+	/** process cache of the worker or NULL */
+	procsref_t procs;
+
+	/** ids of execs and files after merge */
+	uint64_t* exec_ids;
+	uint64_t* file_ids;
+} bulk_chunk_t;
+
+typedef struct {
+	fusg_stats_key_t key;
+	int chunk;
+	fusg_stats_t stats;
+} bulk_entry_t;
+
+
+
+static uint64_t hash_str(const char* s)
+{
+	uint64_t hash = 0xcbf29ce484222325UL;
+	for (; *s; s++) hash = (hash ^ (unsigned char)*s) * 0x100000001b3UL;
+	return hash;
+}
+
+static uint64_t hash_pair(uint32_t exec, uint32_t file)
+{
+	uint64_t x = ((uint64_t)exec << 32 | file) * 0x9e3779b97f4a7c15UL;
+	return x ^ (x >> 29);
+}
+
+
+static int strtab_grow(strtab_t* t)
+{
+	uint32_t num_slots = t->num_slots ? t->num_slots * 2 : 4096;
+	uint32_t* slots = calloc(num_slots, sizeof(uint32_t));
+	if (!slots) return -1;
+	for (uint32_t i = 0; i < t->num; i++)
+	{
+		uint32_t s = hash_str(t->strs[i]) & (num_slots - 1);
+		while (slots[s]) s = (s + 1) & (num_slots - 1);
+		slots[s] = i + 1;
+	}
+	free(t->slots);
+	t->slots = slots;
+	t->num_slots = num_slots;
+	return 0;
+}
+
+/**
+ * @param created set to 1, if str was new
+ * @return index of str or -1 if out of memory
+ */
+static int64_t strtab_intern(strtab_t* t, const char* str, int* created)
+{
+	*created = 0;
+	if (2 * (t->num + 1) > t->num_slots && strtab_grow(t)) return -1;
+
+	uint32_t s = hash_str(str) & (t->num_slots - 1);
+	for (; t->slots[s]; s = (s + 1) & (t->num_slots - 1))
+	{
+		if (!strcmp(t->strs[t->slots[s] - 1], str)) return t->slots[s] - 1;
+	}
+
+	if (t->num == t->cap)
+	{
+		uint32_t cap = t->cap ? t->cap * 2 : 1024;
+		char** strs = realloc(t->strs, cap * sizeof(char*));
+		if (!strs) return -1;
+		t->strs = strs;
+		t->cap = cap;
+	}
+	char* copy = strdup(str);
+	if (!copy) return -1;
+	t->strs[t->num] = copy;
+	t->slots[s] = ++t->num;
+	*created = 1;
+	return t->num - 1;
+}
+
+static void strtab_free(strtab_t* t)
+{
+	for (uint32_t i = 0; i < t->num; i++) free(t->strs[i]);
+	free(t->strs);
+	free(t->slots);
+}
+
+
+static int pairtab_grow(pairtab_t* t)
+{
+	uint32_t num_slots = t->num_slots ? t->num_slots * 2 : 4096;
+	uint32_t* slots = calloc(num_slots, sizeof(uint32_t));
+	if (!slots) return -1;
+	for (uint32_t i = 0; i < t->num; i++)
+	{
+		uint32_t s = hash_pair(t->pairs[i].exec, t->pairs[i].file) & (num_slots - 1);
+		while (slots[s]) s = (s + 1) & (num_slots - 1);
+		slots[s] = i + 1;
+	}
+	free(t->slots);
+	t->slots = slots;
+	t->num_slots = num_slots;
+	return 0;
+}
+
+static bulk_pair_t* pairtab_get(pairtab_t* t, uint32_t exec, uint32_t file)
+{
+	if (2 * (t->num + 1) > t->num_slots && pairtab_grow(t)) return NULL;
+
+	uint32_t s = hash_pair(exec, file) & (t->num_slots - 1);
+	for (; t->slots[s]; s = (s + 1) & (t->num_slots - 1))
+	{
+		bulk_pair_t* p = &t->pairs[t->slots[s] - 1];
+		if (p->exec == exec && p->file == file) return p;
+	}
+
+	if (t->num == t->cap)
+	{
+		uint32_t cap = t->cap ? t->cap * 2 : 4096;
+		bulk_pair_t* pairs = realloc(t->pairs, cap * sizeof(bulk_pair_t));
+		if (!pairs) return NULL;
+		t->pairs = pairs;
+		t->cap = cap;
+	}
+	bulk_pair_t* p = &t->pairs[t->num];
+	memset(p, 0, sizeof(bulk_pair_t));
+	p->exec = exec;
+	p->file = file;
+	t->slots[s] = ++t->num;
+	return p;
+}
+
+
+static int seq_push(bulk_chunk_t* c, uint32_t value)
+{
+	if (c->num_seq == c->cap_seq)
+	{
+		size_t cap = c->cap_seq ? c->cap_seq * 2 : 4096;
+		uint32_t* seq = realloc(c->seq, cap * sizeof(uint32_t));
+		if (!seq) return -1;
+		c->seq = seq;
+		c->cap_seq = cap;
+	}
+	c->seq[c->num_seq++] = value;
+	return 0;
+}
+
+
+/**
+ * Aggregates a file usage like db_update() would store it.
+ */
+static int bulk_visit(void* ctx, const char* executable, const char* filepath,
+		const fusg_inode_t* inode, file_usage_t flags, uint64_t timestamp)
+{
+	bulk_chunk_t* c = ctx;
+	int created;
+
+	int64_t exec = strtab_intern(&c->execs, executable, &created);
+	if (exec < 0 || (created && seq_push(c, exec))) return ENOMEM;
+	int64_t file = strtab_intern(&c->files, filepath, &created);
+	if (file < 0 || (created && seq_push(c, file | BULK_SEQ_FILE))) return ENOMEM;
+
+	bulk_pair_t* p = pairtab_get(&c->pairs, exec, file);
+	if (!p) return ENOMEM;
+	p->stats.read   += ((flags & FUSG_READ)  > 0);
+	p->stats.write  += ((flags & FUSG_WRITE) > 0);
+	p->stats.create += ((flags & FUSG_CREAT) > 0);
+	p->stats.exec   += ((flags & FUSG_EXEC)  > 0);
+	p->stats.time    = timestamp;
+	if (flags & FUSG_DELET) p->stats.deleted = timestamp;
+	c->usages++;
+	return 0;
+}
+
+static void bulk_handle_event(auparse_state_t *au, auparse_cb_event_t cb_event_type, void *user_data)
+{
+	bulk_chunk_t* c = user_data;
+	if (cb_event_type != AUPARSE_CB_EVENT_READY || c->rc == ENOMEM) return;
+
+	store_parsed_t parsed;
+	int rc = store_parse(au, c->procs, bulk_visit, c, &parsed);
+	if (rc == ENOMEM) c->rc = rc;
+	c->events++;
+}
+
+static void* bulk_worker(void* arg)
+{
+	bulk_chunk_t* c = arg;
+	auparse_state_t* au = auparse_init(AUSOURCE_FEED, 0);
+	if (!au)
+	{
+		c->rc = ERR_AUPARSE;
+		return NULL;
+	}
+	auparse_set_escape_mode(au, AUPARSE_ESC_RAW);
+	auparse_add_callback(au, bulk_handle_event, c, NULL);
+	// without, events are just interpreted completely
+	c->procs = procs_create(PROCS_SLOTS);
+
+	for (size_t off = 0; off < c->len && c->rc != ENOMEM; off += BULK_FEED_SIZE)
+	{
+		size_t len = c->len - off < BULK_FEED_SIZE ? c->len - off : BULK_FEED_SIZE;
+		auparse_feed(au, c->data + off, len);
+	}
+	auparse_flush_feed(au);
+	auparse_destroy(au);
+	procs_destroy(c->procs);
+	c->procs = NULL;
+	return NULL;
+}
+
+
+static const char* next_line(const char* p, const char* end)
+{
+	const char* nl = memchr(p, '\n', end - p);
+	return nl ? nl + 1 : end;
+}
+
+static int is_eoe(const char* line, const char* end)
+{
+	const char* type = memmem(line, end - line, "type=", 5);
+	return type && end - type > 9 && !memcmp(type, "type=EOE ", 9);
+}
+
+/**
+ * @return start of the first event after the EOE record following p
+ */
+static const char* event_boundary(const char* p, const char* end)
+{
+	p = next_line(p, end);
+	while (p < end)
+	{
+		const char* next = next_line(p, end);
+		if (is_eoe(p, next)) return next;
+		p = next;
+	}
+	return end;
+}
+
+
+static int entry_cmp(const void* a, const void* b)
+{
+	const bulk_entry_t* x = a;
+	const bulk_entry_t* y = b;
+	if (x->key.exec_id != y->key.exec_id) return x->key.exec_id < y->key.exec_id ? -1 : 1;
+	if (x->key.file_id != y->key.file_id) return x->key.file_id < y->key.file_id ? -1 : 1;
+	return x->chunk - y->chunk;
+}
+
+
+/**
+ * Creates ids in order of first occurrence, then writes
+ * all aggregates in key order.
+ */
+static int bulk_merge(dbref_t db, bulk_chunk_t* chunks, int jobs, uint64_t* entries_written)
+{
+	int rc = 0;
+	size_t num_entries = 0;
+	for (int j = 0; j < jobs; j++) num_entries += chunks[j].pairs.num;
+	bulk_entry_t* entries = malloc((num_entries ? num_entries : 1) * sizeof(bulk_entry_t));
+	if (!entries) return ENOMEM;
+
+	if (db_begin_batch(db)) log_warn("bulk: no batch, writing entry by entry");
+
+	size_t n = 0;
+	for (int j = 0; j < jobs && !rc; j++)
+	{
+		bulk_chunk_t* c = &chunks[j];
+		free(c->exec_ids);
+		free(c->file_ids);
+		c->exec_ids = malloc((c->execs.num + 1) * sizeof(uint64_t));
+		c->file_ids = malloc((c->files.num + 1) * sizeof(uint64_t));
+		if (!c->exec_ids || !c->file_ids)
+		{
+			rc = ENOMEM;
+			break;
+		}
+		for (size_t i = 0; i < c->num_seq && !rc; i++)
+		{
+			uint32_t s = c->seq[i];
+			if (s & BULK_SEQ_FILE)
+				rc = db_file_create_id(db, c->files.strs[s & ~BULK_SEQ_FILE], &c->file_ids[s & ~BULK_SEQ_FILE]);
+			else
+				rc = db_exec_create_id(db, c->execs.strs[s], &c->exec_ids[s]);
+		}
+		for (uint32_t i = 0; i < c->pairs.num; i++, n++)
+		{
+			entries[n].key.exec_id = c->exec_ids[c->pairs.pairs[i].exec];
+			entries[n].key.file_id = c->file_ids[c->pairs.pairs[i].file];
+			entries[n].chunk = j;
+			entries[n].stats = c->pairs.pairs[i].stats;
+		}
+	}
+	if (rc) goto bail;
+
+	// later chunks go last, so their time stamps win
+	qsort(entries, num_entries, sizeof(bulk_entry_t), entry_cmp);
+	for (size_t i = 0; i < num_entries && !rc; )
+	{
+		fusg_stats_t stats = entries[i].stats;
+		size_t k = i + 1;
+		for (; k < num_entries && !memcmp(&entries[k].key, &entries[i].key, sizeof(fusg_stats_key_t)); k++)
+		{
+			stats.read   += entries[k].stats.read;
+			stats.write  += entries[k].stats.write;
+			stats.create += entries[k].stats.create;
+			stats.exec   += entries[k].stats.exec;
+			stats.time    = entries[k].stats.time;
+			if (entries[k].stats.deleted) stats.deleted = entries[k].stats.deleted;
+		}
+		rc = db_update_stats(db, &entries[i].key, &stats);
+		(*entries_written)++;
+		i = k;
+	}
+
+bail:
+	db_commit_batch(db);
+	free(entries);
+	return rc ? ERR_DB : 0;
+}
+
+
+/**
+ * Compares entries by names, ids may differ. The serial import
+ * completes events in the assembler, i.e. out-of-order events are
+ * stored in another order: time stamps of their entries may differ,
+ * hence time is compared separately and deleted as a flag.
+ * @param times receives the number of entries with another time stamp
+ * @return number of differences between the entries of a and b
+ */
+static uint64_t bulk_compare(dbref_t a, dbref_t b, uint64_t* entries, uint64_t* times)
+{
+	uint64_t diffs = 0;
+	fusg_stats_iterator_t it;
+	char exec[PATH_MAX];
+	char file[PATH_MAX];
+	*entries = 0;
+	*times = 0;
+	if (0 == db_fusg_stats_first(a, &it))
+	{
+		do {
+			fusg_stats_key_t key = db_iterator_get_fugs_stats_key(&it);
+			fusg_stats_t sa, sb;
+			(*entries)++;
+			if (db_iterator_fetch(&it, &sa)
+					|| db_exec_get_executable(a, key.exec_id, exec, sizeof(exec))
+					|| db_file_get_file(a, key.file_id, file, sizeof(file))
+					|| db_fetch(b, exec, file, &sb)
+					|| sa.read != sb.read || sa.write != sb.write || sa.create != sb.create
+					|| sa.exec != sb.exec || !sa.deleted != !sb.deleted)
+			{
+				if (!diffs) log_error("bulk: first difference: '%s' '%s'", exec, file);
+				diffs++;
+			}
+			else if (sa.time != sb.time) (*times)++;
+		} while (0 == db_iterator_next(&it));
+	}
+	db_iterator_release(it);
+
+	// entries only in b
+	uint64_t entries_b = 0;
+	if (0 == db_fusg_stats_first(b, &it))
+	{
+		do entries_b++; while (0 == db_iterator_next(&it));
+	}
+	db_iterator_release(it);
+	if (entries_b > *entries) diffs += entries_b - *entries;
+
+	return diffs;
+}
+
+/**
+ * Merges the chunks into a scratch db, imports the file serially
+ * into another one and compares both. global.db may hold more,
+ * e.g. other files or earlier imports, hence it isn't compared.
+ */
+static int bulk_verify(const char* path, bulk_chunk_t* chunks, int jobs)
+{
+	char bulk_path[PATH_MAX + 8];
+	char verify_path[PATH_MAX + 8];
+	snprintf(bulk_path, sizeof(bulk_path), "%s.bulk", global.conf.db_path);
+	snprintf(verify_path, sizeof(verify_path), "%s.verify", global.conf.db_path);
+	db_delete(bulk_path);
+	db_delete(verify_path);
+
+	FILE* fin = fopen(path, "r");
+	dbref_t bulk_db = db_open(bulk_path, DB_WRITE);
+	dbref_t verify_db = db_open(verify_path, DB_WRITE);
+	uint64_t entries = 0;
+	if (!fin || !bulk_db || !verify_db || bulk_merge(bulk_db, chunks, jobs, &entries))
+	{
+		log_error("bulk: can't verify: %s", strerror(errno));
+		if (fin) fclose(fin);
+		db_close(bulk_db);
+		db_close(verify_db);
+		db_delete(bulk_path);
+		db_delete(verify_path);
+		return ERR_DB;
+	}
+
+	dbref_t db = global.db;
+	global.db = verify_db;
+	global.fin = fin;
+	global.fd = fileno(fin);
+	log_info("bulk: serial import into '%s'", verify_path);
+	work();
+	global.db = db;
+
+	uint64_t times;
+	uint64_t diffs = bulk_compare(bulk_db, verify_db, &entries, &times);
+	fclose(fin);
+	db_close(bulk_db);
+	db_close(verify_db);
+	db_delete(bulk_path);
+	db_delete(verify_path);
+
+	if (diffs)
+	{
+		log_error("bulk: %lu of %lu entries differ from serial import", diffs, entries);
+		return ERR_UNKNOWN;
+	}
+	if (times) log_info("bulk: %lu entries with another time stamp (events out of order)", times);
+	log_info("bulk: %lu entries identical to serial import", entries);
+	return 0;
+}
+
+
+static double elapsed_s(const struct timespec* start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+int bulk_import(const char* path, int jobs, int verify)
+{
+	int rc = 0;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st))
+	{
+		log_error("bulk: can't open '%s': %s", path, strerror(errno));
+		if (fd != -1) close(fd);
+		return ERR_CONF;
+	}
+	size_t size = st.st_size;
+	const char* data = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		log_error("bulk: can't map '%s': %s", path, strerror(errno));
+		return ERR_CONF;
+	}
+	if (size) madvise((void*)data, size, MADV_SEQUENTIAL);
+
+	if (jobs < 1) jobs = 1;
+	bulk_chunk_t* chunks = calloc(jobs, sizeof(bulk_chunk_t));
+	pthread_t* threads = calloc(jobs, sizeof(pthread_t));
+	if (!chunks || !threads)
+	{
+		rc = ENOMEM;
+		goto bail;
+	}
+
+	//
+	// split at event boundaries
+	//
+	const char* end = data + size;
+	const char* p = data;
+	for (int j = 0; j < jobs; j++)
+	{
+		const char* target = data + size / jobs * (j + 1);
+		const char* next = end;
+		if (j < jobs - 1) next = target <= p ? p : event_boundary(target, end);
+		chunks[j].index = j;
+		chunks[j].data = p;
+		chunks[j].len = next - p;
+		p = next;
+	}
+
+	//
+	// parse and aggregate in parallel
+	//
+	int started = 0;
+	for (; started < jobs; started++)
+	{
+		if (pthread_create(&threads[started], NULL, bulk_worker, &chunks[started]))
+		{
+			log_error("bulk: can't start thread: %s", strerror(errno));
+			rc = ERR_UNKNOWN;
+			break;
+		}
+	}
+	uint64_t events = 0;
+	uint64_t usages = 0;
+	for (int j = 0; j < started; j++)
+	{
+		pthread_join(threads[j], NULL);
+		if (chunks[j].rc && !rc) rc = chunks[j].rc;
+		events += chunks[j].events;
+		usages += chunks[j].usages;
+	}
+	log_info("bulk: parsed %lu events, %lu file usages with %d jobs in %.1f s",
+			events, usages, jobs, elapsed_s(&start));
+	if (rc) goto bail;
+
+	//
+	// merge and write
+	//
+	uint64_t entries = 0;
+	rc = bulk_merge(global.db, chunks, jobs, &entries);
+	db_flush(global.db);
+	log_info("bulk: wrote %lu entries in %.1f s", entries, elapsed_s(&start));
+
+	global.events_processed += events;
+	if (!rc && verify) rc = bulk_verify(path, chunks, jobs);
+
+bail:
+	if (rc == ENOMEM)
+	{
+		log_error("bulk: out of memory");
+		rc = ERR_UNKNOWN;
+	}
+	for (int j = 0; chunks && j < jobs; j++)
+	{
+		strtab_free(&chunks[j].execs);
+		strtab_free(&chunks[j].files);
+		free(chunks[j].pairs.pairs);
+		free(chunks[j].pairs.slots);
+		free(chunks[j].seq);
+		free(chunks[j].exec_ids);
+		free(chunks[j].file_ids);
+	}
+	free(chunks);
+	free(threads);
+	if (size) munmap((void*)data, size);
+	return rc;
+}
@@ -0,0 +1,32 @@
+/*
+ * bulk.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef BULK_H_
+#define BULK_H_
+
+
+/*
+ * Parallel bulk import of audit logs (fusgd -r <file> -j <jobs>).
+ *
+ * The file is split at event boundaries into one chunk per job.
+ * Each job parses its chunk with its own auparse state and
+ * aggregates the file usages in memory. The aggregates are merged
+ * in file order, so ids are created in the same order as by a
+ * serial import, and written to the db in key order in one pass.
+ */
+
+
+/**
+ * Imports a log file into global.db.
+ * @param jobs number of threads
+ * @param verify compare the result of this file with a serial import
+ * @return 0 on success, error code otherwise
+ */
+int bulk_import(const char* path, int jobs, int verify);
+
+
+#endif /* BULK_H_ */
@@ -0,0 +1,260 @@
+/*
+ * degrade.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#define _GNU_SOURCE
+#include "degrade.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+
+#include "fusgd.h"
+#include "trace.h"
+#include "reader.h"
+
+
+/** consecutive overloaded checks before stepping down */
+#define DEGRADE_STEP_DOWN 2
+/** consecutive relaxed checks before stepping up */
+#define DEGRADE_STEP_UP 10
+/** slots of the sampling table */
+#define DEGRADE_SAMPLE_SLOTS 4096
+
+
+static const char* level_names[DEGRADE_LEVELS] = {
+	[DEGRADE_NONE]     = "normal",
+	[DEGRADE_NOTRACE]  = "notrace",
+	[DEGRADE_COALESCE] = "coalesce",
+	[DEGRADE_SAMPLE]   = "sample",
+};
+
+
+static degrade_level_t level = DEGRADE_NONE;
+static int overloaded_checks = 0;
+static int relaxed_checks = 0;
+static time_t last_check = 0;
+
+/** trace output while tracing is off */
+static FILE* trace_saved = NULL;
+
+/** processing lag of the latest event */
+static double event_lag = 0;
+static time_t event_wall = 0;
+
+/** time window at the current (degraded) level */
+static struct {
+	struct timespec start;
+	uint64_t first_ms;
+	uint64_t last_ms;
+	uint64_t events;
+} window;
+static double seconds_closed = 0;
+
+/** (exe, dir) pairs stored at that second */
+static struct {
+	uint64_t hash;
+	uint64_t timestamp;
+} samples[DEGRADE_SAMPLE_SLOTS];
+
+
+
+degrade_level_t degrade_level(void)
+{
+	return level;
+}
+
+
+void degrade_event(const au_event_t* event)
+{
+	struct timespec wall;
+	clock_gettime(CLOCK_REALTIME, &wall);
+	event_lag = (wall.tv_sec - event->sec) + (wall.tv_nsec / 1e9 - event->milli / 1e3);
+	event_wall = wall.tv_sec;
+
+	if (level != DEGRADE_NONE)
+	{
+		uint64_t ms = (uint64_t)event->sec * 1000 + event->milli;
+		if (!window.events) window.first_ms = ms;
+		window.last_ms = ms;
+		window.events++;
+	}
+}
+
+
+static double window_seconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - window.start.tv_sec) + (now.tv_nsec - window.start.tv_nsec) / 1e9;
+}
+
+/**
+ * Records the window of the current level.
+ */
+static void window_close(void)
+{
+	if (level == DEGRADE_NONE) return;
+
+	double seconds = window_seconds();
+	seconds_closed += seconds;
+	log_info("degraded: level %d (%s) for %.1f s, events %lu.%03lu .. %lu.%03lu (%lu events)",
+			level, level_names[level], seconds,
+			window.first_ms / 1000, window.first_ms % 1000,
+			window.last_ms / 1000, window.last_ms % 1000, window.events);
+
+	const char* path = global.conf.fusgd_degrade_windows;
+	if (!path[0]) return;
+	FILE* out = fopen(path, "a");
+	if (out)
+	{
+		// columns: level, name, first and last event time, events, duration
+		fprintf(out, "%d %s %lu.%03lu %lu.%03lu %lu %.1f\n",
+				level, level_names[level],
+				window.first_ms / 1000, window.first_ms % 1000,
+				window.last_ms / 1000, window.last_ms % 1000,
+				window.events, seconds);
+		fclose(out);
+	}
+	else log_warn("degrade: can't write '%s': %s", path, strerror(errno));
+}
+
+
+static void degrade_set(degrade_level_t next, double lag, int backlog)
+{
+	window_close();
+
+	if (next >= DEGRADE_NOTRACE && level < DEGRADE_NOTRACE)
+	{
+		trace_saved = trace_set(NULL);
+	}
+	else if (next < DEGRADE_NOTRACE && level >= DEGRADE_NOTRACE)
+	{
+		trace_set(trace_saved);
+		trace_saved = NULL;
+	}
+
+	if (next > level)
+		log_warn("overload: lag %.1f s, backlog %d%%: degrading to level %d (%s)",
+				lag, backlog, next, level_names[next]);
+	else
+		log_info("load relaxed: lag %.1f s, backlog %d%%: back to level %d (%s)",
+				lag, backlog, next, level_names[next]);
+
+	level = next;
+	memset(&window, 0, sizeof(window));
+	clock_gettime(CLOCK_MONOTONIC, &window.start);
+	if (level < DEGRADE_SAMPLE) memset(samples, 0, sizeof(samples));
+}
+
+
+int degrade_load(double lag, int backlog)
+{
+	int lag_max = global.conf.fusgd_degrade_lag;
+	int backlog_max = global.conf.fusgd_degrade_backlog;
+
+	if ((lag_max && lag > lag_max) || (backlog_max && backlog > backlog_max)) return 1;
+	if ((!lag_max || lag <= lag_max / 2.0) && (!backlog_max || backlog <= backlog_max / 2)) return -1;
+	return 0;
+}
+
+
+void degrade_check(void)
+{
+	int max = global.conf.fusgd_degrade_max;
+	// files are read at full speed, which is no overload
+	if (!max || global.mode == OP_PARSE_FILE) return;
+
+	time_t now = time(NULL);
+	if (now == last_check) return;
+	last_check = now;
+
+	// without recent events there is no lag
+	double lag = (now - event_wall <= 1) ? event_lag : 0;
+	int backlog = fd_backlog(global.fd);
+	int load = degrade_load(lag, backlog);
+
+	if (load > 0)
+	{
+		relaxed_checks = 0;
+		if (++overloaded_checks >= DEGRADE_STEP_DOWN && (int)level < max)
+		{
+			overloaded_checks = 0;
+			degrade_set(level + 1, lag, backlog);
+		}
+	}
+	else if (load < 0)
+	{
+		overloaded_checks = 0;
+		if (++relaxed_checks >= DEGRADE_STEP_UP && level != DEGRADE_NONE)
+		{
+			relaxed_checks = 0;
+			degrade_set(level - 1, lag, backlog);
+		}
+	}
+	else
+	{
+		// in between: stay
+		overloaded_checks = 0;
+		relaxed_checks = 0;
+	}
+}
+
+
+const char* degrade_coalesce(const char* filepath, char* buf)
+{
+	const char* slash = strrchr(filepath, '/');
+	if (!slash || slash == filepath) return "/";
+	size_t len = slash - filepath;
+	if (len >= PATH_MAX) len = PATH_MAX - 1;
+	memcpy(buf, filepath, len);
+	buf[len] = 0;
+	return buf;
+}
+
+
+static uint64_t fnv1a(uint64_t hash, const char* s)
+{
+	for (; *s; s++) hash = (hash ^ (unsigned char)*s) * 0x100000001b3UL;
+	return hash;
+}
+
+int degrade_sample(const char* executable, const char* dir, uint64_t timestamp)
+{
+	uint64_t hash = fnv1a(fnv1a(0xcbf29ce484222325UL, executable), dir);
+	size_t slot = hash % DEGRADE_SAMPLE_SLOTS;
+	if (samples[slot].hash == hash && samples[slot].timestamp == timestamp) return 1;
+	// collisions just let an update through
+	samples[slot].hash = hash;
+	samples[slot].timestamp = timestamp;
+	return 0;
+}
+
+
+double degrade_seconds(void)
+{
+	return seconds_closed + (level != DEGRADE_NONE ? window_seconds() : 0);
+}
+
+
+FILE* degrade_trace_set(FILE* fout)
+{
+	if (level < DEGRADE_NOTRACE) return trace_set(fout);
+	FILE* previous = trace_saved;
+	trace_saved = fout;
+	return previous;
+}
+
+
+void degrade_close(void)
+{
+	window_close();
+	if (level >= DEGRADE_NOTRACE) trace_set(trace_saved);
+	level = DEGRADE_NONE;
+}
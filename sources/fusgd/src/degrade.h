@@ -0,0 +1,101 @@
+/*
+ * degrade.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef DEGRADE_H_
+#define DEGRADE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <auparse.h>
+
+
+/*
+ * Overload protection.
+ *
+ * If fusgd can't keep up with its input, audispd queues events and
+ * eventually blocks syscalls or drops events. Instead, fusgd steps
+ * down through degradation levels, each one cheaper than the one
+ * before, up to fusgd_degrade_max. When the load is gone, it steps
+ * back up again.
+ *
+ * fusgd is overloaded, if events are processed more than
+ * fusgd_degrade_lag seconds after they occurred or if the input
+ * pipe is filled more than fusgd_degrade_backlog percent.
+ *
+ * Each time window spent at a degraded level is logged and written
+ * to fusgd_degrade_windows, so the affected db entries are known.
+ */
+
+
+typedef enum {
+	DEGRADE_NONE = 0,
+	/** no event tracing */
+	DEGRADE_NOTRACE,
+	/** store directories instead of files */
+	DEGRADE_COALESCE,
+	/** store repeated (exe, dir) pairs once per second only */
+	DEGRADE_SAMPLE,
+	DEGRADE_LEVELS
+} degrade_level_t;
+
+
+/**
+ * The current degradation level.
+ */
+degrade_level_t degrade_level(void);
+
+/**
+ * Accounts an event to the current time window.
+ */
+void degrade_event(const au_event_t* event);
+
+/**
+ * Steps down or up according to the load. Call periodically.
+ */
+void degrade_check(void);
+
+/**
+ * Rates the load against fusgd_degrade_lag and fusgd_degrade_backlog,
+ * a limit of 0 being disabled.
+ * @param lag [s]
+ * @param backlog filling of the input pipe [%]
+ * @return 1 if overloaded, -1 if below half of the enabled limits
+ *         (relaxed) and 0 in between
+ */
+int degrade_load(double lag, int backlog);
+
+/**
+ * Coalesces a file into its directory.
+ * @param filepath absolute path of a file
+ * @param buf receives the directory, size PATH_MAX
+ * @return directory of the file
+ */
+const char* degrade_coalesce(const char* filepath, char* buf);
+
+/**
+ * @return 1 if the update of this pair should be dropped, 0 otherwise
+ */
+int degrade_sample(const char* executable, const char* dir, uint64_t timestamp);
+
+/**
+ * Seconds spent in degraded levels so far.
+ */
+double degrade_seconds(void);
+
+/**
+ * Closes the current time window.
+ */
+void degrade_close(void);
+
+/**
+ * Replaces the trace output, which stays off while tracing is degraded.
+ * @return previous trace output
+ */
+FILE* degrade_trace_set(FILE* fout);
+
+
+#endif /* DEGRADE_H_ */
@@ -0,0 +1,437 @@
+/*
+ * fan.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#define _GNU_SOURCE
+#include "fan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+
+#include "metrics.h"
+
+
+/** size of the buffer events are read into */
+#define FAN_BUF_SIZE (64 * 1024)
+/** max number of marked paths */
+#define FAN_MARKS_MAX 32
+/** entries of the directory cache (direct mapped) */
+#define FAN_DIRS 1024
+/** directory handles up to this size are cached */
+#define FAN_HANDLE_MAX 64
+/** entries of the pid cache (direct mapped) */
+#define FAN_PIDS 1024
+/** seconds an executable of a pid is cached */
+#define FAN_PID_TTL 10
+
+#define FAN_EVENTS (FAN_OPEN | FAN_OPEN_EXEC | FAN_CLOSE_WRITE | FAN_CREATE | FAN_DELETE \
+		| FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR)
+
+
+typedef struct {
+	/** file system of the handle */
+	__kernel_fsid_t fsid;
+	/** fd on the file system, for open_by_handle_at() */
+	int fd;
+} fan_mount_t;
+
+typedef struct {
+	__kernel_fsid_t fsid;
+	int type;
+	unsigned int bytes;
+	unsigned char handle[FAN_HANDLE_MAX];
+	/** NULL if unused */
+	char* path;
+} fan_dir_t;
+
+typedef struct {
+	pid_t pid;
+	/** time exe was read from /proc (0: taken from an exec) */
+	time_t resolved;
+	/** NULL if unused */
+	char* exe;
+	/** last event of pid was an exec */
+	int execing;
+} fan_pid_t;
+
+
+static int fan = -1;
+static pid_t self;
+
+static fan_mount_t mounts[FAN_MARKS_MAX];
+static int num_mounts = 0;
+
+static fan_dir_t dirs[FAN_DIRS];
+static fan_pid_t pids[FAN_PIDS];
+
+
+
+static int is_mount_point(const char* path, const struct stat* st)
+{
+	char parent[PATH_MAX + 4];
+	struct stat pst;
+	snprintf(parent, sizeof(parent), "%s/..", path);
+	if (stat(parent, &pst)) return 0;
+	// the root is its own parent
+	return st->st_dev != pst.st_dev || st->st_ino == pst.st_ino;
+}
+
+
+static int mark(const char* path)
+{
+	struct stat st;
+	if (stat(path, &st) || !S_ISDIR(st.st_mode))
+	{
+		log_error("fanotify: '%s' is no directory", path);
+		return -1;
+	}
+	int whole_fs = is_mount_point(path, &st);
+	unsigned int flags = FAN_MARK_ADD | (whole_fs ? FAN_MARK_FILESYSTEM : 0);
+	uint64_t mask = FAN_EVENTS | (whole_fs ? 0 : FAN_EVENT_ON_CHILD);
+	if (fanotify_mark(fan, flags, mask, AT_FDCWD, path))
+	{
+		log_error("fanotify: can't mark '%s': %s", path, strerror(errno));
+		return -1;
+	}
+	log_info("fanotify: marked '%s'%s", path, whole_fs ? " (file system)" : "");
+
+	// keep an fd per file system to resolve handles
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	struct statfs sfs;
+	if (fd == -1 || fstatfs(fd, &sfs))
+	{
+		log_error("fanotify: can't open '%s': %s", path, strerror(errno));
+		if (fd != -1) close(fd);
+		return -1;
+	}
+	for (int i = 0; i < num_mounts; i++)
+	{
+		if (!memcmp(&mounts[i].fsid, &sfs.f_fsid, sizeof(mounts[i].fsid)))
+		{
+			close(fd);
+			return 0;
+		}
+	}
+	memcpy(&mounts[num_mounts].fsid, &sfs.f_fsid, sizeof(mounts[num_mounts].fsid));
+	mounts[num_mounts].fd = fd;
+	num_mounts++;
+	return 0;
+}
+
+
+int fan_open(const char* paths)
+{
+	fan = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_CLOEXEC | FAN_NONBLOCK,
+			O_RDONLY | O_LARGEFILE);
+	if (fan == -1)
+	{
+		log_error("fanotify: init: %s", strerror(errno));
+		return -1;
+	}
+	self = getpid();
+
+	char* list = strdup(paths);
+	char* save = NULL;
+	int rc = list ? 0 : -1;
+	for (char* path = list ? strtok_r(list, " \t", &save) : NULL;
+			!rc && path; path = strtok_r(NULL, " \t", &save))
+	{
+		if (num_mounts == FAN_MARKS_MAX)
+		{
+			log_error("fanotify: more than %d paths", FAN_MARKS_MAX);
+			rc = -1;
+		}
+		else rc = mark(path);
+	}
+	free(list);
+	if (rc || !num_mounts)
+	{
+		fan_close();
+		return -1;
+	}
+	return fan;
+}
+
+
+static void dirs_clear(void)
+{
+	for (int i = 0; i < FAN_DIRS; i++)
+	{
+		free(dirs[i].path);
+		dirs[i].path = NULL;
+	}
+}
+
+static void pids_clear(void)
+{
+	for (int i = 0; i < FAN_PIDS; i++)
+	{
+		free(pids[i].exe);
+		pids[i].exe = NULL;
+	}
+}
+
+
+void fan_close(void)
+{
+	if (fan != -1) close(fan);
+	fan = -1;
+	for (int i = 0; i < num_mounts; i++) close(mounts[i].fd);
+	num_mounts = 0;
+	dirs_clear();
+	pids_clear();
+}
+
+
+int fan_enabled(void)
+{
+	return fan != -1;
+}
+
+
+int fan_fd(void)
+{
+	return fan;
+}
+
+
+/**
+ * @return path of the fd or NULL
+ */
+static char* fd_path(int fd)
+{
+	char proc[32];
+	char path[PATH_MAX];
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+	ssize_t len = readlink(proc, path, sizeof(path) - 1);
+	if (len <= 0) return NULL;
+	path[len] = '\0';
+	return strdup(path);
+}
+
+
+static unsigned int dir_hash(const __kernel_fsid_t* fsid, const struct file_handle* h)
+{
+	// FNV-1a
+	unsigned int hash = 2166136261u;
+	const unsigned char* p = (const unsigned char*)fsid;
+	for (size_t i = 0; i < sizeof(*fsid); i++) hash = (hash ^ p[i]) * 16777619u;
+	for (unsigned int i = 0; i < h->handle_bytes; i++) hash = (hash ^ h->f_handle[i]) * 16777619u;
+	return hash;
+}
+
+/**
+ * @return path of the directory or NULL if it's gone
+ */
+static const char* dir_path(const __kernel_fsid_t* fsid, struct file_handle* h)
+{
+	fan_dir_t* d = &dirs[dir_hash(fsid, h) % FAN_DIRS];
+	int cacheable = h->handle_bytes <= FAN_HANDLE_MAX;
+	if (cacheable && d->path && d->type == h->handle_type && d->bytes == h->handle_bytes
+			&& !memcmp(&d->fsid, fsid, sizeof(*fsid))
+			&& !memcmp(d->handle, h->f_handle, h->handle_bytes))
+	{
+		return d->path;
+	}
+
+	int mount_fd = -1;
+	for (int i = 0; i < num_mounts && mount_fd == -1; i++)
+	{
+		if (!memcmp(&mounts[i].fsid, fsid, sizeof(*fsid))) mount_fd = mounts[i].fd;
+	}
+	if (mount_fd == -1) return NULL;
+	int fd = open_by_handle_at(mount_fd, h, O_PATH | O_CLOEXEC);
+	if (fd == -1) return NULL;
+	char* path = fd_path(fd);
+	close(fd);
+	if (!path) return NULL;
+
+	// the entry is replaced also if the handle can't be cached
+	free(d->path);
+	d->path = path;
+	d->bytes = cacheable ? h->handle_bytes : 0;
+	d->type = cacheable ? h->handle_type : -1;
+	memcpy(&d->fsid, fsid, sizeof(*fsid));
+	if (cacheable) memcpy(d->handle, h->f_handle, h->handle_bytes);
+	return path;
+}
+
+
+/**
+ * @return executable of pid or NULL if the process is gone
+ *         and it didn't exec a file watched
+ */
+static const char* pid_exe(pid_t pid, time_t now)
+{
+	fan_pid_t* p = &pids[pid % FAN_PIDS];
+	if (p->pid != pid)
+	{
+		free(p->exe);
+		p->exe = NULL;
+		p->pid = pid;
+		p->execing = 0;
+	}
+	else if (p->exe && p->resolved && now - p->resolved < FAN_PID_TTL) return p->exe;
+
+	char proc[32];
+	char exe[PATH_MAX];
+	snprintf(proc, sizeof(proc), "/proc/%d/exe", pid);
+	ssize_t len = readlink(proc, exe, sizeof(exe) - 1);
+	if (len <= 0)
+	{
+		// short-lived: the file it exec'd, if seen
+		return p->exe;
+	}
+	exe[len] = '\0';
+
+	char* copy = strdup(exe);
+	if (!copy) return NULL;
+	free(p->exe);
+	p->exe = copy;
+	p->resolved = now;
+	return p->exe;
+}
+
+/**
+ * Records the file exec'd by pid, which replaces its cached executable.
+ * Further execs in a row load the interpreter (ld.so), which is not
+ * the executable.
+ */
+static void pid_exec(pid_t pid, const char* filepath)
+{
+	fan_pid_t* p = &pids[pid % FAN_PIDS];
+	if (p->pid == pid && p->execing) return;
+	char* copy = strdup(filepath);
+	if (!copy) return;
+	free(p->exe);
+	p->exe = copy;
+	p->pid = pid;
+	p->resolved = 0;
+	p->execing = 1;
+}
+
+static void pid_event(pid_t pid)
+{
+	fan_pid_t* p = &pids[pid % FAN_PIDS];
+	if (p->pid == pid) p->execing = 0;
+}
+
+
+static file_usage_t usage_of(uint64_t mask)
+{
+	file_usage_t flags = 0;
+	// an exec opens the file, too
+	if (mask & FAN_OPEN_EXEC) flags |= FUSG_EXEC;
+	else if (mask & FAN_OPEN) flags |= FUSG_READ;
+	if (mask & FAN_CLOSE_WRITE) flags |= FUSG_WRITE;
+	if (mask & FAN_CREATE) flags |= FUSG_CREAT;
+	if (mask & FAN_DELETE) flags |= FUSG_DELET;
+	return flags;
+}
+
+
+/**
+ * Resolves and hands over a single event.
+ */
+static void handle(const struct fanotify_event_metadata* m, time_t now, fan_usage_t usage)
+{
+	if (m->mask & FAN_ONDIR)
+	{
+		// cached paths below a moved or deleted directory are stale
+		if (m->mask & (FAN_MOVED_FROM | FAN_MOVED_TO | FAN_DELETE)) dirs_clear();
+		return;
+	}
+	file_usage_t flags = usage_of(m->mask);
+	if (!flags) return;
+
+	const char* info = (const char*)m + m->metadata_len;
+	const char* end = (const char*)m + m->event_len;
+	const struct fanotify_event_info_fid* fid = NULL;
+	while (info + sizeof(struct fanotify_event_info_header) <= end)
+	{
+		const struct fanotify_event_info_header* hdr = (const void*)info;
+		if (!hdr->len) break;
+		if (hdr->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) fid = (const void*)info;
+		info += hdr->len;
+	}
+	if (!fid)
+	{
+		metrics_inc(METRIC_FAN_UNRESOLVED);
+		return;
+	}
+
+	struct file_handle* h = (struct file_handle*)fid->handle;
+	const char* name = (const char*)h->f_handle + h->handle_bytes;
+
+	const char* dir = dir_path(&fid->fsid, h);
+	char filepath[PATH_MAX];
+	int len = dir ? snprintf(filepath, sizeof(filepath), "%s/%s", strcmp(dir, "/") ? dir : "", name) : -1;
+	if (len < 0 || len >= (int)sizeof(filepath))
+	{
+		// directory deleted meanwhile
+		metrics_inc(METRIC_FAN_UNRESOLVED);
+		return;
+	}
+
+	if (m->mask & FAN_OPEN_EXEC) pid_exec(m->pid, filepath);
+	else pid_event(m->pid);
+	const char* exe = pid_exe(m->pid, now);
+	if (!exe)
+	{
+		// process exited meanwhile
+		metrics_inc(METRIC_FAN_UNRESOLVED);
+		return;
+	}
+	usage(exe, filepath, flags, now);
+}
+
+
+int fan_read(fan_usage_t usage)
+{
+	char buf[FAN_BUF_SIZE] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+	ssize_t len = read(fan, buf, sizeof(buf));
+	if (len < 0)
+	{
+		if (errno == EAGAIN || errno == EINTR) return 0;
+		log_error("fanotify: read: %s", strerror(errno));
+		return -1;
+	}
+
+	time_t now = time(NULL);
+	int events = 0;
+	const struct fanotify_event_metadata* m = (const void*)buf;
+	for (; FAN_EVENT_OK(m, len); m = FAN_EVENT_NEXT(m, len))
+	{
+		if (m->vers != FANOTIFY_METADATA_VERSION)
+		{
+			log_error("fanotify: unsupported metadata version %d", m->vers);
+			return -1;
+		}
+		events++;
+		metrics_inc(METRIC_FAN_EVENTS);
+		if (m->mask & FAN_Q_OVERFLOW)
+		{
+			log_limited(LL_WARN, "fanotify: event queue overflow, events lost");
+			metrics_inc(METRIC_FAN_OVERFLOWS);
+			continue;
+		}
+		// our own db updates
+		if (m->pid == self) continue;
+		handle(m, now, usage);
+	}
+	return events;
+}
@@ -0,0 +1,75 @@
+/*
+ * fan.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef FAN_H_
+#define FAN_H_
+
+#include <stdint.h>
+
+#include "../../fusg-common/include/fusg/db.h"
+
+
+/*
+ * Event source based on fanotify (fusgd_fanotify), as alternative to
+ * the audit log: the kernel reports file events of marked file systems
+ * or directories directly, without audit records, auditd, text
+ * formatting and auparse.
+ *
+ * Events are reported with the handle of the parent directory and the
+ * name of the file (FAN_REPORT_DFID_NAME). Directory handles are
+ * resolved to paths through open_by_handle_at() and cached. The
+ * executable is resolved through /proc/<pid>/exe and cached per pid
+ * for a few seconds, or until the pid execs another file.
+ *
+ *   FAN_OPEN        -> FUSG_READ
+ *   FAN_OPEN_EXEC   -> FUSG_EXEC
+ *   FAN_CLOSE_WRITE -> FUSG_WRITE
+ *   FAN_CREATE      -> FUSG_CREAT
+ *   FAN_DELETE      -> FUSG_DELET
+ *
+ * Requires CAP_SYS_ADMIN and Linux 5.9.
+ */
+
+
+/**
+ * Receives a file usage.
+ */
+typedef void (*fan_usage_t)(const char* executable, const char* filepath,
+		file_usage_t flags, uint64_t timestamp);
+
+/**
+ * Marks the given paths: mount points as whole file system,
+ * any other directory with its direct children only.
+ * @param paths space separated list of directories
+ * @return fanotify fd or -1 on error
+ */
+int fan_open(const char* paths);
+
+/**
+ * Closes the fanotify fd and releases all caches.
+ */
+void fan_close(void);
+
+/**
+ * @return 1 if fanotify is the event source
+ */
+int fan_enabled(void);
+
+/**
+ * @return fanotify fd or -1
+ */
+int fan_fd(void);
+
+/**
+ * Reads the pending events (one buffer at most) and hands
+ * their file usages to usage.
+ * @return number of events read, 0 if none is pending, -1 on error
+ */
+int fan_read(fan_usage_t usage);
+
+
+#endif /* FAN_H_ */
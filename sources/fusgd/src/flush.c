@@ -0,0 +1,133 @@
+/*
+ * flush.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#include "flush.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+
+#include "fusgd.h"
+#include "lag.h"
+#include "metrics.h"
+#include "spool.h"
+#include "tail.h"
+
+
+static const char* const flush_reasons[] = {
+	[FLUSH_UPDATES] = "updates",
+	[FLUSH_BYTES]   = "size",
+	[FLUSH_AGE]     = "age",
+	[FLUSH_IDLE]    = "idle",
+	[FLUSH_EXIT]    = "exit",
+	[FLUSH_RELOAD]  = "reload",
+};
+
+static uint64_t flush_counts[FLUSH_REASONS];
+
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+void flush_db(flush_reason_t reason)
+{
+	db_dirty_t dirty;
+	db_dirty(global.db, &dirty);
+
+	uint64_t start = now_ns();
+	if (0 == db_flush(global.db))
+	{
+		lag_durable();
+		spool_checkpoint();
+		tail_checkpoint();
+	}
+	uint64_t duration = now_ns() - start;
+	metrics_observe(METRIC_DB_FLUSH_SECONDS, duration / 1e9);
+	global.db_flushes++;
+	flush_counts[reason]++;
+	global.db_flush_ns_total += duration;
+	if (duration > global.db_flush_ns_max) global.db_flush_ns_max = duration;
+
+	if (dirty.updates)
+	{
+		metrics_observe(METRIC_DB_FLUSH_UPDATES, dirty.updates);
+		metrics_add(METRIC_DB_FLUSHED_BYTES, dirty.bytes);
+		log_debug("db flush (%s): %lu updates, %lu bytes, oldest %.0f ms, took %.1f ms",
+				flush_reasons[reason], dirty.updates, dirty.bytes,
+				(start - dirty.first_ns) / 1e6, duration / 1e6);
+	}
+}
+
+
+uint64_t flush_count(flush_reason_t reason)
+{
+	return flush_counts[reason];
+}
+
+const char* flush_reason_name(flush_reason_t reason)
+{
+	return flush_reasons[reason];
+}
+
+
+/**
+ * @return what triggers a flush now or -1
+ */
+static int flush_due(const db_dirty_t* dirty, uint64_t now)
+{
+	if (!dirty->updates) return -1;
+	if (global.conf.db_flush_updates > 0
+			&& dirty->updates >= (uint64_t)global.conf.db_flush_updates)
+	{
+		return FLUSH_UPDATES;
+	}
+	if (global.conf.db_flush_kib > 0
+			&& dirty->bytes >= (uint64_t)global.conf.db_flush_kib * 1024)
+	{
+		return FLUSH_BYTES;
+	}
+	if (now - dirty->first_ns >= (uint64_t)global.conf.db_flush_age * 1000000)
+	{
+		return FLUSH_AGE;
+	}
+	if (now - dirty->last_ns >= (uint64_t)global.conf.db_flush_idle * 1000000)
+	{
+		return FLUSH_IDLE;
+	}
+	return -1;
+}
+
+
+void flush_check(void)
+{
+	db_dirty_t dirty;
+	db_dirty(global.db, &dirty);
+	int reason = flush_due(&dirty, now_ns());
+	if (reason >= 0) flush_db(reason);
+}
+
+
+int flush_timeout_ms(void)
+{
+	db_dirty_t dirty;
+	db_dirty(global.db, &dirty);
+	if (!dirty.updates) return -1;
+
+	uint64_t now = now_ns();
+	uint64_t age_due = dirty.first_ns + (uint64_t)global.conf.db_flush_age * 1000000;
+	uint64_t idle_due = dirty.last_ns + (uint64_t)global.conf.db_flush_idle * 1000000;
+	uint64_t due = age_due < idle_due ? age_due : idle_due;
+	// round up: don't wake up just before
+	return due > now ? (due - now + 999999) / 1000000 : 0;
+}
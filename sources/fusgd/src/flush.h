@@ -0,0 +1,65 @@
+/*
+ * flush.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef FLUSH_H_
+#define FLUSH_H_
+
+#include <stdint.h>
+
+
+/*
+ * Flush policy: the db gets flushed (synced to disk), as soon as one
+ * of its targets is reached:
+ *
+ *   - db_flush_updates updates are not flushed yet,
+ *   - db_flush_kib KiB of records are not flushed yet,
+ *   - the oldest update not flushed is db_flush_age ms old,
+ *   - input is idle for db_flush_idle ms.
+ *
+ * This bounds the data lost on a crash as well as the time spent
+ * in fsync, under continuous input as well as when idle.
+ */
+
+
+/** what triggered a flush */
+typedef enum {
+	FLUSH_UPDATES,
+	FLUSH_BYTES,
+	FLUSH_AGE,
+	FLUSH_IDLE,
+	FLUSH_EXIT,
+	FLUSH_RELOAD,
+	FLUSH_REASONS
+} flush_reason_t;
+
+
+/**
+ * Flushes the db, if one of the targets is reached. Call after
+ * updates and while input is idle.
+ */
+void flush_check(void);
+
+/**
+ * @return milliseconds until flush_check() reaches a time based
+ *         target, if input stays idle, or -1 if nothing is pending
+ */
+int flush_timeout_ms(void);
+
+/**
+ * Flushes the db unconditionally and reports size and duration.
+ */
+void flush_db(flush_reason_t reason);
+
+/**
+ * @return number of flushes for the given reason so far
+ */
+uint64_t flush_count(flush_reason_t reason);
+
+const char* flush_reason_name(flush_reason_t reason);
+
+
+#endif /* FLUSH_H_ */
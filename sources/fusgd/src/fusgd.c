@@ -8,6 +8,7 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
 
 #include "fusg/db.h"
 #include "fusg/err.h"
@@ -19,6 +20,16 @@
 #include "fusgd.h"
 #include "trace.h"
 #include "work.h"
+#include "service.h"
+#include "metrics.h"
+#include "spool.h"
+#include "bulk.h"
+#include "input.h"
+#include "tail.h"
+#include "fan.h"
+#include "assemble.h"
+#include "degrade.h"
+#include "flush.h"
 
 
 #define FUSGD_NAME "fusgd"
@@ -26,10 +37,18 @@
 
 static void term_handler(int sig);
 static void hup_handler(int sig);
+static void usr1_handler(int sig);
 
 static int read_args(int argc, char** argv);
 static void print_usage(void);
+static void log_conf(void);
+static dbref_t open_db(const fusg_conf_t* conf);
 
+/** log file given by --follow */
+static const char* follow_path = NULL;
+
+static FILE* fusgd_trace = 0;
+static FILE* fusgd_log = 0;
 
 
 fusgd_global_t global;
@@ -39,8 +58,6 @@ fusgd_global_t global;
 
 int main(int argc, char *argv[]) {
 	int rc = 0;
-	FILE* fusgd_trace = 0;
-	FILE* fusgd_log = 0;
 
 
 	// init global variables
@@ -56,6 +73,9 @@ int main(int argc, char *argv[]) {
 	// read arguments and config
 	rc = read_args(argc, argv);
 	if (!rc) fusg_conf_read(&global.conf, global.conf_file);
+	if (follow_path) snprintf(global.conf.fusgd_tail, PATH_MAX, "%s", follow_path);
+	if (global.mode == OP_PARSE_STDIN && global.conf.fusgd_tail[0]) global.mode = OP_TAIL;
+	if (global.mode == OP_PARSE_STDIN && global.conf.fusgd_fanotify[0]) global.mode = OP_FANOTIFY;
 
 	//
 	// shortcut if we just want to output help
@@ -85,9 +105,10 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	log_info("db_path: '%s'", global.conf.db_path);
-	log_info("fusg_log: '%s'", global.conf.fusgd_log);
-	log_info("fusg_trace: '%s'", global.conf.fusgd_trace);
+	// writing the log must not hold up event processing
+	if (logging_start_async()) log_warn("logging: no background writer: %s", strerror(errno));
+
+	log_conf();
 
 	rlim_t coredump_size = system_coredump_size();
 	if (coredump_size >= 0)
@@ -111,15 +132,29 @@ int main(int argc, char *argv[]) {
 	}
 
 
-	if (global.mode == OP_PARSE_FILE)
+	if (global.mode == OP_PARSE_FILE && !global.jobs)
+	{
+		global.fd = input_open();
+		if (global.fd == -1) {
+			rc = ERR_CONF;
+			goto bail;
+		}
+	}
+	else if (global.mode == OP_TAIL)
 	{
-		global.fin = fopen(global.source, "rm");
-		if (!global.fin) {
-			log_error("can't open input log file '%s'\n\t%s", global.source, strerror(errno));
+		global.fd = tail_open(global.conf.fusgd_tail, global.conf.fusgd_tail_state);
+		if (global.fd == -1) {
+			rc = ERR_CONF;
+			goto bail;
+		}
+	}
+	else if (global.mode == OP_FANOTIFY)
+	{
+		// no input stream: events are read from fan_fd()
+		global.fd = -1;
+		if (fan_open(global.conf.fusgd_fanotify) == -1) {
 			rc = ERR_CONF;
 			goto bail;
-		} else {
-			global.fd = fileno(global.fin);
 		}
 	}
 
@@ -154,18 +189,72 @@ int main(int argc, char *argv[]) {
 	sigaction(SIGTERM, &sa, NULL);
 	sa.sa_handler = hup_handler;
 	sigaction(SIGHUP, &sa, NULL);
+	sa.sa_handler = usr1_handler;
+	sigaction(SIGUSR1, &sa, NULL);
 
 	//
 	// open db
 	//
-	global.db = db_open(global.conf.db_path, DB_WRITE);
+	if (global.conf.db_inodes && global.jobs)
+	{
+		// bulk import aggregates by path
+		log_warn("db_inodes is ignored by bulk import: files are identified by path");
+	}
+	global.db = open_db(&global.conf);
+
+	//
+	// start query service
+	//
+	if (global.db && global.conf.fusgd_socket[0] && !global.jobs)
+	{
+		// fusg falls back to the db, if this fails
+		service_open(global.conf.fusgd_socket, global.conf.db_path);
+	}
+
+	//
+	// publish live table
+	//
+	if (global.db && global.conf.fusgd_live[0] && !global.jobs)
+	{
+		global.live = live_create(global.conf.fusgd_live, global.conf.fusgd_live_entries);
+		if (global.live) log_info("live table: '%s'", global.conf.fusgd_live);
+	}
 
+	//
+	// spool input backing up (and replay what's left)
+	//
+	if (global.db && global.mode == OP_PARSE_STDIN && global.conf.fusgd_spool[0])
+	{
+		// without spool, input just backs up as before
+		if (0 == spool_open(global.conf.fusgd_spool, (uint64_t)global.conf.fusgd_spool_max << 20))
+		{
+			int fd = spool_intake_start(global.fd, global.conf.fusgd_spool_watermark);
+			if (fd != -1) global.fd = fd;
+			else spool_close();
+		}
+	}
 
 	//
 	// start serving
 	//
 	log_info("start processing events");
-	work();
+	if (global.jobs)
+	{
+		if (!global.db) rc = ERR_DB;
+		for (size_t i = 0; !rc && i < input_files() && !global.stop; i++)
+		{
+			if (input_format(input_file(i)) != INPUT_PLAIN)
+			{
+				log_error("bulk import of compressed file '%s' not supported", input_file(i));
+				rc = ERR_USAGE;
+			}
+			else rc = bulk_import(input_file(i), global.jobs, global.verify);
+		}
+	}
+	else
+	{
+		work();
+	}
 	log_info("finished processing events");
 
 	//
@@ -179,6 +268,13 @@ int main(int argc, char *argv[]) {
 
 bail:
 
+	spool_close();
+	input_close();
+	input_clear();
+	tail_close();
+	fan_close();
+	live_destroy(global.live);
+	service_close();
 	db_close(global.db);
 
 	if (fusgd_trace)
@@ -186,6 +282,7 @@ bail:
 
 
 	log_info("exit code: %d", rc);
+	logging_finalize();
 
 
 	if (fusgd_log)
@@ -197,6 +294,53 @@ bail:
 
 
 
+static void log_conf(void)
+{
+	log_info("db_path: '%s'", global.conf.db_path);
+	log_info("fusg_log: '%s'", global.conf.fusgd_log);
+	log_info("fusg_trace: '%s'", global.conf.fusgd_trace);
+	log_info("fusgd_socket: '%s'", global.conf.fusgd_socket);
+	log_info("fusgd_live: '%s' (%d entries)", global.conf.fusgd_live, global.conf.fusgd_live_entries);
+	log_info("fusgd_metrics: '%s' (every %d s)", global.conf.fusgd_metrics, global.conf.fusgd_metrics_period);
+	log_info("fusgd_degrade_max: %d (lag %d s, backlog %d%%, windows '%s')", global.conf.fusgd_degrade_max,
+			global.conf.fusgd_degrade_lag, global.conf.fusgd_degrade_backlog, global.conf.fusgd_degrade_windows);
+	log_info("fusgd_inflight_max: %d (timeout %d ms)", global.conf.fusgd_inflight_max, global.conf.fusgd_inflight_timeout);
+	log_info("fusgd_spool: '%s' (max %d MiB, watermark %d%%)", global.conf.fusgd_spool,
+			global.conf.fusgd_spool_max, global.conf.fusgd_spool_watermark);
+	log_info("fusgd_tail: '%s' (state '%s')", global.conf.fusgd_tail, global.conf.fusgd_tail_state);
+	log_info("fusgd_fanotify: '%s'", global.conf.fusgd_fanotify);
+	log_info("db_snapshot_period: %d s", global.conf.db_snapshot_period);
+	log_info("db_batch_events: %d", global.conf.db_batch_events);
+	log_info("db_batch_time: %d ms", global.conf.db_batch_time);
+	log_info("db_inodes: %d", global.conf.db_inodes);
+	log_info("db_retention_days: %d (deleted: %d, every %d s, %d per step, pause %d ms)",
+			global.conf.db_retention_days, global.conf.db_retention_deleted_days,
+			global.conf.db_prune_period, global.conf.db_prune_work, global.conf.db_reorganise_pause);
+	log_info("db_dir_depth: %d (max %d pending)", global.conf.db_dir_depth, global.conf.db_dir_pending);
+	log_info("db_flush: %d updates, %d KiB, age %d ms, idle %d ms",
+			global.conf.db_flush_updates, global.conf.db_flush_kib,
+			global.conf.db_flush_age, global.conf.db_flush_idle);
+}
+
+
+/**
+ * Opens the db for writing as configured, with directory rollups.
+ * @return db or NULL
+ */
+static dbref_t open_db(const fusg_conf_t* conf)
+{
+	db_flags_t db_flags = DB_WRITE;
+	if (conf->db_snapshot_period) db_flags |= DB_SNAPSHOT;
+	if (conf->db_inodes && !global.jobs) db_flags |= DB_INODES;
+	dbref_t db = db_open(conf->db_path, db_flags);
+	if (db && db_dirs(db, conf->db_dir_depth, conf->db_dir_pending))
+	{
+		log_warn("no directory rollups: %s", strerror(errno));
+	}
+	return db;
+}
+
+
 static int read_args(int argc, char** argv)
 {
 	// set defaults
@@ -231,11 +375,51 @@ static int read_args(int argc, char** argv)
 				log_error("missing log file to read");
 				global.mode = OP_HELP;
 			}
+			// files or globs up to the next flag
+			for (; i < argc; i++)
+			{
+				if (input_add(argv[i]) < 0)
+				{
+					log_error("no log file matches '%s'", argv[i]);
+					global.mode = OP_HELP;
+					rc = ERR_USAGE;
+				}
+				if (i + 1 < argc && argv[i + 1][0] == '-') break;
+			}
+		}
+		else if (!strcmp(arg, "-f") || !strcmp(arg, "--follow"))
+		{
+			i++;
+			if (i < argc)
+			{
+				follow_path = argv[i];
+			}
 			else
 			{
-				snprintf(global.source, PATH_MAX, "%s", argv[i]);
+				log_error("missing log file to follow");
+				global.mode = OP_HELP;
+				rc = ERR_USAGE;
+				break;
 			}
-			break;
+		}
+		else if (!strcmp(arg, "-j") || !strcmp(arg, "--jobs"))
+		{
+			i++;
+			if (i < argc && atoi(argv[i]) > 0)
+			{
+				global.jobs = atoi(argv[i]);
+			}
+			else
+			{
+				log_error("missing number of jobs");
+				global.mode = OP_HELP;
+				rc = ERR_USAGE;
+				break;
+			}
+		}
+		else if (!strcmp(arg, "--verify"))
+		{
+			global.verify = 1;
 		}
 		else
 		{
@@ -247,6 +431,13 @@ static int read_args(int argc, char** argv)
 	}
 
 
+	if (global.jobs && global.mode != OP_PARSE_FILE)
+	{
+		log_error("bulk import requires a log file to read");
+		global.mode = OP_HELP;
+		rc = ERR_USAGE;
+	}
+
 	return rc;
 }
 
@@ -255,8 +446,15 @@ static void print_usage(void)
 	printf("> %s <flags>\n", global.progname);
 	printf("-c | --conf <fusg.conf>\n"
 			"\tread config from given path <fusg.conf>.\n");
-	printf("-r | --read <file>\n"
-			"\tread file instead of stdin.\n");
+	printf("-r | --read <file|glob> ...\n"
+			"\tread files instead of stdin, in the given order.\n"
+			"\tgzip and zstd compressed files are decompressed on the fly.\n");
+	printf("-f | --follow <file>\n"
+			"\tfollow audit log <file> instead of reading stdin (see fusgd_tail).\n");
+	printf("-j | --jobs <n>\n"
+			"\timport file given by --read with <n> threads (offline only).\n");
+	printf("--verify\n"
+			"\tcompare the result of --jobs with a serial import.\n");
 }
 
 
@@ -270,9 +468,188 @@ static void hup_handler(int sig)
 	global.received_sighup = 1;
 }
 
+static void usr1_handler(int sig)
+{
+	global.received_sigusr1 = 1;
+}
+
+/**
+ * Keeps the current value of a setting, which applies after restart only.
+ */
+static void keep_str(char* value, const char* current, const char* name)
+{
+	if (strcmp(value, current))
+	{
+		log_warn("reload: %s requires a restart, keeping '%s'", name, current);
+		strcpy(value, current);
+	}
+}
+
+static void keep_int(int* value, int current, const char* name)
+{
+	if (*value != current)
+	{
+		log_warn("reload: %s requires a restart, keeping %d", name, current);
+		*value = current;
+	}
+}
+
+
+/**
+ * Reopens the log file, e.g. after logrotate moved it away.
+ */
+static void reload_log(const char* path)
+{
+	if (!path[0])
+	{
+		if (!fusgd_log) return;
+		logging_set_file(NULL);
+		fclose(fusgd_log);
+		fusgd_log = NULL;
+		logging_set_log_levels(LL_INFO, LL_DEBUG, LL_INFO);
+		return;
+	}
+
+	// append: it may be the same file still
+	FILE* fp = fopen(path, "a");
+	if (!fp)
+	{
+		log_warn("reload: open '%s': %s", path, strerror(errno));
+		return;
+	}
+	if (fusgd_log)
+	{
+		logging_set_file(fp);
+		fclose(fusgd_log);
+	}
+	else
+	{
+		logging_setup_file(fp, 1);
+		logging_set_log_levels(LL_ERROR, LL_DEBUG, LL_ERROR);
+	}
+	fusgd_log = fp;
+}
+
+static void reload_trace(const char* path)
+{
+	FILE* fp = stdout;
+	if (path[0])
+	{
+		fp = fopen(path, "a");
+		if (!fp)
+		{
+			log_warn("reload: open '%s': %s", path, strerror(errno));
+			return;
+		}
+	}
+	// stays off while degraded
+	degrade_trace_set(fp);
+	if (fusgd_trace) fclose(fusgd_trace);
+	fusgd_trace = fp != stdout ? fp : NULL;
+}
+
+/**
+ * Switches to another db (db_path, db_inodes or snapshots changed).
+ * @return 0 on success, -1 if the current db stays
+ */
+static int reload_db(const fusg_conf_t* conf)
+{
+	// everything received so far goes to the current db
+	flush_db(FLUSH_RELOAD);
+
+	// the db is locked by its writer
+	int same = !strcmp(conf->db_path, global.conf.db_path);
+	if (same)
+	{
+		db_close(global.db);
+		global.db = NULL;
+	}
+	dbref_t db = open_db(conf);
+	if (!db)
+	{
+		log_error("reload: can't open db '%s', keeping '%s'", conf->db_path, global.conf.db_path);
+		if (same) global.db = open_db(&global.conf);
+		if (!global.db)
+		{
+			// input stays unacknowledged (tail state, spool) for the next run
+			log_fatal("reload: can't reopen db '%s'", global.conf.db_path);
+			exit(ERR_DB);
+		}
+		return -1;
+	}
+	if (!same) db_close(global.db);
+	global.db = db;
+	if (service_fd() != -1) service_reindex(conf->db_path);
+	return 0;
+}
+
+
 void reload_config(void)
 {
-	// TODO: reload config here
 	global.received_sighup = 0;
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	fusg_conf_t conf;
+	if (fusg_conf_read(&conf, global.conf_file))
+	{
+		log_error("reload: can't read '%s', keeping the current config", global.conf_file);
+		metrics_inc(METRIC_RELOAD_ERRORS);
+		return;
+	}
+	if (follow_path) snprintf(conf.fusgd_tail, PATH_MAX, "%s", follow_path);
+
+	keep_str(conf.fusgd_socket, global.conf.fusgd_socket, "fusgd_socket");
+	keep_str(conf.fusgd_live, global.conf.fusgd_live, "fusgd_live");
+	keep_int(&conf.fusgd_live_entries, global.conf.fusgd_live_entries, "fusgd_live_entries");
+	keep_str(conf.fusgd_spool, global.conf.fusgd_spool, "fusgd_spool");
+	keep_int(&conf.fusgd_spool_max, global.conf.fusgd_spool_max, "fusgd_spool_max");
+	keep_str(conf.fusgd_tail, global.conf.fusgd_tail, "fusgd_tail");
+	keep_str(conf.fusgd_tail_state, global.conf.fusgd_tail_state, "fusgd_tail_state");
+	keep_str(conf.fusgd_fanotify, global.conf.fusgd_fanotify, "fusgd_fanotify");
+
+	reload_log(conf.fusgd_log);
+	reload_trace(conf.fusgd_trace);
+
+	if (strcmp(conf.db_path, global.conf.db_path) || conf.db_inodes != global.conf.db_inodes
+			|| !conf.db_snapshot_period != !global.conf.db_snapshot_period)
+	{
+		if (reload_db(&conf))
+		{
+			snprintf(conf.db_path, PATH_MAX, "%s", global.conf.db_path);
+			conf.db_inodes = global.conf.db_inodes;
+			conf.db_snapshot_period = global.conf.db_snapshot_period;
+			conf.db_dir_depth = global.conf.db_dir_depth;
+			conf.db_dir_pending = global.conf.db_dir_pending;
+		}
+	}
+	else if ((conf.db_dir_depth != global.conf.db_dir_depth || conf.db_dir_pending != global.conf.db_dir_pending)
+			&& db_dirs(global.db, conf.db_dir_depth, conf.db_dir_pending))
+	{
+		log_warn("reload: no directory rollups: %s", strerror(errno));
+	}
+
+	if ((conf.fusgd_inflight_max != global.conf.fusgd_inflight_max
+			|| conf.fusgd_inflight_timeout != global.conf.fusgd_inflight_timeout)
+			&& assemble_resize(conf.fusgd_inflight_max, conf.fusgd_inflight_timeout))
+	{
+		conf.fusgd_inflight_max = global.conf.fusgd_inflight_max;
+		conf.fusgd_inflight_timeout = global.conf.fusgd_inflight_timeout;
+	}
+
+	if (conf.fusgd_spool_watermark != global.conf.fusgd_spool_watermark)
+		spool_watermark(conf.fusgd_spool_watermark);
+
+	// anything else is read on use
+	global.conf = conf;
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	metrics_inc(METRIC_RELOADS);
+	metrics_observe(METRIC_RELOAD_SECONDS, seconds);
+	log_info("reloaded '%s' in %.1f ms", global.conf_file, seconds * 1e3);
+	log_conf();
 }
 
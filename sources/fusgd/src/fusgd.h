@@ -10,12 +10,15 @@
 
 #include "../../fusg-common/include/fusg/conf.h"
 #include "../../fusg-common/include/fusg/db.h"
+#include "../../fusg-common/include/fusg/live.h"
 
 typedef enum
 {
 	OP_HELP,
 	OP_PARSE_STDIN,
 	OP_PARSE_FILE,
+	OP_TAIL,
+	OP_FANOTIFY,
 } fusgd_op_t;
 
 typedef struct
@@ -28,17 +31,26 @@ typedef struct
 
 	volatile int stop;
 	volatile int received_sighup;
+	volatile int received_sigusr1;
 
-	char source[PATH_MAX];
 	int fd;
 	FILE* fin;
+	/** bulk import threads or 0 */
+	int jobs;
+	int verify;
 
 	dbref_t db;
+	liveref_t live;
 
 	// some processing stats
 	time_t last_stats_report;
 	uint64_t events_processed;
 	uint64_t events_stored;
+	uint64_t batches_committed;
+	uint64_t batch_hold_max_ms;
+	uint64_t db_flushes;
+	uint64_t db_flush_ns_total;
+	uint64_t db_flush_ns_max;
 
 } fusgd_global_t;
 
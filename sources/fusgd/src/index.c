@@ -0,0 +1,483 @@
+/*
+ * index.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#include "index.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+
+
+/** open addressing hash table of pointers */
+typedef struct {
+	size_t mask;
+	size_t used;
+	uint64_t* hashes;
+	void** slots;
+} htab_t;
+
+typedef int (*htab_eq_t)(const void* entry, const void* key);
+
+
+typedef struct {
+	fusg_stats_key_t key;
+	fusg_stats_t stats;
+} index_edge_t;
+
+
+typedef struct {
+	/** index_node_t* by path */
+	htab_t path;
+	/** index_node_t* by id */
+	htab_t id;
+} index_nodes_t;
+
+
+static index_nodes_t execs;
+static index_nodes_t files;
+/** index_edge_t* by fusg_stats_key_t */
+static htab_t edges;
+
+/** all files, sorted by path up to files_sorted */
+static index_node_t** files_list = NULL;
+static size_t files_num = 0;
+static size_t files_cap = 0;
+static size_t files_sorted = 0;
+
+
+
+static inline uint64_t hash_str(const char* s)
+{
+	// FNV-1a
+	uint64_t h = 14695981039346656037UL;
+	for (; *s; s++)
+	{
+		h ^= (unsigned char)*s;
+		h *= 1099511628211UL;
+	}
+	return h;
+}
+
+static inline uint64_t hash_u64(uint64_t x)
+{
+	// splitmix64 finaliser
+	x ^= x >> 30; x *= 0xbf58476d1ce4e5b9UL;
+	x ^= x >> 27; x *= 0x94d049bb133111ebUL;
+	x ^= x >> 31;
+	return x;
+}
+
+static inline uint64_t hash_key(const fusg_stats_key_t* key)
+{
+	return hash_u64(key->exec_id ^ hash_u64(key->file_id));
+}
+
+
+static int eq_path(const void* entry, const void* key)
+{
+	return !strcmp(((const index_node_t*)entry)->path, (const char*)key);
+}
+
+static int eq_id(const void* entry, const void* key)
+{
+	return ((const index_node_t*)entry)->id == *(const uint64_t*)key;
+}
+
+static int eq_edge(const void* entry, const void* key)
+{
+	const fusg_stats_key_t* a = &((const index_edge_t*)entry)->key;
+	const fusg_stats_key_t* b = key;
+	return a->exec_id == b->exec_id && a->file_id == b->file_id;
+}
+
+
+static int htab_init(htab_t* t, size_t cap)
+{
+	t->mask = cap - 1;
+	t->used = 0;
+	t->hashes = calloc(cap, sizeof(uint64_t));
+	t->slots = calloc(cap, sizeof(void*));
+	return (t->hashes && t->slots) ? 0 : -1;
+}
+
+static void htab_free(htab_t* t)
+{
+	free(t->hashes);
+	free(t->slots);
+	memset(t, 0, sizeof(htab_t));
+}
+
+static void* htab_find(htab_t* t, uint64_t h, htab_eq_t eq, const void* key)
+{
+	for (size_t i = h & t->mask; t->slots[i]; i = (i + 1) & t->mask)
+	{
+		if (t->hashes[i] == h && eq(t->slots[i], key)) return t->slots[i];
+	}
+	return NULL;
+}
+
+/**
+ * Removes the entry at slot i. Following entries are shifted back,
+ * so their probe sequences stay intact.
+ */
+static void htab_remove(htab_t* t, size_t i)
+{
+	size_t j = i;
+	for (;;)
+	{
+		t->slots[i] = NULL;
+		size_t home;
+		do {
+			j = (j + 1) & t->mask;
+			if (!t->slots[j])
+			{
+				t->used--;
+				return;
+			}
+			home = t->hashes[j] & t->mask;
+			// entries with their home in (i, j] stay where they are
+		} while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+		t->hashes[i] = t->hashes[j];
+		t->slots[i] = t->slots[j];
+		i = j;
+	}
+}
+
+static int htab_insert(htab_t* t, uint64_t h, void* entry)
+{
+	if ((t->used + 1) * 4 > (t->mask + 1) * 3)
+	{
+		// grow at 75% load
+		htab_t n;
+		if (htab_init(&n, (t->mask + 1) * 2)) return -1;
+		for (size_t i = 0; i <= t->mask; i++)
+		{
+			if (t->slots[i]) htab_insert(&n, t->hashes[i], t->slots[i]);
+		}
+		htab_free(t);
+		*t = n;
+	}
+	size_t i;
+	for (i = h & t->mask; t->slots[i]; i = (i + 1) & t->mask);
+	t->hashes[i] = h;
+	t->slots[i] = entry;
+	t->used++;
+	return 0;
+}
+
+
+
+static void nodes_free(index_nodes_t* nodes)
+{
+	for (size_t i = 0; nodes->id.slots && i <= nodes->id.mask; i++)
+	{
+		index_node_t* node = nodes->id.slots[i];
+		if (node)
+		{
+			free(node->path);
+			free(node->partners);
+			free(node);
+		}
+	}
+	htab_free(&nodes->id);
+	htab_free(&nodes->path);
+}
+
+static index_node_t* nodes_find_id(index_nodes_t* nodes, uint64_t id)
+{
+	return htab_find(&nodes->id, hash_u64(id), eq_id, &id);
+}
+
+static index_node_t* nodes_find_path(index_nodes_t* nodes, const char* path)
+{
+	return htab_find(&nodes->path, hash_str(path), eq_path, path);
+}
+
+static index_node_t* nodes_get(index_nodes_t* nodes, uint64_t id, const char* path, int* created)
+{
+	index_node_t* node = nodes_find_id(nodes, id);
+	*created = 0;
+	if (node) return node;
+
+	node = calloc(1, sizeof(index_node_t));
+	if (!node) return NULL;
+	node->id = id;
+	node->path = strdup(path);
+	if (!node->path
+			|| htab_insert(&nodes->id, hash_u64(id), node)
+			|| htab_insert(&nodes->path, hash_str(path), node))
+	{
+		// tables are in an inconsistent state now
+		log_error("index: out of memory");
+		return NULL;
+	}
+	*created = 1;
+	return node;
+}
+
+static int node_add_partner(index_node_t* node, uint64_t partner)
+{
+	if (node->num_partners == node->cap_partners)
+	{
+		size_t cap = node->cap_partners ? node->cap_partners * 2 : 4;
+		uint64_t* p = realloc(node->partners, cap * sizeof(uint64_t));
+		if (!p) return -1;
+		node->partners = p;
+		node->cap_partners = cap;
+	}
+	node->partners[node->num_partners++] = partner;
+	return 0;
+}
+
+static void node_remove_partner(index_node_t* node, uint64_t partner)
+{
+	for (size_t i = 0; i < node->num_partners; i++)
+	{
+		if (node->partners[i] == partner)
+		{
+			node->partners[i] = node->partners[--node->num_partners];
+			return;
+		}
+	}
+}
+
+static int files_list_add(index_node_t* node)
+{
+	if (files_num == files_cap)
+	{
+		size_t cap = files_cap ? files_cap * 2 : 1024;
+		index_node_t** l = realloc(files_list, cap * sizeof(index_node_t*));
+		if (!l) return -1;
+		files_list = l;
+		files_cap = cap;
+	}
+	files_list[files_num++] = node;
+	return 0;
+}
+
+static int files_list_cmp(const void* a, const void* b)
+{
+	return strcmp((*(index_node_t* const*)a)->path, (*(index_node_t* const*)b)->path);
+}
+
+/**
+ * New files are appended unsorted. We sort on demand,
+ * because queries are rare compared to updates.
+ */
+static void files_list_sort(void)
+{
+	if (files_sorted != files_num)
+	{
+		qsort(files_list, files_num, sizeof(index_node_t*), files_list_cmp);
+		files_sorted = files_num;
+	}
+}
+
+
+
+int index_init(void)
+{
+	index_destroy();
+	if (htab_init(&execs.path, 1024) || htab_init(&execs.id, 1024)
+			|| htab_init(&files.path, 1<<16) || htab_init(&files.id, 1<<16)
+			|| htab_init(&edges, 1<<16))
+	{
+		log_error("index: out of memory");
+		index_destroy();
+		return -1;
+	}
+	return 0;
+}
+
+void index_destroy(void)
+{
+	for (size_t i = 0; edges.slots && i <= edges.mask; i++)
+	{
+		free(edges.slots[i]);
+	}
+	htab_free(&edges);
+	nodes_free(&execs);
+	nodes_free(&files);
+	free(files_list);
+	files_list = NULL;
+	files_num = files_cap = files_sorted = 0;
+}
+
+
+int index_load(dbref_t db)
+{
+	int rc;
+	fusg_stats_iterator_t it;
+	fusg_stats_t stats;
+	char exebuf[PATH_MAX + 1];
+	char filebuf[PATH_MAX + 1];
+
+	for (rc = db_fusg_stats_first(db, &it); rc == 0; rc = db_iterator_next(&it))
+	{
+		if (db_iterator_fetch(&it, &stats)) continue;
+		fusg_stats_key_t key = db_iterator_get_fugs_stats_key(&it);
+		if (db_exec_get_executable(db, key.exec_id, exebuf, sizeof(exebuf))
+				|| db_file_get_file(db, key.file_id, filebuf, sizeof(filebuf)))
+		{
+			log_warn("index: incomplete db entry (exec: %lu, file: %lu)", key.exec_id, key.file_id);
+			continue;
+		}
+		if (index_update(&key, exebuf, filebuf, &stats))
+		{
+			db_iterator_release(it);
+			return -1;
+		}
+	}
+	db_iterator_release(it);
+	return 0;
+}
+
+
+int index_update(const fusg_stats_key_t* key, const char* exec, const char* file, const fusg_stats_t* stats)
+{
+	uint64_t h = hash_key(key);
+	index_edge_t* edge = htab_find(&edges, h, eq_edge, key);
+	if (edge)
+	{
+		edge->stats = *stats;
+		return 0;
+	}
+
+	int created;
+	index_node_t* exec_node = nodes_get(&execs, key->exec_id, exec, &created);
+	if (!exec_node) return -1;
+	index_node_t* file_node = nodes_get(&files, key->file_id, file, &created);
+	if (!file_node) return -1;
+	if (created && files_list_add(file_node)) goto oom;
+
+	edge = malloc(sizeof(index_edge_t));
+	if (!edge) goto oom;
+	edge->key = *key;
+	edge->stats = *stats;
+	if (htab_insert(&edges, h, edge)) goto oom;
+
+	if (node_add_partner(exec_node, key->file_id)
+			|| node_add_partner(file_node, key->exec_id))
+	{
+		goto oom;
+	}
+	return 0;
+oom:
+	log_error("index: out of memory");
+	return -1;
+}
+
+
+void index_remove(const fusg_stats_key_t* key)
+{
+	if (!edges.slots) return;
+	uint64_t h = hash_key(key);
+	for (size_t i = h & edges.mask; edges.slots[i]; i = (i + 1) & edges.mask)
+	{
+		if (edges.hashes[i] == h && eq_edge(edges.slots[i], key))
+		{
+			free(edges.slots[i]);
+			htab_remove(&edges, i);
+			break;
+		}
+	}
+
+	// nodes stay, even without partners
+	index_node_t* node = nodes_find_id(&execs, key->exec_id);
+	if (node) node_remove_partner(node, key->file_id);
+	node = nodes_find_id(&files, key->file_id);
+	if (node) node_remove_partner(node, key->exec_id);
+}
+
+
+static int index_visit(uint64_t exec_id, uint64_t file_id, index_visitor_t visit, void* ctx)
+{
+	fusg_stats_key_t key = { .exec_id = exec_id, .file_id = file_id };
+	index_edge_t* edge = htab_find(&edges, hash_key(&key), eq_edge, &key);
+	index_node_t* exec = nodes_find_id(&execs, exec_id);
+	index_node_t* file = nodes_find_id(&files, file_id);
+	if (!edge || !exec || !file) return 0;
+	return visit(ctx, exec->path, file->path, &edge->stats);
+}
+
+
+long index_query_file(const char* file, index_visitor_t visit, void* ctx)
+{
+	index_node_t* node = nodes_find_path(&files, file);
+	if (!node) return -1;
+	long count = 0;
+	for (size_t i = 0; i < node->num_partners; i++, count++)
+	{
+		if (index_visit(node->partners[i], node->id, visit, ctx)) break;
+	}
+	return count;
+}
+
+long index_query_exec(const char* exec, index_visitor_t visit, void* ctx)
+{
+	index_node_t* node = nodes_find_path(&execs, exec);
+	if (!node) return -1;
+	long count = 0;
+	for (size_t i = 0; i < node->num_partners; i++, count++)
+	{
+		if (index_visit(node->id, node->partners[i], visit, ctx)) break;
+	}
+	return count;
+}
+
+long index_query_subtree(const char* dir, index_visitor_t visit, void* ctx)
+{
+	files_list_sort();
+
+	size_t len = strlen(dir);
+	// "/" matches everything
+	if (len == 1 && dir[0] == '/') len = 0;
+
+	// binary search for the first path >= dir
+	size_t lo = 0, hi = files_num;
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		if (strcmp(files_list[mid]->path, dir) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+
+	long count = 0;
+	for (size_t f = lo; f < files_num; f++)
+	{
+		index_node_t* node = files_list[f];
+		if (strncmp(node->path, dir, len)) break;
+		// skip siblings with same prefix (e.g. /tmpfoo for /tmp)
+		if (node->path[len] != '\0' && node->path[len] != '/') continue;
+
+		for (size_t i = 0; i < node->num_partners; i++, count++)
+		{
+			if (index_visit(node->partners[i], node->id, visit, ctx)) return count;
+		}
+	}
+	return count;
+}
+
+long index_query_all(index_visitor_t visit, void* ctx)
+{
+	long count = 0;
+	for (size_t i = 0; i <= edges.mask; i++)
+	{
+		index_edge_t* edge = edges.slots[i];
+		if (!edge) continue;
+		if (index_visit(edge->key.exec_id, edge->key.file_id, visit, ctx)) break;
+		count++;
+	}
+	return count;
+}
+
+size_t index_size(void)
+{
+	return edges.used;
+}
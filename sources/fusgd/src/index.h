@@ -0,0 +1,92 @@
+/*
+ * index.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef INDEX_H_
+#define INDEX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../../fusg-common/include/fusg/db.h"
+
+
+/*
+ * In-memory mirror of the fusg_stats entries of the db,
+ * indexed by executable, by file and by path, so the query
+ * service can answer without scanning the db.
+ */
+
+
+/** An executable or a file and the ids of its partners. */
+typedef struct {
+	uint64_t id;
+	char* path;
+	size_t num_partners;
+	size_t cap_partners;
+	uint64_t* partners;
+} index_node_t;
+
+
+/**
+ * Receives the entries found by a query.
+ * @return 0 to continue, anything else aborts the query
+ */
+typedef int (*index_visitor_t)(void* ctx, const char* exec, const char* file, const fusg_stats_t* stats);
+
+
+int index_init(void);
+
+void index_destroy(void);
+
+/**
+ * Loads all entries of the given db into the index.
+ * @return 0 on success -1 otherwise
+ */
+int index_load(dbref_t db);
+
+/**
+ * Adds or updates an entry.
+ * @return 0 on success -1 otherwise
+ */
+int index_update(const fusg_stats_key_t* key, const char* exec, const char* file, const fusg_stats_t* stats);
+
+/**
+ * Removes an entry (see db_prune_step()).
+ */
+void index_remove(const fusg_stats_key_t* key);
+
+/**
+ * Visits all executables which used the given file.
+ * @return number of entries visited or -1 if there is no such file
+ */
+long index_query_file(const char* file, index_visitor_t visit, void* ctx);
+
+/**
+ * Visits all files which were used by the given executable.
+ * @return number of entries visited or -1 if there is no such executable
+ */
+long index_query_exec(const char* exec, index_visitor_t visit, void* ctx);
+
+/**
+ * Visits all entries of files in the given directory or below.
+ * @return number of entries visited
+ */
+long index_query_subtree(const char* dir, index_visitor_t visit, void* ctx);
+
+/**
+ * Visits all entries.
+ * @return number of entries visited
+ */
+long index_query_all(index_visitor_t visit, void* ctx);
+
+/**
+ * @return number of entries in the index
+ */
+size_t index_size(void);
+
+
+#endif /* INDEX_H_ */
@@ -0,0 +1,440 @@
+/*
+ * input.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#define _GNU_SOURCE
+#include "input.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+
+
+/** size of read and decompression buffers */
+#define INPUT_BUF_SIZE (256 * 1024)
+/** pipe capacity requested between decompression and parsing */
+#define INPUT_PIPE_SIZE (1024 * 1024)
+
+
+static char** files = NULL;
+static size_t num_files = 0;
+
+static int read_fd = -1;
+static int write_fd = -1;
+static pthread_t thread;
+static int thread_running = 0;
+static volatile int stopping = 0;
+
+
+
+/**
+ * Parses "msg=audit(<sec>.<milli>:" of the first record in buf,
+ * which is NUL terminated.
+ * @return time stamp [ms] or 0 if there is none
+ */
+static uint64_t parse_first_stamp(const char* buf, size_t len)
+{
+	const char* nl = memchr(buf, '\n', len);
+	const char* p = memmem(buf, nl ? (size_t)(nl - buf) : len, "audit(", 6);
+	if (!p) return 0;
+	char* end;
+	uint64_t sec = strtoull(p + 6, &end, 10);
+	if (end == p + 6 || *end != '.') return 0;
+	p = end + 1;
+	uint64_t milli = strtoull(p, &end, 10);
+	if (end == p || *end != ':') return 0;
+	return sec * 1000 + milli;
+}
+
+/**
+ * Reads the time stamp of the first record of a file, decompressing
+ * its beginning if needed.
+ * @return time stamp [ms] or 0 if there is none
+ */
+static uint64_t first_stamp(const char* path)
+{
+	char buf[4096];
+	ssize_t n = -1;
+	int format = input_format(path);
+	if (format == INPUT_PLAIN)
+	{
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd == -1) return 0;
+		n = read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+	}
+	else if (format == INPUT_GZIP)
+	{
+		gzFile gz = gzopen(path, "rb");
+		if (!gz) return 0;
+		n = gzread(gz, buf, sizeof(buf) - 1);
+		gzclose(gz);
+	}
+	else if (format == INPUT_ZSTD)
+	{
+		char in[4096];
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd == -1) return 0;
+		ssize_t len = read(fd, in, sizeof(in));
+		close(fd);
+		ZSTD_DStream* z = len > 0 ? ZSTD_createDStream() : NULL;
+		if (!z) return 0;
+		ZSTD_initDStream(z);
+		ZSTD_inBuffer zin = { in, len, 0 };
+		ZSTD_outBuffer zout = { buf, sizeof(buf) - 1, 0 };
+		size_t rc = ZSTD_decompressStream(z, &zout, &zin);
+		ZSTD_freeDStream(z);
+		n = ZSTD_isError(rc) ? -1 : (ssize_t)zout.pos;
+	}
+	if (n <= 0) return 0;
+	buf[n] = '\0';
+	return parse_first_stamp(buf, n);
+}
+
+typedef struct {
+	char* path;
+	/** time stamp of the first record, else mtime [ms] */
+	uint64_t time_ms;
+	/** in glob order */
+	size_t index;
+} input_match_t;
+
+static int match_compare(const void* a, const void* b)
+{
+	const input_match_t* x = a;
+	const input_match_t* y = b;
+	if (x->time_ms != y->time_ms) return x->time_ms < y->time_ms ? -1 : 1;
+	return x->index < y->index ? -1 : (x->index > y->index);
+}
+
+int input_add(const char* pattern)
+{
+	glob_t g;
+	int rc = glob(pattern, 0, NULL, &g);
+	if (rc || !g.gl_pathc)
+	{
+		globfree(&g);
+		return -1;
+	}
+
+	char** grown = realloc(files, (num_files + g.gl_pathc) * sizeof(char*));
+	input_match_t* matches = calloc(g.gl_pathc, sizeof(input_match_t));
+	if (grown) files = grown;
+	if (!grown || !matches)
+	{
+		free(matches);
+		globfree(&g);
+		return -1;
+	}
+
+	// rotated logs sort lexically newest first (audit.log, .1, .10, .2),
+	// but db entries keep the time of their latest update: oldest first
+	size_t num_matches = 0;
+	for (size_t i = 0; i < g.gl_pathc; i++)
+	{
+		input_match_t* m = &matches[num_matches];
+		m->path = strdup(g.gl_pathv[i]);
+		if (!m->path) continue;
+		m->index = i;
+		m->time_ms = first_stamp(m->path);
+		struct stat st;
+		if (!m->time_ms && !stat(m->path, &st))
+		{
+			m->time_ms = (uint64_t)st.st_mtim.tv_sec * 1000 + st.st_mtim.tv_nsec / 1000000;
+		}
+		num_matches++;
+	}
+	globfree(&g);
+	qsort(matches, num_matches, sizeof(input_match_t), match_compare);
+	for (size_t i = 0; i < num_matches; i++) files[num_files++] = matches[i].path;
+	free(matches);
+	return num_matches;
+}
+
+
+size_t input_files(void)
+{
+	return num_files;
+}
+
+
+const char* input_file(size_t i)
+{
+	return i < num_files ? files[i] : NULL;
+}
+
+
+void input_clear(void)
+{
+	for (size_t i = 0; i < num_files; i++) free(files[i]);
+	free(files);
+	files = NULL;
+	num_files = 0;
+}
+
+
+static int format_of(const unsigned char* magic, size_t len)
+{
+	if (len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) return INPUT_GZIP;
+	if (len >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) return INPUT_ZSTD;
+	return INPUT_PLAIN;
+}
+
+int input_format(const char* path)
+{
+	unsigned char magic[4];
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return -1;
+	ssize_t len = read(fd, magic, sizeof(magic));
+	close(fd);
+	return len < 0 ? -1 : format_of(magic, len);
+}
+
+
+static int write_all(const char* data, size_t len)
+{
+	while (len && !stopping)
+	{
+		ssize_t n = write(write_fd, data, len);
+		if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		data += n;
+		len -= n;
+	}
+	return stopping ? -1 : 0;
+}
+
+
+/**
+ * Reads into in and keeps unconsumed input.
+ * @return bytes available in in, 0 on EOF, -1 on error
+ */
+static ssize_t read_more(int fd, char* in, size_t* avail)
+{
+	ssize_t n;
+	do n = read(fd, in + *avail, INPUT_BUF_SIZE - *avail);
+	while (n < 0 && errno == EINTR);
+	if (n < 0) return -1;
+	*avail += n;
+	return n;
+}
+
+
+static int copy_plain(int fd, char* in)
+{
+	size_t avail = 0;
+	ssize_t n;
+	while ((n = read_more(fd, in, &avail)) > 0)
+	{
+		if (write_all(in, avail)) return -1;
+		avail = 0;
+	}
+	return n;
+}
+
+
+static int copy_gzip(int fd, char* in, char* out)
+{
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	// 32: detect gzip header
+	if (inflateInit2(&z, 15 + 32) != Z_OK) return -1;
+
+	int rc = 0;
+	int zrc = Z_OK;
+	size_t avail = 0;
+	ssize_t n;
+	while (!rc && (n = read_more(fd, in, &avail)) > 0)
+	{
+		z.next_in = (Bytef*)in;
+		z.avail_in = avail;
+		for (;;)
+		{
+			if (zrc == Z_STREAM_END)
+			{
+				if (!z.avail_in) break;
+				// concatenated gzip members
+				inflateReset(&z);
+			}
+			z.next_out = (Bytef*)out;
+			z.avail_out = INPUT_BUF_SIZE;
+			zrc = inflate(&z, Z_NO_FLUSH);
+			if (zrc != Z_OK && zrc != Z_STREAM_END && zrc != Z_BUF_ERROR)
+			{
+				log_error("input: gzip: %s", z.msg ? z.msg : "corrupt data");
+				rc = -1;
+				break;
+			}
+			if (write_all(out, INPUT_BUF_SIZE - z.avail_out))
+			{
+				rc = -1;
+				break;
+			}
+			// output left only if the buffer was filled up
+			if (zrc == Z_BUF_ERROR || (!z.avail_in && z.avail_out)) break;
+		}
+		avail = 0;
+	}
+	if (!rc && n < 0) rc = -1;
+	if (!rc && zrc != Z_STREAM_END)
+	{
+		log_error("input: gzip: truncated");
+		rc = -1;
+	}
+	inflateEnd(&z);
+	return rc;
+}
+
+
+static int copy_zstd(int fd, char* in, char* out)
+{
+	ZSTD_DStream* z = ZSTD_createDStream();
+	if (!z) return -1;
+	ZSTD_initDStream(z);
+
+	int rc = 0;
+	size_t zrc = 0;
+	size_t avail = 0;
+	ssize_t n;
+	while (!rc && (n = read_more(fd, in, &avail)) > 0)
+	{
+		ZSTD_inBuffer zin = { in, avail, 0 };
+		for (;;)
+		{
+			ZSTD_outBuffer zout = { out, INPUT_BUF_SIZE, 0 };
+			zrc = ZSTD_decompressStream(z, &zout, &zin);
+			if (ZSTD_isError(zrc))
+			{
+				log_error("input: zstd: %s", ZSTD_getErrorName(zrc));
+				rc = -1;
+				break;
+			}
+			if (write_all(out, zout.pos))
+			{
+				rc = -1;
+				break;
+			}
+			// output left only if the buffer was filled up
+			if (zin.pos == zin.size && zout.pos < zout.size) break;
+		}
+		avail = 0;
+	}
+	if (!rc && n < 0) rc = -1;
+	if (!rc && zrc != 0)
+	{
+		log_error("input: zstd: truncated");
+		rc = -1;
+	}
+	ZSTD_freeDStream(z);
+	return rc;
+}
+
+
+static void* input_thread(void* arg)
+{
+	// signals are for the main thread
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+	char* in = malloc(INPUT_BUF_SIZE);
+	char* out = malloc(INPUT_BUF_SIZE);
+	if (!in || !out) log_error("input: out of memory");
+
+	for (size_t i = 0; in && out && i < num_files && !stopping; i++)
+	{
+		int fd = open(files[i], O_RDONLY | O_CLOEXEC);
+		if (fd == -1)
+		{
+			log_error("input: can't open '%s': %s", files[i], strerror(errno));
+			continue;
+		}
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		int format = input_format(files[i]);
+		log_info("input: reading '%s'%s", files[i],
+				format == INPUT_GZIP ? " (gzip)" : format == INPUT_ZSTD ? " (zstd)" : "");
+
+		int rc;
+		switch (format)
+		{
+		case INPUT_GZIP: rc = copy_gzip(fd, in, out); break;
+		case INPUT_ZSTD: rc = copy_zstd(fd, in, out); break;
+		default:         rc = copy_plain(fd, in);     break;
+		}
+		if (rc && !stopping) log_error("input: failed reading '%s'", files[i]);
+		close(fd);
+	}
+
+	free(in);
+	free(out);
+	// EOF for the reader
+	close(write_fd);
+	write_fd = -1;
+	return NULL;
+}
+
+
+int input_open(void)
+{
+	if (!num_files) return -1;
+
+	if (num_files == 1 && input_format(files[0]) == INPUT_PLAIN)
+	{
+		// nothing to decompress or concatenate
+		read_fd = open(files[0], O_RDONLY | O_CLOEXEC);
+		if (read_fd == -1) log_error("can't open input log file '%s'\n\t%s", files[0], strerror(errno));
+		return read_fd;
+	}
+
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC))
+	{
+		log_error("input: pipe: %s", strerror(errno));
+		return -1;
+	}
+	// fewer wake-ups between the threads
+	fcntl(fds[1], F_SETPIPE_SZ, INPUT_PIPE_SIZE);
+	read_fd = fds[0];
+	write_fd = fds[1];
+	stopping = 0;
+
+	if (pthread_create(&thread, NULL, input_thread, NULL))
+	{
+		log_error("input: can't start thread");
+		input_close();
+		return -1;
+	}
+	thread_running = 1;
+	return read_fd;
+}
+
+
+void input_close(void)
+{
+	stopping = 1;
+	// unblocks a writing thread with EPIPE
+	if (read_fd != -1) close(read_fd);
+	read_fd = -1;
+	if (thread_running) pthread_join(thread, NULL);
+	thread_running = 0;
+	if (write_fd != -1) close(write_fd);
+	write_fd = -1;
+}
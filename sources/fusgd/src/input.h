@@ -0,0 +1,72 @@
+/*
+ * input.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef INPUT_H_
+#define INPUT_H_
+
+#include <stddef.h>
+
+
+/*
+ * Input files of --read.
+ *
+ * Files are read in the order given. The files of a glob are read
+ * oldest first, by the time stamp of their first record (or their
+ * mtime, if they have none), as rotated logs sort newest first.
+ * Compressed files (gzip, zstd) are detected by their magic number
+ * and decompressed on the fly. If there is more than a single plain
+ * file, a thread reads (and decompresses) all files and writes their
+ * content into a pipe, which is the input of the line pipeline.
+ */
+
+
+typedef enum {
+	INPUT_PLAIN,
+	INPUT_GZIP,
+	INPUT_ZSTD,
+} input_format_t;
+
+
+/**
+ * Adds a file or all files matching a glob pattern, oldest first.
+ * @return number of files added or -1 if nothing matched
+ */
+int input_add(const char* pattern);
+
+/**
+ * @return number of files added
+ */
+size_t input_files(void);
+
+/**
+ * @return path of file i
+ */
+const char* input_file(size_t i);
+
+/**
+ * @return format of the file by its magic number or -1 on error
+ */
+int input_format(const char* path);
+
+/**
+ * Opens the input and starts decompression, if needed.
+ * @return fd to read the content of all files from or -1 on error
+ */
+int input_open(void);
+
+/**
+ * Stops decompression and closes the input.
+ */
+void input_close(void);
+
+/**
+ * Releases the list of files.
+ */
+void input_clear(void);
+
+
+#endif /* INPUT_H_ */
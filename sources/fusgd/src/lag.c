@@ -0,0 +1,106 @@
+/*
+ * lag.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#include "lag.h"
+
+#include <stdlib.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+
+#include "fusgd.h"
+#include "metrics.h"
+
+
+/** event times [ms] of stored events not yet durable */
+static uint64_t* pending = NULL;
+static uint64_t num_pending = 0;
+static uint64_t cap_pending = 0;
+/** oldest pending event time [ms] */
+static uint64_t watermark_ms = 0;
+
+/** lag exceeds threshold */
+static int lagging = 0;
+static time_t last_check = 0;
+
+
+
+static uint64_t wall_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+void lag_pending(const au_event_t* event)
+{
+	uint64_t ms = (uint64_t)event->sec * 1000 + event->milli;
+	if (num_pending == cap_pending)
+	{
+		uint64_t cap = cap_pending ? cap_pending * 2 : 4096;
+		uint64_t* p = realloc(pending, cap * sizeof(uint64_t));
+		if (!p)
+		{
+			// lag statistics are not worth dying for
+			log_warn("lag: out of memory");
+			return;
+		}
+		pending = p;
+		cap_pending = cap;
+	}
+	if (!num_pending || ms < watermark_ms) watermark_ms = ms;
+	pending[num_pending++] = ms;
+}
+
+
+void lag_durable(void)
+{
+	uint64_t now = wall_ms();
+	for (uint64_t i = 0; i < num_pending; i++)
+	{
+		uint64_t lag = now > pending[i] ? now - pending[i] : 0;
+		metrics_observe(METRIC_COMMIT_LAG_SECONDS, lag / 1e3);
+	}
+	num_pending = 0;
+	watermark_ms = 0;
+}
+
+
+double lag_watermark_age(void)
+{
+	if (!num_pending) return 0;
+	uint64_t now = wall_ms();
+	return now > watermark_ms ? (now - watermark_ms) / 1e3 : 0;
+}
+
+uint64_t lag_pending_count(void)
+{
+	return num_pending;
+}
+
+
+void lag_check(void)
+{
+	int threshold = global.conf.fusgd_lag_warn;
+	if (!threshold) return;
+
+	time_t now = time(NULL);
+	if (now == last_check) return;
+	last_check = now;
+
+	double age = lag_watermark_age();
+	if (!lagging && age > threshold)
+	{
+		lagging = 1;
+		log_warn("lag: %.1f s behind (threshold %d s, %lu events pending)", age, threshold, num_pending);
+	}
+	else if (lagging && age <= threshold)
+	{
+		lagging = 0;
+		log_info("lag: caught up (%.1f s)", age);
+	}
+}
@@ -0,0 +1,53 @@
+/*
+ * lag.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef LAG_H_
+#define LAG_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <auparse.h>
+
+
+/*
+ * Ingestion lag: time from an event (audit time stamp) until its
+ * db update was flushed to disk (durable).
+ *
+ * Stored events stay pending until the next db flush. On flush,
+ * the lag of each pending event goes into the histogram
+ * fusgd_commit_lag_seconds. The oldest pending event is the
+ * watermark: its age is the current lag of fusgd.
+ */
+
+
+/**
+ * Registers a stored event as pending.
+ */
+void lag_pending(const au_event_t* event);
+
+/**
+ * All pending events are durable now.
+ */
+void lag_durable(void);
+
+/**
+ * Warns if the lag exceeds fusgd_lag_warn. Call periodically.
+ */
+void lag_check(void);
+
+/**
+ * @return age of the oldest pending event [s] or 0 if none is pending.
+ */
+double lag_watermark_age(void);
+
+/**
+ * @return number of pending events
+ */
+uint64_t lag_pending_count(void);
+
+
+#endif /* LAG_H_ */
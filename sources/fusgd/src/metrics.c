@@ -0,0 +1,305 @@
+/*
+ * metrics.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#define _GNU_SOURCE
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+
+#include "fusgd.h"
+#include "lag.h"
+#include "serial.h"
+#include "degrade.h"
+#include "spool.h"
+#include "assemble.h"
+
+
+metrics_t metrics;
+__thread uint64_t* metrics_counters = metrics.counters;
+
+/** blocks of other threads */
+static metrics_block_t* blocks = NULL;
+static pthread_mutex_t blocks_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static const struct {
+	const char* name;
+	const char* help;
+} counter_info[METRIC_COUNTERS] = {
+	[METRIC_LINES_IN]               = { "fusgd_lines_total", "Lines read from the input." },
+	[METRIC_RECORDS_IN]             = { "fusgd_records_total", "Records of complete events." },
+	[METRIC_EVENTS_IN]              = { "fusgd_events_total", "Events received from auparse." },
+	[METRIC_EVENTS_STORED]          = { "fusgd_events_stored_total", "Events stored in the db." },
+	[METRIC_SKIPPED_NO_SYSCALL]     = { "fusgd_events_skipped_no_syscall_total", "Events skipped: no SYSCALL record." },
+	[METRIC_SKIPPED_FAILED_SYSCALL] = { "fusgd_events_skipped_failed_total", "Events skipped: syscall failed." },
+	[METRIC_SKIPPED_INCOMPLETE]     = { "fusgd_events_skipped_incomplete_total", "Events skipped: incomplete or corrupted." },
+	[METRIC_PARSE_ERRORS]           = { "fusgd_parse_errors_total", "Events which failed to parse." },
+	[METRIC_DB_ERRORS]              = { "fusgd_db_errors_total", "Failed db updates." },
+	[METRIC_DB_UPDATES]             = { "fusgd_db_updates_total", "Updates of db entries." },
+	[METRIC_QUERIES]                = { "fusgd_queries_total", "Queries answered by the query service." },
+	[METRIC_MISSING_CWD]            = { "fusgd_events_missing_cwd_total", "Successful syscall events without CWD record." },
+	[METRIC_MISSING_PATH]           = { "fusgd_events_missing_path_total", "Successful syscall events without PATH record." },
+	[METRIC_DEGRADED_COALESCED]     = { "fusgd_degraded_coalesced_total", "Files stored as their directory due to overload." },
+	[METRIC_DEGRADED_SAMPLED]       = { "fusgd_degraded_sampled_total", "Updates dropped by sampling due to overload." },
+	[METRIC_EVENTS_TIMED_OUT]       = { "fusgd_events_timed_out_total", "Events completed without EOE after the in-flight timeout." },
+	[METRIC_EVENTS_LIMITED]         = { "fusgd_events_limited_total", "Events completed at the max number of records or bytes." },
+	[METRIC_EVENTS_EVICTED]         = { "fusgd_events_evicted_total", "Events completed because a newer event needed the slot." },
+	[METRIC_SPOOLED_BYTES]          = { "fusgd_spooled_bytes_total", "Input moved into the spool." },
+	[METRIC_SPOOL_FULL]             = { "fusgd_spool_full_total", "Input not spooled, because the spool was full." },
+	[METRIC_TAIL_ROTATIONS]         = { "fusgd_tail_rotations_total", "Log file rotations followed." },
+	[METRIC_TAIL_TRUNCATIONS]       = { "fusgd_tail_truncations_total", "Log file truncations detected." },
+	[METRIC_TAIL_SKIPPED]           = { "fusgd_tail_skipped_total", "Events skipped on resume, because they were stored before." },
+	[METRIC_FAN_EVENTS]             = { "fusgd_fan_events_total", "Events read from fanotify." },
+	[METRIC_FAN_OVERFLOWS]          = { "fusgd_fan_overflows_total", "fanotify queue overflows, events were lost." },
+	[METRIC_FAN_UNRESOLVED]         = { "fusgd_fan_unresolved_total", "fanotify events whose executable or file could not be resolved." },
+	[METRIC_PRUNED_ENTRIES]         = { "fusgd_pruned_entries_total", "Entries dropped by retention." },
+	[METRIC_PRUNED_FILES]           = { "fusgd_pruned_files_total", "Files without entries removed by retention." },
+	[METRIC_PRUNED_EXECS]           = { "fusgd_pruned_execs_total", "Executables without entries removed by retention." },
+	[METRIC_DB_REORGANISED]         = { "fusgd_db_reorganised_total", "db files reorganised after pruning." },
+	[METRIC_DB_RECLAIMED_BYTES]     = { "fusgd_db_reclaimed_bytes_total", "Bytes released by reorganising db files." },
+	[METRIC_DB_FLUSHED_BYTES]       = { "fusgd_db_flushed_bytes_total", "Approximate size of the updated records flushed." },
+	[METRIC_RELOADS]                = { "fusgd_reloads_total", "Config reloads on SIGHUP." },
+	[METRIC_RELOAD_ERRORS]          = { "fusgd_reload_errors_total", "Config reloads failed, the config was kept." },
+	[METRIC_PROCS_CACHED]           = { "fusgd_procs_cached_total", "Executables and cwds taken from the process cache." },
+	[METRIC_PROCS_MISSED]           = { "fusgd_procs_missed_total", "Executables and cwds not found in the process cache." },
+};
+
+
+/** bucket bounds of latencies: 1us .. 10s */
+static const double latency_bounds[] = {
+	1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4,
+	1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+};
+
+/** bucket bounds of lags: 10ms .. 1h */
+static const double lag_bounds[] = {
+	0.01, 0.1, 0.5, 1, 2, 5, 10, 30, 60, 120, 300, 900, 3600,
+};
+
+/** bucket bounds of counts: 1 .. 1M */
+static const double count_bounds[] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000,
+};
+
+#define BOUNDS(b) b, sizeof(b) / sizeof(b[0])
+
+static const struct {
+	const char* name;
+	const char* help;
+	const double* bounds;
+	size_t num_bounds;
+} histogram_info[METRIC_HISTOGRAMS] = {
+	[METRIC_EVENT_SECONDS]     = { "fusgd_event_seconds", "Processing time per event.", BOUNDS(latency_bounds) },
+	[METRIC_DB_UPDATE_SECONDS] = { "fusgd_db_update_seconds", "Time per db update.", BOUNDS(latency_bounds) },
+	[METRIC_DB_FLUSH_SECONDS]  = { "fusgd_db_flush_seconds", "Time per db flush.", BOUNDS(latency_bounds) },
+	[METRIC_LAG_SECONDS]       = { "fusgd_lag_seconds", "Time from event until its processing.", BOUNDS(lag_bounds) },
+	[METRIC_COMMIT_LAG_SECONDS] = { "fusgd_commit_lag_seconds", "Time from event until its update was flushed to disk.", BOUNDS(lag_bounds) },
+	[METRIC_PRUNE_STEP_SECONDS] = { "fusgd_prune_step_seconds", "Time per pruning step, including reorganising.", BOUNDS(latency_bounds) },
+	[METRIC_DB_FLUSH_UPDATES]  = { "fusgd_db_flush_updates", "Updates written per db flush.", BOUNDS(count_bounds) },
+	[METRIC_RELOAD_SECONDS]    = { "fusgd_reload_seconds", "Time per config reload.", BOUNDS(latency_bounds) },
+};
+
+
+static time_t metrics_last_write = 0;
+
+
+
+void metrics_observe(metric_histogram_t histogram, double value)
+{
+	const double* bounds = histogram_info[histogram].bounds;
+	size_t num = histogram_info[histogram].num_bounds;
+	size_t i;
+	for (i = 0; i < num && value > bounds[i]; i++);
+	// i == num -> +Inf
+	metrics.histograms[histogram].buckets[i]++;
+	metrics.histograms[histogram].count++;
+	metrics.histograms[histogram].sum += value;
+}
+
+
+static long metrics_rss_bytes(void)
+{
+	long pages = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		if (1 != fscanf(statm, "%*d %ld", &pages)) pages = 0;
+		fclose(statm);
+	}
+	return pages * sysconf(_SC_PAGESIZE);
+}
+
+
+void metrics_thread(metrics_block_t* block)
+{
+	pthread_mutex_lock(&blocks_mutex);
+	if (!block->listed)
+	{
+		block->listed = 1;
+		block->next = blocks;
+		blocks = block;
+	}
+	pthread_mutex_unlock(&blocks_mutex);
+	metrics_counters = block->counters;
+}
+
+uint64_t metrics_total(metric_counter_t counter)
+{
+	uint64_t total = __atomic_load_n(&metrics.counters[counter], __ATOMIC_RELAXED);
+	pthread_mutex_lock(&blocks_mutex);
+	for (metrics_block_t* b = blocks; b; b = b->next)
+	{
+		total += __atomic_load_n(&b->counters[counter], __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&blocks_mutex);
+	return total;
+}
+
+
+int metrics_write(FILE* out)
+{
+	for (int c = 0; c < METRIC_COUNTERS; c++)
+	{
+		fprintf(out, "# HELP %s %s\n", counter_info[c].name, counter_info[c].help);
+		fprintf(out, "# TYPE %s counter\n", counter_info[c].name);
+		fprintf(out, "%s %lu\n", counter_info[c].name, metrics_total(c));
+	}
+
+	for (int h = 0; h < METRIC_HISTOGRAMS; h++)
+	{
+		const char* name = histogram_info[h].name;
+		fprintf(out, "# HELP %s %s\n", name, histogram_info[h].help);
+		fprintf(out, "# TYPE %s histogram\n", name);
+		uint64_t cumulative = 0;
+		for (size_t i = 0; i < histogram_info[h].num_bounds; i++)
+		{
+			cumulative += metrics.histograms[h].buckets[i];
+			fprintf(out, "%s_bucket{le=\"%g\"} %lu\n", name, histogram_info[h].bounds[i], cumulative);
+		}
+		fprintf(out, "%s_bucket{le=\"+Inf\"} %lu\n", name, metrics.histograms[h].count);
+		fprintf(out, "%s_sum %.9f\n", name, metrics.histograms[h].sum);
+		fprintf(out, "%s_count %lu\n", name, metrics.histograms[h].count);
+	}
+
+	fprintf(out, "# HELP fusgd_auparse_pending_records Records read, not yet part of a complete event.\n");
+	fprintf(out, "# TYPE fusgd_auparse_pending_records gauge\n");
+	uint64_t lines = metrics.counters[METRIC_LINES_IN];
+	uint64_t records = metrics.counters[METRIC_RECORDS_IN];
+	fprintf(out, "fusgd_auparse_pending_records %lu\n", lines > records ? lines - records : 0);
+
+	fprintf(out, "# HELP fusgd_events_inflight Events not yet complete.\n");
+	fprintf(out, "# TYPE fusgd_events_inflight gauge\n");
+	fprintf(out, "fusgd_events_inflight %lu\n", assemble_inflight());
+
+	fprintf(out, "# HELP fusgd_watermark_age_seconds Age of the oldest event not yet flushed to disk.\n");
+	fprintf(out, "# TYPE fusgd_watermark_age_seconds gauge\n");
+	fprintf(out, "fusgd_watermark_age_seconds %.3f\n", lag_watermark_age());
+
+	fprintf(out, "# HELP fusgd_events_pending Stored events not yet flushed to disk.\n");
+	fprintf(out, "# TYPE fusgd_events_pending gauge\n");
+	fprintf(out, "fusgd_events_pending %lu\n", lag_pending_count());
+
+	serial_stats_t serials;
+	serial_totals(&serials);
+	fprintf(out, "# HELP fusgd_serial_missing Audit serials skipped in the input, i.e. lost events.\n");
+	fprintf(out, "# TYPE fusgd_serial_missing gauge\n");
+	fprintf(out, "fusgd_serial_missing %lu\n", serials.missing);
+	fprintf(out, "# HELP fusgd_serial_duplicates_total Events received with a serial seen before.\n");
+	fprintf(out, "# TYPE fusgd_serial_duplicates_total counter\n");
+	fprintf(out, "fusgd_serial_duplicates_total %lu\n", serials.duplicates);
+	fprintf(out, "# HELP fusgd_serial_reordered_total Events received after events with higher serials.\n");
+	fprintf(out, "# TYPE fusgd_serial_reordered_total counter\n");
+	fprintf(out, "fusgd_serial_reordered_total %lu\n", serials.reordered);
+	fprintf(out, "# HELP fusgd_serial_resets_total Restarts of the audit serial numbering.\n");
+	fprintf(out, "# TYPE fusgd_serial_resets_total counter\n");
+	fprintf(out, "fusgd_serial_resets_total %lu\n", serials.resets);
+
+	fprintf(out, "# HELP fusgd_degrade_level Current degradation level due to overload (0: normal).\n");
+	fprintf(out, "# TYPE fusgd_degrade_level gauge\n");
+	fprintf(out, "fusgd_degrade_level %d\n", degrade_level());
+	fprintf(out, "# HELP fusgd_degraded_seconds_total Time spent in degraded levels.\n");
+	fprintf(out, "# TYPE fusgd_degraded_seconds_total counter\n");
+	fprintf(out, "fusgd_degraded_seconds_total %.1f\n", degrade_seconds());
+
+	fprintf(out, "# HELP fusgd_spool_bytes Spooled input not yet processed.\n");
+	fprintf(out, "# TYPE fusgd_spool_bytes gauge\n");
+	fprintf(out, "fusgd_spool_bytes %lu\n", spool_pending());
+
+	fprintf(out, "# HELP fusgd_batches_total Committed db batches.\n");
+	fprintf(out, "# TYPE fusgd_batches_total counter\n");
+	fprintf(out, "fusgd_batches_total %lu\n", global.batches_committed);
+
+	fprintf(out, "# HELP fusgd_resident_memory_bytes Resident set size.\n");
+	fprintf(out, "# TYPE fusgd_resident_memory_bytes gauge\n");
+	fprintf(out, "fusgd_resident_memory_bytes %ld\n", metrics_rss_bytes());
+
+	return ferror(out) ? -1 : 0;
+}
+
+
+/**
+ * Replaces the metrics file atomically, so scrapers never
+ * see partial content.
+ */
+static int metrics_write_file(const char* path)
+{
+	char tmp[PATH_MAX + 8];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE* out = fopen(tmp, "w");
+	if (!out) goto error;
+	int rc = metrics_write(out);
+	if (fclose(out) || rc || rename(tmp, path)) goto error;
+	return 0;
+error:
+	log_warn("metrics: can't write '%s': %s", path, strerror(errno));
+	unlink(tmp);
+	return -1;
+}
+
+
+void metrics_periodic(void)
+{
+	if (!global.conf.fusgd_metrics[0] || !global.conf.fusgd_metrics_period) return;
+
+	time_t now = time(NULL);
+	if (now - metrics_last_write >= global.conf.fusgd_metrics_period)
+	{
+		metrics_last_write = now;
+		metrics_write_file(global.conf.fusgd_metrics);
+	}
+}
+
+
+void metrics_dump(void)
+{
+	if (global.conf.fusgd_metrics[0])
+	{
+		metrics_last_write = time(NULL);
+		metrics_write_file(global.conf.fusgd_metrics);
+	}
+
+	char* buf = NULL;
+	size_t size = 0;
+	FILE* out = open_memstream(&buf, &size);
+	if (!out) return;
+	metrics_write(out);
+	fclose(out);
+
+	log_info("metrics:");
+	for (char* line = strtok(buf, "\n"); line; line = strtok(NULL, "\n"))
+	{
+		if (line[0] != '#') log_info("\t%s", line);
+	}
+	free(buf);
+}
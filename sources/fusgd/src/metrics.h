@@ -0,0 +1,192 @@
+/*
+ * metrics.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+/*
+ * Runtime metrics of fusgd in Prometheus text format.
+ *
+ * Each thread counts into a block of counters of its own: the main
+ * thread, which processes events, into metrics.counters, the others
+ * into the block they registered with metrics_thread(). A block is
+ * written by its thread only, hence without locks or atomic read-
+ * modify-writes. Relaxed atomic loads and stores merely keep the
+ * main thread's reads of it well defined. metrics_total() sums up
+ * the blocks. Histograms are observed by the main thread only.
+ *
+ * Metrics are written to the file given by fusgd_metrics every
+ * fusgd_metrics_period seconds and on SIGUSR1.
+ */
+
+
+typedef enum {
+	/** lines read from the input */
+	METRIC_LINES_IN,
+	/** records of complete events received from auparse */
+	METRIC_RECORDS_IN,
+	METRIC_EVENTS_IN,
+	METRIC_EVENTS_STORED,
+	/** first record is not a SYSCALL record */
+	METRIC_SKIPPED_NO_SYSCALL,
+	METRIC_SKIPPED_FAILED_SYSCALL,
+	/** missing executable, path or flags */
+	METRIC_SKIPPED_INCOMPLETE,
+	METRIC_PARSE_ERRORS,
+	METRIC_DB_ERRORS,
+	METRIC_DB_UPDATES,
+	METRIC_QUERIES,
+	/** successful SYSCALL events without CWD record */
+	METRIC_MISSING_CWD,
+	/** successful SYSCALL events without PATH record */
+	METRIC_MISSING_PATH,
+	/** overload: files stored as their directory */
+	METRIC_DEGRADED_COALESCED,
+	/** overload: updates dropped by sampling */
+	METRIC_DEGRADED_SAMPLED,
+	/** completed without EOE after fusgd_inflight_timeout */
+	METRIC_EVENTS_TIMED_OUT,
+	/** completed at the max number of records or bytes */
+	METRIC_EVENTS_LIMITED,
+	/** completed because a newer event needed the slot */
+	METRIC_EVENTS_EVICTED,
+	/** input moved into the spool */
+	METRIC_SPOOLED_BYTES,
+	/** input not spooled, because the spool was full */
+	METRIC_SPOOL_FULL,
+	/** log file rotations followed */
+	METRIC_TAIL_ROTATIONS,
+	/** log file truncations detected */
+	METRIC_TAIL_TRUNCATIONS,
+	/** events skipped on resume, because they were stored before */
+	METRIC_TAIL_SKIPPED,
+	/** events read from fanotify */
+	METRIC_FAN_EVENTS,
+	/** fanotify queue overflows (events lost) */
+	METRIC_FAN_OVERFLOWS,
+	/** fanotify events whose executable or file could not be resolved */
+	METRIC_FAN_UNRESOLVED,
+	/** entries dropped by retention */
+	METRIC_PRUNED_ENTRIES,
+	/** files without entries removed by retention */
+	METRIC_PRUNED_FILES,
+	/** executables without entries removed by retention */
+	METRIC_PRUNED_EXECS,
+	/** db files reorganised after pruning */
+	METRIC_DB_REORGANISED,
+	/** bytes released by reorganising db files */
+	METRIC_DB_RECLAIMED_BYTES,
+	/** approximate size of the updated records flushed */
+	METRIC_DB_FLUSHED_BYTES,
+	/** config reloads on SIGHUP */
+	METRIC_RELOADS,
+	/** config reloads failed, the config was kept */
+	METRIC_RELOAD_ERRORS,
+	/** executables and cwds taken from the process cache, not interpreted */
+	METRIC_PROCS_CACHED,
+	/** executables and cwds looked up in the process cache, but interpreted */
+	METRIC_PROCS_MISSED,
+	METRIC_COUNTERS
+} metric_counter_t;
+
+typedef enum {
+	/** processing time of an event [s] */
+	METRIC_EVENT_SECONDS,
+	METRIC_DB_UPDATE_SECONDS,
+	METRIC_DB_FLUSH_SECONDS,
+	/** time between event and its processing [s] */
+	METRIC_LAG_SECONDS,
+	/** time between event and the db flush of its update [s] */
+	METRIC_COMMIT_LAG_SECONDS,
+	/** time fusgd spent in a pruning step, including reorganising [s] */
+	METRIC_PRUNE_STEP_SECONDS,
+	/** updates written per db flush */
+	METRIC_DB_FLUSH_UPDATES,
+	/** time a config reload took [s] */
+	METRIC_RELOAD_SECONDS,
+	METRIC_HISTOGRAMS
+} metric_histogram_t;
+
+
+typedef struct {
+	uint64_t counters[METRIC_COUNTERS];
+	struct {
+		uint64_t count;
+		double sum;
+		/** not cumulative, see metrics_write() */
+		uint64_t buckets[32];
+	} histograms[METRIC_HISTOGRAMS];
+} metrics_t;
+
+
+/**
+ * Counters of a thread other than the main thread.
+ */
+typedef struct metrics_block_t {
+	uint64_t counters[METRIC_COUNTERS];
+	/** known to metrics_total(), once registered */
+	int listed;
+	struct metrics_block_t* next;
+} metrics_block_t;
+
+
+extern metrics_t metrics;
+
+/** counters of the calling thread */
+extern __thread uint64_t* metrics_counters;
+
+
+static inline void metrics_add(metric_counter_t counter, uint64_t value)
+{
+	uint64_t* c = &metrics_counters[counter];
+	__atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_inc(metric_counter_t counter)
+{
+	metrics_add(counter, 1);
+}
+
+/**
+ * Makes the calling thread count into block, which has to outlive it.
+ * Counts of a block stay, when its thread ends. A thread started again
+ * may take the same block.
+ */
+void metrics_thread(metrics_block_t* block);
+
+/**
+ * @return a counter summed up over all threads
+ */
+uint64_t metrics_total(metric_counter_t counter);
+
+/**
+ * Adds a sample to a histogram.
+ */
+void metrics_observe(metric_histogram_t histogram, double value);
+
+/**
+ * Writes all metrics in Prometheus text format.
+ * @return 0 on success -1 otherwise
+ */
+int metrics_write(FILE* out);
+
+/**
+ * Rewrites the metrics file, if configured and due.
+ */
+void metrics_periodic(void);
+
+/**
+ * Writes the metrics file and the metrics into the log (SIGUSR1).
+ */
+void metrics_dump(void);
+
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,147 @@
+/*
+ * procs.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#define _GNU_SOURCE
+#include "procs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+
+
+typedef struct {
+	/** 0: free */
+	pid_t pid;
+	char* exe_raw;
+	char* exe;
+	char* cwd_raw;
+	char* cwd;
+} proc_t;
+
+struct __procs_t {
+	proc_t* slots;
+	size_t num_slots;
+};
+
+
+
+procsref_t procs_create(size_t slots)
+{
+	if (slots < 1) slots = 1;
+	procsref_t procs = calloc(1, sizeof(struct __procs_t));
+	if (procs) procs->slots = calloc(slots, sizeof(proc_t));
+	if (!procs || !procs->slots)
+	{
+		log_error("procs: out of memory");
+		free(procs);
+		return NULL;
+	}
+	procs->num_slots = slots;
+	return procs;
+}
+
+
+static void proc_clear_cwd(proc_t* p)
+{
+	free(p->cwd_raw);
+	free(p->cwd);
+	p->cwd_raw = p->cwd = NULL;
+}
+
+static void proc_clear(proc_t* p)
+{
+	proc_clear_cwd(p);
+	free(p->exe_raw);
+	free(p->exe);
+	memset(p, 0, sizeof(proc_t));
+}
+
+
+void procs_destroy(procsref_t procs)
+{
+	if (!procs) return;
+	for (size_t i = 0; i < procs->num_slots; i++) proc_clear(&procs->slots[i]);
+	free(procs->slots);
+	free(procs);
+}
+
+
+/**
+ * @return entry of pid or NULL
+ */
+static proc_t* proc_find(procsref_t procs, pid_t pid)
+{
+	proc_t* p = &procs->slots[(size_t)pid % procs->num_slots];
+	return pid && p->pid == pid ? p : NULL;
+}
+
+
+const char* procs_exe(procsref_t procs, pid_t pid, const char* raw)
+{
+	proc_t* p = proc_find(procs, pid);
+	return p && !strcmp(p->exe_raw, raw) ? p->exe : NULL;
+}
+
+
+const char* procs_set_exe(procsref_t procs, pid_t pid, const char* raw, const char* exe)
+{
+	if (!pid) return NULL;
+	proc_t* p = &procs->slots[(size_t)pid % procs->num_slots];
+	if (p->pid == pid && !strcmp(p->exe_raw, raw)) return p->exe;
+
+	char* exe_raw = strdup(raw);
+	char* exe_copy = strdup(exe);
+	if (!exe_raw || !exe_copy)
+	{
+		free(exe_raw);
+		free(exe_copy);
+		return NULL;
+	}
+
+	// exec'd another file, pid reused or slot taken by another pid
+	proc_clear(p);
+	p->pid = pid;
+	p->exe_raw = exe_raw;
+	p->exe = exe_copy;
+	return p->exe;
+}
+
+
+const char* procs_cwd(procsref_t procs, pid_t pid, const char* raw)
+{
+	proc_t* p = proc_find(procs, pid);
+	return p && p->cwd_raw && !strcmp(p->cwd_raw, raw) ? p->cwd : NULL;
+}
+
+
+const char* procs_set_cwd(procsref_t procs, pid_t pid, const char* raw, const char* cwd)
+{
+	proc_t* p = proc_find(procs, pid);
+	if (!p) return NULL;
+	if (p->cwd_raw && !strcmp(p->cwd_raw, raw)) return p->cwd;
+
+	char* cwd_raw = strdup(raw);
+	char* cwd_copy = strdup(cwd);
+	if (!cwd_raw || !cwd_copy)
+	{
+		free(cwd_raw);
+		free(cwd_copy);
+		return NULL;
+	}
+	proc_clear_cwd(p);
+	p->cwd_raw = cwd_raw;
+	p->cwd = cwd_copy;
+	return p->cwd;
+}
+
+
+void procs_exit(procsref_t procs, pid_t pid)
+{
+	proc_t* p = proc_find(procs, pid);
+	if (p) proc_clear(p);
+}
@@ -0,0 +1,81 @@
+/*
+ * procs.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef PROCS_H_
+#define PROCS_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+
+/*
+ * Per-process context cache.
+ *
+ * A busy process emits thousands of events with the same executable
+ * and mostly the same cwd. The cache keeps both per pid, interpreted,
+ * along with their raw field values as logged (quoted or hex encoded).
+ * A record whose raw value equals the cached one takes the cached
+ * interpretation, without auparse_interpret_field() and a copy.
+ *
+ * Comparing the raw values keeps the cache correct on its own: a pid
+ * which exec'd another file, or was reused by another process, shows
+ * another exe and gets a new entry. Audit records carry no process
+ * start time; an exec of the same file or a reuse by the same file
+ * keeps the entry, whose values are just as valid. Exits drop the
+ * entry.
+ *
+ * Entries are indexed by pid in a fixed number of slots, hence memory
+ * stays flat; a pid taking an occupied slot replaces its entry.
+ * Not thread safe: one cache per parser.
+ */
+
+
+/** slots of a cache */
+#define PROCS_SLOTS 4096
+
+
+typedef struct __procs_t* procsref_t;
+
+
+/**
+ * @return cache or NULL if out of memory
+ */
+procsref_t procs_create(size_t slots);
+
+void procs_destroy(procsref_t procs);
+
+/**
+ * @param raw exe field as logged
+ * @return cached executable of pid or NULL if unknown or raw differs
+ */
+const char* procs_exe(procsref_t procs, pid_t pid, const char* raw);
+
+/**
+ * Caches the executable of pid. Another executable than the cached one
+ * starts a new process image, i.e. drops the cwd.
+ * @return the cached copy of exe or NULL if out of memory
+ */
+const char* procs_set_exe(procsref_t procs, pid_t pid, const char* raw, const char* exe);
+
+/**
+ * @return cached cwd of pid or NULL if unknown or raw differs
+ */
+const char* procs_cwd(procsref_t procs, pid_t pid, const char* raw);
+
+/**
+ * Caches the cwd of pid, if its executable is cached.
+ * @return the cached copy of cwd or NULL
+ */
+const char* procs_set_cwd(procsref_t procs, pid_t pid, const char* raw, const char* cwd);
+
+/**
+ * pid exited.
+ */
+void procs_exit(procsref_t procs, pid_t pid);
+
+
+#endif /* PROCS_H_ */
@@ -0,0 +1,124 @@
+/*
+ * prune.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#include "prune.h"
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+
+#include "fusgd.h"
+#include "metrics.h"
+#include "service.h"
+
+
+static time_t last_run = 0;
+static uint64_t last_step_ms = 0;
+
+/** the current run */
+static db_prune_stats_t run_stats;
+static uint64_t run_start_ms;
+
+
+
+static uint64_t mono_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int prune_enabled(void)
+{
+	// replayed logs are old by nature
+	return global.mode != OP_PARSE_FILE
+			&& (global.conf.db_retention_days > 0 || global.conf.db_retention_deleted_days > 0);
+}
+
+
+/**
+ * Keeps the query service up to date.
+ */
+static void prune_dropped(void* ctx, const fusg_stats_key_t* key)
+{
+	if (service_fd() != -1) service_remove(key);
+}
+
+
+static void prune_start(void)
+{
+	time_t now = time(NULL);
+	if (last_run && now - last_run < global.conf.db_prune_period) return;
+	last_run = now;
+
+	int days = global.conf.db_retention_days;
+	int deleted_days = global.conf.db_retention_deleted_days;
+	db_retention_t retention = {
+		.expire_before = days > 0 ? now - days * 86400L : 0,
+		.deleted_before = deleted_days > 0 ? now - deleted_days * 86400L : 0,
+	};
+	if (db_prune_begin(global.db, &retention))
+	{
+		log_error("prune: can't start: %s", strerror(errno));
+		return;
+	}
+	memset(&run_stats, 0, sizeof(run_stats));
+	run_start_ms = mono_ms();
+	log_debug("prune: started");
+}
+
+
+void prune_check(void)
+{
+	if (!prune_enabled()) return;
+
+	uint64_t start = mono_ms();
+	if (start - last_step_ms < PRUNE_TICK_MS) return;
+	last_step_ms = start;
+
+	if (!db_prune_active(global.db))
+	{
+		prune_start();
+		return;
+	}
+
+	db_prune_stats_t stats;
+	memset(&stats, 0, sizeof(stats));
+	int rc = db_prune_step(global.db, global.conf.db_prune_work, global.conf.db_reorganise_pause,
+			prune_dropped, NULL, &stats);
+	metrics_observe(METRIC_PRUNE_STEP_SECONDS, (mono_ms() - start) / 1e3);
+
+	metrics_add(METRIC_PRUNED_ENTRIES, stats.entries);
+	metrics_add(METRIC_PRUNED_FILES, stats.files);
+	metrics_add(METRIC_PRUNED_EXECS, stats.execs);
+	metrics_add(METRIC_DB_REORGANISED, stats.reorganised);
+	if (stats.reclaimed > 0) metrics_add(METRIC_DB_RECLAIMED_BYTES, stats.reclaimed);
+	run_stats.entries += stats.entries;
+	run_stats.files += stats.files;
+	run_stats.execs += stats.execs;
+	run_stats.reorganised += stats.reorganised;
+	run_stats.reclaimed += stats.reclaimed;
+
+	if (rc == 0)
+	{
+		log_info("prune: %lu entries, %lu files, %lu executables removed, %lu db files reorganised (%ld bytes released) in %.1f s",
+				run_stats.entries, run_stats.files, run_stats.execs,
+				run_stats.reorganised, run_stats.reclaimed, (mono_ms() - run_start_ms) / 1e3);
+	}
+	else if (rc < 0)
+	{
+		log_error("prune: aborted after %lu entries", run_stats.entries);
+	}
+}
+
+
+int prune_active(void)
+{
+	return global.db && db_prune_active(global.db);
+}
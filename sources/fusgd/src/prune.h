@@ -0,0 +1,40 @@
+/*
+ * prune.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef PRUNE_H_
+#define PRUNE_H_
+
+
+/*
+ * Retention: drops entries not updated for db_retention_days days and
+ * entries of files deleted db_retention_deleted_days days ago, then
+ * reorganises the affected db files (see db_prune_begin()).
+ *
+ * A pruning run starts every db_prune_period seconds and proceeds in
+ * steps of db_prune_work entries or records every PRUNE_TICK_MS, in
+ * between events. Reorganising a db file blocks fusgd for as long as
+ * it takes, thus only files expected to take db_reorganise_pause ms
+ * at most are reorganised.
+ */
+
+
+/** time between pruning steps [ms] */
+#define PRUNE_TICK_MS 100
+
+
+/**
+ * Starts a pruning run or does its next step, if due. Call periodically.
+ */
+void prune_check(void);
+
+/**
+ * @return 1 if a pruning run is in progress
+ */
+int prune_active(void);
+
+
+#endif /* PRUNE_H_ */
@@ -0,0 +1,128 @@
+/*
+ * reader.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#define _GNU_SOURCE
+#include "reader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+
+
+
+int reader_init(reader_t* reader, int fd, size_t size)
+{
+	memset(reader, 0, sizeof(reader_t));
+	reader->buf = malloc(size);
+	if (!reader->buf) return -1;
+	reader->fd = fd;
+	reader->size = size;
+	return 0;
+}
+
+
+void reader_destroy(reader_t* reader)
+{
+	free(reader->buf);
+	reader->buf = NULL;
+}
+
+
+void reader_reset(reader_t* reader, int fd)
+{
+	reader->fd = fd;
+	reader->head = reader->tail = 0;
+	reader->eof = 0;
+}
+
+
+ssize_t reader_fill(reader_t* reader)
+{
+	if (reader->head == reader->tail)
+	{
+		reader->head = reader->tail = 0;
+	}
+	else if (reader->tail == reader->size && reader->head)
+	{
+		// make room at the end
+		memmove(reader->buf, reader->buf + reader->head, reader->tail - reader->head);
+		reader->tail -= reader->head;
+		reader->head = 0;
+	}
+	if (reader->tail == reader->size) return 0;
+
+	ssize_t n;
+	do {
+		n = read(reader->fd, reader->buf + reader->tail, reader->size - reader->tail);
+	} while (n == -1 && errno == EINTR);
+
+	if (n > 0) reader->tail += n;
+	else if (n == 0) reader->eof = 1;
+	return n;
+}
+
+
+const char* reader_line(reader_t* reader, size_t* len)
+{
+	size_t pending = reader->tail - reader->head;
+	if (!pending) return NULL;
+
+	const char* line = reader->buf + reader->head;
+	const char* nl = memchr(line, '\n', pending);
+	if (nl)
+	{
+		*len = nl - line + 1;
+	}
+	else if ((reader->eof && !reader->follow) || (reader->head == 0 && reader->tail == reader->size))
+	{
+		*len = pending;
+	}
+	else
+	{
+		return NULL;
+	}
+	reader->head += *len;
+	return line;
+}
+
+
+const char* reader_lines(reader_t* reader, size_t* len)
+{
+	size_t pending = reader->tail - reader->head;
+	const char* data = reader->buf + reader->head;
+	const char* nl = memrchr(data, '\n', pending);
+	if (nl) *len = nl - data + 1;
+	else if (reader->head == 0 && reader->tail == reader->size) *len = pending;
+	else *len = 0;
+	return data;
+}
+
+
+void reader_consume(reader_t* reader, size_t len)
+{
+	reader->head += len;
+}
+
+
+int fd_backlog(int fd)
+{
+	int size = fcntl(fd, F_GETPIPE_SZ);
+	int pending = 0;
+	if (size <= 0 || ioctl(fd, FIONREAD, &pending)) return 0;
+	return (int)((100L * pending) / size);
+}
+
+
+int fd_readable(int fd)
+{
+	struct pollfd p = { .fd = fd, .events = POLLIN };
+	return poll(&p, 1, 0) > 0 && (p.revents & (POLLIN | POLLHUP));
+}
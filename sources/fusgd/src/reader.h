@@ -0,0 +1,99 @@
+/*
+ * reader.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef READER_H_
+#define READER_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+
+/*
+ * Line reader on a file descriptor.
+ *
+ * Reads in large chunks and hands out lines straight from its
+ * buffer. Unlike stdio, it tells whether a complete line is buffered,
+ * so the work loop never waits in select() while lines are pending,
+ * and it hands over its raw buffer, e.g. to the spool.
+ */
+
+
+typedef struct {
+	int fd;
+	char* buf;
+	size_t size;
+	/** start of unconsumed data */
+	size_t head;
+	/** end of data */
+	size_t tail;
+	/** fd reached end of file */
+	int eof;
+	/** more data may follow EOF (tailing a file), i.e. keep an incomplete last line */
+	int follow;
+} reader_t;
+
+
+/**
+ * @param size buffer size, which is also the max line length
+ * @return 0 on success, -1 otherwise
+ */
+int reader_init(reader_t* reader, int fd, size_t size);
+
+void reader_destroy(reader_t* reader);
+
+/**
+ * Switches to another fd and drops all buffered data.
+ */
+void reader_reset(reader_t* reader, int fd);
+
+/**
+ * Reads once from the fd. Blocks, if the fd is blocking and has no data.
+ * @return bytes read, 0 on EOF or full buffer, -1 on error
+ */
+ssize_t reader_fill(reader_t* reader);
+
+/**
+ * Hands out the next line, including its '\n'. At EOF or if the buffer
+ * is full, the remaining data is a line on its own.
+ * @param len receives the length of the line
+ * @return line (not terminated, valid until the next call) or NULL if there is no complete line
+ */
+const char* reader_line(reader_t* reader, size_t* len);
+
+/**
+ * @return number of buffered bytes not yet handed out
+ */
+static inline size_t reader_pending(const reader_t* reader)
+{
+	return reader->tail - reader->head;
+}
+
+/**
+ * Buffered complete lines, e.g. to be handed over to the spool.
+ * If the buffer is full without any line break, that's all of it.
+ * @param len receives their length
+ * @return the lines (not consumed, valid until the next call)
+ */
+const char* reader_lines(reader_t* reader, size_t* len);
+
+/**
+ * Drops bytes handed out by reader_lines().
+ */
+void reader_consume(reader_t* reader, size_t len);
+
+/**
+ * @return fill level of a pipe [%] or 0 if fd is no pipe
+ */
+int fd_backlog(int fd);
+
+/**
+ * @return 1 if fd has data to read without blocking, 0 otherwise
+ */
+int fd_readable(int fd);
+
+
+#endif /* READER_H_ */
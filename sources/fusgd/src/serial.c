@@ -0,0 +1,174 @@
+/*
+ * serial.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#include "serial.h"
+
+#include <string.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+
+#include "metrics.h"
+#include "trace.h"
+
+
+/** serials below the latest one, which are still checked */
+#define SERIAL_WINDOW 4096
+/** serials that far below the latest one indicate a restart */
+#define SERIAL_RESET_DISTANCE (SERIAL_WINDOW * 16)
+/** hosts beyond are accounted to the last one */
+#define SERIAL_HOSTS_MAX 16
+#define SERIAL_HOST_MAX 64
+
+
+typedef struct {
+	char host[SERIAL_HOST_MAX];
+	int initialised;
+	/** highest serial seen */
+	uint64_t latest;
+	/** serials seen in (latest - SERIAL_WINDOW, latest] */
+	uint64_t seen[SERIAL_WINDOW / 64];
+	serial_stats_t stats;
+} serial_host_t;
+
+
+static serial_host_t hosts[SERIAL_HOSTS_MAX];
+static int num_hosts = 0;
+
+/** totals at the last report */
+static serial_stats_t reported;
+static uint64_t reported_missing_cwd = 0;
+static uint64_t reported_missing_path = 0;
+
+
+
+static inline int seen_get(serial_host_t* h, uint64_t serial)
+{
+	uint64_t i = serial % SERIAL_WINDOW;
+	return (h->seen[i / 64] >> (i % 64)) & 1;
+}
+
+static inline void seen_set(serial_host_t* h, uint64_t serial, int value)
+{
+	uint64_t i = serial % SERIAL_WINDOW;
+	if (value) h->seen[i / 64] |= (1UL << (i % 64));
+	else h->seen[i / 64] &= ~(1UL << (i % 64));
+}
+
+
+static serial_host_t* serial_host(const char* host)
+{
+	if (!host) host = "";
+	for (int i = 0; i < num_hosts; i++)
+	{
+		if (!strncmp(hosts[i].host, host, SERIAL_HOST_MAX - 1)) return &hosts[i];
+	}
+	if (num_hosts == SERIAL_HOSTS_MAX) return &hosts[SERIAL_HOSTS_MAX - 1];
+
+	serial_host_t* h = &hosts[num_hosts++];
+	strncpy(h->host, host, SERIAL_HOST_MAX - 1);
+	return h;
+}
+
+static void serial_restart(serial_host_t* h, uint64_t serial)
+{
+	memset(h->seen, 0, sizeof(h->seen));
+	h->latest = serial;
+	h->initialised = 1;
+	seen_set(h, serial, 1);
+}
+
+
+void serial_track(const au_event_t* event)
+{
+	serial_host_t* h = serial_host(event->host);
+	uint64_t serial = event->serial;
+	h->stats.events++;
+
+	if (!h->initialised)
+	{
+		serial_restart(h, serial);
+	}
+	else if (serial > h->latest)
+	{
+		uint64_t gap = serial - h->latest - 1;
+		if (gap)
+		{
+			h->stats.missing += gap;
+			trace_note("serial gap: %lu events missing before %lu (host '%s')", gap, serial, h->host);
+		}
+		// forget serials falling out of the window
+		uint64_t clear = serial - h->latest < SERIAL_WINDOW ? serial - h->latest : SERIAL_WINDOW;
+		for (uint64_t s = serial - clear + 1; s <= serial; s++) seen_set(h, s, 0);
+		h->latest = serial;
+		seen_set(h, serial, 1);
+	}
+	else if (h->latest - serial >= SERIAL_RESET_DISTANCE)
+	{
+		h->stats.resets++;
+		trace_note("serial reset: %lu after %lu (host '%s')", serial, h->latest, h->host);
+		serial_restart(h, serial);
+	}
+	else if (h->latest - serial >= SERIAL_WINDOW)
+	{
+		h->stats.stale++;
+	}
+	else if (seen_get(h, serial))
+	{
+		h->stats.duplicates++;
+		trace_note("serial duplicate: %lu (host '%s')", serial, h->host);
+	}
+	else
+	{
+		// counted as missing before
+		seen_set(h, serial, 1);
+		h->stats.reordered++;
+		if (h->stats.missing) h->stats.missing--;
+	}
+}
+
+
+void serial_totals(serial_stats_t* stats)
+{
+	memset(stats, 0, sizeof(serial_stats_t));
+	for (int i = 0; i < num_hosts; i++)
+	{
+		stats->events     += hosts[i].stats.events;
+		stats->missing    += hosts[i].stats.missing;
+		stats->duplicates += hosts[i].stats.duplicates;
+		stats->reordered  += hosts[i].stats.reordered;
+		stats->stale      += hosts[i].stats.stale;
+		stats->resets     += hosts[i].stats.resets;
+	}
+}
+
+
+static double serial_rate(uint64_t count, uint64_t previous, uint64_t events)
+{
+	return (events && count > previous) ? 100.0 * (count - previous) / events : 0;
+}
+
+void serial_report(void)
+{
+	serial_stats_t now;
+	serial_totals(&now);
+	uint64_t missing_cwd = metrics.counters[METRIC_MISSING_CWD];
+	uint64_t missing_path = metrics.counters[METRIC_MISSING_PATH];
+
+	// missing serials are relative to all events that should have been seen
+	uint64_t events = now.events - reported.events;
+	uint64_t expected = events + (now.missing > reported.missing ? now.missing - reported.missing : 0);
+
+	log_info("\tmissing serials: %lu (%.2f%%)", now.missing, serial_rate(now.missing, reported.missing, expected));
+	log_info("\tduplicate serials: %lu (%.2f%%)", now.duplicates, serial_rate(now.duplicates, reported.duplicates, events));
+	log_info("\treordered events: %lu, serial resets: %lu", now.reordered, now.resets);
+	log_info("\tevents missing CWD: %lu (%.2f%%)", missing_cwd, serial_rate(missing_cwd, reported_missing_cwd, events));
+	log_info("\tevents missing PATH: %lu (%.2f%%)", missing_path, serial_rate(missing_path, reported_missing_path, events));
+
+	reported = now;
+	reported_missing_cwd = missing_cwd;
+	reported_missing_path = missing_path;
+}
@@ -0,0 +1,56 @@
+/*
+ * serial.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef SERIAL_H_
+#define SERIAL_H_
+
+#include <stdint.h>
+#include <auparse.h>
+
+
+/*
+ * Detection of lost events.
+ *
+ * auditd numbers events per host with consecutive serials. Serials
+ * skipped in the stream of events are counted as missing, until they
+ * arrive late (auparse may complete events out of order). Serials
+ * seen twice are duplicates. A serial far below the latest one means
+ * auditd was restarted.
+ */
+
+
+typedef struct {
+	uint64_t events;
+	/** serials not (yet) seen */
+	uint64_t missing;
+	uint64_t duplicates;
+	/** events which arrived after higher serials */
+	uint64_t reordered;
+	/** events too old to be checked */
+	uint64_t stale;
+	/** restarts of the serial numbering */
+	uint64_t resets;
+} serial_stats_t;
+
+
+/**
+ * Checks the serial of an event.
+ */
+void serial_track(const au_event_t* event);
+
+/**
+ * @param stats receives the sums over all hosts
+ */
+void serial_totals(serial_stats_t* stats);
+
+/**
+ * Logs the rates of lost and duplicate events since the last report.
+ */
+void serial_report(void);
+
+
+#endif /* SERIAL_H_ */
@@ -0,0 +1,451 @@
+/*
+ * service.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#define _GNU_SOURCE
+#include "service.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+#include "../../fusg-common/include/fusg/query.h"
+
+#include "fusgd.h"
+#include "index.h"
+#include "metrics.h"
+
+
+/** max time a client may block us while sending or receiving */
+#define SERVICE_IO_TIMEOUT_MS 1000
+/** max time a client may take to receive all replies of a query */
+#define SERVICE_QUERY_TIMEOUT_MS 10000
+
+
+static int service_sock = -1;
+static struct sockaddr_un service_addr;
+static char service_db_path[PATH_MAX];
+
+static pthread_t service_thread;
+static int service_running = 0;
+/** wakes up the service thread to stop */
+static int service_wake[2] = { -1, -1 };
+/** protects the index and service_db_path */
+static pthread_mutex_t service_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** replies of a query, sent after releasing the index */
+typedef struct {
+	char* data;
+	size_t len;
+	size_t cap;
+	/** out of memory: replies are incomplete */
+	int failed;
+} service_out_t;
+
+
+static void* service_main(void* arg);
+
+
+int service_open(const char* socket_path, const char* db_path)
+{
+	if (strlen(socket_path) >= sizeof(service_addr.sun_path))
+	{
+		log_error("service: socket path too long: '%s'", socket_path);
+		return -1;
+	}
+
+	if (index_init() || index_load(global.db))
+	{
+		log_error("service: failed to build index");
+		goto error;
+	}
+	log_info("service: indexed %lu entries", index_size());
+	snprintf(service_db_path, sizeof(service_db_path), "%s", db_path);
+
+	service_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (service_sock == -1) goto error;
+
+	memset(&service_addr, 0, sizeof(service_addr));
+	service_addr.sun_family = AF_UNIX;
+	strcpy(service_addr.sun_path, socket_path);
+
+	// remove stale socket of a previous run
+	unlink(socket_path);
+	if (bind(service_sock, (struct sockaddr*)&service_addr, sizeof(service_addr))) goto error;
+	// db access is restricted to root (cf. FUSG-README)
+	if (chmod(socket_path, 0600)) goto error;
+	if (listen(service_sock, 16)) goto error;
+
+	// a client giving up between poll() and accept() must not block us
+	int flags = fcntl(service_sock, F_GETFL);
+	if (flags == -1 || fcntl(service_sock, F_SETFL, flags | O_NONBLOCK)) goto error;
+
+	if (pipe2(service_wake, O_CLOEXEC)) goto error;
+	int rc = pthread_create(&service_thread, NULL, service_main, NULL);
+	if (rc)
+	{
+		errno = rc;
+		goto error;
+	}
+	service_running = 1;
+
+	log_info("service: listening at '%s'", socket_path);
+	return 0;
+
+error:
+	log_error("service: can't listen at '%s': %s", socket_path, strerror(errno));
+	service_close();
+	return -1;
+}
+
+void service_close(void)
+{
+	if (service_running)
+	{
+		// a query in progress is finished first
+		if (write(service_wake[1], "", 1) != 1) log_error("service: can't stop: %s", strerror(errno));
+		pthread_join(service_thread, NULL);
+		service_running = 0;
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		if (service_wake[i] != -1) close(service_wake[i]);
+		service_wake[i] = -1;
+	}
+	if (service_sock != -1)
+	{
+		close(service_sock);
+		unlink(service_addr.sun_path);
+		service_sock = -1;
+	}
+	index_destroy();
+}
+
+int service_reindex(const char* db_path)
+{
+	pthread_mutex_lock(&service_mutex);
+	index_destroy();
+	int rc = index_init() || index_load(global.db);
+	snprintf(service_db_path, sizeof(service_db_path), "%s", db_path);
+	if (!rc) log_info("service: indexed %lu entries", index_size());
+	pthread_mutex_unlock(&service_mutex);
+
+	if (rc)
+	{
+		log_error("service: failed to rebuild index");
+		service_close();
+		return -1;
+	}
+	return 0;
+}
+
+int service_fd(void)
+{
+	return service_sock;
+}
+
+void service_update(const fusg_stats_key_t* key, const char* exec, const char* file, const fusg_stats_t* stats)
+{
+	pthread_mutex_lock(&service_mutex);
+	index_update(key, exec, file, stats);
+	pthread_mutex_unlock(&service_mutex);
+}
+
+void service_remove(const fusg_stats_key_t* key)
+{
+	pthread_mutex_lock(&service_mutex);
+	index_remove(key);
+	pthread_mutex_unlock(&service_mutex);
+}
+
+
+static int service_out_reply(service_out_t* out, query_status_t status,
+		const char* exec, const char* file, const fusg_stats_t* stats, uint64_t entries)
+{
+	size_t len = query_pack_reply(NULL, 0, status, exec, file, stats, entries);
+	if (out->len + len > out->cap)
+	{
+		size_t cap = out->cap ? out->cap : 64 * 1024;
+		while (cap < out->len + len) cap *= 2;
+		char* data = realloc(out->data, cap);
+		if (!data)
+		{
+			log_error("service: out of memory");
+			out->failed = 1;
+			return -1;
+		}
+		out->data = data;
+		out->cap = cap;
+	}
+	out->len += query_pack_reply(out->data + out->len, len, status, exec, file, stats, entries);
+	return 0;
+}
+
+static int service_send_record(void* ctx, const char* exec, const char* file, const fusg_stats_t* stats)
+{
+	return service_out_reply(ctx, QUERY_RECORD, exec, file, stats, 1);
+}
+
+
+/**
+ * Runs a file query for an alias by querying the name of the file.
+ * Aliases are not in the index, which knows files by name only.
+ */
+static long service_query_alias(dbref_t db, const char* file, service_out_t* out)
+{
+	char name[PATH_MAX + 1];
+	uint64_t id = db_file_get_id(db, file);
+	if (id == (uint64_t)-1
+			|| db_file_get_file(db, id, name, sizeof(name))
+			|| !strcmp(name, file))
+	{
+		return -1;
+	}
+	pthread_mutex_lock(&service_mutex);
+	long count = index_query_file(name, service_send_record, out);
+	pthread_mutex_unlock(&service_mutex);
+	return count;
+}
+
+static long service_query_aliases(dbref_t db, const char* file, service_out_t* out)
+{
+	char name[PATH_MAX + 1];
+	char aliases[PATH_MAX * 16];
+	uint64_t id = db_file_get_id(db, file);
+	if (id == (uint64_t)-1
+			|| db_file_get_file(db, id, name, sizeof(name)))
+	{
+		return -1;
+	}
+	if (db_file_get_aliases(db, id, aliases, sizeof(aliases)) < 0)
+	{
+		log_warn("service: can't get aliases of '%s'", name);
+		aliases[0] = '\0';
+	}
+
+	if (service_out_reply(out, QUERY_RECORD, NULL, name, NULL, 0)) return -1;
+	long count = 1;
+	for (const char* alias = aliases; *alias; alias += strlen(alias) + 1, count++)
+	{
+		if (service_out_reply(out, QUERY_RECORD, NULL, alias, NULL, 0)) return -1;
+	}
+	return count;
+}
+
+
+/**
+ * Adds the rollup of a file, an executable or a directory.
+ * @return 1, 0 if there is none and -1 if rollups are not available
+ */
+static long service_query_summary(dbref_t db, query_type_t type, const char* arg, service_out_t* out)
+{
+	fusg_rollup_t rollup;
+	int rc = (type == QUERY_SUMMARY_FILE) ? db_file_rollup(db, arg, &rollup)
+			: (type == QUERY_SUMMARY_EXEC) ? db_exec_rollup(db, arg, &rollup)
+			: db_dir_rollup(db, arg, &rollup);
+	if (rc < 0) return -1;
+	if (rc > 0) return 0;
+	return service_out_reply(out, QUERY_RECORD,
+			type == QUERY_SUMMARY_EXEC ? arg : NULL,
+			type != QUERY_SUMMARY_EXEC ? arg : NULL,
+			&rollup.stats, rollup.entries) ? -1 : 1;
+}
+
+
+/**
+ * Opens the db for queries not answered by the index. The service
+ * thread reads like fusg does: the writer's handle is not shared.
+ */
+static dbref_t service_db_open(void)
+{
+	char path[PATH_MAX];
+	pthread_mutex_lock(&service_mutex);
+	strcpy(path, service_db_path);
+	pthread_mutex_unlock(&service_mutex);
+	dbref_t db = db_open(path, DB_READ);
+	if (!db) log_warn("service: can't open db '%s'", path);
+	return db;
+}
+
+
+/**
+ * Evaluates a query into out.
+ * @return number of entries, -1 if not found, -2 on failure
+ */
+static long service_query(query_type_t type, const char* arg, service_out_t* out)
+{
+	long count = -2;
+	dbref_t db = NULL;
+	switch (type)
+	{
+	case QUERY_FILE:
+		pthread_mutex_lock(&service_mutex);
+		count = index_query_file(arg, service_send_record, out);
+		pthread_mutex_unlock(&service_mutex);
+		if (count < 0 && (db = service_db_open())) count = service_query_alias(db, arg, out);
+		break;
+	case QUERY_EXEC:
+		pthread_mutex_lock(&service_mutex);
+		count = index_query_exec(arg, service_send_record, out);
+		pthread_mutex_unlock(&service_mutex);
+		break;
+	case QUERY_SUBTREE:
+		pthread_mutex_lock(&service_mutex);
+		count = index_query_subtree(arg, service_send_record, out);
+		pthread_mutex_unlock(&service_mutex);
+		break;
+	case QUERY_DUMP:
+		pthread_mutex_lock(&service_mutex);
+		count = index_query_all(service_send_record, out);
+		pthread_mutex_unlock(&service_mutex);
+		break;
+	case QUERY_ALIASES:
+		if ((db = service_db_open())) count = service_query_aliases(db, arg, out);
+		break;
+	case QUERY_SUMMARY_FILE:
+	case QUERY_SUMMARY_EXEC:
+	case QUERY_SUMMARY_DIR:
+		if ((db = service_db_open())) count = service_query_summary(db, type, arg, out);
+		if (count == 0) count = -1;
+		else if (count < 0) count = -2;
+		break;
+	default:
+		log_warn("service: unknown request type %u", type);
+		break;
+	}
+	if (db) db_close(db);
+	return out->failed ? -2 : count;
+}
+
+
+/**
+ * Sends all replies, giving up after SERVICE_QUERY_TIMEOUT_MS.
+ */
+static int service_send(int sock, const char* data, size_t len)
+{
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (len)
+	{
+		// don't die on SIGPIPE, if the peer went away
+		ssize_t n = send(sock, data, len, MSG_NOSIGNAL);
+		if (n < 0 && errno != EINTR) return -1;
+		if (n > 0)
+		{
+			data += n;
+			len -= n;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ((now.tv_sec - start.tv_sec) * 1000
+				+ (now.tv_nsec - start.tv_nsec) / 1000000 > SERVICE_QUERY_TIMEOUT_MS)
+		{
+			errno = ETIMEDOUT;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Accepts and answers a single pending query.
+ * @return 0 on success -1 otherwise
+ */
+static int service_handle(void)
+{
+	int sock = accept4(service_sock, NULL, NULL, SOCK_CLOEXEC);
+	if (sock == -1)
+	{
+		// spurious wakeup or client gave up
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	}
+
+	struct timeval tv = {
+		.tv_sec = SERVICE_IO_TIMEOUT_MS / 1000,
+		.tv_usec = (SERVICE_IO_TIMEOUT_MS % 1000) * 1000,
+	};
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	int rc = 0;
+	query_request_t request;
+	char arg[PATH_MAX + 1];
+	service_out_t out = { NULL, 0, 0, 0 };
+	if (query_recv_request(sock, &request, arg, sizeof(arg)))
+	{
+		log_warn("service: bad request: %s", strerror(errno));
+		close(sock);
+		return -1;
+	}
+
+	long count = service_query(request.type, arg, &out);
+	if (count < -1)
+	{
+		// nothing but the failure
+		out.len = 0;
+		out.failed = 0;
+		rc = -1;
+	}
+	query_status_t status = count < -1 ? QUERY_FAILED : count < 0 ? QUERY_NOTFOUND : QUERY_END;
+	if (service_out_reply(&out, status, NULL, NULL, NULL, 0)
+			|| service_send(sock, out.data, out.len))
+	{
+		log_warn("service: request %u '%s': %s", request.type, arg, strerror(errno));
+		rc = -1;
+	}
+	else if (status != QUERY_FAILED)
+	{
+		metrics_inc(METRIC_QUERIES);
+		log_debug("service: request %u '%s': %ld entries", request.type, arg, count);
+	}
+	free(out.data);
+	close(sock);
+	return rc;
+}
+
+
+/** counters of the service thread */
+static metrics_block_t service_metrics;
+
+static void* service_main(void* arg)
+{
+	// signals are for the main thread
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+	metrics_thread(&service_metrics);
+
+	struct pollfd fds[2] = {
+		{ .fd = service_sock, .events = POLLIN },
+		{ .fd = service_wake[0], .events = POLLIN },
+	};
+	for (;;)
+	{
+		if (poll(fds, 2, -1) == -1 && errno != EINTR)
+		{
+			log_error("service: poll: %s", strerror(errno));
+			break;
+		}
+		if (fds[1].revents) break;
+		if (fds[0].revents & POLLIN) service_handle();
+	}
+	return NULL;
+}
@@ -0,0 +1,66 @@
+/*
+ * service.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef SERVICE_H_
+#define SERVICE_H_
+
+
+/*
+ * Query service of fusgd.
+ *
+ * Answers queries of fusg over a unix domain socket from the
+ * in-memory index (see index.h), using the protocol defined
+ * in fusg/query.h.
+ *
+ * Queries are served by a thread of their own, so neither large
+ * answers nor slow clients hold up ingestion. The index is shared
+ * with the ingesting thread under a mutex, which a query holds
+ * only while collecting its answer in memory, never while sending.
+ * Queries of aliases and summaries read the db through a handle of
+ * their own, i.e. from the published snapshot if there is one.
+ */
+
+#include "../../fusg-common/include/fusg/db.h"
+
+
+/**
+ * Loads the index from the db and starts serving at the given socket.
+ * @param db_path path of global.db for queries reading the db
+ * @return 0 on success -1 otherwise
+ */
+int service_open(const char* socket_path, const char* db_path);
+
+/**
+ * Stops serving and releases the index.
+ */
+void service_close(void);
+
+/**
+ * Rebuilds the index from global.db, e.g. after the db changed.
+ * Stops the service if that fails, then fusg falls back to the db.
+ * @param db_path path of global.db
+ * @return 0 on success -1 otherwise
+ */
+int service_reindex(const char* db_path);
+
+/**
+ * @return listening socket or -1 if the service is not running.
+ */
+int service_fd(void);
+
+/**
+ * Adds or updates an entry of the index (see index_update()).
+ */
+void service_update(const fusg_stats_key_t* key, const char* exec, const char* file, const fusg_stats_t* stats);
+
+/**
+ * Removes an entry from the index (see index_remove()).
+ */
+void service_remove(const fusg_stats_key_t* key);
+
+
+#endif /* SERVICE_H_ */
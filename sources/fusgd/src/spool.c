@@ -0,0 +1,515 @@
+/*
+ * spool.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#define _GNU_SOURCE
+#include "spool.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+
+#include "assemble.h"
+#include "reader.h"
+#include "metrics.h"
+
+
+/** "fusgd-spool <read offset>\n" */
+#define SPOOL_HEADER_SIZE 32
+#define SPOOL_HEADER_FMT "fusgd-spool %019lu\n"
+#define SPOOL_BUFFER_SIZE (256 * 1024)
+/** pipe capacity requested between intake and processing */
+#define SPOOL_PIPE_SIZE (1024 * 1024)
+/** retry period while the spool is full */
+#define SPOOL_RETRY_MS 100
+
+
+/** spooled lines handed out in a row, i.e. consecutive in the assembler's input */
+typedef struct {
+	int valid;
+	/** spool offset of the first line */
+	uint64_t start;
+	/** input bytes (see assemble_offset()) before the first line */
+	uint64_t base;
+	/** spool offset after the last line handed out */
+	uint64_t end;
+} spool_run_t;
+
+
+/** guards the spool, which is written by the intake thread */
+static pthread_mutex_t spool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int spool_fd = -1;
+static reader_t spool_reader;
+static uint64_t spool_max = 0;
+/** end of data */
+static uint64_t write_off = 0;
+/** first byte not yet handed out */
+static uint64_t read_off = 0;
+/** read offset persisted last */
+static uint64_t checkpoint_off = 0;
+static int spool_full = 0;
+
+static spool_run_t cur;
+static spool_run_t prev;
+
+/** intake thread */
+static struct {
+	int running;
+	pthread_t thread;
+	/** input it reads */
+	int src;
+	reader_t in;
+	/** pipe to the work loop */
+	int out;
+	int pipe;
+	int pipe_size;
+	/** last write to the pipe ended within a line */
+	int midline;
+	int watermark;
+	/** wakes the thread to stop */
+	int wake[2];
+} intake = { .src = -1, .out = -1, .pipe = -1, .wake = { -1, -1 } };
+
+
+
+static int spool_header_write(uint64_t offset)
+{
+	char header[SPOOL_HEADER_SIZE + 1];
+	snprintf(header, sizeof(header), SPOOL_HEADER_FMT, offset);
+	if (SPOOL_HEADER_SIZE != pwrite(spool_fd, header, SPOOL_HEADER_SIZE, 0))
+	{
+		log_error("spool: can't write header: %s", strerror(errno));
+		return -1;
+	}
+	checkpoint_off = offset;
+	return 0;
+}
+
+
+/**
+ * Positions the reader at the read offset.
+ */
+static void spool_rewind(void)
+{
+	lseek(spool_reader.fd, read_off, SEEK_SET);
+	spool_reader.head = spool_reader.tail = 0;
+	spool_reader.eof = 0;
+}
+
+
+/**
+ * Everything is processed: start over.
+ */
+static void spool_reset(void)
+{
+	if (ftruncate(spool_fd, SPOOL_HEADER_SIZE))
+		log_warn("spool: can't truncate: %s", strerror(errno));
+	write_off = read_off = SPOOL_HEADER_SIZE;
+	cur.valid = prev.valid = 0;
+	spool_header_write(read_off);
+	spool_rewind();
+	if (spool_full) log_info("spool: caught up");
+	spool_full = 0;
+}
+
+
+/**
+ * @return spool offset up to which lines are processed completely,
+ *         i.e. stored with the events in flight
+ */
+static uint64_t spool_durable(void)
+{
+	// nothing handed out since open or reset
+	if (!cur.valid) return read_off;
+
+	uint64_t safe = assemble_offset();
+	const spool_run_t* run = NULL;
+	if (safe >= cur.base) run = &cur;
+	else if (prev.valid && safe >= prev.base) run = &prev;
+	// the oldest event in flight started before
+	if (!run) return checkpoint_off;
+
+	uint64_t end = run == &cur ? read_off : run->end;
+	uint64_t offset = run->start + (safe - run->base);
+	return offset < end ? offset : end;
+}
+
+
+int spool_open(const char* path, uint64_t max_bytes)
+{
+	spool_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	int rfd = open(path, O_RDONLY | O_CLOEXEC);
+	if (spool_fd == -1 || rfd == -1 || reader_init(&spool_reader, rfd, SPOOL_BUFFER_SIZE))
+	{
+		log_error("spool: can't open '%s': %s", path, strerror(errno));
+		if (rfd != -1) close(rfd);
+		if (spool_fd != -1) close(spool_fd);
+		spool_fd = -1;
+		return -1;
+	}
+	spool_max = max_bytes;
+	cur.valid = prev.valid = 0;
+
+	struct stat st;
+	memset(&st, 0, sizeof(st));
+	char header[SPOOL_HEADER_SIZE + 1] = "";
+	uint64_t offset = 0;
+	if (0 == fstat(spool_fd, &st)
+			&& st.st_size >= SPOOL_HEADER_SIZE
+			&& SPOOL_HEADER_SIZE == pread(spool_fd, header, SPOOL_HEADER_SIZE, 0)
+			&& 1 == sscanf(header, "fusgd-spool %lu", &offset)
+			&& offset >= SPOOL_HEADER_SIZE && offset <= (uint64_t)st.st_size)
+	{
+		write_off = st.st_size;
+		read_off = offset;
+		spool_header_write(read_off);
+		spool_rewind();
+		if (read_off < write_off)
+			log_info("spool: replaying %lu bytes of '%s'", write_off - read_off, path);
+	}
+	else
+	{
+		if (st.st_size) log_warn("spool: discarding '%s': no valid header", path);
+		spool_reset();
+	}
+	return 0;
+}
+
+
+void spool_close(void)
+{
+	if (spool_fd == -1) return;
+	if (intake.running) spool_intake_stop(NULL);
+
+	uint64_t durable = spool_durable();
+	if (durable == write_off) spool_reset();
+	else
+	{
+		spool_header_write(durable);
+		fdatasync(spool_fd);
+		log_info("spool: %lu bytes left for the next start", write_off - durable);
+	}
+	close(spool_reader.fd);
+	reader_destroy(&spool_reader);
+	close(spool_fd);
+	spool_fd = -1;
+}
+
+
+int spool_enabled(void)
+{
+	return spool_fd != -1;
+}
+
+
+int spool_active(void)
+{
+	pthread_mutex_lock(&spool_mutex);
+	int active = read_off < write_off;
+	pthread_mutex_unlock(&spool_mutex);
+	return active;
+}
+
+
+/**
+ * spool_write() with spool_mutex held.
+ */
+static int spool_append(const char* data, size_t len)
+{
+	if (write_off + len > spool_max)
+	{
+		if (!spool_full)
+		{
+			spool_full = 1;
+			log_warn("spool: full (%lu bytes), input backs up", write_off);
+		}
+		metrics_inc(METRIC_SPOOL_FULL);
+		return -1;
+	}
+
+	size_t written = 0;
+	while (written < len)
+	{
+		ssize_t n = pwrite(spool_fd, data + written, len - written, write_off + written);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0)
+		{
+			log_error("spool: write failed: %s", strerror(errno));
+			// drop the incomplete write
+			if (ftruncate(spool_fd, write_off))
+				log_warn("spool: can't truncate: %s", strerror(errno));
+			return -1;
+		}
+		written += n;
+	}
+	write_off += len;
+	metrics_add(METRIC_SPOOLED_BYTES, len);
+	return 0;
+}
+
+
+int spool_write(const char* data, size_t len)
+{
+	pthread_mutex_lock(&spool_mutex);
+	int rc = spool_append(data, len);
+	pthread_mutex_unlock(&spool_mutex);
+	return rc;
+}
+
+
+const char* spool_line(size_t* len)
+{
+	pthread_mutex_lock(&spool_mutex);
+	const char* line = NULL;
+	if (read_off < write_off)
+	{
+		line = reader_line(&spool_reader, len);
+		if (!line && read_off + reader_pending(&spool_reader) < write_off)
+		{
+			reader_fill(&spool_reader);
+			line = reader_line(&spool_reader, len);
+		}
+	}
+	if (line)
+	{
+		// other input went to the assembler since the last spooled line
+		uint64_t base = assemble_bytes();
+		if (!cur.valid || base != cur.base + (read_off - cur.start))
+		{
+			prev = cur;
+			prev.end = read_off;
+			cur.valid = 1;
+			cur.start = read_off;
+			cur.base = base;
+		}
+		read_off += *len;
+	}
+	pthread_mutex_unlock(&spool_mutex);
+	return line;
+}
+
+
+void spool_checkpoint(void)
+{
+	if (spool_fd == -1) return;
+
+	pthread_mutex_lock(&spool_mutex);
+	uint64_t durable = spool_durable();
+	if (durable == write_off && write_off > SPOOL_HEADER_SIZE) spool_reset();
+	else if (durable != checkpoint_off) spool_header_write(durable);
+	pthread_mutex_unlock(&spool_mutex);
+}
+
+
+uint64_t spool_pending(void)
+{
+	pthread_mutex_lock(&spool_mutex);
+	uint64_t pending = write_off - read_off;
+	pthread_mutex_unlock(&spool_mutex);
+	return pending;
+}
+
+
+/**
+ * Passes lines on: through the pipe, or into the spool while it is
+ * in use or the pipe backs up. The rest of a line partly written to
+ * the pipe follows through the pipe.
+ * @return bytes passed on (0: nothing takes them now), -1 on error
+ */
+static ssize_t intake_push(const char* data, size_t len)
+{
+	size_t room = len;
+	if (!intake.midline)
+	{
+		pthread_mutex_lock(&spool_mutex);
+		int spill = read_off < write_off;
+		if (!spill)
+		{
+			// one ioctl per chunk read, the capacity doesn't change
+			int pending = 0;
+			if (ioctl(intake.out, FIONREAD, &pending)) pending = 0;
+			int watermark = __atomic_load_n(&intake.watermark, __ATOMIC_RELAXED);
+			// an empty pipe wakes up nobody
+			spill = pending && (100L * pending) / intake.pipe_size >= watermark;
+			room = pending < intake.pipe_size ? (size_t)(intake.pipe_size - pending) : 0;
+		}
+		if (!spill && room < len)
+		{
+			// complete lines, which fit, or else a part of one
+			const char* nl = room ? memrchr(data, '\n', room) : NULL;
+			if (nl) room = nl - data + 1;
+		}
+		ssize_t n = spill ? (spool_append(data, len) ? 0 : (ssize_t)len) : -1;
+		pthread_mutex_unlock(&spool_mutex);
+		if (spill) return n;
+		// full pipe: retry later
+		if (!room) return 0;
+	}
+
+	ssize_t n;
+	do {
+		n = write(intake.out, data, room < len ? room : len);
+	} while (n == -1 && errno == EINTR);
+	if (n == -1 && errno == EAGAIN) return 0;
+	if (n <= 0)
+	{
+		log_error("spool: can't pass input on: %s", strerror(errno));
+		return -1;
+	}
+	intake.midline = data[n - 1] != '\n';
+	return n;
+}
+
+
+/** counters of the intake thread */
+static metrics_block_t intake_metrics;
+
+static void* intake_main(void* arg)
+{
+	(void)arg;
+	// signals are for the main thread
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+	metrics_thread(&intake_metrics);
+
+	for (;;)
+	{
+		size_t len;
+		const char* data = reader_lines(&intake.in, &len);
+		// the last line may lack its '\n'
+		if (!len && intake.in.eof) len = reader_pending(&intake.in);
+		if (len)
+		{
+			ssize_t n = intake_push(data, len);
+			if (n < 0) break;
+			reader_consume(&intake.in, n);
+			if (n) continue;
+		}
+		else if (intake.in.eof) break;
+
+		// wait for input, or for room in the pipe or the spool
+		struct pollfd fds[2] = {
+			{ .fd = intake.wake[0], .events = POLLIN },
+			{ .fd = len ? intake.out : intake.src, .events = len ? POLLOUT : POLLIN },
+		};
+		int nfds = !len || intake.midline ? 2 : 1;
+		if (-1 == poll(fds, nfds, len && !intake.midline ? SPOOL_RETRY_MS : -1) && errno != EINTR)
+		{
+			log_error("spool: poll: %s", strerror(errno));
+			break;
+		}
+		if (fds[0].revents) break;
+		if (!len && fds[1].revents && -1 == reader_fill(&intake.in))
+		{
+			log_error("spool: can't read input: %s", strerror(errno));
+			break;
+		}
+	}
+
+	// the work loop sees EOF
+	close(intake.out);
+	intake.out = -1;
+	return NULL;
+}
+
+
+int spool_intake_start(int fd, int watermark)
+{
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC))
+	{
+		log_error("spool: pipe: %s", strerror(errno));
+		return -1;
+	}
+	if (pipe2(intake.wake, O_CLOEXEC) || reader_init(&intake.in, fd, SPOOL_BUFFER_SIZE))
+	{
+		log_error("spool: can't start intake: %s", strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		if (intake.wake[0] != -1) close(intake.wake[0]);
+		if (intake.wake[1] != -1) close(intake.wake[1]);
+		intake.wake[0] = intake.wake[1] = -1;
+		return -1;
+	}
+	// room for bursts, before the spool takes over
+	fcntl(fds[1], F_SETPIPE_SZ, SPOOL_PIPE_SIZE);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	intake.pipe_size = fcntl(fds[1], F_GETPIPE_SZ);
+	if (intake.pipe_size <= 0) intake.pipe_size = 65536;
+	intake.src = fd;
+	intake.pipe = fds[0];
+	intake.out = fds[1];
+	intake.midline = 0;
+	intake.watermark = watermark;
+
+	if (pthread_create(&intake.thread, NULL, intake_main, NULL))
+	{
+		log_error("spool: can't start intake thread");
+		reader_destroy(&intake.in);
+		close(fds[0]);
+		close(fds[1]);
+		close(intake.wake[0]);
+		close(intake.wake[1]);
+		intake.wake[0] = intake.wake[1] = -1;
+		intake.out = -1;
+		return -1;
+	}
+	intake.running = 1;
+	return fds[0];
+}
+
+
+void spool_watermark(int watermark)
+{
+	__atomic_store_n(&intake.watermark, watermark, __ATOMIC_RELAXED);
+}
+
+
+int spool_intake_stop(reader_t* input)
+{
+	if (!intake.running) return input ? input->fd : -1;
+
+	if (1 != write(intake.wake[1], "", 1)) log_warn("spool: can't wake intake: %s", strerror(errno));
+	pthread_join(intake.thread, NULL);
+	intake.running = 0;
+	close(intake.wake[0]);
+	close(intake.wake[1]);
+	intake.wake[0] = intake.wake[1] = -1;
+
+	// in order: buffered by the work loop, left in the pipe, buffered by intake;
+	// a line split among them is put together again
+	reader_t pipe;
+	if (!input && 0 == reader_init(&pipe, intake.pipe, SPOOL_BUFFER_SIZE)) input = &pipe;
+	if (input)
+	{
+		for (;;)
+		{
+			size_t len = reader_pending(input);
+			if (len && spool_write(input->buf + input->head, len)) break;
+			reader_consume(input, len);
+			if (input->eof || reader_fill(input) <= 0) break;
+		}
+		reader_reset(input, intake.src);
+		if (input == &pipe) reader_destroy(&pipe);
+	}
+	close(intake.pipe);
+	intake.pipe = -1;
+	size_t len = reader_pending(&intake.in);
+	if (len) spool_write(intake.in.buf + intake.in.head, len);
+	reader_destroy(&intake.in);
+	return intake.src;
+}
@@ -0,0 +1,104 @@
+/*
+ * spool.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef SPOOL_H_
+#define SPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "reader.h"
+
+
+/*
+ * Spill-to-disk spool.
+ *
+ * If the db is slow, fusgd stops reading its input and audispd's
+ * queue fills up, which stalls or drops audit events system-wide.
+ * Hence, an intake thread reads the input and passes it on through
+ * a pipe. Once that pipe is filled beyond fusgd_spool_watermark
+ * percent, it moves everything it reads into the spool file, which
+ * is written sequentially, and the work loop processes the spool in
+ * order until it caught up. A db flush stalling the work loop
+ * doesn't stall the intake.
+ *
+ * The spool file starts with a header holding the offset of the
+ * first byte not yet stored, i.e. before the events in flight. It
+ * is updated on each db flush and on shutdown, so a restarted fusgd
+ * replays what is left.
+ */
+
+
+/**
+ * Opens the spool. Unprocessed content of a previous run is replayed.
+ * @param max_bytes size cap of the spool file
+ * @return 0 on success, -1 otherwise
+ */
+int spool_open(const char* path, uint64_t max_bytes);
+
+/**
+ * Stops the intake, persists the read offset and closes the spool.
+ * An empty spool is truncated.
+ */
+void spool_close(void);
+
+/**
+ * @return 1 if the spool is open
+ */
+int spool_enabled(void);
+
+/**
+ * @return 1 if the spool has data, which has to be processed before any new input
+ */
+int spool_active(void);
+
+/**
+ * Appends raw input. Thread safe, like all of the spool.
+ * @return 0 on success, -1 if the spool is full or on error (nothing written)
+ */
+int spool_write(const char* data, size_t len);
+
+/**
+ * Hands out the next line of the spool, to be passed to assemble_record().
+ * @return line (not terminated) or NULL if the spool is empty
+ */
+const char* spool_line(size_t* len);
+
+/**
+ * Persists the offset of lines processed completely, after they
+ * became durable. Once all lines are, the spool is reset.
+ */
+void spool_checkpoint(void);
+
+/**
+ * @return bytes in the spool not yet processed
+ */
+uint64_t spool_pending(void);
+
+/**
+ * Starts the intake thread on fd.
+ * @param watermark fill level of the pipe [%], which starts spooling
+ * @return read end of the pipe, which passes input on, or -1 on error
+ */
+int spool_intake_start(int fd, int watermark);
+
+/**
+ * Changes the watermark of the intake.
+ */
+void spool_watermark(int watermark);
+
+/**
+ * Stops the intake thread and spools the input read so far,
+ * i.e. the rest in input, in the pipe and in the thread's buffer.
+ * Closes the pipe, input is reset to the original fd.
+ * @param input reads the pipe, may be NULL
+ * @return the fd passed to spool_intake_start()
+ */
+int spool_intake_stop(reader_t* input);
+
+
+#endif /* SPOOL_H_ */
@@ -7,10 +7,13 @@
 #include "../../../sources/fusgd/src/store.h"
 
 #include <unistd.h>
+#include <stdlib.h>
 #include <syscall.h>
+#include <sys/sysmacros.h>
 #include <assert.h>
 #include <stdarg.h>
 #include <string.h>
+#include <time.h>
 #include <libaudit.h>
 
 #include "../../../sources/fusgd/src/fusgd.h"
@@ -18,6 +21,12 @@
 #include "../../fusg-common/include/fusg/logging.h"
 #include "../../fusg-common/include/fusg/utils.h"
 
+#include "service.h"
+#include "metrics.h"
+#include "trace.h"
+#include "degrade.h"
+#include "procs.h"
+
 
 
 
@@ -25,6 +34,8 @@
 typedef struct {
 	const char* executable;
 	const char* filepath;
+	/** identity of filepath (0/0: unknown) */
+	fusg_inode_t inode;
 	file_usage_t flags;
 	uint64_t timestamp;
 
@@ -35,11 +46,25 @@ typedef struct {
 	int syscall_number; 			// syscall number
 	int syscall_success; 		// whether syscall was successful
 	const char* cwd;	// current wd of executable
+	pid_t pid;
 
+	procsref_t procs;	// process cache or NULL
+	int cached;			// values taken from procs
+	int missed;			// values looked up in procs, but interpreted
 
 } fusg_event_t;
 
 
+/** process cache of store_event() */
+static procsref_t procs = NULL;
+
+
+static int is_exit(int syscall_number)
+{
+	return syscall_number == __NR_exit_group || syscall_number == __NR_exit;
+}
+
+
 int event_valid(fusg_event_t* fusg)
 {
 	return (   fusg->executable
@@ -51,6 +76,10 @@ int event_valid(fusg_event_t* fusg)
 
 void store_error(fusg_event_t* fusg, const char* fmt, ...)
 {
+	// may fire for each event of a burst: no formatting, if suppressed
+	static log_limit_t limit;
+	if (!log_limit_take(&limit, LL_ERROR, "store: %lu, %s")) return;
+
 	va_list ap;
 	const size_t size = PATH_MAX*2;
 	char msg[size];
@@ -59,7 +88,7 @@ void store_error(fusg_event_t* fusg, const char* fmt, ...)
 	vsnprintf(msg, size, fmt, ap);
     va_end(ap);
 
-	log_error("store: %lu, %s", fusg->serial, msg);
+	log_limit_log(&limit, LL_ERROR, "store: %lu, %s", fusg->serial, msg);
 }
 
 
@@ -77,6 +106,25 @@ int check_field_value(fusg_event_t* fusg, auparse_state_t *au, const char* expec
 
 
 
+/**
+ * Interprets the exe field, unless the process cache knows it.
+ */
+static const char* parse_exe(fusg_event_t* fusg, auparse_state_t *au)
+{
+	const char* raw = fusg->procs && fusg->pid ? auparse_get_field_str(au) : NULL;
+	const char* exe = raw ? procs_exe(fusg->procs, fusg->pid, raw) : NULL;
+	if (exe)
+	{
+		fusg->cached++;
+		return exe;
+	}
+	fusg->missed += (raw != NULL);
+	// NOTE: auparse tries realpath(path) but returns original in case of errno!=0
+	exe = auparse_interpret_field(au);
+	if (raw && exe) procs_set_exe(fusg->procs, fusg->pid, raw, exe);
+	return exe;
+}
+
 int parse_syscall(fusg_event_t* fusg, auparse_state_t *au)
 {
 	int rc = 0;
@@ -86,7 +134,7 @@ int parse_syscall(fusg_event_t* fusg, auparse_state_t *au)
 
 	if (!auparse_first_field(au))
 	{
-		log_error("missing first field");
+		log_limited(LL_ERROR, "missing first field");
 		return ERR_AUPARSE;
 	}
 
@@ -123,11 +171,13 @@ int parse_syscall(fusg_event_t* fusg, auparse_state_t *au)
 				return ERR_AUPARSE;
 			}
 		}
+		else if (!strcmp(name, "pid"))
+		{
+			fusg->pid = auparse_get_field_int(au);
+		}
 		else if (!strcmp(name, "exe"))
 		{
-			// NOTE: auparse tries realpath(path) but returns original in case of errno!=0
-			value = auparse_interpret_field(au);
-			fusg->executable = value;
+			fusg->executable = parse_exe(fusg, au);
 		}
 		else
 		{
@@ -139,6 +189,25 @@ int parse_syscall(fusg_event_t* fusg, auparse_state_t *au)
 }
 
 
+/**
+ * Interprets the cwd field, unless the process cache knows it.
+ */
+static const char* parse_cwd_value(fusg_event_t* fusg, auparse_state_t *au)
+{
+	const char* raw = fusg->procs && fusg->pid ? auparse_get_field_str(au) : NULL;
+	const char* cwd = raw ? procs_cwd(fusg->procs, fusg->pid, raw) : NULL;
+	if (cwd)
+	{
+		fusg->cached++;
+		return cwd;
+	}
+	fusg->missed += (raw != NULL);
+	// NOTE: auparse tries realpath(path) but returns original in case of errno!=0
+	cwd = auparse_interpret_field(au);
+	if (raw && cwd) procs_set_cwd(fusg->procs, fusg->pid, raw, cwd);
+	return cwd;
+}
+
 int parse_cwd(fusg_event_t* fusg, auparse_state_t *au)
 {
 	int rc = 0;
@@ -147,7 +216,7 @@ int parse_cwd(fusg_event_t* fusg, auparse_state_t *au)
 
 	if (!auparse_first_field(au))
 	{
-		log_error("missing first field");
+		log_limited(LL_ERROR, "missing first field");
 		return ERR_AUPARSE;
 	}
 
@@ -165,8 +234,7 @@ int parse_cwd(fusg_event_t* fusg, auparse_state_t *au)
 #endif // NDEBUG
 		if (!strcmp(name, "cwd"))
 		{
-			// NOTE: auparse tries realpath(path) but returns original in case of errno!=0
-			fusg->cwd = auparse_interpret_field(au);
+			fusg->cwd = parse_cwd_value(fusg, au);
 			break;
 		}
 	} while (auparse_next_field(au) > 0);
@@ -184,7 +252,7 @@ int parse_path(fusg_event_t* fusg, auparse_state_t *au)
 
 	if (!auparse_first_field(au))
 	{
-		log_error("missing first field");
+		log_limited(LL_ERROR, "missing first field");
 		return ERR_AUPARSE;
 	}
 
@@ -207,6 +275,19 @@ int parse_path(fusg_event_t* fusg, auparse_state_t *au)
 			// NOTE: auparse tries realpath(path) but returns original in case of errno!=0
 			fusg->filepath = auparse_interpret_field(au);
 		}
+		else if (!strcmp(name, "inode"))
+		{
+			value = auparse_get_field_str(au);
+			if (value) fusg->inode.ino = strtoull(value, NULL, 10);
+		}
+		else if (!strcmp(name, "dev"))
+		{
+			// major:minor in hex
+			value = auparse_get_field_str(au);
+			char* end;
+			unsigned long major = value ? strtoul(value, &end, 16) : 0;
+			if (value && *end == ':') fusg->inode.dev = makedev(major, strtoul(end + 1, NULL, 16));
+		}
 		else if (!strcmp(name, "nametype"))
 		{
 			value = auparse_interpret_field(au);
@@ -248,22 +329,20 @@ int parse_path(fusg_event_t* fusg, auparse_state_t *au)
 }
 
 
-int store_event(auparse_state_t *au)
+int store_parse(auparse_state_t *au, procsref_t procs, store_visitor_t visitor, void* ctx, store_parsed_t* parsed)
 {
 	int rc = 0;
-	int stored = 0; // true if anything of this event was stored
-
-	dbref_t db = global.db;
-	assert(db);
 
+	memset(parsed, 0, sizeof(store_parsed_t));
 	fusg_event_t fusg;
 	memset(&fusg, 0, sizeof(fusg_event_t));
+	fusg.procs = procs;
 
 
 	const au_event_t* e = auparse_get_timestamp(au);
 	if (!e)
 	{
-		log_warn("corrupted event: no timestamp found.");
+		log_limited(LL_WARN, "corrupted event: no timestamp found.");
 		return ERR_AUPARSE;
 	}
 	fusg.serial = e->serial;
@@ -281,9 +360,10 @@ int store_event(auparse_state_t *au)
 	// then discard it. (either corrupted or not interesting)
 	int record_type = auparse_get_type(au);
 	if (record_type != AUDIT_SYSCALL)
+	{
+		parsed->no_syscall = 1;
 		return 0;
-
-	int skip = 0;
+	}
 
 	char filepathbuf[PATH_MAX];
 	do /* iterate over all records of the event */
@@ -296,14 +376,16 @@ int store_event(auparse_state_t *au)
 			rc = parse_syscall(&fusg, au);
 			if (!fusg.syscall_success)
 			{
-				skip = 1;
+				parsed->failed_syscall = 1;
 			}
 			break;
 		case AUDIT_CWD:
 			rc = parse_cwd(&fusg, au);
+			parsed->has_cwd = 1;
 			break;
 		case AUDIT_PATH:
 			rc = parse_path(&fusg, au);
+			parsed->has_path = 1;
 			if (!rc)
 			{
 
@@ -311,28 +393,146 @@ int store_event(auparse_state_t *au)
 				fusg.filepath = fabsolute(fusg.cwd, fusg.filepath, filepathbuf);
 				if (event_valid(&fusg))
 				{
-					rc = db_update(
-							global.db,
-							fusg.executable,
-							fusg.filepath,
-							fusg.flags,
-							fusg.timestamp);
-					stored = 1;
+					rc = visitor(ctx, fusg.executable, fusg.filepath,
+							fusg.inode.ino ? &fusg.inode : NULL, fusg.flags, fusg.timestamp);
+					parsed->visited++;
 				}
 				else
 				{
-					log_warn("incomplete or corrupted audit event (serial: %lu)", e->serial);
+					log_limited(LL_WARN, "incomplete or corrupted audit event (serial: %lu)", e->serial);
+					parsed->incomplete++;
 				}
 				// reset variable entries
 				fusg.filepath = 0;
+				memset(&fusg.inode, 0, sizeof(fusg.inode));
 				fusg.flags = 0;
 			}
 			break;
 		}
 
-	} while (!rc && !skip && auparse_next_record(au) > 0);
+	} while (!rc && !parsed->failed_syscall && auparse_next_record(au) > 0);
+
+	parsed->cached = fusg.cached;
+	parsed->missed = fusg.missed;
+	if (procs && is_exit(fusg.syscall_number)) procs_exit(procs, fusg.pid);
+	return rc;
+}
+
+
+/**
+ * Stores a file usage in the db and publishes the result.
+ */
+static int store_update(void* ctx, const char* executable, const char* filepath, const fusg_inode_t* inode,
+		file_usage_t flags, uint64_t timestamp)
+{
+	char dirbuf[PATH_MAX];
+	if (degrade_level() >= DEGRADE_COALESCE)
+	{
+		// overload: directories instead of files
+		filepath = degrade_coalesce(filepath, dirbuf);
+		inode = NULL;
+		metrics_inc(METRIC_DEGRADED_COALESCED);
+	}
+
+	if (degrade_level() >= DEGRADE_SAMPLE
+			&& degrade_sample(executable, filepath, timestamp))
+	{
+		// overload: this pair was stored in this second already
+		metrics_inc(METRIC_DEGRADED_SAMPLED);
+		return 0;
+	}
+
+	fusg_stats_key_t key;
+	fusg_stats_t stats;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int rc = db_update_r(
+			global.db,
+			executable,
+			filepath,
+			inode,
+			flags,
+			timestamp,
+			&key, &stats);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	metrics_observe(METRIC_DB_UPDATE_SECONDS,
+			(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+	metrics_inc(rc ? METRIC_DB_ERRORS : METRIC_DB_UPDATES);
+	if (!rc && service_fd() != -1)
+	{
+		// keep query service up to date
+		service_update(&key, executable, filepath, &stats);
+	}
+	if (!rc && global.live)
+	{
+		live_update(global.live, &key, executable, filepath, &stats);
+	}
+	*(int*)ctx = 1;
+	return rc;
+}
+
+
+int store_usage(const char* executable, const char* filepath, file_usage_t flags, uint64_t timestamp)
+{
+	int stored = 0;
 
-	if (!rc && stored) global.events_stored++;
+	assert(global.db);
+
+	// fanotify doesn't report inodes
+	int rc = store_update(&stored, executable, filepath, NULL, flags, timestamp);
+	if (!rc && stored)
+	{
+		global.events_stored++;
+		metrics_inc(METRIC_EVENTS_STORED);
+	}
+	return rc;
+}
+
+
+void store_close(void)
+{
+	procs_destroy(procs);
+	procs = NULL;
+}
+
+
+int store_event(auparse_state_t *au)
+{
+	int stored = 0; // true if anything of this event was stored
+
+	assert(global.db);
+
+	if (!procs) procs = procs_create(PROCS_SLOTS);
+
+	store_parsed_t parsed;
+	int rc = store_parse(au, procs, store_update, &stored, &parsed);
+	if (db_end_event(global.db)) metrics_inc(METRIC_DB_ERRORS);
+	metrics_add(METRIC_PROCS_CACHED, parsed.cached);
+	metrics_add(METRIC_PROCS_MISSED, parsed.missed);
+
+	if (parsed.no_syscall) metrics_inc(METRIC_SKIPPED_NO_SYSCALL);
+	if (parsed.failed_syscall) metrics_inc(METRIC_SKIPPED_FAILED_SYSCALL);
+	metrics_add(METRIC_SKIPPED_INCOMPLETE, parsed.incomplete);
+
+	if (!rc && !parsed.no_syscall && !parsed.failed_syscall && (!parsed.has_cwd || !parsed.has_path))
+	{
+		// auditd lost records of an otherwise successful syscall
+		const au_event_t* e = auparse_get_timestamp(au);
+		if (!parsed.has_cwd) metrics_inc(METRIC_MISSING_CWD);
+		if (!parsed.has_path) metrics_inc(METRIC_MISSING_PATH);
+		trace_note("event %lu: missing%s%s record", e ? e->serial : 0,
+				parsed.has_cwd ? "" : " CWD", parsed.has_path ? "" : " PATH");
+	}
+
+	if (!rc && stored)
+	{
+		global.events_stored++;
+		metrics_inc(METRIC_EVENTS_STORED);
+	}
+	else if (rc == ERR_AUPARSE)
+	{
+		metrics_inc(METRIC_PARSE_ERRORS);
+	}
 
 	return rc;
 }
@@ -8,9 +8,62 @@
 #ifndef STORE_H_
 #define STORE_H_
 
+#include <stdint.h>
 #include <auparse.h>
 
+#include "../../fusg-common/include/fusg/db.h"
+#include "procs.h"
+
+
+typedef struct {
+	/** first record is no SYSCALL record */
+	int no_syscall;
+	int failed_syscall;
+	int has_cwd;
+	int has_path;
+	/** PATH records missing executable, file or flags */
+	int incomplete;
+	/** files handed to the visitor */
+	int visited;
+	/** executables and cwds taken from the process cache */
+	int cached;
+	/** executables and cwds not found in the process cache */
+	int missed;
+} store_parsed_t;
+
+/**
+ * Receives a file usage of an event.
+ * @return 0 to go on, anything else stops parsing and is returned
+ */
+typedef int (*store_visitor_t)(void* ctx, const char* executable, const char* filepath,
+		const fusg_inode_t* inode, file_usage_t flags, uint64_t timestamp);
+
+/**
+ * Parses an event and hands each file usage to the visitor.
+ * Doesn't touch any global state, hence it can run in
+ * parallel on separate auparse states (and process caches).
+ * @param procs process cache (see procs.h) or NULL
+ * @param parsed receives what was found
+ * @return 0 on success, ERR_AUPARSE or a visitor's result otherwise
+ */
+int store_parse(auparse_state_t *au, procsref_t procs, store_visitor_t visitor, void* ctx, store_parsed_t* parsed);
+
+/**
+ * Parses an event and stores its file usages in the db.
+ */
 int store_event(auparse_state_t *au);
 
+/**
+ * Releases the process cache of store_event().
+ */
+void store_close(void);
+
+
+/**
+ * Stores a single file usage, which isn't parsed from an audit
+ * event (see fan.h), in the db.
+ */
+int store_usage(const char* executable, const char* filepath, file_usage_t flags, uint64_t timestamp);
+
 
 #endif /* STORE_H_ */
@@ -0,0 +1,556 @@
+/*
+ * tail.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#define _GNU_SOURCE
+#include "tail.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "../../fusg-common/include/fusg/logging.h"
+
+#include "fusgd.h"
+#include "assemble.h"
+#include "metrics.h"
+
+
+#define TAIL_STATE_MAGIC "fusgd-tail2"
+/** rotated files <path>.1 .. <path>.<n> searched on resume */
+#define TAIL_ROTATED_MAX 9
+
+
+/** a log file and where its content starts in the input */
+typedef struct {
+	int valid;
+	dev_t dev;
+	ino_t ino;
+	/** file offset where reading started */
+	uint64_t start;
+	/** input bytes (see assemble_offset()) before start */
+	uint64_t base;
+	/** time stamp of its first record, tells reused inodes apart (0: empty) */
+	uint64_t first_ms;
+	uint64_t first_serial;
+	/** events starting before this offset were read by the previous run */
+	uint64_t skip_end;
+} tail_file_t;
+
+
+static char log_path[PATH_MAX];
+static char state_path[PATH_MAX];
+static int log_fd = -1;
+static int notify_fd = -1;
+
+static tail_file_t cur;
+static tail_file_t prev;
+
+/** state of the previous run, to skip what it stored */
+static struct {
+	/** files up to end are still to be opened */
+	int active;
+	tail_file_t file;
+	uint64_t offset;
+	/** file and offset up to which it read */
+	tail_file_t end;
+	uint64_t end_offset;
+	uint64_t* inflight;
+	size_t num_inflight;
+} resume;
+
+/** state persisted last */
+static struct {
+	ino_t ino;
+	uint64_t offset;
+	ino_t end_ino;
+	uint64_t end_offset;
+} persisted;
+
+static uint64_t* serials = NULL;
+static size_t max_serials = 0;
+
+
+
+static int parse_number(const char** p, const char* end, uint64_t* value)
+{
+	const char* start = *p;
+	*value = 0;
+	for (; *p < end && **p >= '0' && **p <= '9'; (*p)++) *value = *value * 10 + (**p - '0');
+	return *p == start ? -1 : 0;
+}
+
+/**
+ * Parses "msg=audit(<sec>.<milli>:<serial>)" of the first record.
+ * @return 0 on success, -1 otherwise
+ */
+static int parse_stamp(const char* records, size_t len, uint64_t* time_ms, uint64_t* serial)
+{
+	const char* nl = memchr(records, '\n', len);
+	const char* end = nl ? nl : records + len;
+	const char* p = memmem(records, end - records, "audit(", 6);
+	if (!p) return -1;
+	p += 6;
+	uint64_t sec, milli;
+	if (parse_number(&p, end, &sec) || p == end || *p++ != '.'
+			|| parse_number(&p, end, &milli) || p == end || *p++ != ':'
+			|| parse_number(&p, end, serial))
+	{
+		return -1;
+	}
+	*time_ms = sec * 1000 + milli;
+	return 0;
+}
+
+/**
+ * Reads the time stamp of the first record of a file, if it has one.
+ */
+static void first_stamp(int fd, tail_file_t* f)
+{
+	char buf[512];
+	ssize_t n = pread(fd, buf, sizeof(buf), 0);
+	if (n <= 0 || parse_stamp(buf, n, &f->first_ms, &f->first_serial))
+	{
+		f->first_ms = f->first_serial = 0;
+	}
+}
+
+
+static void rotated_path(int n, char* buffer, size_t size)
+{
+	if (n) snprintf(buffer, size, "%s.%d", log_path, n);
+	else snprintf(buffer, size, "%s", log_path);
+}
+
+
+/**
+ * Opens a file as cur, following the previous one.
+ * @return 0 on success, -1 otherwise
+ */
+static int open_file(const char* path, uint64_t offset, uint64_t base)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st))
+	{
+		if (fd != -1) close(fd);
+		return -1;
+	}
+	if (offset && lseek(fd, offset, SEEK_SET) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if (log_fd != -1)
+	{
+		// was empty when opened
+		if (!cur.first_ms) first_stamp(log_fd, &cur);
+		close(log_fd);
+	}
+	log_fd = fd;
+	global.fd = fd;
+	prev = cur;
+	cur.valid = 1;
+	cur.dev = st.st_dev;
+	cur.ino = st.st_ino;
+	cur.start = offset;
+	cur.base = base;
+	first_stamp(fd, &cur);
+
+	// files before the one the previous run read last were read completely
+	cur.skip_end = 0;
+	if (resume.active)
+	{
+		cur.skip_end = UINT64_MAX;
+		if (cur.dev == resume.end.dev && cur.ino == resume.end.ino)
+		{
+			cur.skip_end = resume.end_offset;
+			resume.active = 0;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * @return 1 if offset is at the start of a line of the file
+ */
+static int line_start(const char* path, uint64_t offset)
+{
+	if (!offset) return 1;
+	char c = 0;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return 0;
+	ssize_t n = pread(fd, &c, 1, offset - 1);
+	close(fd);
+	return n == 1 && c == '\n';
+}
+
+
+static void load_state(void)
+{
+	FILE* f = fopen(state_path, "r");
+	if (!f) return;
+
+	unsigned long dev, ino, end_dev, end_ino;
+	size_t n;
+	if (11 != fscanf(f, TAIL_STATE_MAGIC " %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %zu", &dev, &ino,
+			&resume.file.first_ms, &resume.file.first_serial, &resume.offset,
+			&end_dev, &end_ino, &resume.end.first_ms, &resume.end.first_serial,
+			&resume.end_offset, &n)
+			|| n > (size_t)global.conf.fusgd_inflight_max)
+	{
+		log_warn("tail: ignoring corrupt state '%s'", state_path);
+		fclose(f);
+		return;
+	}
+	resume.inflight = calloc(n + 1, sizeof(uint64_t));
+	for (resume.num_inflight = 0; resume.inflight && resume.num_inflight < n; resume.num_inflight++)
+	{
+		if (1 != fscanf(f, " %lu", &resume.inflight[resume.num_inflight])) break;
+	}
+	fclose(f);
+
+	resume.file.valid = 1;
+	resume.file.dev = dev;
+	resume.file.ino = ino;
+	resume.end.valid = 1;
+	resume.end.dev = end_dev;
+	resume.end.ino = end_ino;
+	persisted.ino = ino;
+	persisted.offset = resume.offset;
+	persisted.end_ino = end_ino;
+	persisted.end_offset = resume.end_offset;
+}
+
+
+/**
+ * @return 1 if path is the file of the previous run given by file
+ */
+static int same_file(const char* path, const tail_file_t* file)
+{
+	struct stat st;
+	tail_file_t f;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return 0;
+	int same = !fstat(fd, &st) && st.st_dev == file->dev && st.st_ino == file->ino;
+	if (same && file->first_ms)
+	{
+		// inode may have been reused
+		first_stamp(fd, &f);
+		same = f.first_ms == file->first_ms && f.first_serial == file->first_serial;
+	}
+	close(fd);
+	return same;
+}
+
+
+int tail_open(const char* path, const char* state)
+{
+	snprintf(log_path, sizeof(log_path), "%s", path);
+	snprintf(state_path, sizeof(state_path), "%s", state);
+	memset(&cur, 0, sizeof(cur));
+	memset(&prev, 0, sizeof(prev));
+	memset(&resume, 0, sizeof(resume));
+
+	max_serials = global.conf.fusgd_inflight_max;
+	serials = calloc(max_serials, sizeof(uint64_t));
+	if (!serials)
+	{
+		log_error("tail: out of memory");
+		return -1;
+	}
+
+	//
+	// find the file and offset to resume at
+	//
+	load_state();
+
+	char file[PATH_MAX + 16];
+	int found = -1;
+	uint64_t offset = 0;
+	for (int n = 0; resume.file.valid && n <= TAIL_ROTATED_MAX; n++)
+	{
+		rotated_path(n, file, sizeof(file));
+		if (found == -1 && same_file(file, &resume.file)) found = n;
+		if (!resume.active && same_file(file, &resume.end)) resume.active = 1;
+	}
+	if (resume.file.valid && !resume.active)
+	{
+		log_warn("tail: file read last by the previous run is gone, events may be stored twice");
+	}
+	if (found != -1)
+	{
+		offset = resume.offset;
+		rotated_path(found, file, sizeof(file));
+		struct stat st;
+		if (offset && (stat(file, &st) || (uint64_t)st.st_size < offset || !line_start(file, offset)))
+		{
+			log_warn("tail: '%s' changed since the previous run, reading from its start", file);
+			offset = 0;
+			// offsets of the previous run don't apply
+			resume.active = 0;
+		}
+	}
+	else if (resume.file.valid)
+	{
+		// read all there is, events stored before are skipped
+		log_warn("tail: file of the previous run is gone, reading the oldest rotated file");
+		found = 0;
+		for (int n = TAIL_ROTATED_MAX; n > 0 && !found; n--)
+		{
+			rotated_path(n, file, sizeof(file));
+			if (!access(file, R_OK)) found = n;
+		}
+	}
+	else found = 0;
+	rotated_path(found, file, sizeof(file));
+
+	if (open_file(file, offset, 0))
+	{
+		log_error("tail: can't open '%s': %s", file, strerror(errno));
+		return -1;
+	}
+	prev.valid = 0;
+	log_info("tail: reading '%s' from offset %lu", file, offset);
+
+	//
+	// get woken up on changes in the log's directory
+	//
+	char dir[PATH_MAX];
+	snprintf(dir, sizeof(dir), "%s", log_path);
+	notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (notify_fd == -1 || -1 == inotify_add_watch(notify_fd, dirname(dir),
+			IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE))
+	{
+		// still polled once per flush period
+		log_warn("tail: inotify: %s", strerror(errno));
+		if (notify_fd != -1) close(notify_fd);
+		notify_fd = -1;
+	}
+	return log_fd;
+}
+
+
+void tail_close(void)
+{
+	if (log_fd != -1) close(log_fd);
+	if (notify_fd != -1) close(notify_fd);
+	log_fd = notify_fd = -1;
+	cur.valid = 0;
+	free(resume.inflight);
+	free(serials);
+	resume.inflight = serials = NULL;
+}
+
+
+int tail_enabled(void)
+{
+	return cur.valid;
+}
+
+
+int tail_fd(void)
+{
+	return notify_fd;
+}
+
+
+void tail_drain(void)
+{
+	char buf[4096];
+	while (notify_fd != -1 && read(notify_fd, buf, sizeof(buf)) > 0);
+}
+
+
+/**
+ * @return index of the file rotated after cur (0: <path>) or -1 if none
+ */
+static int next_index(void)
+{
+	char file[PATH_MAX + 16];
+	struct stat st;
+	// cur may have been rotated further meanwhile
+	for (int n = 1; n <= TAIL_ROTATED_MAX; n++)
+	{
+		rotated_path(n, file, sizeof(file));
+		if (!stat(file, &st) && st.st_dev == cur.dev && st.st_ino == cur.ino) return n - 1;
+	}
+
+	// cur is gone: the oldest file started after it
+	if (!cur.first_ms) first_stamp(log_fd, &cur);
+	for (int n = TAIL_ROTATED_MAX; n >= 0; n--)
+	{
+		tail_file_t f;
+		rotated_path(n, file, sizeof(file));
+		int fd = open(file, O_RDONLY | O_CLOEXEC);
+		if (fd == -1) continue;
+		first_stamp(fd, &f);
+		close(fd);
+		if (f.first_ms > cur.first_ms || (f.first_ms == cur.first_ms && f.first_serial > cur.first_serial))
+		{
+			log_warn("tail: file read is gone, continuing with '%s'", file);
+			return n;
+		}
+	}
+	return -1;
+}
+
+
+/**
+ * Switches to the file after cur.
+ */
+static int next_file(reader_t* input, uint64_t pos)
+{
+	char file[PATH_MAX + 16];
+	int n = next_index();
+	if (n == -1) return 0;
+	rotated_path(n, file, sizeof(file));
+
+	size_t dropped = reader_pending(input);
+	if (dropped) log_warn("tail: dropping incomplete last line of rotated file");
+	uint64_t base = cur.base + (pos - cur.start) - dropped;
+
+	if (open_file(file, 0, base))
+	{
+		// e.g. not created yet
+		return 0;
+	}
+	reader_reset(input, log_fd);
+	log_info("tail: rotated file done, reading '%s'", file);
+	return 1;
+}
+
+
+int tail_follow(reader_t* input)
+{
+	if (!cur.valid) return 0;
+
+	struct stat path_st, fd_st;
+	int path_ok = !stat(log_path, &path_st);
+	off_t pos = lseek(log_fd, 0, SEEK_CUR);
+	if (pos == -1 || fstat(log_fd, &fd_st)) return 0;
+
+	if (fd_st.st_size > pos)
+	{
+		input->eof = 0;
+		return 1;
+	}
+	if (fd_st.st_size < pos)
+	{
+		log_warn("tail: '%s' was truncated, reading from its start", log_path);
+		metrics_inc(METRIC_TAIL_TRUNCATIONS);
+		size_t dropped = reader_pending(input);
+		uint64_t base = cur.base + (pos - cur.start) - dropped;
+		lseek(log_fd, 0, SEEK_SET);
+		cur.start = 0;
+		cur.base = base;
+		cur.skip_end = 0;
+		prev.valid = 0;
+		reader_reset(input, log_fd);
+		return 1;
+	}
+	// a rotated file is complete, also if fusgd resumed in it
+	if (path_ok && (path_st.st_ino != cur.ino || path_st.st_dev != cur.dev))
+	{
+		if (!next_file(input, pos)) return 0;
+		metrics_inc(METRIC_TAIL_ROTATIONS);
+		return 1;
+	}
+	return 0;
+}
+
+
+void tail_checkpoint(void)
+{
+	if (!cur.valid || !state_path[0]) return;
+
+	uint64_t safe = assemble_offset();
+	const tail_file_t* f = NULL;
+	if (safe >= cur.base) f = &cur;
+	else if (prev.valid && safe >= prev.base) f = &prev;
+	// oldest event in flight is in a file we lost track of
+	if (!f) return;
+	uint64_t offset = f->start + (safe - f->base);
+	if (f == &cur && !cur.first_ms) first_stamp(log_fd, &cur);
+
+	if (assemble_inflight() > max_serials)
+	{
+		// fusgd_inflight_max grew on reload
+		uint64_t* more = realloc(serials, assemble_inflight() * sizeof(uint64_t));
+		if (!more)
+		{
+			log_warn("tail: out of memory");
+			return;
+		}
+		serials = more;
+		max_serials = assemble_inflight();
+	}
+	size_t n = assemble_serials(serials, max_serials);
+	// all input passed on is in cur
+	uint64_t end = cur.start + (assemble_bytes() - cur.base);
+	if (!n && f->ino == persisted.ino && offset == persisted.offset
+			&& cur.ino == persisted.end_ino && end == persisted.end_offset)
+	{
+		return;
+	}
+
+	char tmp_path[PATH_MAX + 8];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", state_path);
+	FILE* out = fopen(tmp_path, "w");
+	if (!out)
+	{
+		log_warn("tail: can't write '%s': %s", tmp_path, strerror(errno));
+		return;
+	}
+	fprintf(out, TAIL_STATE_MAGIC " %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %zu",
+			(unsigned long)f->dev, (unsigned long)f->ino, f->first_ms, f->first_serial, offset,
+			(unsigned long)cur.dev, (unsigned long)cur.ino, cur.first_ms, cur.first_serial, end, n);
+	for (size_t i = 0; i < n; i++) fprintf(out, " %lu", serials[i]);
+	fprintf(out, "\n");
+	int rc = fflush(out) || fsync(fileno(out));
+	rc = fclose(out) || rc;
+	if (rc || rename(tmp_path, state_path))
+	{
+		log_warn("tail: can't write '%s': %s", state_path, strerror(errno));
+		return;
+	}
+	persisted.ino = f->ino;
+	persisted.offset = offset;
+	persisted.end_ino = cur.ino;
+	persisted.end_offset = end;
+}
+
+
+int tail_skip(const char* records, size_t len)
+{
+	// by position: events starting after the end of the previous run's
+	// input are new, whatever their time stamp (long syscalls)
+	uint64_t input_off = assemble_emitting();
+	const tail_file_t* f = NULL;
+	if (input_off >= cur.base) f = &cur;
+	else if (prev.valid && input_off >= prev.base) f = &prev;
+	if (!f || f->start + (input_off - f->base) >= f->skip_end) return 0;
+
+	uint64_t time_ms, serial;
+	if (parse_stamp(records, len, &time_ms, &serial)) return 0;
+	for (size_t i = 0; i < resume.num_inflight; i++)
+	{
+		// was in flight, i.e. not stored
+		if (resume.inflight[i] == serial) return 0;
+	}
+	metrics_inc(METRIC_TAIL_SKIPPED);
+	return 1;
+}
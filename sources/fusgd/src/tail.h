@@ -0,0 +1,82 @@
+/*
+ * tail.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: homac
+ */
+
+#ifndef TAIL_H_
+#define TAIL_H_
+
+#include <stddef.h>
+
+#include "reader.h"
+
+
+/*
+ * Follows the audit log (fusgd_tail), instead of reading audispd's
+ * pipe, so fusgd is not on audispd's dispatch path.
+ *
+ * inotify on the log's directory wakes fusgd up on new data. At EOF,
+ * tail_follow() detects
+ *   - rotation: the path refers to a new file; the old file is
+ *     read to its end before switching,
+ *   - truncation: the file got shorter than what was read; it's
+ *     read from its start again.
+ *
+ * After each db flush, the state file (fusgd_tail_state) receives
+ * the file's inode and the offset up to which all events are stored,
+ * the inode and offset up to which input was read, and the serials
+ * of the events in flight. On restart, reading resumes at the first
+ * offset, in a rotated file (<path>.1 .. <path>.9) if needed. Events
+ * starting before the second offset are skipped, unless they were in
+ * flight: they are stored already. Rotated files are told apart by
+ * inode, they may be renamed again while being read.
+ */
+
+
+/**
+ * Opens the log file at its resume offset.
+ * @return fd to read from or -1 on error
+ */
+int tail_open(const char* path, const char* state_path);
+
+/**
+ * Closes the log file.
+ */
+void tail_close(void);
+
+/**
+ * @return 1 if the log file is followed
+ */
+int tail_enabled(void);
+
+/**
+ * @return fd signalling changes of the log file or -1
+ */
+int tail_fd(void);
+
+/**
+ * Consumes the changes signalled by tail_fd().
+ */
+void tail_drain(void);
+
+/**
+ * Called at EOF of the input.
+ * @return 1 if there is more input (file grew, was rotated or truncated), 0 otherwise
+ */
+int tail_follow(reader_t* input);
+
+/**
+ * Persists the resume state. Call when all events emitted are durable.
+ */
+void tail_checkpoint(void);
+
+/**
+ * Checks a complete event (its records) before it's processed.
+ * @return 1 if it was stored before the restart, i.e. has to be skipped
+ */
+int tail_skip(const char* records, size_t len);
+
+
+#endif /* TAIL_H_ */
@@ -9,6 +9,7 @@
 #define FUSG_TRACE_H_
 
 #include <stdio.h>
+#include <stdarg.h>
 
 
 #include "../../fusg-common/include/fusg/logging.h"
@@ -140,5 +141,16 @@ void trace_whole_event_interpreted(auparse_state_t *au) {
 
 
 
+/* Writes a note (e.g. about lost events) in between the traced events */
+void trace_note(const char* fmt, ...) {
+	if (!trace_out) return;
+	va_list ap;
+	fprintf(trace_out, "# ");
+	va_start(ap, fmt);
+	vfprintf(trace_out, fmt, ap);
+	va_end(ap);
+	fprintf(trace_out, "\n");
+}
+
 
 #endif /* FUSG_DEBUG_TOOLS_H_ */
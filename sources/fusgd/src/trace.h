@@ -35,5 +35,8 @@ void trace_fields_of_record_interpreted(auparse_state_t *au);
 /* This function shows how to dump a whole event by iterating over records */
 void trace_whole_event_interpreted(auparse_state_t *au);
 
+/* Writes a note (e.g. about lost events) in between the traced events */
+void trace_note(const char* fmt, ...) __attribute__ ((format (printf, 1, 2)));
+
 
 #endif /* FUSG_TRACE_H_ */
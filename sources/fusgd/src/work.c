@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/select.h>
+#include <time.h>
 #include <errno.h>
 #include <libaudit.h>
 #include <auparse.h>
@@ -21,42 +22,156 @@
 
 #include "../../../sources/fusgd/src/trace.h"
 #include "../../../sources/fusgd/src/store.h"
+#include "work.h"
+#include "metrics.h"
+#include "lag.h"
+#include "serial.h"
+#include "degrade.h"
+#include "reader.h"
+#include "spool.h"
+#include "assemble.h"
+#include "tail.h"
+#include "fan.h"
+#include "prune.h"
+#include "flush.h"
+
+work_event_hook_t work_event_hook = NULL;
 
 static auparse_state_t *au = NULL;
 
-static time_t time_last_flush = 0;
-static time_t time_flush_period = 1; // db-flush every n secs
+/** input is considered idle after this time [ms] */
+static const int idle_period_ms = 1000;
+static time_t time_last_snapshot = 0;
+
+/** input is read in chunks of this size */
+static const size_t input_buffer_size = 256 * 1024;
+
+static int batch_events = 0;
+static struct timespec batch_start;
 
 /* Local declarations */
 static void handle_event(auparse_state_t *au, auparse_cb_event_t cb_event_type,
 		void *user_data);
+static void handle_usage(const char* executable, const char* filepath,
+		file_usage_t flags, uint64_t timestamp);
+static void event_done(const au_event_t* e, uint64_t start);
+
 
 
 
+/**
+ * Hands a complete event over to auparse.
+ */
+static void feed_event(const char* records, size_t len)
+{
+	if (tail_enabled() && tail_skip(records, len)) return;
+	auparse_feed(au, records, len);
+	// complete, even without EOE
+	auparse_flush_feed(au);
+}
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
 
 static void periodic_db_flush()
 {
+	flush_check();
 
 	time_t now;
 	time(&now);
-	time_t duration = now - time_last_flush;
-	if (duration > time_flush_period)
+
+	if (global.conf.db_snapshot_period
+			&& now - time_last_snapshot >= global.conf.db_snapshot_period)
+	{
+		time_last_snapshot = now;
+		db_snapshot(global.db);
+	}
+}
+
+
+
+static uint64_t batch_elapsed_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - batch_start.tv_sec) * 1000
+			+ (now.tv_nsec - batch_start.tv_nsec) / 1000000;
+}
+
+static int batch_is_open(void)
+{
+	return db_batch_size(global.db) >= 0;
+}
+
+/**
+ * Opens a db batch, if batching is enabled and there is none open.
+ */
+static void batch_begin(void)
+{
+	if (global.conf.db_batch_events && !batch_is_open())
 	{
-		time_last_flush = now;
-		db_flush(global.db);
+		if (0 == db_begin_batch(global.db))
+		{
+			batch_events = 0;
+			clock_gettime(CLOCK_MONOTONIC, &batch_start);
+		}
 	}
 }
 
+static void batch_commit(void)
+{
+	if (batch_is_open())
+	{
+		uint64_t hold = batch_elapsed_ms();
+		db_commit_batch(global.db);
+		global.batches_committed++;
+		if (hold > global.batch_hold_max_ms) global.batch_hold_max_ms = hold;
+	}
+}
+
+/**
+ * Commits the current batch, if it reached its size or time limit.
+ */
+static void batch_check(void)
+{
+	if (batch_is_open())
+	{
+		batch_events++;
+		if (batch_events >= global.conf.db_batch_events
+				|| batch_elapsed_ms() >= global.conf.db_batch_time)
+		{
+			batch_commit();
+		}
+	}
+}
 
 
 int work()
 {
-	char tmp[MAX_AUDIT_MESSAGE_LENGTH + 1];
+	reader_t input;
 
 	int rc = 0;
+	if (reader_init(&input, global.fd, input_buffer_size))
+	{
+		log_fatal("exiting due to out of memory");
+		return ERR_UNKNOWN;
+	}
+	input.follow = tail_enabled();
+	if (assemble_init(global.conf.fusgd_inflight_max, global.conf.fusgd_inflight_timeout, feed_event))
+	{
+		reader_destroy(&input);
+		return ERR_UNKNOWN;
+	}
 	au = auparse_init(AUSOURCE_FEED, 0);
 	if (au == NULL) {
 		log_fatal("exiting due to auparse init errors");
+		assemble_destroy();
+		reader_destroy(&input);
 		return ERR_AUPARSE;
 	}
 	// homac: indicate that events are raw
@@ -64,93 +179,169 @@ int work()
 	auparse_add_callback(au, handle_event, NULL, NULL);
 
 
+	// the pipe from the intake holds no input from before the spool took over
+	int pipe_drained = 0;
+
 	do {
 		fd_set read_mask;
 		struct timeval tv;
 		int retval = -1;
+		int batch_timeout = 0;
 
 		/* Load configuration */
 		if (global.received_sighup)
 		{
-			// SIGHUP means: reload config
+			// SIGHUP means: reload config, the current batch goes to the current db
+			batch_commit();
 			reload_config();
 		}
+		if (global.received_sigusr1)
+		{
+			global.received_sigusr1 = 0;
+			metrics_dump();
+		}
+		metrics_periodic();
+		lag_check();
+		degrade_check();
+		prune_check();
+
+		//
+		// next line: input from before the spool took over goes first
+		//
+		size_t len = 0;
+		const char* line = reader_line(&input, &len);
+		if (!line && spool_active())
+		{
+			if (!pipe_drained && !input.eof && fd_readable(global.fd))
+			{
+				reader_fill(&input);
+				continue;
+			}
+			pipe_drained = 1;
+			line = spool_line(&len);
+		}
+		else pipe_drained = 0;
+
+		if (line)
+		{
+			metrics_inc(METRIC_LINES_IN);
+			assemble_record(line, len);
+			continue;
+		}
+		if (input.eof)
+		{
+			if (!tail_enabled()) break;
+			// caught up: more data, next or truncated file?
+			if (tail_follow(&input)) continue;
+		}
 
-		if (global.mode == OP_PARSE_FILE)
+		if (global.mode == OP_PARSE_FILE || (tail_enabled() && !input.eof))
 		{
 			// we have always data, when reading files
 			retval = 1;
 		}
-		else // --> reads stdin
+		else // --> reads stdin or waits for the followed file
 		{
 			// the regular path, which does not work with regular files:
 			// - wait for input at fd (usually stdin)
-			// - every 3 seconds, check incomplete but queued events to have
-			//   reached complete time. If they have reached complete time
-			//   they will be processed through the callback handler.
+			// - if input is idle for a while, complete all events
+			//   in flight, which are processed through the callback
+			//   handler.
+			// - while a db batch is open, don't wait longer than
+			//   its remaining time.
 			int retry = 0;
+			int wait_fd = fan_enabled() ? fan_fd() : tail_enabled() ? tail_fd() : global.fd;
+			batch_timeout = batch_is_open();
 			do {
-
-				tv.tv_sec = time_flush_period;
-				tv.tv_usec = 0;
+				if (batch_timeout)
+				{
+					uint64_t elapsed = batch_elapsed_ms();
+					uint64_t remaining = (elapsed < global.conf.db_batch_time)
+							? global.conf.db_batch_time - elapsed : 0;
+					tv.tv_sec = remaining / 1000;
+					tv.tv_usec = (remaining % 1000) * 1000;
+				}
+				else if (prune_active())
+				{
+					// keep pruning while idle
+					tv.tv_sec = 0;
+					tv.tv_usec = PRUNE_TICK_MS * 1000;
+				}
+				else
+				{
+					// wake up for the next flush, if due earlier
+					int timeout = flush_timeout_ms();
+					if (timeout < 0 || timeout > idle_period_ms) timeout = idle_period_ms;
+					tv.tv_sec = timeout / 1000;
+					tv.tv_usec = (timeout % 1000) * 1000;
+				}
 				FD_ZERO(&read_mask);
-				FD_SET(global.fd, &read_mask);
-				retval = select(1, &read_mask, NULL, NULL, &tv);
+				int nfds = 0;
+				if (wait_fd != -1)
+				{
+					FD_SET(wait_fd, &read_mask);
+					nfds = wait_fd + 1;
+				}
+				retval = select(nfds, &read_mask, NULL, NULL, &tv);
 
 				// retry if select was just interrupted by a signal
 				// handler and neither sighup nor stop is set.
-				retry = (retval == -1 && errno == EINTR && !global.received_sighup && !global.stop);
+				retry = (retval == -1 && errno == EINTR
+						&& !global.received_sighup && !global.received_sigusr1 && !global.stop);
 			} while (retry);
 		}
 
 		if (!global.stop && !global.received_sighup && retval > 0) {
 			//
-			// we have got a new record -> process
+			// we have got new input -> read it
 			//
-
-
-			// NOTE: this has to be fgets, because the given len in the header is
-			//       wrong.
-			if (fgets_unlocked(tmp, MAX_AUDIT_MESSAGE_LENGTH, global.fin))
-			{
-				auparse_feed(au, tmp, strnlen(tmp, MAX_AUDIT_MESSAGE_LENGTH));
-			}
-			else
-			{
-				if (!feof(global.fin)) log_error("audit message stream corrupted?");
-			}
+			if (fan_enabled()) fan_read(handle_usage);
+			else if (tail_enabled() && input.eof) tail_drain();
+			else if (-1 == reader_fill(&input)) log_error("audit message stream corrupted?");
+		} else if (retval == 0 && batch_timeout) {
+			//
+			// input is idle: don't keep readers waiting
+			//
+			batch_commit();
 		} else if (retval == 0) {
 			//
 			// select() timed out.
 			//
 
-			// if we still have pending events
-			// they might never get finished.
-			// Aging mechanism avoids them getting
-			// stuck in memory.
-			if (auparse_feed_has_data(au))
-				auparse_feed_age_events(au);
-
-			auparse_flush_feed(au);
+			// input is idle: events in flight
+			// won't see more records.
+			assemble_flush();
+			batch_commit();
 
 			// since we are waiting check if we can
 			// flush changes in db to file system.
 			periodic_db_flush();
 		}
-	} while (!feof(global.fin) && !global.stop);
+	} while (!global.stop);
+
+	// keep input, which was read already, for the next start
+	if (spool_enabled()) global.fd = spool_intake_stop(&input);
+	reader_destroy(&input);
+
+	// events reported until now
+	if (fan_enabled()) while (fan_read(handle_usage) > 0);
 
 	// flush any accumulated events from queue
+	assemble_flush();
 	auparse_flush_feed(au);
 	auparse_destroy(au);
+	assemble_destroy();
+	store_close();
+	batch_commit();
+	degrade_close();
 
 	// do a final explicit flush
-	db_flush(global.db);
+	flush_db(FLUSH_EXIT);
 
 	return rc;
 }
 
 
-
 /* This function receives a single complete event at a time from the auparse
  * library. This is where the main analysis code would be added. */
 static void handle_event(auparse_state_t *au, auparse_cb_event_t cb_event_type,
@@ -160,13 +351,91 @@ static void handle_event(auparse_state_t *au, auparse_cb_event_t cb_event_type,
 		return;
 
 	global.events_processed++;
+	metrics_inc(METRIC_EVENTS_IN);
+	metrics_add(METRIC_RECORDS_IN, auparse_get_num_records(au));
+
+	uint64_t start = now_ns();
+	au_event_t event;
+	memset(&event, 0, sizeof(event));
+	const au_event_t* e = auparse_get_timestamp(au);
+	if (e)
+	{
+		event = *e;
+		serial_track(e);
+		degrade_event(e);
+	}
 
 	trace_whole_event_interpreted(au);
+	batch_begin();
+	uint64_t stored = global.events_stored;
 	rc = store_event(au);
 	if (rc)
 	{
-		log_error("rc=%d, errno: %s", rc, strerror(errno));
+		log_limited(LL_ERROR, "rc=%d, errno: %s", rc, strerror(errno));
+	}
+	if (e && stored != global.events_stored) lag_pending(&event);
+	batch_check();
+
+	event_done(e ? &event : NULL, start);
+}
+
+
+/**
+ * Receives a file usage from fanotify, which is an event of its own.
+ */
+static void handle_usage(const char* executable, const char* filepath,
+		file_usage_t flags, uint64_t timestamp)
+{
+	global.events_processed++;
+	metrics_inc(METRIC_EVENTS_IN);
+
+	uint64_t start = now_ns();
+	// fanotify events carry no time stamp: they are timed when read
+	struct timespec wall;
+	clock_gettime(CLOCK_REALTIME, &wall);
+	au_event_t event;
+	memset(&event, 0, sizeof(event));
+	event.sec = wall.tv_sec;
+	event.milli = wall.tv_nsec / 1000000;
+	degrade_event(&event);
+
+	batch_begin();
+	uint64_t stored = global.events_stored;
+	int rc = store_usage(executable, filepath, flags, timestamp);
+	if (rc)
+	{
+		log_limited(LL_ERROR, "rc=%d, errno: %s", rc, strerror(errno));
+	}
+	if (stored != global.events_stored) lag_pending(&event);
+	batch_check();
+
+	event_done(&event, start);
+}
+
+
+/**
+ * Common part of processing an event, after it was stored.
+ * @param e time stamp of the event or NULL
+ * @param start begin of processing [ns]
+ */
+static void event_done(const au_event_t* e, uint64_t start)
+{
+	au_event_t none;
+	memset(&none, 0, sizeof(none));
+
+	// keep the time to durability bounded under load, too
+	if (!batch_is_open()) periodic_db_flush();
+
+	uint64_t duration = now_ns() - start;
+	metrics_observe(METRIC_EVENT_SECONDS, duration / 1e9);
+	if (e)
+	{
+		struct timespec wall;
+		clock_gettime(CLOCK_REALTIME, &wall);
+		double lag = (wall.tv_sec - e->sec) + (wall.tv_nsec / 1e9 - e->milli / 1e3);
+		metrics_observe(METRIC_LAG_SECONDS, lag > 0 ? lag : 0);
 	}
+	if (work_event_hook) work_event_hook(e ? e : &none, duration);
 
 	if (0 == global.events_processed % 1000)
 	{
@@ -177,6 +446,10 @@ static void handle_event(auparse_state_t *au, auparse_cb_event_t cb_event_type,
 		log_info("\ttime since last report: %lu s", duration);
 		log_info("\tprocessed events: %d", global.events_processed);
 		log_info("\tstored events: %d", global.events_stored);
+		log_info("\tcommitted batches: %lu", global.batches_committed);
+		log_info("\tmax batch lock time: %lu ms", global.batch_hold_max_ms);
+		serial_report();
+		global.batch_hold_max_ms = 0;
 	}
 
 }
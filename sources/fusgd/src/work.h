@@ -8,8 +8,20 @@
 #ifndef WORK_H_
 #define WORK_H_
 
+#include <stdint.h>
+#include <auparse.h>
 
-void work(void);
+
+/**
+ * Called after each processed event with its time stamp and the
+ * time spent processing it. Used for instrumentation (fusg-bench).
+ */
+typedef void (*work_event_hook_t)(const au_event_t* event, uint64_t duration_ns);
+
+extern work_event_hook_t work_event_hook;
+
+
+int work(void);
 
 
 #endif /* WORK_H_ */